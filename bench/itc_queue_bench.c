@@ -0,0 +1,263 @@
+#include "itc_queue.h"
+#include "mutex_queue.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <pthread.h>
+
+// Compares the lock-free itc_queue with the mutex queue it replaced. Each run either
+// has one producer feeding every consumer, like a reactor handing jobs to the
+// thread pool, or as many producers as consumers.
+//
+// Usage: itc_queue_bench [messages per run]
+
+enum
+{
+    // The same as the thread pool's job queue
+    BENCH_QUEUE_SIZE       = 200,
+    BENCH_DEFAULT_MESSAGES = 2000000,
+    BENCH_MAX_THREADS      = 32,
+};
+
+// Roughly the size of a thread pool job
+struct bench_message
+{
+    uint64_t seq;
+    bool     stop;
+    void*    payload;
+};
+
+struct bench_queue_ops
+{
+    char const* name;
+    void* (*init)(size_t max_size, size_t msglen);
+    int (*post)(void* queue, size_t msglen, unsigned char const msg[msglen]);
+    int (*receive)(void* queue, size_t buflen, unsigned char buf[buflen]);
+    void (*destroy)(void* queue);
+};
+
+struct bench_thread_args
+{
+    struct bench_queue_ops const* ops;
+    void*                         queue;
+    uint64_t                      num_messages;
+    uint64_t                      num_received;
+};
+
+// ==== STATIC PROTOTYPES ====
+
+static void* bench_itc_init(size_t max_size, size_t msglen);
+static int   bench_itc_post(void* queue, size_t msglen, unsigned char const msg[msglen]);
+static int   bench_itc_receive(void* queue, size_t buflen, unsigned char buf[buflen]);
+static void  bench_itc_destroy(void* queue);
+static void* bench_mutex_init(size_t max_size, size_t msglen);
+static int   bench_mutex_post(void*               queue,
+                              size_t              msglen,
+                              unsigned char const msg[msglen]);
+static int  bench_mutex_receive(void* queue, size_t buflen, unsigned char buf[buflen]);
+static void bench_mutex_destroy(void* queue);
+
+static void*  bench_producer(void* arg);
+static void*  bench_consumer(void* arg);
+static double bench_run(struct bench_queue_ops const* ops,
+                        size_t                        num_producers,
+                        size_t                        num_consumers,
+                        uint64_t                      num_messages);
+static double bench_now_s(void);
+
+static struct bench_queue_ops const BENCH_QUEUES[] = {
+    {"mutex", bench_mutex_init, bench_mutex_post, bench_mutex_receive,
+     bench_mutex_destroy},
+    {"lock-free", bench_itc_init, bench_itc_post, bench_itc_receive,
+     bench_itc_destroy},
+};
+
+static size_t const BENCH_THREAD_COUNTS[] = {1, 2, 4, 8, 16, 32};
+
+// ==== MAIN ====
+
+int main(int argc, char* argv[])
+{
+    uint64_t num_messages = BENCH_DEFAULT_MESSAGES;
+    if (argc > 1) { num_messages = strtoull(argv[1], NULL, 10); }
+    if (num_messages == 0)
+    {
+        fprintf(stderr, "Usage: %s [messages per run]\n", argv[0]);
+        return 1;
+    }
+
+    printf("%-10s %-10s %8s %12s\n", "queue", "producers", "threads", "Mmsg/s");
+    size_t const num_queues  = sizeof(BENCH_QUEUES) / sizeof(BENCH_QUEUES[0]);
+    size_t const num_counts  = sizeof(BENCH_THREAD_COUNTS) / sizeof(size_t);
+    bool const   many_prods[] = {false, true};
+    for (size_t p = 0; p < 2; ++p)
+    {
+        for (size_t t = 0; t < num_counts; ++t)
+        {
+            size_t threads   = BENCH_THREAD_COUNTS[t];
+            size_t producers = many_prods[p] ? threads : 1;
+            for (size_t q = 0; q < num_queues; ++q)
+            {
+                double rate =
+                    bench_run(&BENCH_QUEUES[q], producers, threads, num_messages);
+                if (rate < 0) { return 1; }
+
+                printf("%-10s %-10s %8zu %12.2f\n", BENCH_QUEUES[q].name,
+                       many_prods[p] ? "many" : "one", threads, rate / 1e6);
+            }
+        }
+    }
+
+    return 0;
+}
+
+// ==== STATIC FUNCTIONS IMPLEMENTATION ====
+
+static void* bench_itc_init(size_t max_size, size_t msglen)
+{
+    return itc_queue_init(max_size, msglen);
+}
+
+static int bench_itc_post(void* queue, size_t msglen, unsigned char const msg[msglen])
+{
+    return post_message(queue, msglen, msg);
+}
+
+static int bench_itc_receive(void* queue, size_t buflen, unsigned char buf[buflen])
+{
+    return receive_message(queue, buflen, buf);
+}
+
+static void bench_itc_destroy(void* queue) { itc_queue_destroy(queue); }
+
+static void* bench_mutex_init(size_t max_size, size_t msglen)
+{
+    return mutex_queue_init(max_size, msglen);
+}
+
+static int bench_mutex_post(void*               queue,
+                            size_t              msglen,
+                            unsigned char const msg[msglen])
+{
+    return mutex_queue_post(queue, msglen, msg);
+}
+
+static int bench_mutex_receive(void* queue, size_t buflen, unsigned char buf[buflen])
+{
+    return mutex_queue_receive(queue, buflen, buf);
+}
+
+static void bench_mutex_destroy(void* queue) { mutex_queue_destroy(queue); }
+
+static void* bench_producer(void* arg)
+{
+    struct bench_thread_args* args = arg;
+
+    for (uint64_t i = 0; i < args->num_messages; ++i)
+    {
+        struct bench_message message = {.seq = i, .stop = false, .payload = args};
+        args->ops->post(args->queue, sizeof(message), (unsigned char*) &message);
+    }
+
+    return NULL;
+}
+
+static void* bench_consumer(void* arg)
+{
+    struct bench_thread_args* args = arg;
+
+    for (;;)
+    {
+        struct bench_message message = {0};
+        args->ops->receive(args->queue, sizeof(message), (unsigned char*) &message);
+        if (message.stop) { break; }
+        ++args->num_received;
+    }
+
+    return NULL;
+}
+
+// Returns messages per second, or -1 if the run couldn't be set up
+static double bench_run(struct bench_queue_ops const* ops,
+                        size_t                        num_producers,
+                        size_t                        num_consumers,
+                        uint64_t                      num_messages)
+{
+    assert(num_producers <= BENCH_MAX_THREADS);
+    assert(num_consumers <= BENCH_MAX_THREADS);
+
+    void* queue = ops->init(BENCH_QUEUE_SIZE, sizeof(struct bench_message));
+    if (!queue)
+    {
+        fprintf(stderr, "Failed to create %s queue\n", ops->name);
+        return -1;
+    }
+
+    pthread_t                producers[BENCH_MAX_THREADS];
+    pthread_t                consumers[BENCH_MAX_THREADS];
+    struct bench_thread_args producer_args[BENCH_MAX_THREADS];
+    struct bench_thread_args consumer_args[BENCH_MAX_THREADS];
+
+    double start = bench_now_s();
+
+    for (size_t i = 0; i < num_consumers; ++i)
+    {
+        consumer_args[i] = (struct bench_thread_args) {.ops = ops, .queue = queue};
+        pthread_create(&consumers[i], NULL, bench_consumer, &consumer_args[i]);
+    }
+
+    for (size_t i = 0; i < num_producers; ++i)
+    {
+        // Share the messages out, with the first producer taking any remainder
+        uint64_t share = num_messages / num_producers;
+        if (i == 0) { share += num_messages % num_producers; }
+
+        producer_args[i] = (struct bench_thread_args) {
+            .ops = ops, .queue = queue, .num_messages = share};
+        pthread_create(&producers[i], NULL, bench_producer, &producer_args[i]);
+    }
+
+    for (size_t i = 0; i < num_producers; ++i) { pthread_join(producers[i], NULL); }
+
+    // Everything real is ahead of these in the queue, so each consumer stops once
+    // it's all been taken
+    for (size_t i = 0; i < num_consumers; ++i)
+    {
+        struct bench_message stop = {.stop = true};
+        ops->post(queue, sizeof(stop), (unsigned char*) &stop);
+    }
+
+    uint64_t total_received = 0;
+    for (size_t i = 0; i < num_consumers; ++i)
+    {
+        pthread_join(consumers[i], NULL);
+        total_received += consumer_args[i].num_received;
+    }
+
+    double elapsed = bench_now_s() - start;
+    ops->destroy(queue);
+
+    if (total_received != num_messages)
+    {
+        fprintf(stderr, "%s queue lost messages: %llu of %llu received\n", ops->name,
+                (unsigned long long) total_received,
+                (unsigned long long) num_messages);
+        return -1;
+    }
+
+    return (double) num_messages / elapsed;
+}
+
+static double bench_now_s(void)
+{
+    struct timespec now = {0};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (double) now.tv_sec + ((double) now.tv_nsec / 1e9);
+}
@@ -0,0 +1,290 @@
+#include "mutex_queue.h"
+
+#include "logging.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <pthread.h>
+
+// The mutex and condition variable itc_queue, kept as a baseline to measure the
+// lock-free one against
+struct mutex_queue
+{
+    unsigned char* storage;
+    size_t         read;
+    size_t         write;
+
+    size_t capacity;
+    // Only changed under the lock, but spinners peek at it without taking it
+    atomic_size_t num_elements;
+    size_t        msglen;
+
+    pthread_mutex_t rw_lock;
+    pthread_cond_t  not_empty;
+    pthread_cond_t  not_full;
+    // So we only pay for a signal when somebody is actually asleep
+    size_t num_waiting_receivers;
+    size_t num_waiting_posters;
+
+    // How long to spin before going to sleep. It grows while spinning keeps paying
+    // off and shrinks when it doesn't, so an idle queue soon stops burning CPU.
+    atomic_uint spin_limit;
+};
+
+enum
+{
+    MUTEX_QUEUE_MIN_SPINS = 16,
+    MUTEX_QUEUE_MAX_SPINS = 4096,
+};
+
+enum
+{
+    MUTEX_QUEUE_EQUEUEFULL  = -1,
+    MUTEX_QUEUE_EQUEUEEMPTY = -2,
+};
+
+// ==== STATIC PROTOTYPES ====
+
+static void mutex_queue_push_locked(struct mutex_queue* restrict queue,
+                                    size_t                       msglen,
+                                    unsigned char const          msg[msglen]);
+static void mutex_queue_pop_locked(struct mutex_queue* restrict queue,
+                                   unsigned char                buf[]);
+static void mutex_queue_spin(struct mutex_queue* restrict queue, bool for_space);
+static inline void mutex_queue_cpu_relax(void);
+
+// ==== PUBLIC FUNCTIONS IMPLEMENTATION
+
+struct mutex_queue* mutex_queue_init(size_t max_size, size_t msglen)
+{
+    unsigned char* storage = calloc(max_size, msglen);
+    if (!storage)
+    {
+        MINIWEB_LOG_ERROR("Could not allocate space for %zu elements of %zu bytes",
+                          max_size, msglen);
+        return NULL;
+    }
+
+    struct mutex_queue* queue = calloc(1, sizeof(struct mutex_queue));
+    if (!queue)
+    {
+        MINIWEB_LOG_ERROR("Could not allocate space for queue control structure");
+        free(storage);
+        return NULL;
+    }
+
+    queue->storage  = storage;
+    queue->read     = 0;
+    queue->write    = 0;
+    queue->capacity = max_size;
+    queue->msglen   = msglen;
+    atomic_init(&queue->num_elements, 0);
+    atomic_init(&queue->spin_limit, MUTEX_QUEUE_MIN_SPINS);
+
+    int rc = pthread_mutex_init(&queue->rw_lock, NULL);
+    if (rc != 0)
+    {
+        MINIWEB_LOG_ERROR("Failed to init read_lock: %d (%s)", rc, strerror(rc));
+        free(queue);
+        free(storage);
+        return NULL;
+    }
+
+    rc = pthread_cond_init(&queue->not_empty, NULL);
+    if (rc != 0)
+    {
+        MINIWEB_LOG_ERROR("Failed to init not_empty: %d (%s)", rc, strerror(rc));
+        pthread_mutex_destroy(&queue->rw_lock);
+        free(queue);
+        free(storage);
+        return NULL;
+    }
+
+    rc = pthread_cond_init(&queue->not_full, NULL);
+    if (rc != 0)
+    {
+        MINIWEB_LOG_ERROR("Failed to init not_full: %d (%s)", rc, strerror(rc));
+        pthread_cond_destroy(&queue->not_empty);
+        pthread_mutex_destroy(&queue->rw_lock);
+        free(queue);
+        free(storage);
+        return NULL;
+    }
+
+    return queue;
+}
+
+int mutex_queue_post_noblock(struct mutex_queue* restrict queue,
+                             size_t                       msglen,
+                             unsigned char const          msg[msglen])
+{
+    assert(queue);
+    assert(msglen <= queue->msglen);
+
+    pthread_mutex_lock(&queue->rw_lock);
+    if (atomic_load_explicit(&queue->num_elements, memory_order_relaxed)
+        == queue->capacity)
+    {
+        pthread_mutex_unlock(&queue->rw_lock);
+        return MUTEX_QUEUE_EQUEUEFULL;
+    }
+
+    mutex_queue_push_locked(queue, msglen, msg);
+
+    pthread_mutex_unlock(&queue->rw_lock);
+    return 0;
+}
+
+int mutex_queue_post(struct mutex_queue* restrict queue,
+                     size_t                       msglen,
+                     unsigned char const          msg[msglen])
+{
+    assert(queue);
+    assert(msglen <= queue->msglen);
+
+    mutex_queue_spin(queue, true);
+
+    pthread_mutex_lock(&queue->rw_lock);
+    while (atomic_load_explicit(&queue->num_elements, memory_order_relaxed)
+           == queue->capacity)
+    {
+        ++queue->num_waiting_posters;
+        pthread_cond_wait(&queue->not_full, &queue->rw_lock);
+        --queue->num_waiting_posters;
+    }
+
+    mutex_queue_push_locked(queue, msglen, msg);
+
+    pthread_mutex_unlock(&queue->rw_lock);
+    return 0;
+}
+
+int mutex_queue_receive_noblock(struct mutex_queue* restrict queue,
+                                size_t                       buflen,
+                                unsigned char                buf[buflen])
+{
+    assert(queue);
+    assert(buflen >= queue->msglen);
+
+    pthread_mutex_lock(&queue->rw_lock);
+
+    if (atomic_load_explicit(&queue->num_elements, memory_order_relaxed) == 0)
+    {
+        // In this case the queue is empty
+        pthread_mutex_unlock(&queue->rw_lock);
+        return MUTEX_QUEUE_EQUEUEEMPTY;
+    }
+
+    mutex_queue_pop_locked(queue, buf);
+
+    pthread_mutex_unlock(&queue->rw_lock);
+
+    return 0;
+}
+
+int mutex_queue_receive(struct mutex_queue* restrict queue,
+                        size_t                       buflen,
+                        unsigned char                buf[buflen])
+{
+    assert(queue);
+    assert(buflen >= queue->msglen);
+
+    mutex_queue_spin(queue, false);
+
+    pthread_mutex_lock(&queue->rw_lock);
+    while (atomic_load_explicit(&queue->num_elements, memory_order_relaxed) == 0)
+    {
+        ++queue->num_waiting_receivers;
+        pthread_cond_wait(&queue->not_empty, &queue->rw_lock);
+        --queue->num_waiting_receivers;
+    }
+
+    mutex_queue_pop_locked(queue, buf);
+
+    pthread_mutex_unlock(&queue->rw_lock);
+    return 0;
+}
+
+void mutex_queue_destroy(struct mutex_queue* restrict queue)
+{
+    // Acquire the mutex so we know it's safe to proceed
+    pthread_mutex_lock(&queue->rw_lock);
+
+    free(queue->storage);
+    queue->storage = NULL;
+
+    pthread_mutex_unlock(&queue->rw_lock);
+
+    pthread_cond_destroy(&queue->not_full);
+    pthread_cond_destroy(&queue->not_empty);
+    pthread_mutex_destroy(&queue->rw_lock);
+
+    free(queue);
+}
+
+// ==== STATIC FUNCTIONS IMPLEMENTATION ====
+
+static void mutex_queue_push_locked(struct mutex_queue* restrict queue,
+                                    size_t                       msglen,
+                                    unsigned char const          msg[msglen])
+{
+    // Advance the write ptr.
+    queue->write = (queue->write + 1) % queue->capacity;
+    // All good to write!
+    memcpy(queue->storage + (queue->write * queue->msglen), msg, msglen);
+    atomic_fetch_add_explicit(&queue->num_elements, 1, memory_order_relaxed);
+
+    if (queue->num_waiting_receivers > 0) { pthread_cond_signal(&queue->not_empty); }
+}
+
+static void mutex_queue_pop_locked(struct mutex_queue* restrict queue,
+                                   unsigned char                buf[])
+{
+    // Copy this data into our buffer, clear it, and return
+    queue->read = (queue->read + 1) % queue->capacity;
+    memcpy(buf, queue->storage + (queue->read * queue->msglen), queue->msglen);
+    memset(queue->storage + (queue->read * queue->msglen), 0, queue->msglen);
+    atomic_fetch_sub_explicit(&queue->num_elements, 1, memory_order_relaxed);
+
+    if (queue->num_waiting_posters > 0) { pthread_cond_signal(&queue->not_full); }
+}
+
+// Waits a little while, without the lock, for the queue to have room (or a message)
+// in the hope we won't need to sleep. Whether it does is only a hint, the caller
+// still has to check under the lock.
+static void mutex_queue_spin(struct mutex_queue* restrict queue, bool for_space)
+{
+    unsigned limit = atomic_load_explicit(&queue->spin_limit, memory_order_relaxed);
+    for (unsigned i = 0; i < limit; ++i)
+    {
+        size_t num =
+            atomic_load_explicit(&queue->num_elements, memory_order_relaxed);
+        if (for_space ? num < queue->capacity : num > 0)
+        {
+            if (limit < MUTEX_QUEUE_MAX_SPINS)
+            {
+                atomic_store_explicit(&queue->spin_limit, limit * 2,
+                                      memory_order_relaxed);
+            }
+            return;
+        }
+
+        mutex_queue_cpu_relax();
+    }
+
+    if (limit > MUTEX_QUEUE_MIN_SPINS)
+    { atomic_store_explicit(&queue->spin_limit, limit / 2, memory_order_relaxed); }
+}
+
+static inline void mutex_queue_cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
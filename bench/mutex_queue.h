@@ -0,0 +1,27 @@
+#ifndef INCLUDED_MUTEX_QUEUE_H
+#define INCLUDED_MUTEX_QUEUE_H
+
+#include <stdlib.h>
+
+// The same interface as itc_queue, backed by a mutex and two condition variables
+
+typedef struct mutex_queue mutex_queue_t;
+
+mutex_queue_t* mutex_queue_init(size_t max_size, size_t msglen);
+
+int mutex_queue_post(mutex_queue_t* restrict queue,
+                     size_t                  msglen,
+                     unsigned char const     msg[msglen]);
+int mutex_queue_post_noblock(mutex_queue_t* restrict queue,
+                             size_t                  msglen,
+                             unsigned char const     msg[msglen]);
+int mutex_queue_receive(mutex_queue_t* restrict queue,
+                        size_t                  buflen,
+                        unsigned char           buf[buflen]);
+int mutex_queue_receive_noblock(mutex_queue_t* restrict queue,
+                                size_t                  buflen,
+                                unsigned char           buf[buflen]);
+
+void mutex_queue_destroy(mutex_queue_t* restrict queue);
+
+#endif // INCLUDED_MUTEX_QUEUE_H
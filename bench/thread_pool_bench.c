@@ -0,0 +1,166 @@
+#include "thread_pool.h"
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <pthread.h>
+
+// Measures how quickly a handful of reactor-like threads can get small jobs run by
+// the thread pool, in each of its modes, as the number of workers grows.
+//
+// Usage: thread_pool_bench [jobs per run]
+
+enum
+{
+    BENCH_NUM_SUBMITTERS  = 4,
+    BENCH_DEFAULT_JOBS    = 1000000,
+    BENCH_JOB_WORK_ROUNDS = 64,
+};
+
+struct bench_pool_mode
+{
+    char const*           name;
+    enum thread_pool_mode mode;
+};
+
+struct bench_submitter_args
+{
+    thread_pool_t* pool;
+    uint64_t       num_jobs;
+};
+
+// ==== STATIC PROTOTYPES ====
+
+static void   bench_job(void* data);
+static void*  bench_submitter(void* arg);
+static double bench_run(enum thread_pool_mode mode,
+                        size_t                num_threads,
+                        uint64_t              num_jobs);
+static double bench_now_s(void);
+
+static struct bench_pool_mode const BENCH_MODES[] = {
+    {"shared", THREAD_POOL_MODE_SHARED_QUEUE},
+    {"stealing", THREAD_POOL_MODE_WORK_STEALING},
+    // Grows from one worker up to the thread count
+    {"elastic", THREAD_POOL_MODE_ELASTIC},
+};
+
+static size_t const BENCH_THREAD_COUNTS[] = {1, 2, 4, 8, 16, 32};
+
+static atomic_uint_fast64_t g_jobs_done;
+
+// ==== MAIN ====
+
+int main(int argc, char* argv[])
+{
+    uint64_t num_jobs = BENCH_DEFAULT_JOBS;
+    if (argc > 1) { num_jobs = strtoull(argv[1], NULL, 10); }
+    if (num_jobs == 0)
+    {
+        fprintf(stderr, "Usage: %s [jobs per run]\n", argv[0]);
+        return 1;
+    }
+
+    printf("%-10s %8s %12s\n", "mode", "threads", "Mjobs/s");
+    size_t const num_modes  = sizeof(BENCH_MODES) / sizeof(BENCH_MODES[0]);
+    size_t const num_counts = sizeof(BENCH_THREAD_COUNTS) / sizeof(size_t);
+    for (size_t t = 0; t < num_counts; ++t)
+    {
+        for (size_t m = 0; m < num_modes; ++m)
+        {
+            double rate = bench_run(BENCH_MODES[m].mode, BENCH_THREAD_COUNTS[t],
+                                    num_jobs);
+            if (rate < 0) { return 1; }
+
+            printf("%-10s %8zu %12.2f\n", BENCH_MODES[m].name,
+                   BENCH_THREAD_COUNTS[t], rate / 1e6);
+        }
+    }
+
+    return 0;
+}
+
+// ==== STATIC FUNCTIONS IMPLEMENTATION ====
+
+static void bench_job(void* data)
+{
+    // Just enough work that the job isn't free
+    uint64_t x = (uint64_t) (uintptr_t) data | 1;
+    for (int i = 0; i < BENCH_JOB_WORK_ROUNDS; ++i)
+    {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+    }
+
+    atomic_fetch_add_explicit(&g_jobs_done, x ? 1 : 0, memory_order_relaxed);
+}
+
+static void* bench_submitter(void* arg)
+{
+    struct bench_submitter_args* args = arg;
+
+    for (uint64_t i = 0; i < args->num_jobs; ++i)
+    { thread_pool_run(args->pool, &bench_job, (void*) (uintptr_t) i); }
+
+    return NULL;
+}
+
+// Returns jobs per second, or -1 if the run couldn't be set up
+static double bench_run(enum thread_pool_mode mode,
+                        size_t                num_threads,
+                        uint64_t              num_jobs)
+{
+    thread_pool_t* pool = thread_pool_init_with_mode(num_threads, mode);
+    if (!pool || thread_pool_start(pool) != 0)
+    {
+        fprintf(stderr, "Failed to start a pool of %zu threads\n", num_threads);
+        if (pool) { thread_pool_destroy(pool); }
+        return -1;
+    }
+
+    atomic_store(&g_jobs_done, 0);
+
+    pthread_t                   submitters[BENCH_NUM_SUBMITTERS];
+    struct bench_submitter_args args[BENCH_NUM_SUBMITTERS];
+
+    double start = bench_now_s();
+
+    for (size_t i = 0; i < BENCH_NUM_SUBMITTERS; ++i)
+    {
+        uint64_t share = num_jobs / BENCH_NUM_SUBMITTERS;
+        if (i == 0) { share += num_jobs % BENCH_NUM_SUBMITTERS; }
+
+        args[i] = (struct bench_submitter_args) {.pool = pool, .num_jobs = share};
+        pthread_create(&submitters[i], NULL, bench_submitter, &args[i]);
+    }
+
+    for (size_t i = 0; i < BENCH_NUM_SUBMITTERS; ++i)
+    { pthread_join(submitters[i], NULL); }
+
+    // Stopping runs whatever's still queued first
+    thread_pool_destroy(pool);
+
+    double elapsed = bench_now_s() - start;
+
+    uint64_t done = atomic_load(&g_jobs_done);
+    if (done != num_jobs)
+    {
+        fprintf(stderr, "Only %llu of %llu jobs ran\n", (unsigned long long) done,
+                (unsigned long long) num_jobs);
+        return -1;
+    }
+
+    return (double) num_jobs / elapsed;
+}
+
+static double bench_now_s(void)
+{
+    struct timespec now = {0};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (double) now.tv_sec + ((double) now.tv_nsec / 1e9);
+}
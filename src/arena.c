@@ -0,0 +1,151 @@
+#include "arena.h"
+
+#include "logging.h"
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef MINIWEB_TESTING
+extern void* _test_malloc(const size_t size, char const* file, int const line);
+extern void*
+             _test_calloc(size_t nmemb, size_t size, char const* file, int const line);
+extern void  _test_free(void* ptr, char const* file, int const line);
+extern void* _test_realloc(void* ptr, size_t size, char const* file, int const line);
+
+    #define malloc(size)       _test_malloc(size, __FILE__, __LINE__)
+    #define calloc(n, size)    _test_calloc(n, size, __FILE__, __LINE__)
+    #define free(ptr)          _test_free(ptr, __FILE__, __LINE__)
+    #define realloc(ptr, size) _test_realloc(ptr, size, __FILE__, __LINE__)
+#endif
+
+struct arena_chunk
+{
+    // Only set for chunks that came from the pool
+    pool_handle_t       handle;
+    struct arena_chunk* next;
+    max_align_t         data[];
+};
+
+static const size_t ARENA_CHUNK_CAPACITY =
+    ARENA_CHUNK_SIZE - offsetof(struct arena_chunk, data);
+
+// ==== STATIC PROTOTYPES ====
+
+static size_t arena_align_up(size_t size);
+static void*  arena_alloc_oversized(arena_t* arena, size_t size);
+
+// ==== PUBLIC FUNCTIONS IMPLEMENTATION ====
+
+void arena_init(arena_t* arena, pool_t* chunk_pool)
+{
+    assert(arena);
+    assert(chunk_pool);
+
+    *arena = (arena_t) {.chunk_pool = chunk_pool};
+}
+
+void arena_reset(arena_t* arena)
+{
+    assert(arena);
+
+    for (struct arena_chunk* curr = arena->chunks; curr;)
+    {
+        struct arena_chunk* next = curr->next;
+        pool_free(arena->chunk_pool, curr->handle);
+        curr = next;
+    }
+
+    for (struct arena_chunk* curr = arena->oversized; curr;)
+    {
+        struct arena_chunk* next = curr->next;
+        free(curr);
+        curr = next;
+    }
+
+    arena->chunks     = NULL;
+    arena->chunk_used = 0;
+    arena->oversized  = NULL;
+}
+
+void* arena_alloc(arena_t* arena, size_t size)
+{
+    assert(arena);
+
+    if (size > SIZE_MAX - ARENA_CHUNK_SIZE)
+    {
+        MINIWEB_LOG_ERROR("Can't allocate %zu bytes from an arena", size);
+        return NULL;
+    }
+
+    // Every allocation gets its own address, even an empty one
+    size = arena_align_up(size ? size : 1);
+    if (size > ARENA_CHUNK_CAPACITY) { return arena_alloc_oversized(arena, size); }
+
+    if (!arena->chunks || arena->chunk_used + size > ARENA_CHUNK_CAPACITY)
+    {
+        // Whatever's left at the end of the old chunk is wasted, but requests only
+        // live for so long
+        pool_handle_t handle = pool_alloc(arena->chunk_pool);
+        if (!handle.data)
+        {
+            MINIWEB_LOG_ERROR("Failed to get a new arena chunk");
+            return NULL;
+        }
+
+        struct arena_chunk* chunk = handle.data;
+        chunk->handle             = handle;
+        chunk->next               = arena->chunks;
+        arena->chunks             = chunk;
+        arena->chunk_used         = 0;
+    }
+
+    void* ptr = (char*) arena->chunks->data + arena->chunk_used;
+    arena->chunk_used += size;
+
+    return ptr;
+}
+
+void* arena_calloc(arena_t* arena, size_t size)
+{
+    void* ptr = arena_alloc(arena, size);
+    if (ptr) { memset(ptr, 0, size); }
+
+    return ptr;
+}
+
+char* arena_strdup(arena_t* arena, char const* str)
+{
+    assert(str);
+
+    size_t len  = strlen(str);
+    char*  copy = arena_alloc(arena, len + 1);
+    if (copy) { memcpy(copy, str, len + 1); }
+
+    return copy;
+}
+
+// ==== STATIC FUNCTIONS IMPLEMENTATION ====
+
+static size_t arena_align_up(size_t size)
+{
+    size_t const align = _Alignof(max_align_t);
+    return (size + align - 1) & ~(align - 1);
+}
+
+static void* arena_alloc_oversized(arena_t* arena, size_t size)
+{
+    struct arena_chunk* chunk = malloc(offsetof(struct arena_chunk, data) + size);
+    if (!chunk)
+    {
+        MINIWEB_LOG_ERROR("Failed to allocate %zu bytes for arena", size);
+        return NULL;
+    }
+
+    chunk->handle    = (pool_handle_t) {0};
+    chunk->next      = arena->oversized;
+    arena->oversized = chunk;
+
+    return chunk->data;
+}
@@ -0,0 +1,42 @@
+#ifndef INCLUDED_ARENA_H
+#define INCLUDED_ARENA_H
+
+#include "pool.h"
+
+#include <stdlib.h>
+
+// Scratch memory that's only ever freed all at once. Allocating just bumps a
+// pointer along the current chunk, and the chunks themselves come from a pool, so
+// a short-lived arena costs a pool_alloc or two and never touches malloc.
+
+enum
+{
+    // The block size the chunk pool has to be made with
+    ARENA_CHUNK_SIZE = 4096,
+};
+
+typedef struct arena_chunk arena_chunk_t;
+
+typedef struct arena
+{
+    pool_t*        chunk_pool;
+    // The chunk being allocated from is first
+    arena_chunk_t* chunks;
+    size_t         chunk_used;
+    // Anything too big for a chunk gets a malloc of its own
+    arena_chunk_t* oversized;
+} arena_t;
+
+// The chunk pool can be shared between arenas, and must be concurrent if they're
+// on different threads
+void arena_init(arena_t* arena, pool_t* chunk_pool);
+// Frees everything allocated from the arena in one go, after which it can be used
+// again straight away
+void arena_reset(arena_t* arena);
+
+// Aligned for any type. NULL if we're out of memory.
+void* arena_alloc(arena_t* arena, size_t size);
+void* arena_calloc(arena_t* arena, size_t size);
+char* arena_strdup(arena_t* arena, char const* str);
+
+#endif // INCLUDED_ARENA_H
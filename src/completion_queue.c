@@ -0,0 +1,75 @@
+#include "completion_queue.h"
+
+#include "logging.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+// ==== PUBLIC FUNCTIONS IMPLEMENTATION ====
+
+int completion_queue_init(completion_queue_t* completions)
+{
+    assert(completions);
+
+    mpsc_queue_init(&completions->queue);
+    completions->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (completions->event_fd == -1)
+    {
+        MINIWEB_LOG_ERROR("Failed to create eventfd for completions: %d (%s)", errno,
+                          strerror(errno));
+        errno = 0;
+        return -1;
+    }
+
+    return 0;
+}
+
+void completion_queue_clean(completion_queue_t* completions)
+{
+    assert(completions);
+
+    if (completions->event_fd != -1) { close(completions->event_fd); }
+    completions->event_fd = -1;
+}
+
+void completion_queue_post(completion_queue_t* completions, mpsc_node_t* node)
+{
+    assert(completions);
+    assert(node);
+
+    // If the queue wasn't empty the reactor is already due to wake up
+    bool was_empty = mpsc_queue_push(&completions->queue, node);
+    if (!was_empty) { return; }
+
+    uint64_t one = 1;
+    ssize_t  rc  = write(completions->event_fd, &one, sizeof(one));
+    if (rc != sizeof(one))
+    {
+        MINIWEB_LOG_ERROR("Failed to signal completions eventfd %d: %d (%s)",
+                          completions->event_fd, errno, strerror(errno));
+        errno = 0;
+    }
+}
+
+mpsc_node_t* completion_queue_take_all(completion_queue_t* completions)
+{
+    assert(completions);
+
+    // Reset the eventfd before taking, so anything posted in between still wakes
+    // the reactor up again
+    uint64_t count = 0;
+    ssize_t  rc    = read(completions->event_fd, &count, sizeof(count));
+    if (rc == -1 && errno != EAGAIN)
+    {
+        MINIWEB_LOG_ERROR("Failed to read completions eventfd %d: %d (%s)",
+                          completions->event_fd, errno, strerror(errno));
+    }
+    errno = 0;
+
+    return mpsc_queue_take_all(&completions->queue);
+}
@@ -0,0 +1,28 @@
+#ifndef INCLUDED_COMPLETION_QUEUE_H
+#define INCLUDED_COMPLETION_QUEUE_H
+
+#include "mpsc_queue.h"
+
+// How other threads hand things back to a reactor: finished responses, or anything
+// else the reactor should deal with on its own thread. Any thread can post, and
+// posting to an empty queue makes event_fd readable, so the reactor can watch it
+// along with its sockets and take everything at once when it fires.
+
+typedef struct completion_queue
+{
+    mpsc_queue_t queue;
+    // An eventfd, which belongs to the queue and is closed along with it
+    int event_fd;
+} completion_queue_t;
+
+int  completion_queue_init(completion_queue_t* completions);
+void completion_queue_clean(completion_queue_t* completions);
+
+// Safe to call from any thread
+void completion_queue_post(completion_queue_t* completions, mpsc_node_t* node);
+
+// Only for the reactor. Takes everything posted so far as a list linked through
+// next, oldest first, and leaves event_fd unreadable until something else is posted.
+mpsc_node_t* completion_queue_take_all(completion_queue_t* completions);
+
+#endif // INCLUDED_COMPLETION_QUEUE_H
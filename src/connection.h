@@ -1,4 +1,75 @@
 #ifndef INCLUDED_CONNECTION_H
 #define INCLUDED_CONNECTION_H
 
+#include "http_helpers.h"
+#include "pool.h"
+#include "response_queue.h"
+#include "slab.h"
+#include "timer_wheel.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+enum connection_flags
+{
+    // Always armed and never times out. Used for anything that isn't a client.
+    CONNECTION_FLAG_LISTENER = 1 << 0,
+    // Close the connection once the workers have handed it back and everything
+    // they gave us has been written
+    CONNECTION_FLAG_CLOSING = 1 << 1,
+    // Somebody else owns the fd, so the manager leaves it open when it's cleaned up
+    CONNECTION_FLAG_BORROWED = 1 << 2,
+};
+
+// Who is allowed to touch a client socket. The reactor only reads from or closes a
+// connection it owns, and it's only armed in the poll set while that's the case.
+enum connection_state
+{
+    CONNECTION_STATE_REACTOR,
+    // Requests are out with the workers. The reactor gets it back once they've all
+    // finished.
+    CONNECTION_STATE_WORKERS,
+    // The socket filled up part way through a response, so it's armed for writing
+    // rather than reading until we've caught up
+    CONNECTION_STATE_WRITING,
+};
+
+// Per-socket state owned by the connection_manager. These live in a pool, so their
+// addresses stay put for as long as the connection is open, even though the slot
+// they occupy in the manager's table may move.
+struct connection
+{
+    int                   fd;
+    uint32_t              flags;
+    enum connection_state state;
+    // Only ever touched by the reactor
+    size_t jobs_in_flight;
+    // Where this connection currently lives in the manager's table
+    size_t index;
+
+    // Timestamps are milliseconds from timer_wheel_now_ms()
+    uint64_t            accepted_ms;
+    uint64_t            last_active_ms;
+    timer_wheel_entry_t idle_timer;
+
+    // Bytes read off the socket that haven't been handled yet, allocated from the
+    // manager's read buffer slab. If the connection goes away with some still
+    // here, the manager frees them.
+    slab_handle_t read_buffer;
+    size_t        read_len;
+
+    // Created when the first request is dispatched. Jobs in flight hold their own
+    // reference, so it can outlive the connection.
+    response_queue_t* responses;
+
+    // The response we're part way through writing, taken off responses in order.
+    // If the connection goes away before it's done, the manager closes its file.
+    http_file_response_t output;
+    http_send_progress_t output_progress;
+    bool                 has_output;
+
+    pool_handle_t handle_to_me;
+};
+
 #endif // INCLUDED_CONNECTION_H
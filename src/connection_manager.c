@@ -1,6 +1,11 @@
 #include "connection_manager.h"
 
+#include "connection.h"
 #include "logging.h"
+#include "macro_helpers.h"
+#include "pool.h"
+#include "slab.h"
+#include "timer_wheel.h"
 
 #include <assert.h>
 #include <errno.h>
@@ -11,19 +16,79 @@
 #include <poll.h>
 #include <unistd.h>
 
-static const int CONNECTION_MANAGER_DEFAULT_TIMEOUT = 2000;
+#ifdef MINIWEB_USE_EPOLL
+    #include <sys/epoll.h>
+#endif
+
+static const int      CONNECTION_MANAGER_DEFAULT_TIMEOUT         = 2000;
+static const uint64_t CONNECTION_MANAGER_DEFAULT_IDLE_TIMEOUT_MS = 300 * 1000;
+
+enum
+{
+    CONNECTION_MANAGER_MAX_EVENTS = 64,
+    // One second ticks, and enough slots that the default timeout fits in one turn
+    TIMER_WHEEL_TICK_MS   = 1000,
+    TIMER_WHEEL_NUM_SLOTS = 512,
+};
 
 struct connection_manager
 {
+    // A dense table of every socket we own - the first connections_num entries
+    // are in use and there are no gaps. With poll() the pollfd array is the set we
+    // hand to the kernel, with epoll() it is only used to keep track of things.
     struct pollfd* connections;
     size_t         connections_num;
     size_t         connections_cap;
     int            current_event_index;
+
+    // Index-aligned with the pollfd array
+    struct connection** connection_data;
+    pool_t*             connection_pool;
+    slab_t*             read_buffer_slab;
+
+    // Indexed by fd, NULL for any fd we aren't tracking
+    struct connection** fd_table;
+    size_t              fd_table_cap;
+
+    timer_wheel_t* idle_timers;
+    uint64_t       idle_timeout_ms;
+    // Read once per wakeup, it's close enough for refreshing idle timers
+    uint64_t now_ms;
+
+#ifdef MINIWEB_USE_EPOLL
+    int                epoll_fd;
+    int                num_events;
+    struct epoll_event events[CONNECTION_MANAGER_MAX_EVENTS];
+#endif
 };
 
 // ==== STATIC PROTOTYPES ====
 
-static size_t connection_manager_find_free_spot(struct connection_manager* manager);
+static int connection_manager_grow(struct connection_manager* manager);
+static int connection_manager_grow_fd_table(struct connection_manager* manager,
+                                            int                        sockfd);
+static struct connection*
+            connection_manager_lookup(struct connection_manager* manager,
+                                      int                        sockfd);
+static struct connection*
+            connection_manager_track(struct connection_manager* manager,
+                                     int                        sockfd,
+                                     uint32_t                   flags);
+static void connection_manager_untrack(struct connection_manager* manager,
+                                       struct connection*         connection);
+
+// Backend-specific hooks, implemented with either epoll() or poll()
+static int  connection_manager_backend_init(struct connection_manager* manager);
+static int  connection_manager_backend_add(struct connection_manager* manager,
+                                           struct connection*         connection);
+static void connection_manager_backend_remove(struct connection_manager* manager,
+                                              int                        sockfd);
+static int  connection_manager_backend_rearm(struct connection_manager* manager,
+                                             struct connection*         connection,
+                                             enum connection_interest   interest);
+static struct connection*
+            connection_manager_backend_next_event(struct connection_manager* manager);
+static void connection_manager_backend_clean(struct connection_manager* manager);
 
 struct connection_manager* connection_manager_create(size_t initial_capacity)
 {
@@ -57,23 +122,121 @@ int connection_manager_init(struct connection_manager* restrict conns,
         return -1;
     }
 
+    struct connection** connection_data =
+        calloc(initial_capacity, sizeof(struct connection*));
+    if (!connection_data)
+    {
+        MINIWEB_LOG_ERROR("Failed to allocate memory for connection array");
+        free(connections);
+        return -1;
+    }
+
+    pool_t* connection_pool = pool_init(sizeof(struct connection), initial_capacity);
+    if (!connection_pool)
+    {
+        MINIWEB_LOG_ERROR("Failed to create pool for connection state");
+        free(connection_data);
+        free(connections);
+        return -1;
+    }
+
+    uint64_t       now_ms = timer_wheel_now_ms();
+    timer_wheel_t* idle_timers =
+        timer_wheel_init(TIMER_WHEEL_NUM_SLOTS, TIMER_WHEEL_TICK_MS, now_ms);
+    if (!idle_timers)
+    {
+        MINIWEB_LOG_ERROR("Failed to create timer wheel for idle connections");
+        pool_destroy(connection_pool);
+        free(connection_data);
+        free(connections);
+        return -1;
+    }
+
     conns->connections         = connections;
     conns->connections_num     = 0;
     conns->connections_cap     = initial_capacity;
     conns->current_event_index = -1;
+    conns->connection_data     = connection_data;
+    conns->connection_pool     = connection_pool;
+    conns->read_buffer_slab    = NULL;
+    conns->fd_table            = NULL;
+    conns->fd_table_cap        = 0;
+    conns->idle_timers         = idle_timers;
+    conns->idle_timeout_ms     = CONNECTION_MANAGER_DEFAULT_IDLE_TIMEOUT_MS;
+    conns->now_ms              = now_ms;
+
+    int rc = connection_manager_backend_init(conns);
+    if (rc != 0)
+    {
+        MINIWEB_LOG_ERROR("Failed to initialise connection_manager backend: %d", rc);
+        timer_wheel_destroy(idle_timers);
+        pool_destroy(connection_pool);
+        free(connection_data);
+        free(connections);
+        return -2;
+    }
 
     return 0;
 }
 
+void connection_manager_set_idle_timeout(struct connection_manager* manager,
+                                         uint64_t                   timeout_ms)
+{
+    assert(manager);
+    manager->idle_timeout_ms = timeout_ms;
+}
+
+void connection_manager_set_read_buffer_slab(struct connection_manager* manager,
+                                             slab_t*                    slab)
+{
+    assert(manager);
+    manager->read_buffer_slab = slab;
+}
+
 void connection_manager_add_listener_socket(struct connection_manager* restrict
                                                 conns,
                                             int sockfd)
 {
     assert(conns);
 
-    conns->connections[0].fd     = sockfd;
-    conns->connections[0].events = POLLIN;
-    conns->connections_num       = 1;
+    struct connection* listener =
+        connection_manager_track(conns, sockfd, CONNECTION_FLAG_LISTENER);
+    if (!listener)
+    {
+        MINIWEB_LOG_ERROR("Failed to track listener socket %d", sockfd);
+        return;
+    }
+
+    int rc = connection_manager_backend_add(conns, listener);
+    if (rc != 0)
+    { MINIWEB_LOG_ERROR("Failed to watch listener socket %d: %d", sockfd, rc); }
+}
+
+int connection_manager_add_completion_queue(connection_manager_t* restrict conns,
+                                            completion_queue_t const* completions)
+{
+    assert(conns);
+    assert(completions);
+
+    int                event_fd = completions->event_fd;
+    struct connection* watched  = connection_manager_track(
+        conns, event_fd, CONNECTION_FLAG_LISTENER | CONNECTION_FLAG_BORROWED);
+    if (!watched)
+    {
+        MINIWEB_LOG_ERROR("Failed to track completions eventfd %d", event_fd);
+        return -1;
+    }
+
+    int rc = connection_manager_backend_add(conns, watched);
+    if (rc != 0)
+    {
+        MINIWEB_LOG_ERROR("Failed to watch completions eventfd %d: %d", event_fd,
+                          rc);
+        connection_manager_untrack(conns, watched);
+        return -2;
+    }
+
+    return 0;
 }
 
 bool connection_manager_get_next_event(connection_manager_t* manager,
@@ -82,72 +245,86 @@ bool connection_manager_get_next_event(connection_manager_t* manager,
     assert(sockfd_out);
     assert(manager);
 
-    // We're not currently iterating, and need to call poll()
-    if (manager->current_event_index == -1)
-    {
-        int npolls = poll(manager->connections, manager->connections_num,
-                          CONNECTION_MANAGER_DEFAULT_TIMEOUT);
-        if (npolls == -1)
-        {
-            MINIWEB_LOG_ERROR("Call to poll() failed: %d (%s)", errno,
-                              strerror(errno));
-            errno = 0;
-            return false;
-        }
-        if (npolls == 0)
-        {
-            // We timed out
-            return false;
-        }
+    struct connection* connection = connection_manager_backend_next_event(manager);
+    if (!connection) { return false; }
 
-        // Let's start returning events!
-        manager->current_event_index = 0;
+    // The backend has already disarmed a client socket, and it can't be idle while
+    // somebody is busy with it
+    if (!(connection->flags & CONNECTION_FLAG_LISTENER))
+    {
+        connection->last_active_ms = manager->now_ms;
+        timer_wheel_cancel(manager->idle_timers, &connection->idle_timer);
     }
 
-    for (size_t i = (size_t) manager->current_event_index;
-         i < manager->connections_num; ++i)
+    *sockfd_out = connection->fd;
+    return true;
+}
+
+int connection_manager_rearm_connection(struct connection_manager* manager,
+                                        int                        sockfd,
+                                        enum connection_interest   interest)
+{
+    assert(manager);
+
+    struct connection* connection = connection_manager_lookup(manager, sockfd);
+    if (!connection)
     {
-        if (manager->connections[i].revents & POLLIN)
-        {
-            *sockfd_out                  = manager->connections[i].fd;
-            manager->current_event_index = i + 1;
-            return true;
-        }
+        MINIWEB_LOG_ERROR("Attempted to re-arm socket %d but it isn't being tracked",
+                          sockfd);
+        return -1;
     }
 
-    // If we get here then we are out of polling events and should set our index to
-    // -1
-    manager->current_event_index = -1;
-    return false;
+    int rc = connection_manager_backend_rearm(manager, connection, interest);
+    if (rc != 0) { return -2; }
+
+    // The idle clock starts again from when we were last done with it. A client that
+    // stops reading our responses gets timed out the same way.
+    timer_wheel_schedule(manager->idle_timers, &connection->idle_timer,
+                         manager->now_ms + manager->idle_timeout_ms);
+    return 0;
 }
 
 int connection_manager_add_new_connection(struct connection_manager* manager,
                                           int                        new_sockfd)
 {
-    // Found a free spot in the current array
-    size_t new_index = connection_manager_find_free_spot(manager);
-    if (new_index == SIZE_MAX)
-    {
-        // Need to allocate a new buffer
-        size_t         new_size = manager->connections_cap * 2;
-        struct pollfd* new_buf =
-            realloc(manager->connections, new_size * sizeof(struct pollfd));
-        if (!new_buf)
-        {
-            MINIWEB_LOG_ERROR("Was unable to allocate memory for the new buffer!");
-            return -1;
-        }
+    assert(manager);
 
-        // Realloc won't set the second half to 0, so we should do that ourselves
-        memset(manager->connections + manager->connections_cap, 0,
-               manager->connections_cap * sizeof(struct pollfd));
-        new_index                = manager->connections_cap;
-        manager->connections_cap = new_size;
+    struct connection* connection = connection_manager_track(manager, new_sockfd, 0);
+    if (!connection) { return -1; }
+
+    int rc = connection_manager_backend_add(manager, connection);
+    if (rc != 0)
+    {
+        MINIWEB_LOG_ERROR("Failed to watch socket %d: %d", new_sockfd, rc);
+        connection_manager_untrack(manager, connection);
+        return -2;
     }
 
-    manager->connections[new_index].fd = new_sockfd;
-    manager->connections[new_index].events |= POLLIN;
-    ++manager->connections_num;
+    // Start counting from when the connection was accepted
+    uint64_t now_ms            = timer_wheel_now_ms();
+    connection->accepted_ms    = now_ms;
+    connection->last_active_ms = now_ms;
+    timer_wheel_schedule(manager->idle_timers, &connection->idle_timer,
+                         now_ms + manager->idle_timeout_ms);
+
+    return 0;
+}
+
+int connection_manager_add_borrowed_connection(struct connection_manager* manager,
+                                               int                        sockfd)
+{
+    assert(manager);
+
+    struct connection* connection =
+        connection_manager_track(manager, sockfd, CONNECTION_FLAG_BORROWED);
+    if (!connection) { return -1; }
+
+    // It never goes near epoll, and poll() skips negative fds
+    manager->connections[connection->index].fd = -1;
+
+    uint64_t now_ms            = timer_wheel_now_ms();
+    connection->accepted_ms    = now_ms;
+    connection->last_active_ms = now_ms;
 
     return 0;
 }
@@ -155,48 +332,243 @@ int connection_manager_add_new_connection(struct connection_manager* manager,
 void connection_manager_remove_connection(struct connection_manager* manager,
                                           int                        sockfd)
 {
-    // Find the socket in the connection array
-    for (size_t i = 0; i < manager->connections_cap; ++i)
+    assert(manager);
+
+    struct connection* connection = connection_manager_lookup(manager, sockfd);
+    if (!connection)
     {
-        if (manager->connections[i].fd == sockfd)
+        MINIWEB_LOG_ERROR(
+            "Attempted to delete socket %d but no such socket was found", sockfd);
+        return;
+    }
+
+    // Whoever lent us a borrowed socket is the one watching it
+    if (!(connection->flags & CONNECTION_FLAG_BORROWED))
+    { connection_manager_backend_remove(manager, sockfd); }
+    connection_manager_untrack(manager, connection);
+}
+
+struct connection*
+connection_manager_get_connection(struct connection_manager* manager, int sockfd)
+{
+    assert(manager);
+    return connection_manager_lookup(manager, sockfd);
+}
+
+size_t connection_manager_get_size(struct connection_manager const* manager)
+{
+    assert(manager);
+    return manager->connections_num;
+}
+
+size_t connection_manager_close_idle_connections(struct connection_manager* manager)
+{
+    assert(manager);
+
+    uint64_t             now_ms  = timer_wheel_now_ms();
+    timer_wheel_entry_t* expired = timer_wheel_advance(manager->idle_timers, now_ms);
+
+    size_t num_closed = 0;
+    while (expired)
+    {
+        timer_wheel_entry_t* next = expired->next;
+        struct connection*   connection =
+            CONTAINER_OF(expired, struct connection, idle_timer);
+
+        // Workers still have requests from it, and their responses would go to
+        // whoever got the fd next. Give it another timeout once they're back.
+        if (connection->jobs_in_flight > 0)
         {
-            // And zero it out
-            manager->connections[i] = (const struct pollfd) {0};
-            --manager->connections_num;
-            return;
+            timer_wheel_schedule(manager->idle_timers, &connection->idle_timer,
+                                 now_ms + manager->idle_timeout_ms);
+            expired = next;
+            continue;
         }
+
+        int sockfd = connection->fd;
+        MINIWEB_LOG_INFO("Closing idle connection on socket %d", sockfd);
+
+        connection_manager_backend_remove(manager, sockfd);
+        connection_manager_untrack(manager, connection);
+        close(sockfd);
+
+        ++num_closed;
+        expired = next;
+    }
+
+    return num_closed;
+}
+
+static int connection_manager_grow(struct connection_manager* manager)
+{
+    // Need to allocate a new buffer
+    size_t         new_size = manager->connections_cap * 2;
+    struct pollfd* new_buf =
+        realloc(manager->connections, new_size * sizeof(struct pollfd));
+    if (!new_buf)
+    {
+        MINIWEB_LOG_ERROR("Was unable to allocate memory for the new buffer!");
+        return -1;
+    }
+    manager->connections = new_buf;
+
+    struct connection** new_data =
+        realloc(manager->connection_data, new_size * sizeof(struct connection*));
+    if (!new_data)
+    {
+        MINIWEB_LOG_ERROR("Was unable to allocate memory for the connection array!");
+        return -1;
+    }
+    manager->connection_data = new_data;
+
+    // Nothing past connections_num is ever read, so the new space can stay as it is
+    manager->connections_cap = new_size;
+
+    return 0;
+}
+
+static int connection_manager_grow_fd_table(struct connection_manager* manager,
+                                            int                        sockfd)
+{
+    // The kernel hands out the lowest free fd, so the table only grows as far as
+    // the most sockets we've had open at once
+    size_t new_cap = manager->fd_table_cap ? manager->fd_table_cap : 16;
+    while (new_cap <= (size_t) sockfd) new_cap *= 2;
+
+    struct connection** new_table =
+        realloc(manager->fd_table, new_cap * sizeof(struct connection*));
+    if (!new_table)
+    {
+        MINIWEB_LOG_ERROR("Was unable to allocate memory for the fd table!");
+        return -1;
+    }
+
+    memset(new_table + manager->fd_table_cap, 0,
+           (new_cap - manager->fd_table_cap) * sizeof(struct connection*));
+    manager->fd_table     = new_table;
+    manager->fd_table_cap = new_cap;
+
+    return 0;
+}
+
+static struct connection*
+connection_manager_lookup(struct connection_manager* manager, int sockfd)
+{
+    if (sockfd < 0 || (size_t) sockfd >= manager->fd_table_cap) { return NULL; }
+    return manager->fd_table[sockfd];
+}
+
+static struct connection* connection_manager_track(struct connection_manager* manager,
+                                                   int                        sockfd,
+                                                   uint32_t                   flags)
+{
+    if (sockfd < 0)
+    {
+        MINIWEB_LOG_ERROR("Refusing to track invalid socket %d", sockfd);
+        return NULL;
+    }
+    if (connection_manager_lookup(manager, sockfd))
+    {
+        MINIWEB_LOG_ERROR("Socket %d is already being tracked", sockfd);
+        return NULL;
+    }
+
+    if (manager->connections_num == manager->connections_cap)
+    {
+        int rc = connection_manager_grow(manager);
+        if (rc != 0) { return NULL; }
+    }
+    if ((size_t) sockfd >= manager->fd_table_cap)
+    {
+        int rc = connection_manager_grow_fd_table(manager, sockfd);
+        if (rc != 0) { return NULL; }
+    }
+
+    pool_handle_t handle = pool_calloc(manager->connection_pool);
+    if (!handle.data)
+    {
+        MINIWEB_LOG_ERROR("Failed to allocate connection state for socket %d",
+                          sockfd);
+        return NULL;
     }
 
-    // If we get here, then there was no such socket
-    MINIWEB_LOG_ERROR("Attempted to delete socket %d but no such socket was found",
-                      sockfd);
+    // New connections always go on the end, so the table stays dense
+    size_t index = manager->connections_num++;
+
+    struct connection* connection = handle.data;
+    connection->fd                = sockfd;
+    connection->flags             = flags;
+    connection->index             = index;
+    connection->handle_to_me      = handle;
+
+    manager->connections[index] =
+        (const struct pollfd) {.fd = sockfd, .events = POLLIN};
+    manager->connection_data[index] = connection;
+    manager->fd_table[sockfd]       = connection;
+
+    return connection;
 }
 
-static size_t connection_manager_find_free_spot(struct connection_manager* manager)
+static void connection_manager_untrack(struct connection_manager* manager,
+                                       struct connection*         connection)
 {
-    for (size_t i = 0; i < manager->connections_cap; ++i)
+    timer_wheel_cancel(manager->idle_timers, &connection->idle_timer);
+
+    // Fill the hole with whatever is on the end of the table
+    size_t index = connection->index;
+    size_t last  = --manager->connections_num;
+    if (index != last)
+    {
+        manager->connections[index]            = manager->connections[last];
+        manager->connection_data[index]        = manager->connection_data[last];
+        manager->connection_data[index]->index = index;
+    }
+
+#ifndef MINIWEB_USE_EPOLL
+    // If we've just removed the connection we last handed out, the one we moved in
+    // hasn't been looked at yet, so make sure we don't skip over it. epoll's events
+    // don't refer to the table, so there's nothing to fix up there.
+    if (manager->current_event_index > 0
+        && (size_t) manager->current_event_index == index + 1)
+    { --manager->current_event_index; }
+#endif
+
+    if (connection->responses) { response_queue_release(connection->responses); }
+    if (connection->has_output && connection->output.file_fd != -1)
+    { close(connection->output.file_fd); }
+    if (connection->read_buffer.data)
     {
-        if (manager->connections[i].events == 0 && manager->connections[i].fd == 0)
-        { return i; }
+        assert(manager->read_buffer_slab);
+        slab_free(manager->read_buffer_slab, connection->read_buffer);
     }
 
-    // If we got here, then we didn't find anything
-    return SIZE_MAX;
+    manager->fd_table[connection->fd] = NULL;
+    pool_free(manager->connection_pool, connection->handle_to_me);
 }
 
 void connection_manager_clean(struct connection_manager* restrict conns)
 {
     assert(conns);
 
-    for (size_t i = 0; i < conns->connections_cap; ++i)
+    for (size_t i = 0; i < conns->connections_num; ++i)
     {
-        if (conns->connections[i].events != 0)
+        struct connection* connection = conns->connection_data[i];
+        if (!(connection->flags & CONNECTION_FLAG_BORROWED))
         {
-            MINIWEB_LOG_INFO("Closing socket %d", conns->connections[i].fd);
-            close(conns->connections[i].fd);
+            MINIWEB_LOG_INFO("Closing socket %d", connection->fd);
+            close(connection->fd);
         }
+
+        if (connection->responses) { response_queue_release(connection->responses); }
+        if (connection->has_output && connection->output.file_fd != -1)
+        { close(connection->output.file_fd); }
     }
 
+    connection_manager_backend_clean(conns);
+    timer_wheel_destroy(conns->idle_timers);
+    pool_destroy(conns->connection_pool);
+    free(conns->fd_table);
+    free(conns->connection_data);
     free(conns->connections);
     memset(conns, 0, sizeof(struct connection_manager));
 }
@@ -206,3 +578,216 @@ void connection_manager_destroy(struct connection_manager* restrict conns)
     if (conns) { connection_manager_clean(conns); }
     free(conns);
 }
+
+#ifdef MINIWEB_USE_EPOLL
+
+// ==== EPOLL BACKEND ====
+
+static int connection_manager_backend_init(struct connection_manager* manager)
+{
+    manager->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (manager->epoll_fd == -1)
+    {
+        MINIWEB_LOG_ERROR("Call to epoll_create1() failed: %d (%s)", errno,
+                          strerror(errno));
+        errno = 0;
+        return -1;
+    }
+
+    manager->num_events = 0;
+    return 0;
+}
+
+static int connection_manager_backend_add(struct connection_manager* manager,
+                                          struct connection*         connection)
+{
+    // Clients are one-shot, so the kernel disarms them for us after each event
+    uint32_t events = EPOLLIN;
+    if (!(connection->flags & CONNECTION_FLAG_LISTENER)) { events |= EPOLLONESHOT; }
+
+    int                sockfd = connection->fd;
+    struct epoll_event event  = {.events = events, .data.ptr = connection};
+
+    int rc = epoll_ctl(manager->epoll_fd, EPOLL_CTL_ADD, sockfd, &event);
+    if (rc == -1)
+    {
+        MINIWEB_LOG_ERROR("Failed to add socket %d to epoll set: %d (%s)", sockfd,
+                          errno, strerror(errno));
+        errno = 0;
+        return -1;
+    }
+
+    return 0;
+}
+
+static void connection_manager_backend_remove(struct connection_manager* manager,
+                                              int                        sockfd)
+{
+    int rc = epoll_ctl(manager->epoll_fd, EPOLL_CTL_DEL, sockfd, NULL);
+    if (rc == -1)
+    {
+        MINIWEB_LOG_ERROR("Failed to remove socket %d from epoll set: %d (%s)",
+                          sockfd, errno, strerror(errno));
+        errno = 0;
+    }
+}
+
+static int connection_manager_backend_rearm(struct connection_manager* manager,
+                                            struct connection*         connection,
+                                            enum connection_interest   interest)
+{
+    uint32_t events = interest == CONNECTION_INTEREST_WRITE ? EPOLLOUT : EPOLLIN;
+
+    int                sockfd = connection->fd;
+    struct epoll_event event  = {.events   = events | EPOLLONESHOT,
+                                 .data.ptr = connection};
+
+    int rc = epoll_ctl(manager->epoll_fd, EPOLL_CTL_MOD, sockfd, &event);
+    if (rc == -1)
+    {
+        MINIWEB_LOG_ERROR("Failed to re-arm socket %d in epoll set: %d (%s)", sockfd,
+                          errno, strerror(errno));
+        errno = 0;
+        return -1;
+    }
+
+    return 0;
+}
+
+static struct connection*
+connection_manager_backend_next_event(struct connection_manager* manager)
+{
+    // We're not currently iterating, and need to call epoll_wait()
+    if (manager->current_event_index == -1)
+    {
+        int nevents = epoll_wait(manager->epoll_fd, manager->events,
+                                 CONNECTION_MANAGER_MAX_EVENTS,
+                                 CONNECTION_MANAGER_DEFAULT_TIMEOUT);
+        if (nevents == -1)
+        {
+            MINIWEB_LOG_ERROR("Call to epoll_wait() failed: %d (%s)", errno,
+                              strerror(errno));
+            errno = 0;
+            return NULL;
+        }
+        if (nevents == 0)
+        {
+            // We timed out
+            return NULL;
+        }
+
+        manager->num_events          = nevents;
+        manager->current_event_index = 0;
+        manager->now_ms              = timer_wheel_now_ms();
+    }
+
+    // Unlike poll(), every entry we get back is ready, so there is nothing to skip.
+    // Hangups and errors are handed out too, so the caller's recv() will see them.
+    if (manager->current_event_index < manager->num_events)
+    {
+        struct connection* connection =
+            manager->events[manager->current_event_index].data.ptr;
+        ++manager->current_event_index;
+        return connection;
+    }
+
+    manager->current_event_index = -1;
+    return NULL;
+}
+
+static void connection_manager_backend_clean(struct connection_manager* manager)
+{
+    close(manager->epoll_fd);
+}
+
+#else
+
+// ==== POLL BACKEND ====
+
+static int connection_manager_backend_init(struct connection_manager* manager)
+{
+    (void) manager;
+    return 0;
+}
+
+static int connection_manager_backend_add(struct connection_manager* manager,
+                                          struct connection*         connection)
+{
+    // The pollfd array is the poll set, so there's nothing extra to do
+    (void) manager;
+    (void) connection;
+    return 0;
+}
+
+static void connection_manager_backend_remove(struct connection_manager* manager,
+                                              int                        sockfd)
+{
+    (void) manager;
+    (void) sockfd;
+}
+
+static int connection_manager_backend_rearm(struct connection_manager* manager,
+                                            struct connection*         connection,
+                                            enum connection_interest   interest)
+{
+    short events = interest == CONNECTION_INTEREST_WRITE ? POLLOUT : POLLIN;
+    manager->connections[connection->index] =
+        (const struct pollfd) {.fd = connection->fd, .events = events};
+    return 0;
+}
+
+static struct connection*
+connection_manager_backend_next_event(struct connection_manager* manager)
+{
+    // We're not currently iterating, and need to call poll(). The table is dense,
+    // so the first connections_num entries are exactly the set we want.
+    if (manager->current_event_index == -1)
+    {
+        int npolls = poll(manager->connections, manager->connections_num,
+                          CONNECTION_MANAGER_DEFAULT_TIMEOUT);
+        if (npolls == -1)
+        {
+            MINIWEB_LOG_ERROR("Call to poll() failed: %d (%s)", errno,
+                              strerror(errno));
+            errno = 0;
+            return NULL;
+        }
+        if (npolls == 0)
+        {
+            // We timed out
+            return NULL;
+        }
+
+        // Let's start returning events!
+        manager->current_event_index = 0;
+        manager->now_ms              = timer_wheel_now_ms();
+    }
+
+    for (size_t i = (size_t) manager->current_event_index;
+         i < manager->connections_num; ++i)
+    {
+        if (manager->connections[i].revents & (POLLIN | POLLOUT | POLLHUP | POLLERR))
+        {
+            struct connection* connection = manager->connection_data[i];
+
+            // poll() skips negative fds, which is how we disarm a client
+            if (!(connection->flags & CONNECTION_FLAG_LISTENER))
+            { manager->connections[i].fd = -1; }
+
+            manager->current_event_index = i + 1;
+            return connection;
+        }
+    }
+
+    // If we get here then we are out of polling events and should set our index to
+    // -1
+    manager->current_event_index = -1;
+    return NULL;
+}
+
+static void connection_manager_backend_clean(struct connection_manager* manager)
+{
+    (void) manager;
+}
+
+#endif // MINIWEB_USE_EPOLL
@@ -1,24 +1,72 @@
 #ifndef INCLUDED_CONNECTION_MANAGER_H
 #define INCLUDED_CONNECTION_MANAGER_H
 
+#include "completion_queue.h"
+#include "slab.h"
+
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 
 typedef struct connection_manager connection_manager_t;
 
+struct connection;
+
+// What a re-armed connection should wake us up for
+enum connection_interest
+{
+    CONNECTION_INTEREST_READ,
+    CONNECTION_INTEREST_WRITE,
+};
+
 connection_manager_t* connection_manager_create(size_t initial_capacity);
 int                   connection_manager_init(connection_manager_t* restrict conns,
                                               size_t                         initial_capacity);
+// Connections with no activity for this long are closed by
+// connection_manager_close_idle_connections
+void connection_manager_set_idle_timeout(connection_manager_t* manager,
+                                         uint64_t              timeout_ms);
+
+// Slab that struct connection's read buffers come from, so that they can be freed
+// along with the connection
+void connection_manager_set_read_buffer_slab(connection_manager_t* manager,
+                                             slab_t*               slab);
+
 void connection_manager_add_listener_socket(connection_manager_t* restrict conns,
                                             int                            sockfd);
 
+// Watches the queue's eventfd along with the sockets. get_next_event hands it out,
+// like a listener, whenever something's been posted. The queue still owns the fd.
+int connection_manager_add_completion_queue(connection_manager_t* restrict conns,
+                                            completion_queue_t const* completions);
+
+// Client sockets are one-shot: once one has been handed out here it is disarmed,
+// and we won't report anything more on it, or time it out, until it's re-armed
 bool connection_manager_get_next_event(connection_manager_t* manager,
                                        int*                  sockfd_out);
+int  connection_manager_rearm_connection(connection_manager_t*    manager,
+                                         int                      sockfd,
+                                         enum connection_interest interest);
 
 int connection_manager_add_new_connection(connection_manager_t* manager, int sockfd);
+// Keeps state for a socket that something else watches, like the io_uring engine.
+// It's never armed or timed out, and the manager never closes it.
+int connection_manager_add_borrowed_connection(connection_manager_t* manager,
+                                               int                   sockfd);
 
 void connection_manager_remove_connection(connection_manager_t* manager, int sockfd);
 
+// O(1) lookup of the state we hold for a socket, or NULL if we aren't tracking it.
+// The pointer is good until the connection is removed.
+struct connection* connection_manager_get_connection(connection_manager_t* manager,
+                                                     int                   sockfd);
+size_t connection_manager_get_size(connection_manager_t const* manager);
+
+// Closes and removes every connection that has been idle for longer than the idle
+// timeout. Meant to be called once per trip round the event loop. Connections with
+// jobs in flight are left alone until another timeout has gone by.
+size_t connection_manager_close_idle_connections(connection_manager_t* manager);
+
 void connection_manager_clean(connection_manager_t* restrict conns);
 void connection_manager_destroy(connection_manager_t* restrict conns);
 
@@ -0,0 +1,419 @@
+// Needed for the CPU_* macros and the *_np affinity functions
+#define _GNU_SOURCE
+
+#include "cpu_affinity.h"
+
+#include "logging.h"
+
+#include <assert.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef MINIWEB_TESTING
+extern void* _test_malloc(const size_t size, char const* file, int const line);
+extern void*
+             _test_calloc(size_t nmemb, size_t size, char const* file, int const line);
+extern void  _test_free(void* ptr, char const* file, int const line);
+extern void* _test_realloc(void* ptr, size_t size, char const* file, int const line);
+
+    #define malloc(size)       _test_malloc(size, __FILE__, __LINE__)
+    #define calloc(n, size)    _test_calloc(n, size, __FILE__, __LINE__)
+    #define free(ptr)          _test_free(ptr, __FILE__, __LINE__)
+    #define realloc(ptr, size) _test_realloc(ptr, size, __FILE__, __LINE__)
+#endif
+
+// ==== CONSTANTS ====
+
+enum
+{
+    // Matches the kernel's default CONFIG_NR_CPUS on most distributions
+    CPU_AFFINITY_MAX_CPUS = CPU_SETSIZE,
+    CPU_AFFINITY_MAX_LIST_LENGTH = 4096,
+};
+
+static char const* const NODE_DIRECTORY = "/sys/devices/system/node";
+
+// ==== TYPES ====
+
+struct cpu_topology
+{
+    // Every usable CPU, grouped by node and in order within each node
+    int*    cpus;
+    size_t  num_cpus;
+    // Node i's CPUs are cpus[node_starts[i]] up to cpus[node_starts[i + 1]]
+    size_t* node_starts;
+    size_t  num_nodes;
+};
+
+struct cpu_affinity_saved
+{
+    cpu_set_t mask;
+};
+
+// ==== STATIC PROTOTYPES ====
+
+static cpu_topology_t* cpu_topology_alloc(size_t num_nodes);
+static int  cpu_topology_add_node(struct cpu_topology* topology,
+                                  char const*          list,
+                                  cpu_set_t const*     allowed);
+static bool cpu_topology_read_node_list(char const* path, char buffer[], size_t len);
+
+// ==== PUBLIC FUNCTIONS IMPLEMENTATION ====
+
+cpu_topology_t* cpu_topology_create(void)
+{
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+    {
+        MINIWEB_LOG_ERROR("Failed to get our CPU affinity: %d (%s)", errno,
+                          strerror(errno));
+        errno = 0;
+        return NULL;
+    }
+
+    // Node numbers can have gaps, so look at what's actually there
+    size_t num_node_dirs = 0;
+    DIR*   dir           = opendir(NODE_DIRECTORY);
+    if (dir)
+    {
+        struct dirent* entry = NULL;
+        while ((entry = readdir(dir)))
+        {
+            if (strncmp(entry->d_name, "node", 4) == 0
+                && isdigit((unsigned char) entry->d_name[4]))
+            { ++num_node_dirs; }
+        }
+        rewinddir(dir);
+    }
+
+    struct cpu_topology* topology = cpu_topology_alloc(num_node_dirs + 1);
+    if (!topology)
+    {
+        if (dir) { closedir(dir); }
+        return NULL;
+    }
+
+    if (dir)
+    {
+        // readdir() doesn't promise any order, but nodes are numbered from 0
+        for (size_t node = 0, found = 0; found < num_node_dirs; ++node)
+        {
+            char path[64] = {0};
+            snprintf(path, sizeof(path), "%s/node%zu/cpulist", NODE_DIRECTORY, node);
+
+            char list[CPU_AFFINITY_MAX_LIST_LENGTH] = {0};
+            if (!cpu_topology_read_node_list(path, list, sizeof(list)))
+            {
+                if (node >= CPU_AFFINITY_MAX_CPUS) { break; }
+                continue;
+            }
+            ++found;
+
+            if (cpu_topology_add_node(topology, list, &allowed) != 0)
+            {
+                closedir(dir);
+                cpu_topology_destroy(topology);
+                return NULL;
+            }
+        }
+        closedir(dir);
+    }
+
+    // No NUMA information, so everything we can run on is one node
+    if (topology->num_cpus == 0)
+    {
+        topology->num_nodes = 0;
+        for (int cpu = 0; cpu < CPU_AFFINITY_MAX_CPUS; ++cpu)
+        {
+            if (!CPU_ISSET(cpu, &allowed)) { continue; }
+            topology->cpus[topology->num_cpus++] = cpu;
+        }
+        topology->node_starts[0] = 0;
+        topology->node_starts[1] = topology->num_cpus;
+        topology->num_nodes      = 1;
+    }
+
+    return topology;
+}
+
+cpu_topology_t*
+cpu_topology_create_from_lists(size_t      num_nodes,
+                               char const* node_cpu_lists[num_nodes])
+{
+    assert(num_nodes > 0);
+
+    struct cpu_topology* topology = cpu_topology_alloc(num_nodes);
+    if (!topology) { return NULL; }
+
+    for (size_t i = 0; i < num_nodes; ++i)
+    {
+        if (cpu_topology_add_node(topology, node_cpu_lists[i], NULL) != 0)
+        {
+            cpu_topology_destroy(topology);
+            return NULL;
+        }
+    }
+
+    return topology;
+}
+
+void cpu_topology_destroy(struct cpu_topology* restrict topology)
+{
+    assert(topology);
+
+    free(topology->node_starts);
+    free(topology->cpus);
+    free(topology);
+}
+
+size_t cpu_topology_get_num_nodes(struct cpu_topology const* topology)
+{
+    assert(topology);
+    return topology->num_nodes;
+}
+
+int cpu_topology_get_node(struct cpu_topology const* topology, int cpu)
+{
+    assert(topology);
+
+    for (size_t node = 0; node < topology->num_nodes; ++node)
+    {
+        for (size_t i = topology->node_starts[node];
+             i < topology->node_starts[node + 1]; ++i)
+        {
+            if (topology->cpus[i] == cpu) { return (int) node; }
+        }
+    }
+
+    return -1;
+}
+
+int cpu_topology_pick_cpu(struct cpu_topology const* topology,
+                          cpu_affinity_t const*      affinity,
+                          size_t                     thread_index)
+{
+    assert(topology);
+    assert(affinity);
+
+    switch (affinity->policy)
+    {
+        case CPU_AFFINITY_NONE:
+        {
+            return -1;
+        }
+        case CPU_AFFINITY_LIST:
+        {
+            if (affinity->num_cpus == 0) { return -1; }
+            return affinity->cpus[thread_index % affinity->num_cpus];
+        }
+        case CPU_AFFINITY_COMPACT:
+        {
+            if (topology->num_cpus == 0) { return -1; }
+            return topology->cpus[thread_index % topology->num_cpus];
+        }
+        case CPU_AFFINITY_SCATTER:
+        {
+            if (topology->num_cpus == 0) { return -1; }
+
+            // Nodes can be memory-only, so skip any without CPUs. There's at least
+            // one with some, so this always gets somewhere.
+            size_t node = thread_index % topology->num_nodes;
+            size_t nth  = thread_index / topology->num_nodes;
+            while (topology->node_starts[node] == topology->node_starts[node + 1])
+            { node = (node + 1) % topology->num_nodes; }
+
+            size_t start = topology->node_starts[node];
+            size_t size  = topology->node_starts[node + 1] - start;
+            return topology->cpus[start + (nth % size)];
+        }
+    }
+
+    return -1;
+}
+
+int cpu_affinity_parse_list(char const* list, size_t max_cpus, int cpus_out[])
+{
+    assert(list);
+
+    int         count = 0;
+    char const* curr  = list;
+    while (*curr && *curr != '\n')
+    {
+        char* end   = NULL;
+        long  first = strtol(curr, &end, 10);
+        if (end == curr || first < 0) { return -1; }
+
+        long last = first;
+        curr      = end;
+        if (*curr == '-')
+        {
+            ++curr;
+            last = strtol(curr, &end, 10);
+            if (end == curr || last < first) { return -1; }
+            curr = end;
+        }
+
+        for (long cpu = first; cpu <= last; ++cpu)
+        {
+            if ((size_t) count < max_cpus) { cpus_out[count] = (int) cpu; }
+            ++count;
+        }
+
+        if (*curr == ',') { ++curr; }
+        else if (*curr && *curr != '\n') { return -1; }
+    }
+
+    return count;
+}
+
+int cpu_affinity_set_attr(pthread_attr_t* attr, int cpu)
+{
+    assert(attr);
+    if (cpu == -1) { return 0; }
+
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    CPU_SET(cpu, &mask);
+
+    int rc = pthread_attr_setaffinity_np(attr, sizeof(mask), &mask);
+    if (rc != 0)
+    {
+        MINIWEB_LOG_ERROR("Failed to set affinity to CPU %d: %d (%s)", cpu, rc,
+                          strerror(rc));
+        return -1;
+    }
+
+    return 0;
+}
+
+int cpu_affinity_pin_current_thread(int cpu)
+{
+    if (cpu == -1) { return 0; }
+
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    CPU_SET(cpu, &mask);
+
+    int rc = pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask);
+    if (rc != 0)
+    {
+        MINIWEB_LOG_ERROR("Failed to pin thread to CPU %d: %d (%s)", cpu, rc,
+                          strerror(rc));
+        return -1;
+    }
+
+    return 0;
+}
+
+struct cpu_affinity_saved* cpu_affinity_move_current_thread(int cpu)
+{
+    if (cpu == -1) { return NULL; }
+
+    struct cpu_affinity_saved* saved = calloc(1, sizeof(struct cpu_affinity_saved));
+    if (!saved)
+    {
+        MINIWEB_LOG_ERROR("Failed to allocate space to save our CPU affinity");
+        return NULL;
+    }
+
+    int rc =
+        pthread_getaffinity_np(pthread_self(), sizeof(saved->mask), &saved->mask);
+    if (rc != 0 || cpu_affinity_pin_current_thread(cpu) != 0)
+    {
+        free(saved);
+        return NULL;
+    }
+
+    return saved;
+}
+
+void cpu_affinity_restore_current_thread(struct cpu_affinity_saved* saved)
+{
+    if (!saved) { return; }
+
+    int rc =
+        pthread_setaffinity_np(pthread_self(), sizeof(saved->mask), &saved->mask);
+    if (rc != 0)
+    {
+        MINIWEB_LOG_ERROR("Failed to restore our CPU affinity: %d (%s)", rc,
+                          strerror(rc));
+    }
+
+    free(saved);
+}
+
+// ==== STATIC FUNCTIONS IMPLEMENTATION ====
+
+static struct cpu_topology* cpu_topology_alloc(size_t num_nodes)
+{
+    struct cpu_topology* topology = calloc(1, sizeof(struct cpu_topology));
+    if (!topology)
+    {
+        MINIWEB_LOG_ERROR("Failed to allocate CPU topology control structure");
+        return NULL;
+    }
+
+    topology->cpus = calloc(CPU_AFFINITY_MAX_CPUS, sizeof(int));
+    if (!topology->cpus)
+    {
+        MINIWEB_LOG_ERROR("Failed to allocate space for %d CPUs",
+                          CPU_AFFINITY_MAX_CPUS);
+        free(topology);
+        return NULL;
+    }
+
+    topology->node_starts = calloc(num_nodes + 1, sizeof(size_t));
+    if (!topology->node_starts)
+    {
+        MINIWEB_LOG_ERROR("Failed to allocate space for %zu nodes", num_nodes);
+        free(topology->cpus);
+        free(topology);
+        return NULL;
+    }
+
+    return topology;
+}
+
+// Appends a node's CPUs, skipping any that aren't in allowed (if there is one)
+static int cpu_topology_add_node(struct cpu_topology* topology,
+                                 char const*          list,
+                                 cpu_set_t const*     allowed)
+{
+    int node_cpus[CPU_AFFINITY_MAX_CPUS];
+    int count = cpu_affinity_parse_list(list, CPU_AFFINITY_MAX_CPUS, node_cpus);
+    if (count < 0 || count > CPU_AFFINITY_MAX_CPUS)
+    {
+        MINIWEB_LOG_ERROR("Couldn't make sense of CPU list '%s'", list);
+        return -1;
+    }
+
+    for (int i = 0; i < count; ++i)
+    {
+        int cpu = node_cpus[i];
+        if (cpu >= CPU_AFFINITY_MAX_CPUS) { continue; }
+        if (allowed && !CPU_ISSET(cpu, allowed)) { continue; }
+        if (topology->num_cpus == CPU_AFFINITY_MAX_CPUS) { break; }
+
+        topology->cpus[topology->num_cpus++] = cpu;
+    }
+
+    ++topology->num_nodes;
+    topology->node_starts[topology->num_nodes] = topology->num_cpus;
+    return 0;
+}
+
+static bool cpu_topology_read_node_list(char const* path, char buffer[], size_t len)
+{
+    FILE* file = fopen(path, "r");
+    if (!file) { return false; }
+
+    bool ok = fgets(buffer, (int) len, file) != NULL;
+    fclose(file);
+    return ok;
+}
@@ -0,0 +1,66 @@
+#ifndef INCLUDED_CPU_AFFINITY_H
+#define INCLUDED_CPU_AFFINITY_H
+
+#include <stdlib.h>
+
+#include <pthread.h>
+
+// Decides which CPU each of a set of numbered threads should stay on, based on the
+// NUMA nodes in /sys/devices/system/node. Machines (or containers) without that
+// are treated as a single node.
+
+enum cpu_affinity_policy
+{
+    // Leave it to the scheduler
+    CPU_AFFINITY_NONE,
+    // Thread i runs on cpus[i % num_cpus]
+    CPU_AFFINITY_LIST,
+    // Fill up the first node before moving on to the next
+    CPU_AFFINITY_COMPACT,
+    // Go round the nodes, one thread on each at a time
+    CPU_AFFINITY_SCATTER,
+};
+
+typedef struct cpu_affinity
+{
+    enum cpu_affinity_policy policy;
+    // Only used by CPU_AFFINITY_LIST
+    int const* cpus;
+    size_t     num_cpus;
+} cpu_affinity_t;
+
+typedef struct cpu_topology cpu_topology_t;
+
+// Only includes the CPUs we're allowed to run on
+cpu_topology_t* cpu_topology_create(void);
+// Each node's CPUs in the kernel's cpulist format, e.g. "0-3,8-11"
+cpu_topology_t*
+cpu_topology_create_from_lists(size_t      num_nodes,
+                               char const* node_cpu_lists[num_nodes]);
+void            cpu_topology_destroy(cpu_topology_t* restrict topology);
+
+size_t cpu_topology_get_num_nodes(cpu_topology_t const* topology);
+// Returns -1 if the CPU isn't one we know about
+int    cpu_topology_get_node(cpu_topology_t const* topology, int cpu);
+
+// Returns the CPU for the thread_index'th thread, or -1 if it shouldn't be pinned
+int cpu_topology_pick_cpu(cpu_topology_t const* topology,
+                          cpu_affinity_t const* affinity,
+                          size_t                thread_index);
+
+// Parses a cpulist into cpus_out, returning how many there were or -1 if it's
+// malformed. Anything past max_cpus is counted but not stored.
+int cpu_affinity_parse_list(char const* list, size_t max_cpus, int cpus_out[]);
+
+// Both do nothing when cpu is -1
+int cpu_affinity_set_attr(pthread_attr_t* attr, int cpu);
+int cpu_affinity_pin_current_thread(int cpu);
+
+// Moves the calling thread onto cpu for a while, so that memory it allocates and
+// first touches in the meantime lands on that CPU's node. Returns what to restore
+// it with afterwards, or NULL if it didn't move.
+typedef struct cpu_affinity_saved cpu_affinity_saved_t;
+cpu_affinity_saved_t* cpu_affinity_move_current_thread(int cpu);
+void cpu_affinity_restore_current_thread(cpu_affinity_saved_t* saved);
+
+#endif // INCLUDED_CPU_AFFINITY_H
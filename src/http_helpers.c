@@ -4,14 +4,17 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
 
+#include <poll.h>
 #include <sys/fcntl.h>
 #include <sys/sendfile.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
 // ==== CONSTANTS ====
 
@@ -21,20 +24,51 @@ static char const OK_HEADER_TEMPLATE[] =
     "HTTP/1.1 200 OK\r\nDate: %s\r\nContent-Type: text/html\r\nConnection: "
     "keep-alive\r\nKeep-Alive: timeout=300\r\nContent-Length: %zu\r\n\r\n";
 
+// Sent whole from the header buffer, so Content-Length has to be kept in step with
+// the body by hand
+#define OVERLOADED_BODY                                                           \
+    "<html><body><p>503 - Too busy, please try again shortly</p></body></html>\n"
+#define OVERLOADED_BODY_LENGTH      74
+#define OVERLOADED_STRINGIFY(x)     #x
+#define OVERLOADED_LENGTH_STRING(x) OVERLOADED_STRINGIFY(x)
+
+static char const OVERLOADED_RESPONSE[] =
+    "HTTP/1.1 503 Service Unavailable\r\nContent-Type: text/html\r\nConnection: "
+    "keep-alive\r\nKeep-Alive: timeout=300\r\nRetry-After: 1\r\nContent-Length: "
+    OVERLOADED_LENGTH_STRING(OVERLOADED_BODY_LENGTH) "\r\n\r\n" OVERLOADED_BODY;
+
 static char const DATE_FORMAT[] = "%a, %d %b %Y %T GMT";
 
+static char const REQUEST_TERMINATOR[] = "\r\n\r\n";
+
+// Blocking sends on non-blocking sockets give up if a client stops reading for this
+// long
+static const int SEND_WAIT_TIMEOUT_MS = 10 * 1000;
+
 enum
 {
     DATE_BUF_SIZE      = 40,
     OK_HEADER_BUF_SIZE = sizeof(OK_HEADER_TEMPLATE) + DATE_BUF_SIZE + 10
 };
 
+_Static_assert((size_t) OK_HEADER_BUF_SIZE <= (size_t) HTTP_HELPERS_MAX_HEADER_SIZE,
+               "http_file_response_t header buffer is too small");
+_Static_assert(sizeof(OVERLOADED_BODY) - 1 == OVERLOADED_BODY_LENGTH,
+               "OVERLOADED_BODY_LENGTH doesn't match OVERLOADED_BODY");
+_Static_assert(sizeof(OVERLOADED_RESPONSE) <= HTTP_HELPERS_MAX_HEADER_SIZE,
+               "The 503 response doesn't fit in a http_file_response_t");
+
 // ==== STATIC PROTOTYPES ====
 
 static const char* get_now_string(size_t bufsize, char buffer[bufsize]);
 static off_t       get_html_filesize(int file_fd);
-static int send_header(int sockfd, size_t data_size, char const data[data_size]);
-static int send_html_file(int sockfd, int file_fd, off_t filesize);
+static int send_header(int        sockfd,
+                       size_t     data_size,
+                       char const data[data_size],
+                       bool       more_to_come,
+                       size_t*    sent);
+static int send_html_file(int sockfd, int file_fd, off_t filesize, off_t* offset);
+static int wait_until_writable(int sockfd);
 
 // ==== PUBLIC FUNCTIONS IMPLEMENTATION ====
 
@@ -42,28 +76,62 @@ int http_helpers_send_response(int sockfd, miniweb_response_t const* const respo
 {
     assert(response);
 
+    http_file_response_t prepared = {0};
+
+    int rc = http_helpers_prepare_response(response, &prepared);
+    if (rc != 0) { return rc; }
+
+    rc = http_helpers_send_prepared_response(sockfd, &prepared);
+    close(prepared.file_fd);
+
+    return rc;
+}
+
+int http_helpers_send_html_file_response(int sockfd, char const filename[static 1])
+{
+    assert(filename);
+
+    http_file_response_t prepared = {0};
+
+    int rc = http_helpers_prepare_html_file_response(filename, &prepared);
+    if (rc != 0) { return rc; }
+
+    rc = http_helpers_send_prepared_response(sockfd, &prepared);
+    close(prepared.file_fd);
+
+    return rc;
+}
+
+int http_helpers_prepare_response(miniweb_response_t const* const response,
+                                  http_file_response_t* restrict  prepared)
+{
+    assert(response);
+    assert(prepared);
+
     switch (response->resp_type)
     {
         case MINIWEB_RESPONSE_FILE_TYPE:
-            return http_helpers_send_html_file_response(
-                sockfd, response->body.file_response.file_name);
+            return http_helpers_prepare_html_file_response(
+                response->body.file_response.file_name, prepared);
         case MINIWEB_RESPONSE_TEXT_TYPE:
             MINIWEB_LOG_ERROR("Text response not yet supported!");
-            return http_helpers_send_html_file_response(sockfd,
-                                                        ERROR_404_RESPONSE_FILE);
+            return http_helpers_prepare_html_file_response(ERROR_404_RESPONSE_FILE,
+                                                           prepared);
         default:
             MINIWEB_LOG_ERROR("Invalid response attempted! (type: %d)",
                               response->resp_type);
-            return http_helpers_send_html_file_response(sockfd,
-                                                        ERROR_404_RESPONSE_FILE);
+            return http_helpers_prepare_html_file_response(ERROR_404_RESPONSE_FILE,
+                                                           prepared);
     }
 }
 
-int http_helpers_send_html_file_response(int sockfd, char const filename[static 1])
+int http_helpers_prepare_html_file_response(char const filename[static 1],
+                                            http_file_response_t* restrict prepared)
 {
     assert(filename);
+    assert(prepared);
 
-    int file_fd = open(filename, O_RDONLY);
+    int file_fd = open(filename, O_RDONLY | O_CLOEXEC);
     if (file_fd == -1)
     {
         MINIWEB_LOG_ERROR("Failed to open() file at '%s': %d (%s)", filename, errno,
@@ -72,32 +140,103 @@ int http_helpers_send_html_file_response(int sockfd, char const filename[static
         return -1;
     }
 
-    char time_buf[DATE_BUF_SIZE]    = {0};
-    char buffer[OK_HEADER_BUF_SIZE] = {0};
-    int  msg_size = snprintf(buffer, OK_HEADER_BUF_SIZE, OK_HEADER_TEMPLATE,
-                            get_now_string(DATE_BUF_SIZE, time_buf),
-                            get_html_filesize(file_fd));
+    off_t filesize = get_html_filesize(file_fd);
+
+    char time_buf[DATE_BUF_SIZE] = {0};
+    int  msg_size = snprintf(prepared->header, sizeof(prepared->header),
+                            OK_HEADER_TEMPLATE, get_now_string(DATE_BUF_SIZE, time_buf),
+                            (size_t) filesize);
     if (msg_size < 0)
     {
         MINIWEB_LOG_ERROR("Failed to format header! rc: %d", msg_size);
+        close(file_fd);
         return -2;
     }
-    MINIWEB_LOG_INFO("Formatted header: %s", buffer);
+    MINIWEB_LOG_INFO("Formatted header: %s", prepared->header);
 
-    int rc = send_header(sockfd, msg_size, buffer);
-    if (rc != 0)
+    prepared->file_fd    = file_fd;
+    prepared->file_size  = filesize;
+    prepared->header_len = msg_size;
+
+    return 0;
+}
+
+void
+http_helpers_prepare_overloaded_response(http_file_response_t* restrict prepared)
+{
+    assert(prepared);
+
+    memcpy(prepared->header, OVERLOADED_RESPONSE, sizeof(OVERLOADED_RESPONSE) - 1);
+    prepared->header_len = sizeof(OVERLOADED_RESPONSE) - 1;
+    prepared->file_fd    = -1;
+    prepared->file_size  = 0;
+}
+
+int http_helpers_send_prepared_response(int                               sockfd,
+                                        http_file_response_t const* const prepared)
+{
+    assert(prepared);
+
+    http_send_progress_t progress = {0};
+    for (;;)
+    {
+        int rc =
+            http_helpers_try_send_prepared_response(sockfd, prepared, &progress);
+        if (rc <= 0) { return rc; }
+
+        if (wait_until_writable(sockfd) != 0) { return -5; }
+    }
+}
+
+int http_helpers_try_send_prepared_response(int                         sockfd,
+                                            http_file_response_t const* prepared,
+                                            http_send_progress_t*       progress)
+{
+    assert(prepared);
+    assert(progress);
+
+    // Otherwise Nagle holds the body back until the client ACKs the header, which
+    // it may well delay for 40ms
+    bool has_body = prepared->file_size > 0;
+    int  rc       = send_header(sockfd, prepared->header_len, prepared->header,
+                                has_body, &progress->header_sent);
+    if (rc < 0)
     {
         MINIWEB_LOG_ERROR("Failed to send header: %d", rc);
         return -3;
     }
+    if (rc > 0) { return rc; }
 
-    rc = send_html_file(sockfd, file_fd, get_html_filesize(file_fd));
-    if (rc != 0)
+    rc = send_html_file(sockfd, prepared->file_fd, prepared->file_size,
+                        &progress->file_sent);
+    if (rc < 0)
     {
         MINIWEB_LOG_ERROR("Failed to send file: %d", rc);
         return -4;
     }
 
+    return rc;
+}
+
+size_t http_helpers_find_request_end(size_t     len,
+                                     char const buffer[len],
+                                     size_t     search_from)
+{
+    assert(buffer);
+
+    size_t const terminator_len = sizeof(REQUEST_TERMINATOR) - 1;
+    if (len < terminator_len) { return 0; }
+
+    // The terminator could have been split across the old and new data
+    size_t start = 0;
+    if (search_from >= terminator_len)
+    { start = search_from - (terminator_len - 1); }
+    for (size_t i = start; i + terminator_len <= len; ++i)
+    {
+        if (memcmp(buffer + i, REQUEST_TERMINATOR, terminator_len) == 0)
+        { return i + terminator_len; }
+    }
+
     return 0;
 }
 
@@ -164,33 +303,50 @@ static off_t get_html_filesize(int file_fd)
     return stat_out.st_size;
 }
 
-static int send_header(int sockfd, size_t data_size, char const data[data_size])
+// These both pick up from wherever the last call got to, and return 1 if the socket
+// is full rather than waiting for it
+static int send_header(int        sockfd,
+                       size_t     data_size,
+                       char const data[data_size],
+                       bool       more_to_come,
+                       size_t*    sent)
 {
     assert(data);
-    char const* data_ptr = data;
-    while (data_size > 0)
+    int flags = MSG_NOSIGNAL | (more_to_come ? MSG_MORE : 0);
+    while (*sent < data_size)
     {
-        int bytes_sent = send(sockfd, data_ptr, data_size, 0);
+        ssize_t bytes_sent = send(sockfd, data + *sent, data_size - *sent, flags);
+        if (bytes_sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            errno = 0;
+            return 1;
+        }
+        if (bytes_sent == -1 && errno == EINTR) { continue; }
         if (bytes_sent <= 0)
         {
             MINIWEB_LOG_ERROR("Failed to send header to socket %d: %d (%s)", sockfd,
                               errno, strerror(errno));
+            errno = 0;
             return -1;
         }
 
-        data_size -= bytes_sent;
-        data_ptr += bytes_sent;
+        *sent += bytes_sent;
     }
 
     return 0;
 }
 
-static int send_html_file(int sockfd, int file_fd, off_t filesize)
+static int send_html_file(int sockfd, int file_fd, off_t filesize, off_t* offset)
 {
-    off_t offset = 0;
-    while (filesize > 0)
+    while (*offset < filesize)
     {
-        ssize_t bytes_sent = sendfile(sockfd, file_fd, &offset, filesize);
+        ssize_t bytes_sent = sendfile(sockfd, file_fd, offset, filesize - *offset);
+        if (bytes_sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            errno = 0;
+            return 1;
+        }
+        if (bytes_sent == -1 && errno == EINTR) { continue; }
         if (bytes_sent <= 0)
         {
             MINIWEB_LOG_ERROR("Failed to send file at %d to socket %d: %d (%s)",
@@ -198,8 +354,32 @@ static int send_html_file(int sockfd, int file_fd, off_t filesize)
             errno = 0;
             return -1;
         }
+    }
+
+    return 0;
+}
+
+static int wait_until_writable(int sockfd)
+{
+    struct pollfd pfd = {.fd = sockfd, .events = POLLOUT};
 
-        filesize -= bytes_sent;
+    int rc = 0;
+    do
+    {
+        rc = poll(&pfd, 1, SEND_WAIT_TIMEOUT_MS);
+    } while (rc == -1 && errno == EINTR);
+
+    if (rc == 0)
+    {
+        MINIWEB_LOG_ERROR("Timed out waiting to send to socket %d", sockfd);
+        return -1;
+    }
+    if (rc == -1)
+    {
+        MINIWEB_LOG_ERROR("Failed to poll() socket %d: %d (%s)", sockfd, errno,
+                          strerror(errno));
+        errno = 0;
+        return -1;
     }
 
     return 0;
@@ -5,9 +5,62 @@
 
 #include <stdlib.h>
 
+#include <sys/types.h>
+
+enum
+{
+    HTTP_HELPERS_MAX_HEADER_SIZE = 256,
+};
+
+// A response that's ready to go out on the wire: the formatted header, followed by
+// the whole of file_fd. Whoever sends it is responsible for closing file_fd, which
+// is -1 when the header holds the whole response.
+typedef struct http_file_response
+{
+    int    file_fd;
+    off_t  file_size;
+    size_t header_len;
+    char   header[HTTP_HELPERS_MAX_HEADER_SIZE];
+} http_file_response_t;
+
+// How much of a prepared response has gone out so far, when sending it a bit at a
+// time
+typedef struct http_send_progress
+{
+    size_t header_sent;
+    off_t  file_sent;
+} http_send_progress_t;
+
 int http_helpers_send_response(int sockfd, miniweb_response_t const* const response);
 int http_helpers_send_html_file_response(int sockfd, char const filename[static 1]);
 
+int http_helpers_prepare_response(miniweb_response_t const* const response,
+                                  http_file_response_t* restrict  prepared);
+int http_helpers_prepare_html_file_response(char const filename[static 1],
+                                            http_file_response_t* restrict prepared);
+int http_helpers_send_prepared_response(int                               sockfd,
+                                        http_file_response_t const* const prepared);
+
+// A 503 for when the server's too busy to take the request. It's rendered at compile
+// time, so turning requests away costs next to nothing.
+void
+http_helpers_prepare_overloaded_response(http_file_response_t* restrict prepared);
+
+// Sends as much as a non-blocking socket will take without waiting, carrying on from
+// progress. Returns 0 once the whole response is out, 1 if the socket filled up
+// first, or negative on error.
+int http_helpers_try_send_prepared_response(int                         sockfd,
+                                            http_file_response_t const* prepared,
+                                            http_send_progress_t*       progress);
+
+// Looks for the blank line that ends a request's headers. Returns the length of the
+// request up to and including it, or 0 if it hasn't all arrived yet. The first
+// search_from bytes have already been searched, which saves going over them again
+// each time more of the request turns up.
+size_t http_helpers_find_request_end(size_t     len,
+                                     char const buffer[len],
+                                     size_t     search_from);
+
 char const* http_helpers_get_route(char const request[static 1],
                                    size_t     buflen,
                                    char       buffer[buflen]);
@@ -4,26 +4,78 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <string.h>
+#include <time.h>
 
 #include <pthread.h>
 
-struct itc_queue
+#ifdef MINIWEB_TESTING
+extern void* _test_malloc(const size_t size, char const* file, int const line);
+extern void*
+             _test_calloc(size_t nmemb, size_t size, char const* file, int const line);
+extern void  _test_free(void* ptr, char const* file, int const line);
+extern void* _test_realloc(void* ptr, size_t size, char const* file, int const line);
+
+    #define malloc(size)       _test_malloc(size, __FILE__, __LINE__)
+    #define calloc(n, size)    _test_calloc(n, size, __FILE__, __LINE__)
+    #define free(ptr)          _test_free(ptr, __FILE__, __LINE__)
+    #define realloc(ptr, size) _test_realloc(ptr, size, __FILE__, __LINE__)
+#endif
+
+// ==== TYPES ====
+
+enum
 {
-    unsigned char* storage;
-    size_t         read;
-    size_t         write;
+    ITC_QUEUE_CACHE_LINE_SIZE = 64,
+};
 
-    size_t capacity;
-    size_t num_elements;
-    size_t msglen;
+// A bounded multi-producer multi-consumer ring, after Dmitry Vyukov's. Every slot
+// carries a sequence number saying whose turn it is: the slot for position pos is
+// free for the producer claiming pos when seq == pos, and holds a message for the
+// consumer claiming pos when seq == pos + 1. Producers and consumers each claim
+// positions with a CAS on their own counter, so neither ever takes a lock.
+struct itc_queue_slot
+{
+    atomic_size_t seq;
+    unsigned char msg[];
+};
 
-    pthread_mutex_t rw_lock;
+struct itc_queue
+{
+    // Slots are slot_size apart, which keeps each seq aligned
+    unsigned char* storage;
+    size_t         slot_size;
+    size_t         mask;
+    size_t         msglen;
+
+    // Producers and consumers hammer these, so keep them a cache line away from
+    // each other and from everything else
+    unsigned char write_padding[ITC_QUEUE_CACHE_LINE_SIZE];
+    atomic_size_t write;
+    unsigned char read_padding[ITC_QUEUE_CACHE_LINE_SIZE];
+    atomic_size_t read;
+    unsigned char sleep_padding[ITC_QUEUE_CACHE_LINE_SIZE];
+
+    // Only used by threads that have run out of things to do
+    pthread_mutex_t sleep_lock;
+    pthread_cond_t  not_empty;
+    pthread_cond_t  not_full;
+    // So that the fast paths only take sleep_lock when somebody is actually asleep
+    atomic_size_t num_waiting_receivers;
+    atomic_size_t num_waiting_posters;
+
+    // How long to spin before going to sleep. It grows while spinning keeps paying
+    // off and shrinks when it doesn't, so an idle queue soon stops burning CPU.
+    atomic_uint spin_limit;
 };
 
 enum
 {
-    ITC_QUEUE_DEFAULT_SLEEP_NS = 10 * 1000 * 1000,
+    ITC_QUEUE_MIN_SPINS = 16,
+    ITC_QUEUE_MAX_SPINS = 4096,
 };
 
 enum
@@ -32,15 +84,46 @@ enum
     ITC_QUEUE_EQUEUEEMPTY = -2,
 };
 
+// ==== STATIC PROTOTYPES ====
+
+static inline struct itc_queue_slot* itc_queue_get_slot(struct itc_queue* queue,
+                                                        size_t            pos);
+static size_t itc_queue_claim(struct itc_queue* queue,
+                              atomic_size_t*    counter,
+                              size_t            ready_offset,
+                              size_t            max_slots,
+                              size_t*           pos_out);
+static void   itc_queue_wake(struct itc_queue* restrict queue,
+                             atomic_size_t*             num_waiting,
+                             pthread_cond_t*            cond,
+                             bool                       wake_all);
+static bool   itc_queue_wait(struct itc_queue* restrict queue,
+                             bool                       for_space,
+                             struct timespec const*     deadline);
+static bool itc_queue_looks_ready(struct itc_queue* queue, bool for_space);
+static bool itc_queue_spin(struct itc_queue* restrict queue, bool for_space);
+static inline void itc_queue_cpu_relax(void);
+
 // ==== PUBLIC FUNCTIONS IMPLEMENTATION
 
 struct itc_queue* itc_queue_init(size_t max_size, size_t msglen)
 {
-    unsigned char* storage = calloc(max_size, msglen);
+    assert(max_size > 0);
+
+    // Positions are mapped to slots with a mask, so round up to a power of two. With
+    // a single slot, full and free would look the same.
+    size_t capacity = 2;
+    while (capacity < max_size) capacity <<= 1;
+
+    size_t const slot_align = _Alignof(struct itc_queue_slot);
+    size_t       slot_size  = sizeof(struct itc_queue_slot) + msglen;
+    slot_size               = (slot_size + slot_align - 1) & ~(slot_align - 1);
+
+    unsigned char* storage = calloc(capacity, slot_size);
     if (!storage)
     {
         MINIWEB_LOG_ERROR("Could not allocate space for %zu elements of %zu bytes",
-                          max_size, msglen);
+                          capacity, msglen);
         return NULL;
     }
 
@@ -52,19 +135,53 @@ struct itc_queue* itc_queue_init(size_t max_size, size_t msglen)
         return NULL;
     }
 
-    queue->storage      = storage;
-    queue->read         = 0;
-    queue->write        = 0;
-    queue->capacity     = max_size;
-    queue->num_elements = 0;
-    queue->msglen       = msglen;
+    queue->storage   = storage;
+    queue->slot_size = slot_size;
+    queue->mask      = capacity - 1;
+    queue->msglen    = msglen;
+    atomic_init(&queue->write, 0);
+    atomic_init(&queue->read, 0);
+    atomic_init(&queue->num_waiting_receivers, 0);
+    atomic_init(&queue->num_waiting_posters, 0);
+    atomic_init(&queue->spin_limit, ITC_QUEUE_MIN_SPINS);
+
+    // Every slot starts out free for the producer that claims its position
+    for (size_t i = 0; i < capacity; ++i)
+    { atomic_init(&itc_queue_get_slot(queue, i)->seq, i); }
+
+    int rc = pthread_mutex_init(&queue->sleep_lock, NULL);
+    if (rc != 0)
+    {
+        MINIWEB_LOG_ERROR("Failed to init sleep_lock: %d (%s)", rc, strerror(rc));
+        free(queue);
+        free(storage);
+        return NULL;
+    }
+
+    // Timed waits measure against CLOCK_MONOTONIC, so changing the time of day
+    // doesn't stretch or cut them short
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+
+    rc = pthread_cond_init(&queue->not_empty, &cond_attr);
+    if (rc != 0)
+    {
+        MINIWEB_LOG_ERROR("Failed to init not_empty: %d (%s)", rc, strerror(rc));
+        pthread_condattr_destroy(&cond_attr);
+        pthread_mutex_destroy(&queue->sleep_lock);
+        free(queue);
+        free(storage);
+        return NULL;
+    }
 
-    int rc = pthread_mutex_init(&queue->rw_lock, NULL);
+    rc = pthread_cond_init(&queue->not_full, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
     if (rc != 0)
     {
-        MINIWEB_LOG_ERROR("Failed to init read_lock: %d (%s)", errno,
-                          strerror(errno));
-        errno = 0;
+        MINIWEB_LOG_ERROR("Failed to init not_full: %d (%s)", rc, strerror(rc));
+        pthread_cond_destroy(&queue->not_empty);
+        pthread_mutex_destroy(&queue->sleep_lock);
         free(queue);
         free(storage);
         return NULL;
@@ -76,111 +193,315 @@ struct itc_queue* itc_queue_init(size_t max_size, size_t msglen)
 int post_message_noblock(struct itc_queue* restrict queue,
                          size_t                     msglen,
                          unsigned char const        msg[msglen])
+{
+    size_t posted = post_messages_noblock(
+        queue, msglen, 1, (unsigned char const(*)[msglen]) msg);
+    return posted == 1 ? 0 : ITC_QUEUE_EQUEUEFULL;
+}
+
+int post_message(struct itc_queue* restrict queue,
+                 size_t                     msglen,
+                 unsigned char const        msg[msglen])
+{
+    return post_messages(queue, msglen, 1, (unsigned char const(*)[msglen]) msg);
+}
+
+int receive_message_noblock(struct itc_queue* restrict queue,
+                            size_t                     buflen,
+                            unsigned char              buf[buflen])
+{
+    size_t received =
+        receive_messages_noblock(queue, buflen, 1, (unsigned char(*)[buflen]) buf);
+    return received == 1 ? 0 : ITC_QUEUE_EQUEUEEMPTY;
+}
+
+int receive_message(struct itc_queue* restrict queue,
+                    size_t                     buflen,
+                    unsigned char              buf[buflen])
+{
+    receive_messages(queue, buflen, 1, (unsigned char(*)[buflen]) buf);
+    return 0;
+}
+
+size_t post_messages_noblock(struct itc_queue* restrict queue,
+                             size_t                     msglen,
+                             size_t                     num_msgs,
+                             unsigned char const        msgs[num_msgs][msglen])
 {
     assert(queue);
     assert(msglen <= queue->msglen);
 
-    pthread_mutex_lock(&queue->rw_lock);
-    if (queue->num_elements == queue->capacity)
+    size_t pos    = 0;
+    size_t posted = itc_queue_claim(queue, &queue->write, 0, num_msgs, &pos);
+    if (posted == 0) { return 0; }
+
+    for (size_t i = 0; i < posted; ++i)
     {
-        pthread_mutex_unlock(&queue->rw_lock);
-        return ITC_QUEUE_EQUEUEFULL;
+        struct itc_queue_slot* slot = itc_queue_get_slot(queue, pos + i);
+        memcpy(slot->msg, msgs[i], msglen);
+        atomic_store_explicit(&slot->seq, pos + i + 1, memory_order_release);
     }
 
-    // Advance the write ptr.
-    queue->write = (queue->write + 1) % queue->capacity;
-    // All good to write!
-    memcpy(queue->storage + (queue->write * queue->msglen), msg, msglen);
-    queue->num_elements++;
-
-    pthread_mutex_unlock(&queue->rw_lock);
-    return 0;
+    itc_queue_wake(queue, &queue->num_waiting_receivers, &queue->not_empty,
+                   posted > 1);
+    return posted;
 }
 
-int post_message(struct itc_queue* restrict queue,
-                 size_t                     msglen,
-                 unsigned char const        msg[msglen])
+int post_messages(struct itc_queue* restrict queue,
+                  size_t                     msglen,
+                  size_t                     num_msgs,
+                  unsigned char const        msgs[num_msgs][msglen])
 {
     assert(queue);
     assert(msglen <= queue->msglen);
 
+    size_t posted = 0;
     for (;;)
     {
-        int rc = post_message_noblock(queue, msglen, msg);
-        if (rc == ITC_QUEUE_EQUEUEFULL)
-        {
-            struct timespec sleep = {.tv_nsec = ITC_QUEUE_DEFAULT_SLEEP_NS};
-            nanosleep(&sleep, NULL);
-        }
-        else
-        {
-            return 0;
-        }
-    }
+        posted += post_messages_noblock(queue, msglen, num_msgs - posted,
+                                        &msgs[posted]);
+        if (posted == num_msgs) { return 0; }
 
+        itc_queue_wait(queue, true, NULL);
+    }
 }
 
-int receive_message_noblock(struct itc_queue* restrict queue,
-                            size_t                     buflen,
-                            unsigned char              buf[buflen])
+size_t receive_messages_noblock(struct itc_queue* restrict queue,
+                                size_t                     buflen,
+                                size_t                     max_msgs,
+                                unsigned char              bufs[max_msgs][buflen])
 {
     assert(queue);
     assert(buflen >= queue->msglen);
 
+    size_t pos      = 0;
+    size_t received = itc_queue_claim(queue, &queue->read, 1, max_msgs, &pos);
+    if (received == 0) { return 0; }
 
-    pthread_mutex_lock(&queue->rw_lock);
-
-    if (queue->num_elements == 0)
+    for (size_t i = 0; i < received; ++i)
     {
-        // In this case the queue is empty
-        pthread_mutex_unlock(&queue->rw_lock);
-        return ITC_QUEUE_EQUEUEEMPTY;
+        struct itc_queue_slot* slot = itc_queue_get_slot(queue, pos + i);
+        memcpy(bufs[i], slot->msg, queue->msglen);
+        // Free for the producer that comes round to this slot on the next lap
+        atomic_store_explicit(&slot->seq, pos + i + queue->mask + 1,
+                              memory_order_release);
     }
 
-    // Otherwise, copy this data into our buffer, clear it, and return
-    queue->read = (queue->read + 1) % queue->capacity;
-    memcpy(buf, queue->storage + (queue->read * queue->msglen), queue->msglen);
-    memset(queue->storage + (queue->read * queue->msglen), 0, queue->msglen);
-    queue->num_elements--;
+    itc_queue_wake(queue, &queue->num_waiting_posters, &queue->not_full,
+                   received > 1);
+    return received;
+}
 
-    pthread_mutex_unlock(&queue->rw_lock);
+size_t receive_messages(struct itc_queue* restrict queue,
+                        size_t                     buflen,
+                        size_t                     max_msgs,
+                        unsigned char              bufs[max_msgs][buflen])
+{
+    assert(queue);
+    assert(buflen >= queue->msglen);
+    assert(max_msgs > 0);
 
-    return 0;
+    for (;;)
+    {
+        size_t received = receive_messages_noblock(queue, buflen, max_msgs, bufs);
+        if (received > 0) { return received; }
+
+        itc_queue_wait(queue, false, NULL);
+    }
 }
 
-int receive_message(struct itc_queue* restrict queue,
-                    size_t                     buflen,
-                    unsigned char              buf[buflen])
+size_t receive_messages_timed(struct itc_queue* restrict queue,
+                              size_t                     buflen,
+                              size_t                     max_msgs,
+                              unsigned char              bufs[max_msgs][buflen],
+                              uint64_t                   timeout_ms)
 {
     assert(queue);
     assert(buflen >= queue->msglen);
+    assert(max_msgs > 0);
+
+    struct timespec deadline = {0};
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += (time_t) (timeout_ms / 1000);
+    deadline.tv_nsec += (long) ((timeout_ms % 1000) * 1000000);
+    if (deadline.tv_nsec >= 1000000000)
+    {
+        deadline.tv_sec += 1;
+        deadline.tv_nsec -= 1000000000;
+    }
 
     for (;;)
     {
-        int rc = receive_message_noblock(queue, buflen, buf);
-        if (rc == ITC_QUEUE_EQUEUEEMPTY)
+        size_t received = receive_messages_noblock(queue, buflen, max_msgs, bufs);
+        if (received > 0) { return received; }
+
+        if (!itc_queue_wait(queue, false, &deadline))
+        { return receive_messages_noblock(queue, buflen, max_msgs, bufs); }
+    }
+}
+
+void itc_queue_destroy(struct itc_queue* restrict queue)
+{
+    // Nobody can be using it by now, so there's nothing to wait for
+    pthread_cond_destroy(&queue->not_full);
+    pthread_cond_destroy(&queue->not_empty);
+    pthread_mutex_destroy(&queue->sleep_lock);
+
+    free(queue->storage);
+    free(queue);
+}
+
+// ==== STATIC FUNCTIONS IMPLEMENTATION ====
+
+static inline struct itc_queue_slot* itc_queue_get_slot(struct itc_queue* queue,
+                                                        size_t            pos)
+{
+    return (struct itc_queue_slot*) (queue->storage
+                                     + ((pos & queue->mask) * queue->slot_size));
+}
+
+// Claims up to max_slots positions in a row from counter with a single CAS. A slot
+// is ready for us when its seq is pos + ready_offset: 0 when posting, 1 when
+// receiving. Returns how many we got, which is 0 if the first wasn't ready.
+static size_t itc_queue_claim(struct itc_queue* queue,
+                              atomic_size_t*    counter,
+                              size_t            ready_offset,
+                              size_t            max_slots,
+                              size_t*           pos_out)
+{
+    if (max_slots == 0) { return 0; }
+
+    size_t pos = atomic_load_explicit(counter, memory_order_relaxed);
+    for (;;)
+    {
+        // Signed, so this still works once the counters wrap
+        size_t    seq  = atomic_load_explicit(&itc_queue_get_slot(queue, pos)->seq,
+                                              memory_order_acquire);
+        ptrdiff_t diff = (ptrdiff_t) (seq - (pos + ready_offset));
+        if (diff < 0)
         {
-            struct timespec sleep = {.tv_nsec = ITC_QUEUE_DEFAULT_SLEEP_NS};
-            nanosleep(&sleep, NULL);
+            // Full (or empty), the slot's still a lap behind us
+            return 0;
         }
-        else
+        if (diff > 0)
         {
-            return 0;
+            // Somebody else got here first
+            pos = atomic_load_explicit(counter, memory_order_relaxed);
+            continue;
+        }
+
+        // The rest don't have to be ready in order, so stop at the first that isn't.
+        // Until the counter moves past them nobody else can touch them.
+        size_t num_ready = 1;
+        while (num_ready < max_slots)
+        {
+            size_t next     = pos + num_ready;
+            size_t next_seq = atomic_load_explicit(
+                &itc_queue_get_slot(queue, next)->seq, memory_order_acquire);
+            if (next_seq != next + ready_offset) { break; }
+            ++num_ready;
+        }
+
+        // On failure pos is reloaded for us
+        if (atomic_compare_exchange_weak_explicit(counter, &pos, pos + num_ready,
+                                                  memory_order_relaxed,
+                                                  memory_order_relaxed))
+        {
+            *pos_out = pos;
+            return num_ready;
         }
     }
 }
 
-void itc_queue_destroy(struct itc_queue* restrict queue)
+static void itc_queue_wake(struct itc_queue* restrict queue,
+                           atomic_size_t*             num_waiting,
+                           pthread_cond_t*            cond,
+                           bool                       wake_all)
 {
-    // Acquire both the mutexes so we know it's safe to proceed
-    pthread_mutex_lock(&queue->rw_lock);
+    // Pairs with the sleeper's increment. Either we see it here, or its last check
+    // sees what we've just done.
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(num_waiting, memory_order_relaxed) == 0) { return; }
+
+    // Taking the lock means the sleeper is either yet to check, or already waiting
+    pthread_mutex_lock(&queue->sleep_lock);
+    if (wake_all) { pthread_cond_broadcast(cond); }
+    else { pthread_cond_signal(cond); }
+    pthread_mutex_unlock(&queue->sleep_lock);
+}
 
-    free(queue->storage);
-    queue->storage = NULL;
+// Spins for a bit, then sleeps until there might be room (or a message). The caller
+// has to go and check. Returns false if it got to deadline (on CLOCK_MONOTONIC)
+// first, a NULL deadline means waiting as long as it takes.
+static bool itc_queue_wait(struct itc_queue* restrict queue,
+                           bool                       for_space,
+                           struct timespec const*     deadline)
+{
+    if (itc_queue_spin(queue, for_space)) { return true; }
+
+    atomic_size_t*  num_waiting = for_space ? &queue->num_waiting_posters
+                                            : &queue->num_waiting_receivers;
+    pthread_cond_t* cond        = for_space ? &queue->not_full : &queue->not_empty;
+
+    // Announce ourselves before the last check, so that anyone who makes room after
+    // it is sure to see us and wake us up. The check only looks - posting or
+    // receiving here would mean waking the other side with sleep_lock held.
+    int rc = 0;
+    pthread_mutex_lock(&queue->sleep_lock);
+    atomic_fetch_add(num_waiting, 1);
+    if (!itc_queue_looks_ready(queue, for_space))
+    {
+        if (deadline)
+        { rc = pthread_cond_timedwait(cond, &queue->sleep_lock, deadline); }
+        else { pthread_cond_wait(cond, &queue->sleep_lock); }
+    }
+    atomic_fetch_sub(num_waiting, 1);
+    pthread_mutex_unlock(&queue->sleep_lock);
 
-    pthread_mutex_unlock(&queue->rw_lock);
+    return rc != ETIMEDOUT;
+}
 
-    pthread_mutex_destroy(&queue->rw_lock);
+// Whether the next slot to post into is free (or the next to receive from is
+// filled). Someone may well beat us to it.
+static bool itc_queue_looks_ready(struct itc_queue* queue, bool for_space)
+{
+    atomic_size_t* counter = for_space ? &queue->write : &queue->read;
+    size_t         pos     = atomic_load_explicit(counter, memory_order_seq_cst);
+    size_t seq = atomic_load_explicit(&itc_queue_get_slot(queue, pos)->seq,
+                                      memory_order_seq_cst);
+    return seq == (for_space ? pos : pos + 1);
+}
 
-    free(queue);
+// Waits a little while for the queue to have room (or a message) in the hope we
+// won't need to sleep. Returns whether it looked like it did, which is only a hint.
+static bool itc_queue_spin(struct itc_queue* restrict queue, bool for_space)
+{
+    unsigned limit = atomic_load_explicit(&queue->spin_limit, memory_order_relaxed);
+    for (unsigned i = 0; i < limit; ++i)
+    {
+        if (itc_queue_looks_ready(queue, for_space))
+        {
+            if (limit < ITC_QUEUE_MAX_SPINS)
+            {
+                atomic_store_explicit(&queue->spin_limit, limit * 2,
+                                      memory_order_relaxed);
+            }
+            return true;
+        }
+
+        itc_queue_cpu_relax();
+    }
+
+    if (limit > ITC_QUEUE_MIN_SPINS)
+    { atomic_store_explicit(&queue->spin_limit, limit / 2, memory_order_relaxed); }
+    return false;
+}
+
+static inline void itc_queue_cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
 }
@@ -1,12 +1,16 @@
 #ifndef INCLUDED_ITC_QUEUE_H
 #define INCLUDED_ITC_QUEUE_H
 
+#include <stdint.h>
 #include <stdlib.h>
 
 typedef struct itc_queue itc_queue_t;
 
+// Holds at least max_size messages, rounded up to a power of two
 itc_queue_t* itc_queue_init(size_t max_size, size_t msglen);
 
+// The blocking versions spin briefly and then sleep until there's room or a message,
+// so a waiting thread wakes up as soon as the other side gets to it
 int          post_message(itc_queue_t* restrict queue,
                           size_t                msglen,
                           unsigned char const   msg[msglen]);
@@ -20,6 +24,32 @@ int          receive_message_noblock(itc_queue_t* restrict queue,
                                      size_t                buflen,
                                      unsigned char         buf[buflen]);
 
+// Batched versions, which claim as many slots as they can at once. The noblock ones
+// return how many messages they managed, which may be none. post_messages doesn't
+// return until all of them are in, receive_messages waits for at least one.
+size_t post_messages_noblock(itc_queue_t* restrict queue,
+                             size_t                msglen,
+                             size_t                num_msgs,
+                             unsigned char const   msgs[num_msgs][msglen]);
+int    post_messages(itc_queue_t* restrict queue,
+                     size_t                msglen,
+                     size_t                num_msgs,
+                     unsigned char const   msgs[num_msgs][msglen]);
+size_t receive_messages_noblock(itc_queue_t* restrict queue,
+                                size_t                buflen,
+                                size_t                max_msgs,
+                                unsigned char         bufs[max_msgs][buflen]);
+size_t receive_messages(itc_queue_t* restrict queue,
+                        size_t                buflen,
+                        size_t                max_msgs,
+                        unsigned char         bufs[max_msgs][buflen]);
+// Like receive_messages, but gives up after timeout_ms and returns 0
+size_t receive_messages_timed(itc_queue_t* restrict queue,
+                              size_t                buflen,
+                              size_t                max_msgs,
+                              unsigned char         bufs[max_msgs][buflen],
+                              uint64_t              timeout_ms);
+
 void itc_queue_destroy(itc_queue_t* restrict queue);
 
 #endif // INCLUDED_ITC_QUEUE_H
@@ -1,9 +1,15 @@
 #ifndef INCLUDED_MACRO_HELPERS_H
 #define INCLUDED_MACRO_HELPERS_H
 
+#include <stddef.h>
+
 #define STRGY(X)     #X
 #define STRINGIFY(X) STRGY(X)
 
+// Get back to the struct that an embedded member lives in
+#define CONTAINER_OF(PTR, TYPE, MEMBER) \
+    ((TYPE*) ((unsigned char*) (PTR) - offsetof(TYPE, MEMBER)))
+
 #define GET_NUM_ARGS(...)                                                          \
     SELECT_LAST(__VA_ARGS__, 32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20,   \
                 19, 18, 17, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, \
@@ -6,6 +6,11 @@
 #include <signal.h>
 #include <stdlib.h>
 
+enum
+{
+    NUM_REACTORS = 4,
+};
+
 miniweb_server_t* g_server = NULL;
 
 void sig_handler(int signum)
@@ -47,7 +52,8 @@ int main(void)
         return EXIT_FAILURE;
     }
 
-    rc = router_add_route(router, "/hello", hello_route_handler, NULL);
+    // It's cheap, so the reactor may as well answer it without the thread pool
+    rc = router_add_inline_route(router, "/hello", hello_route_handler, NULL);
     if (rc != 0)
     {
         MINIWEB_LOG_ERROR("Failed to add route for '/hello', rc: %d", rc);
@@ -55,11 +61,15 @@ int main(void)
         return EXIT_FAILURE;
     }
 
-    g_server = miniweb_server_create("127.0.0.1", "6969", router);
+    miniweb_server_options_t options = miniweb_server_default_options();
+    options.num_reactors             = NUM_REACTORS;
+
+    g_server = miniweb_server_create_with_options("127.0.0.1", "6969", router,
+                                                  &options);
     if (!g_server)
     {
+        // The server owns the router now, so it's already been destroyed
         MINIWEB_LOG_ERROR("Failed to create a server!");
-        router_destroy(router);
         return EXIT_FAILURE;
     }
 
@@ -70,6 +80,12 @@ int main(void)
     sigaction(SIGINT, &signal_action, NULL);
     sigaction(SIGTERM, &signal_action, NULL);
 
+    // A client hanging up mid-response should fail the send, not kill the server
+    struct sigaction ignore_action = {0};
+    sigemptyset(&ignore_action.sa_mask);
+    ignore_action.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &ignore_action, NULL);
+
     MINIWEB_LOG_INFO("I AM MINIWEB, STARTING SERVER!");
     rc = miniweb_server_start(g_server);
 
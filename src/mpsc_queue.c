@@ -0,0 +1,47 @@
+#include "mpsc_queue.h"
+
+#include <assert.h>
+#include <stddef.h>
+
+// ==== PUBLIC FUNCTIONS IMPLEMENTATION ====
+
+void mpsc_queue_init(mpsc_queue_t* queue)
+{
+    assert(queue);
+    atomic_init(&queue->head, NULL);
+}
+
+bool mpsc_queue_push(mpsc_queue_t* queue, mpsc_node_t* node)
+{
+    assert(queue);
+    assert(node);
+
+    mpsc_node_t* head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    do
+    {
+        node->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(
+        &queue->head, &head, node, memory_order_release, memory_order_relaxed));
+
+    return head == NULL;
+}
+
+mpsc_node_t* mpsc_queue_take_all(mpsc_queue_t* queue)
+{
+    assert(queue);
+
+    mpsc_node_t* head =
+        atomic_exchange_explicit(&queue->head, NULL, memory_order_acquire);
+
+    // Pushes go on the front, so turn it round to get them in the order they came
+    mpsc_node_t* oldest_first = NULL;
+    while (head)
+    {
+        mpsc_node_t* next = head->next;
+        head->next        = oldest_first;
+        oldest_first      = head;
+        head              = next;
+    }
+
+    return oldest_first;
+}
@@ -0,0 +1,32 @@
+#ifndef INCLUDED_MPSC_QUEUE_H
+#define INCLUDED_MPSC_QUEUE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+// A lock-free, intrusive, multi-producer single-consumer queue. Any thread can push,
+// but only one thread may take. The consumer takes everything at once, which suits
+// an event loop that drains it every time it's woken up.
+
+typedef struct mpsc_node
+{
+    struct mpsc_node* next;
+} mpsc_node_t;
+
+typedef struct mpsc_queue
+{
+    // Newest first, the consumer reverses it
+    _Atomic(mpsc_node_t*) head;
+} mpsc_queue_t;
+
+void mpsc_queue_init(mpsc_queue_t* queue);
+
+// Returns true if the queue was empty, which is the only time the consumer needs
+// waking up. Anything pushed onto a non-empty queue is picked up along with
+// whatever was already there.
+bool mpsc_queue_push(mpsc_queue_t* queue, mpsc_node_t* node);
+
+// Takes everything pushed so far as a list linked through next, oldest first
+mpsc_node_t* mpsc_queue_take_all(mpsc_queue_t* queue);
+
+#endif // INCLUDED_MPSC_QUEUE_H
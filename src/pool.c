@@ -3,10 +3,15 @@
 #include "logging.h"
 
 #include <assert.h>
+#include <errno.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <string.h>
 
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
 #ifdef MINIWEB_TESTING
 extern void* _test_malloc(const size_t size, char const* file, int const line);
 extern void*
@@ -21,50 +26,143 @@ extern void* _test_realloc(void* ptr, size_t size, char const* file, int const l
 #endif
 
 const size_t DEFAULT_NUM_BLOCKS = 64;
+// Marks the end of the free list
+static const size_t POOL_NO_BLOCK = SIZE_MAX;
+
+enum
+{
+    // Threads past this many share the depot directly, under its lock
+    POOL_MAX_THREAD_CACHES = 128,
+    POOL_MAGAZINE_SIZE     = 32,
+    // How many blocks move between a thread's cache and the depot at a time
+    POOL_MAGAZINE_BATCH = POOL_MAGAZINE_SIZE / 2,
+};
+
+// A thread's slot is returned when it exits, so the next thread can take it along
+// with whatever its caches are holding
+static size_t const POOL_NO_THREAD_SLOT = SIZE_MAX;
+
+// What MAP_HUGETLB gives us by default on x86-64 and arm64
+static size_t const POOL_HUGE_PAGE_SIZE = 2 * 1024 * 1024;
 
 // ==== DATA TYPES ====
 
 struct meta_block;
 
-// TODO Potential performance improvement - give each control block an optional
-// "next free" which could be set when we're changing the value of the
-// next_free_block This would help with situations where we free the first block in
-// the pool and cause the next allocation to have to scrub through the entire pool
 struct control_block
 {
     unsigned char* block;
     // Pointer back to my parent meta_block
     struct meta_block* parent;
-    bool               is_free;
+    // The free blocks are linked through here by index, since growing the pool
+    // moves the control array
+    size_t next_free;
+    bool   is_free;
 };
 
 struct meta_block
 {
-    size_t             blocks_used;
-    size_t             num_blocks;
+    size_t blocks_used;
+    size_t num_blocks;
+    // Its memory has gone back to the OS, until one of its blocks is used again
+    bool released;
+    // 0 if it came from calloc, otherwise the size of its own mapping
+    size_t mapped_size;
+    // What it's backed by, only whole ones of these can be released
+    size_t             page_size;
     struct meta_block* next;
     unsigned char      blocks[];
 };
 
+// One thread's free blocks for a concurrent pool, only ever touched by that thread
+struct pool_cache
+{
+    size_t        count;
+    pool_handle_t handles[POOL_MAGAZINE_SIZE];
+};
+
 struct pool
 {
-    size_t block_size;
-    size_t next_free_block;
+    size_t            block_size;
+    enum pool_backing backing;
+    // The most recently freed block, so alloc and free are both O(1) and we hand
+    // out whichever block is most likely still in the cache
+    size_t free_head;
     size_t total_num_blocks;
     // Head of the linked list of meta-blocks
     struct meta_block* blocks;
     // Map of ptrs to blocks and whether or not they're free
     struct control_block* control;
+
+    // A concurrent pool keeps everything above as the depot, behind depot_lock.
+    // Each thread allocates from and frees to its own cache, indexed by its thread
+    // slot, and only takes the lock to move a batch between that and the depot.
+    bool                concurrent;
+    pthread_mutex_t     depot_lock;
+    struct pool_cache** caches;
 };
 
+// ==== THREAD SLOTS ====
+
+static pthread_once_t  g_thread_slot_once = PTHREAD_ONCE_INIT;
+static pthread_key_t   g_thread_slot_key;
+static pthread_mutex_t g_thread_slot_lock = PTHREAD_MUTEX_INITIALIZER;
+static size_t          g_free_thread_slots[POOL_MAX_THREAD_CACHES];
+static size_t          g_num_free_thread_slots = 0;
+static size_t          g_next_thread_slot      = 0;
+
+// Offset by one, so 0 means we haven't got one yet
+static _Thread_local size_t tls_thread_slot = 0;
+
 // ==== STATIC FUNCTION PROTOTYPES
 
-static int pool_add_meta_block(struct pool* pool);
+static struct meta_block* pool_create_meta_block(struct pool* pool,
+                                                 size_t       num_blocks,
+                                                 bool         prefault);
+static void               pool_destroy_meta_block(struct meta_block* meta);
+static int                pool_add_meta_block(struct pool* pool);
+
+static size_t pool_release_meta_block(struct pool* pool, struct meta_block* meta);
+static void   pool_rebuild_free_list(struct pool* pool);
+
+static struct pool_handle pool_alloc_block(struct pool* pool);
+static void               pool_free_block(struct pool*       pool,
+                                          struct pool_handle handle);
+static struct pool_handle pool_alloc_concurrent(struct pool* pool);
+static void               pool_free_concurrent(struct pool*       pool,
+                                               struct pool_handle handle);
+
+static struct pool_cache* pool_get_thread_cache(struct pool* pool);
+static size_t             pool_get_thread_slot(void);
+static void               pool_create_thread_slot_key(void);
+static void               pool_release_thread_slot(void* slot);
 
 // ==== PUBLIC FUNCTIONS IMPLEMENTATION ====
 
+pool_options_t pool_default_options(void)
+{
+    return (pool_options_t) {.concurrent = false, .backing = POOL_BACKING_HEAP};
+}
+
 struct pool* pool_init(size_t block_size, size_t init_num_blocks)
 {
+    pool_options_t options = pool_default_options();
+    return pool_init_with_options(block_size, init_num_blocks, &options);
+}
+
+struct pool* pool_init_concurrent(size_t block_size, size_t init_num_blocks)
+{
+    pool_options_t options = pool_default_options();
+    options.concurrent     = true;
+    return pool_init_with_options(block_size, init_num_blocks, &options);
+}
+
+struct pool* pool_init_with_options(size_t                block_size,
+                                    size_t                init_num_blocks,
+                                    pool_options_t const* options)
+{
+    assert(options);
+
     struct pool* pool = calloc(1, sizeof(struct pool));
     if (!pool)
     {
@@ -73,7 +171,8 @@ struct pool* pool_init(size_t block_size, size_t init_num_blocks)
         return NULL;
     }
 
-    int rc = pool_create(pool, block_size, init_num_blocks);
+    pool->backing = options->backing;
+    int rc        = pool_create(pool, block_size, init_num_blocks);
     if (rc != 0)
     {
         MINIWEB_LOG_ERROR("Failed to initialise pool control structure: %d", rc);
@@ -81,6 +180,28 @@ struct pool* pool_init(size_t block_size, size_t init_num_blocks)
         return NULL;
     }
 
+    if (!options->concurrent) { return pool; }
+
+    // The caches themselves only get allocated once a thread uses the pool
+    struct pool_cache** caches = calloc(POOL_MAX_THREAD_CACHES, sizeof(*caches));
+    if (!caches)
+    {
+        MINIWEB_LOG_ERROR("Failed to allocate pool thread caches");
+        pool_destroy(pool);
+        return NULL;
+    }
+
+    rc = pthread_mutex_init(&pool->depot_lock, NULL);
+    if (rc != 0)
+    {
+        MINIWEB_LOG_ERROR("Failed to initialise pool depot lock: %d", rc);
+        free(caches);
+        pool_destroy(pool);
+        return NULL;
+    }
+    pool->caches     = caches;
+    pool->concurrent = true;
+
     return pool;
 }
 
@@ -90,16 +211,13 @@ int pool_create(struct pool* restrict pool,
 {
     assert(pool);
 
-    // Create our first meta block
-    struct meta_block* meta =
-        calloc(1, sizeof(struct meta_block) + (init_num_blocks * block_size));
-    if (!meta)
-    {
-        MINIWEB_LOG_ERROR("Failed to initialise meta_block of size: %zu",
-                          sizeof(struct meta_block) +
-                              (init_num_blocks * block_size));
-        return -1;
-    }
+    // Create our first meta block. Unless it's on the heap it's faulted in now,
+    // so the first requests don't pay for it.
+    pool->block_size        = block_size;
+    struct meta_block* meta = pool_create_meta_block(pool, init_num_blocks, true);
+    if (!meta) { return -1; }
+    // A mapping's rounded up to whole pages, so there may be room for more
+    init_num_blocks = meta->num_blocks;
 
     // Create the initial control block
     struct control_block* control =
@@ -108,24 +226,20 @@ int pool_create(struct pool* restrict pool,
     {
         MINIWEB_LOG_ERROR("Failed to initialise control block for %zu elements",
                           init_num_blocks);
-        free(meta);
+        pool_destroy_meta_block(meta);
         return -2;
     }
 
-    // Initialise our members
-    meta->blocks_used = 0;
-    meta->num_blocks  = init_num_blocks;
-    meta->next        = NULL;
-
+    // Linked in order, so the blocks get handed out from the front
     for (size_t i = 0; i < init_num_blocks; ++i)
     {
-        control[i].block   = meta->blocks + (block_size * i);
-        control[i].is_free = true;
-        control[i].parent  = meta;
+        control[i].block     = meta->blocks + (block_size * i);
+        control[i].is_free   = true;
+        control[i].parent    = meta;
+        control[i].next_free = i + 1 < init_num_blocks ? i + 1 : POOL_NO_BLOCK;
     }
 
-    pool->block_size       = block_size;
-    pool->next_free_block  = 0;
+    pool->free_head        = 0;
     pool->total_num_blocks = init_num_blocks;
     pool->blocks           = meta;
     pool->control          = control;
@@ -135,27 +249,8 @@ int pool_create(struct pool* restrict pool,
 
 struct pool_handle pool_alloc(pool_t* pool)
 {
-    // Let's look in the block at next_free_block to see if it's really free
-    size_t control_index = pool->next_free_block;
-    for (; control_index <= pool->total_num_blocks; ++control_index)
-    {
-        if (control_index == pool->total_num_blocks)
-        {
-            int rc = pool_add_meta_block(pool);
-            if (rc != 0)
-            { return (struct pool_handle) {.id = SIZE_MAX, .data = NULL}; }
-        }
-        if (pool->control[control_index].is_free) { break; }
-    }
-
-    // The next free block will either be the one after this, or a new meta block
-    pool->next_free_block = control_index + 1;
-
-    struct control_block* control = &pool->control[control_index];
-
-    control->is_free = false;
-    ++control->parent->blocks_used;
-    return (struct pool_handle) {.id = control_index, .data = control->block};
+    if (pool->concurrent) { return pool_alloc_concurrent(pool); }
+    return pool_alloc_block(pool);
 }
 
 struct pool_handle pool_calloc(struct pool* pool)
@@ -170,13 +265,52 @@ struct pool_handle pool_calloc(struct pool* pool)
 
 void pool_free(pool_t* pool, struct pool_handle handle)
 {
-    assert(handle.id < pool->total_num_blocks);
+    if (pool->concurrent) { pool_free_concurrent(pool, handle); }
+    else
+    {
+        pool_free_block(pool, handle);
+    }
+}
 
-    struct control_block* control = &pool->control[handle.id];
-    control->is_free              = true;
-    control->parent->blocks_used -= 1;
+size_t pool_trim(pool_t* pool, size_t keep_free)
+{
+    assert(pool);
+
+    if (pool->concurrent) { pthread_mutex_lock(&pool->depot_lock); }
+
+    // Blocks sitting in the threads' caches count as used here
+    size_t backed_free = 0;
+    for (struct meta_block* meta = pool->blocks; meta; meta = meta->next)
+    {
+        if (!meta->released) { backed_free += meta->num_blocks - meta->blocks_used; }
+    }
+
+    // Biggest first, they're the ones a spike added
+    size_t released           = 0;
+    size_t num_metas_released = 0;
+    for (;;)
+    {
+        struct meta_block* biggest = NULL;
+        for (struct meta_block* meta = pool->blocks; meta; meta = meta->next)
+        {
+            if (meta->released || meta->blocks_used > 0) { continue; }
+            if (backed_free - meta->num_blocks < keep_free) { continue; }
+            if (!biggest || meta->num_blocks > biggest->num_blocks)
+            { biggest = meta; }
+        }
+        if (!biggest) { break; }
+
+        backed_free -= biggest->num_blocks;
+        released += pool_release_meta_block(pool, biggest);
+        ++num_metas_released;
+    }
+
+    // Otherwise the free list would hand the released blocks straight back out
+    if (num_metas_released > 0) { pool_rebuild_free_list(pool); }
+
+    if (pool->concurrent) { pthread_mutex_unlock(&pool->depot_lock); }
 
-    if (pool->next_free_block > handle.id) { pool->next_free_block = handle.id; }
+    return released;
 }
 
 void pool_clear(struct pool* restrict pool)
@@ -189,10 +323,19 @@ void pool_clear(struct pool* restrict pool)
     {
         struct meta_block* old = curr;
         curr                   = old->next;
-        free(old);
+        pool_destroy_meta_block(old);
     }
 
     free(pool->control);
+
+    if (pool->concurrent)
+    {
+        // Whatever's left in them belongs to the meta blocks we just freed
+        for (size_t i = 0; i < POOL_MAX_THREAD_CACHES; ++i)
+        { free(pool->caches[i]); }
+        free(pool->caches);
+        pthread_mutex_destroy(&pool->depot_lock);
+    }
 }
 
 void pool_destroy(struct pool* restrict pool)
@@ -204,21 +347,135 @@ void pool_destroy(struct pool* restrict pool)
 
 // ==== STATIC FUNCTIONS IMPLEMENTATION
 
-static int pool_add_meta_block(struct pool* pool)
+static struct pool_handle pool_alloc_block(struct pool* pool)
 {
-    // Let's make the new meta block twice as big
-    struct meta_block* last_meta = pool->control[pool->total_num_blocks - 1].parent;
-    size_t             new_meta_size = last_meta->num_blocks * 2;
+    if (pool->free_head == POOL_NO_BLOCK)
+    {
+        int rc = pool_add_meta_block(pool);
+        if (rc != 0) { return (struct pool_handle) {.id = SIZE_MAX, .data = NULL}; }
+    }
 
-    struct meta_block* new_meta =
-        calloc(1, sizeof(struct meta_block) + (new_meta_size * pool->block_size));
-    if (!new_meta)
+    size_t                control_index = pool->free_head;
+    struct control_block* control       = &pool->control[control_index];
+    assert(control->is_free);
+
+    pool->free_head          = control->next_free;
+    control->is_free         = false;
+    control->parent->released = false;
+    ++control->parent->blocks_used;
+    return (struct pool_handle) {.id = control_index, .data = control->block};
+}
+
+static void pool_free_block(struct pool* pool, struct pool_handle handle)
+{
+    assert(handle.id < pool->total_num_blocks);
+    assert(!pool->control[handle.id].is_free);
+
+    struct control_block* control = &pool->control[handle.id];
+    control->is_free              = true;
+    control->parent->blocks_used -= 1;
+
+    control->next_free = pool->free_head;
+    pool->free_head    = handle.id;
+}
+
+// Gets a meta block with room for at least num_blocks, from wherever the pool's
+// backing says. Pre-faulting only makes a difference to the mapped ones.
+static struct meta_block*
+pool_create_meta_block(struct pool* pool, size_t num_blocks, bool prefault)
+{
+    size_t size      = sizeof(struct meta_block) + (num_blocks * pool->block_size);
+    size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+
+    if (pool->backing == POOL_BACKING_HEAP)
+    {
+        struct meta_block* meta = calloc(1, size);
+        if (!meta)
+        {
+            MINIWEB_LOG_ERROR("Failed to alloc new meta_block of size %zu", size);
+            return NULL;
+        }
+
+        meta->num_blocks = num_blocks;
+        meta->page_size  = page_size;
+        return meta;
+    }
+
+    int   flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    void* mem   = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+    // Explicit huge pages only work if the admin has reserved some
+    if (pool->backing == POOL_BACKING_HUGE_PAGES)
+    {
+        size_t huge_size =
+            (size + POOL_HUGE_PAGE_SIZE - 1) & ~(POOL_HUGE_PAGE_SIZE - 1);
+        mem = mmap(NULL, huge_size, PROT_READ | PROT_WRITE,
+                   flags | MAP_HUGETLB | (prefault ? MAP_POPULATE : 0), -1, 0);
+        if (mem != MAP_FAILED)
+        {
+            size      = huge_size;
+            page_size = POOL_HUGE_PAGE_SIZE;
+        }
+    }
+#endif
+
+    if (mem == MAP_FAILED)
+    {
+        // Transparent huge pages are only used if we ask before faulting it in
+        bool transparent = pool->backing == POOL_BACKING_HUGE_PAGES;
+
+        size = (size + page_size - 1) & ~(page_size - 1);
+        mem  = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                    flags | (prefault && !transparent ? MAP_POPULATE : 0), -1, 0);
+        if (mem == MAP_FAILED)
+        {
+            MINIWEB_LOG_ERROR("Failed to map new meta_block of size %zu: %d (%s)",
+                              size, errno, strerror(errno));
+            errno = 0;
+            return NULL;
+        }
+
+        if (transparent)
+        {
+#ifdef MADV_HUGEPAGE
+            // Not fatal, we just don't get huge pages
+            if (madvise(mem, size, MADV_HUGEPAGE) != 0) { errno = 0; }
+#endif
+            if (prefault)
+            {
+                for (size_t offset = 0; offset < size; offset += page_size)
+                { ((unsigned char volatile*) mem)[offset] = 0; }
+            }
+        }
+    }
+
+    // The mapping starts out zeroed, and rounding up may have left room for more
+    struct meta_block* meta = mem;
+    meta->num_blocks  = (size - sizeof(struct meta_block)) / pool->block_size;
+    meta->mapped_size = size;
+    meta->page_size   = page_size;
+    return meta;
+}
+
+static void pool_destroy_meta_block(struct meta_block* meta)
+{
+    if (meta->mapped_size == 0) { free(meta); }
+    else
     {
-        MINIWEB_LOG_ERROR("Failed to alloc new meta_block of size %zu",
-                          sizeof(struct meta_block) +
-                              (new_meta_size * pool->block_size));
-        return -1;
+        munmap(meta, meta->mapped_size);
     }
+}
+
+static int pool_add_meta_block(struct pool* pool)
+{
+    // Let's make the new meta block twice as big. It's faulted in as it's used,
+    // faulting it all in now would hold up whoever needed the block.
+    struct meta_block* last_meta = pool->control[pool->total_num_blocks - 1].parent;
+    struct meta_block* new_meta =
+        pool_create_meta_block(pool, last_meta->num_blocks * 2, false);
+    if (!new_meta) { return -1; }
+    size_t new_meta_size = new_meta->num_blocks;
 
     // Now we need to grow the control array...
     struct control_block* new_control =
@@ -228,27 +485,207 @@ static int pool_add_meta_block(struct pool* pool)
     {
         MINIWEB_LOG_ERROR("Failed to grow the control array to size %zu",
                           pool->total_num_blocks + new_meta_size);
+        pool_destroy_meta_block(new_meta);
         return -2;
     }
 
     // Fill out our new data...
-    new_meta->num_blocks  = new_meta_size;
-    new_meta->blocks_used = 0;
-    new_meta->next        = NULL;
-    last_meta->next       = new_meta;
+    last_meta->next = new_meta;
 
-    for (size_t i = pool->total_num_blocks;
-         i < pool->total_num_blocks + new_meta_size; ++i)
+    // We only grow once the free list is empty, so the new blocks are all of it
+    size_t const end = pool->total_num_blocks + new_meta_size;
+    for (size_t i = pool->total_num_blocks; i < end; ++i)
     {
-        new_control[i].parent  = new_meta;
-        new_control[i].is_free = true;
+        new_control[i].parent    = new_meta;
+        new_control[i].is_free   = true;
+        new_control[i].next_free = i + 1 < end ? i + 1 : POOL_NO_BLOCK;
         new_control[i].block =
             new_meta->blocks + ((i - pool->total_num_blocks) * pool->block_size);
     }
 
-    pool->next_free_block  = pool->total_num_blocks;
-    pool->total_num_blocks = pool->total_num_blocks + new_meta_size;
+    pool->free_head        = pool->total_num_blocks;
+    pool->total_num_blocks = end;
     pool->control          = new_control;
 
     return 0;
 }
+
+static struct pool_handle pool_alloc_concurrent(struct pool* pool)
+{
+    struct pool_cache* cache = pool_get_thread_cache(pool);
+    if (!cache)
+    {
+        pthread_mutex_lock(&pool->depot_lock);
+        struct pool_handle handle = pool_alloc_block(pool);
+        pthread_mutex_unlock(&pool->depot_lock);
+        return handle;
+    }
+
+    if (cache->count == 0)
+    {
+        // Refill with a batch, so the lock's only taken every so often
+        pthread_mutex_lock(&pool->depot_lock);
+        for (size_t i = 0; i < POOL_MAGAZINE_BATCH; ++i)
+        {
+            struct pool_handle handle = pool_alloc_block(pool);
+            if (!handle.data) { break; }
+            cache->handles[cache->count++] = handle;
+        }
+        pthread_mutex_unlock(&pool->depot_lock);
+
+        if (cache->count == 0)
+        { return (struct pool_handle) {.id = SIZE_MAX, .data = NULL}; }
+    }
+
+    // Last in, first out, as the depot does
+    return cache->handles[--cache->count];
+}
+
+static void pool_free_concurrent(struct pool* pool, struct pool_handle handle)
+{
+    assert(handle.data);
+
+    struct pool_cache* cache = pool_get_thread_cache(pool);
+    if (!cache)
+    {
+        pthread_mutex_lock(&pool->depot_lock);
+        pool_free_block(pool, handle);
+        pthread_mutex_unlock(&pool->depot_lock);
+        return;
+    }
+
+    if (cache->count == POOL_MAGAZINE_SIZE)
+    {
+        // Give back the oldest, the ones we're least likely to still have cached
+        pthread_mutex_lock(&pool->depot_lock);
+        for (size_t i = 0; i < POOL_MAGAZINE_BATCH; ++i)
+        { pool_free_block(pool, cache->handles[i]); }
+        pthread_mutex_unlock(&pool->depot_lock);
+
+        cache->count -= POOL_MAGAZINE_BATCH;
+        memmove(cache->handles, cache->handles + POOL_MAGAZINE_BATCH,
+                cache->count * sizeof(struct pool_handle));
+    }
+
+    cache->handles[cache->count++] = handle;
+}
+
+// Returns NULL if the thread has to use the depot directly
+static struct pool_cache* pool_get_thread_cache(struct pool* pool)
+{
+    size_t slot = pool_get_thread_slot();
+    if (slot == POOL_NO_THREAD_SLOT) { return NULL; }
+
+    struct pool_cache* cache = pool->caches[slot];
+    if (!cache)
+    {
+        // Allocating under the lock keeps all the pool's allocations in one place
+        pthread_mutex_lock(&pool->depot_lock);
+        cache              = calloc(1, sizeof(struct pool_cache));
+        pool->caches[slot] = cache;
+        pthread_mutex_unlock(&pool->depot_lock);
+
+        if (!cache)
+        { MINIWEB_LOG_ERROR("Failed to allocate a pool cache for slot %zu", slot); }
+    }
+
+    return cache;
+}
+
+static size_t pool_get_thread_slot(void)
+{
+    if (tls_thread_slot != 0) { return tls_thread_slot - 1; }
+
+    pthread_once(&g_thread_slot_once, &pool_create_thread_slot_key);
+
+    size_t slot = POOL_NO_THREAD_SLOT;
+    pthread_mutex_lock(&g_thread_slot_lock);
+    if (g_num_free_thread_slots > 0)
+    { slot = g_free_thread_slots[--g_num_free_thread_slots]; }
+    else if (g_next_thread_slot < POOL_MAX_THREAD_CACHES)
+    {
+        slot = g_next_thread_slot++;
+    }
+    pthread_mutex_unlock(&g_thread_slot_lock);
+
+    // The key's destructor hands the slot back when the thread exits. Without a
+    // slot we'll keep asking, in case one's been handed back since.
+    if (slot == POOL_NO_THREAD_SLOT) { return slot; }
+
+    tls_thread_slot = slot + 1;
+    pthread_setspecific(g_thread_slot_key, (void*) (uintptr_t) tls_thread_slot);
+    return slot;
+}
+
+static void pool_create_thread_slot_key(void)
+{
+    int rc = pthread_key_create(&g_thread_slot_key, &pool_release_thread_slot);
+    if (rc != 0)
+    { MINIWEB_LOG_ERROR("Failed to create pool thread slot key: %d", rc); }
+}
+
+static void pool_release_thread_slot(void* slot)
+{
+    pthread_mutex_lock(&g_thread_slot_lock);
+    g_free_thread_slots[g_num_free_thread_slots++] = (uintptr_t) slot - 1;
+    pthread_mutex_unlock(&g_thread_slot_lock);
+}
+
+// Returns how many bytes went back to the OS, only whole pages can go
+static size_t pool_release_meta_block(struct pool* pool, struct meta_block* meta)
+{
+    meta->released = true;
+
+    uintptr_t const page_size = meta->page_size;
+    uintptr_t       start     = (uintptr_t) meta->blocks;
+    uintptr_t       end       = start + (meta->num_blocks * pool->block_size);
+
+    start = (start + page_size - 1) & ~(page_size - 1);
+    end   = end & ~(page_size - 1);
+    if (start >= end) { return 0; }
+
+    // The pages stay mapped, and come back zeroed when they're next touched
+    if (madvise((void*) start, end - start, MADV_DONTNEED) != 0)
+    {
+        MINIWEB_LOG_ERROR("Failed to release %zu bytes of pool memory",
+                          (size_t) (end - start));
+        return 0;
+    }
+
+    return end - start;
+}
+
+// Puts the blocks we've kept at the front, in order, and the released ones at the
+// back so they're only used once everything else is
+static void pool_rebuild_free_list(struct pool* pool)
+{
+    size_t kept_head     = POOL_NO_BLOCK;
+    size_t kept_tail     = POOL_NO_BLOCK;
+    size_t released_head = POOL_NO_BLOCK;
+    size_t released_tail = POOL_NO_BLOCK;
+
+    for (size_t i = 0; i < pool->total_num_blocks; ++i)
+    {
+        struct control_block* control = &pool->control[i];
+        if (!control->is_free) { continue; }
+
+        bool    released = control->parent->released;
+        size_t* head     = released ? &released_head : &kept_head;
+        size_t* tail     = released ? &released_tail : &kept_tail;
+
+        control->next_free = POOL_NO_BLOCK;
+        if (*tail == POOL_NO_BLOCK) { *head = i; }
+        else
+        {
+            pool->control[*tail].next_free = i;
+        }
+        *tail = i;
+    }
+
+    if (kept_tail == POOL_NO_BLOCK) { pool->free_head = released_head; }
+    else
+    {
+        pool->control[kept_tail].next_free = released_head;
+        pool->free_head                    = kept_head;
+    }
+}
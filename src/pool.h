@@ -1,6 +1,7 @@
 #ifndef INCLUDED_POOL_H
 #define INCLUDED_POOL_H
 
+#include <stdbool.h>
 #include <stdlib.h>
 
 // An extremely simple pool allocator with fixed-size blocks. Should only really
@@ -15,8 +16,35 @@ typedef struct pool_handle
     void*     data;
 } pool_handle_t;
 
+enum pool_backing
+{
+    // Plain calloc, faulted in as each block is first used
+    POOL_BACKING_HEAP,
+    // Each meta block gets its own mapping, and the first is faulted in as soon as
+    // the pool's created
+    POOL_BACKING_MMAP,
+    // As POOL_BACKING_MMAP, but on explicit huge pages if any have been reserved,
+    // otherwise transparent ones if the kernel will give us them
+    POOL_BACKING_HUGE_PAGES,
+};
+
+typedef struct pool_options
+{
+    // See pool_init_concurrent
+    bool              concurrent;
+    enum pool_backing backing;
+} pool_options_t;
+
 // CREATORS AND DESTROYERS
 pool_t* pool_init(size_t block_size, size_t init_num_blocks);
+// Any thread can alloc and free, including blocks another thread allocated. Each
+// thread keeps a small cache of free blocks, so it only takes a lock to move a
+// batch of them to or from the rest of the pool.
+pool_t* pool_init_concurrent(size_t block_size, size_t init_num_blocks);
+pool_options_t pool_default_options(void);
+pool_t*        pool_init_with_options(size_t                block_size,
+                                      size_t                init_num_blocks,
+                                      pool_options_t const* options);
 int pool_create(pool_t* restrict pool, size_t block_size, size_t init_num_blocks);
 // Will free everything in the pool
 void pool_clear(pool_t* restrict pool);
@@ -29,4 +57,10 @@ pool_handle_t pool_calloc(pool_t* pool);
 // search?
 void pool_free(pool_t* pool, pool_handle_t handle);
 
+// Gives the memory behind completely empty meta blocks back to the OS, so long as
+// that leaves keep_free free blocks ready to use. Handles and pointers all stay
+// valid, and a released block comes back zeroed the next time it's used. Returns
+// how many bytes were released.
+size_t pool_trim(pool_t* pool, size_t keep_free);
+
 #endif // INCLUDED_POOL_H
@@ -0,0 +1,150 @@
+#include "response_queue.h"
+
+#include "logging.h"
+
+#include <assert.h>
+#include <stdatomic.h>
+
+#include <pthread.h>
+#include <unistd.h>
+
+#ifdef MINIWEB_TESTING
+extern void* _test_malloc(const size_t size, char const* file, int const line);
+extern void*
+             _test_calloc(size_t nmemb, size_t size, char const* file, int const line);
+extern void  _test_free(void* ptr, char const* file, int const line);
+extern void* _test_realloc(void* ptr, size_t size, char const* file, int const line);
+
+    #define malloc(size)       _test_malloc(size, __FILE__, __LINE__)
+    #define calloc(n, size)    _test_calloc(n, size, __FILE__, __LINE__)
+    #define free(ptr)          _test_free(ptr, __FILE__, __LINE__)
+    #define realloc(ptr, size) _test_realloc(ptr, size, __FILE__, __LINE__)
+#endif
+
+// ==== TYPES ====
+
+struct queued_response
+{
+    uint64_t                seq;
+    http_file_response_t    prepared;
+    struct queued_response* next;
+};
+
+struct response_queue
+{
+    atomic_size_t refs;
+
+    pthread_mutex_t lock;
+    // Kept sorted by seq. Pipelines are short, so a list is plenty.
+    struct queued_response* pending;
+    uint64_t                next_to_send;
+
+    // Only touched by the reactor
+    uint64_t next_seq;
+};
+
+// ==== PUBLIC FUNCTIONS IMPLEMENTATION ====
+
+struct response_queue* response_queue_create(void)
+{
+    struct response_queue* queue = calloc(1, sizeof(struct response_queue));
+    if (!queue)
+    {
+        MINIWEB_LOG_ERROR("Failed to allocate response queue");
+        return NULL;
+    }
+
+    int rc = pthread_mutex_init(&queue->lock, NULL);
+    if (rc != 0)
+    {
+        MINIWEB_LOG_ERROR("Failed to init response queue lock: %d", rc);
+        free(queue);
+        return NULL;
+    }
+
+    atomic_init(&queue->refs, 1);
+    return queue;
+}
+
+void response_queue_retain(struct response_queue* queue)
+{
+    assert(queue);
+    atomic_fetch_add_explicit(&queue->refs, 1, memory_order_relaxed);
+}
+
+void response_queue_release(struct response_queue* queue)
+{
+    assert(queue);
+
+    if (atomic_fetch_sub_explicit(&queue->refs, 1, memory_order_acq_rel) != 1)
+    { return; }
+
+    for (struct queued_response* curr = queue->pending; curr;)
+    {
+        struct queued_response* next = curr->next;
+        if (curr->prepared.file_fd != -1) { close(curr->prepared.file_fd); }
+        free(curr);
+        curr = next;
+    }
+
+    pthread_mutex_destroy(&queue->lock);
+    free(queue);
+}
+
+uint64_t response_queue_next_seq(struct response_queue* queue)
+{
+    assert(queue);
+    return queue->next_seq++;
+}
+
+int response_queue_add(struct response_queue*            queue,
+                       uint64_t                          seq,
+                       http_file_response_t const* const prepared)
+{
+    assert(queue);
+    assert(prepared);
+
+    struct queued_response* response = malloc(sizeof(struct queued_response));
+    if (!response)
+    {
+        MINIWEB_LOG_ERROR("Failed to allocate queued response %zu", (size_t) seq);
+        return -1;
+    }
+    response->seq      = seq;
+    response->prepared = *prepared;
+
+    pthread_mutex_lock(&queue->lock);
+
+    struct queued_response** insert_at = &queue->pending;
+    while (*insert_at && (*insert_at)->seq < seq) insert_at = &(*insert_at)->next;
+    response->next = *insert_at;
+    *insert_at     = response;
+
+    pthread_mutex_unlock(&queue->lock);
+    return 0;
+}
+
+bool response_queue_take_next(struct response_queue* queue,
+                              http_file_response_t*  prepared_out)
+{
+    assert(queue);
+    assert(prepared_out);
+
+    pthread_mutex_lock(&queue->lock);
+
+    struct queued_response* head = queue->pending;
+    if (!head || head->seq != queue->next_to_send)
+    {
+        pthread_mutex_unlock(&queue->lock);
+        return false;
+    }
+
+    queue->pending = head->next;
+    ++queue->next_to_send;
+
+    pthread_mutex_unlock(&queue->lock);
+
+    *prepared_out = head->prepared;
+    free(head);
+    return true;
+}
@@ -0,0 +1,37 @@
+#ifndef INCLUDED_RESPONSE_QUEUE_H
+#define INCLUDED_RESPONSE_QUEUE_H
+
+#include "http_helpers.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// A connection's output queue, which puts its responses back into the order its
+// requests arrived in. Each request is given a sequence number when it's
+// dispatched, and responses can be added in any order from any thread, but only
+// come back out in sequence. Only the reactor takes them, and writes them out as
+// the socket allows.
+
+typedef struct response_queue response_queue_t;
+
+// Starts with a single reference, owned by the caller
+response_queue_t* response_queue_create(void);
+void              response_queue_retain(response_queue_t* queue);
+// Anything still queued when the last reference goes has its file closed
+void              response_queue_release(response_queue_t* queue);
+
+// Only the reactor hands these out, so they don't need to be atomic
+uint64_t response_queue_next_seq(response_queue_t* queue);
+
+// The queue takes ownership of prepared->file_fd. A response with a header_len of 0
+// holds the request's place in the queue but sends nothing.
+int response_queue_add(response_queue_t*                 queue,
+                       uint64_t                          seq,
+                       http_file_response_t const* const prepared);
+
+// Returns false if the next response in sequence isn't ready yet
+bool response_queue_take_next(response_queue_t*     queue,
+                              http_file_response_t* prepared_out);
+
+#endif // INCLUDED_RESPONSE_QUEUE_H
@@ -5,6 +5,7 @@
 #include "pool.h"
 
 #include <assert.h>
+#include <stdatomic.h>
 #include <stddef.h>
 #include <string.h>
 
@@ -34,6 +35,12 @@ struct route
     routerfunc*   func;
     void*         user_data;
     pool_handle_t handle; // Self-referential handle
+
+    enum route_priority priority;
+    // Reactors read these on every request, and any of them can move an inline
+    // route onto the pool
+    _Atomic(enum route_run_mode) run_mode;
+    atomic_uint                  inline_overruns;
 };
 
 // ==== CONSTANTS ====
@@ -86,7 +93,9 @@ int router_add_route_inner(struct router* restrict router,
                            char const              route[static 1],
                            char const              func_name[static 1],
                            routerfunc*             func,
-                           void*                   user_data)
+                           void*                   user_data,
+                           enum route_priority     priority,
+                           enum route_run_mode     run_mode)
 {
     pool_handle_t new_route_handle = pool_alloc(router->route_pool);
     struct route* new_route        = new_route_handle.data;
@@ -103,6 +112,9 @@ int router_add_route_inner(struct router* restrict router,
     new_route->func      = func;
     new_route->user_data = user_data;
     new_route->handle    = new_route_handle;
+    new_route->priority  = priority;
+    atomic_init(&new_route->run_mode, run_mode);
+    atomic_init(&new_route->inline_overruns, 0);
 
     int rc = hash_add(router->route_table, new_route);
     if (rc != 0)
@@ -124,14 +136,55 @@ routerfunc* router_get_route_func(struct router const* restrict router,
     assert(router);
     assert(user_data);
 
+    route_info_t info = {0};
+    if (!router_get_route_info(router, route, &info)) { return NULL; }
+
+    *user_data = info.user_data;
+    return info.func;
+}
+
+bool router_get_route_info(struct router const* restrict router,
+                           char const                    route[static 1],
+                           route_info_t*                 info)
+{
+    assert(router);
+    assert(info);
+
+    *info = (route_info_t) {.priority = ROUTE_PRIORITY_NORMAL,
+                            .run_mode = ROUTE_RUN_ON_POOL};
+
     struct route* found_route = hash_find(router->route_table, route);
     if (!found_route)
     {
         MINIWEB_LOG_ERROR("Could not find route %s in router_table", route);
-        return NULL;
+        return false;
     }
 
-    return found_route->func;
+    info->func      = found_route->func;
+    info->user_data = found_route->user_data;
+    info->priority  = found_route->priority;
+    info->run_mode =
+        atomic_load_explicit(&found_route->run_mode, memory_order_relaxed);
+    return true;
+}
+
+bool router_report_inline_overrun(struct router const* restrict router,
+                                  char const                    route[static 1],
+                                  unsigned                      max_overruns)
+{
+    assert(router);
+
+    struct route* found_route = hash_find(router->route_table, route);
+    if (!found_route) { return false; }
+
+    unsigned overruns = atomic_fetch_add_explicit(&found_route->inline_overruns, 1,
+                                                  memory_order_relaxed)
+                        + 1;
+    if (overruns != max_overruns) { return false; }
+
+    atomic_store_explicit(&found_route->run_mode, ROUTE_RUN_ON_POOL,
+                          memory_order_relaxed);
+    return true;
 }
 
 miniweb_response_t router_invoke_route_func(struct router const* restrict router,
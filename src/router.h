@@ -3,31 +3,84 @@
 
 #include "miniweb_response.h"
 
+#include <stdbool.h>
 #include <stdlib.h>
 
-#define router_add_route(router, route, func, user_data) \
-    router_add_route_inner(router, route, #func, func, user_data)
+#define router_add_route(router, route, func, user_data)          \
+    router_add_route_inner(router, route, #func, func, user_data, \
+                           ROUTE_PRIORITY_NORMAL, ROUTE_RUN_ON_POOL)
+
+// The priority decides which of the thread pool's lanes the route's jobs go in, see
+// enum route_priority
+#define router_add_route_with_priority(router, route, func, user_data, priority) \
+    router_add_route_inner(router, route, #func, func, user_data, priority,      \
+                           ROUTE_RUN_ON_POOL)
+
+// For handlers so cheap that handing them to the thread pool costs more than
+// running them. The reactor runs them itself, until they take too long too often,
+// after which they go to the pool at high priority.
+#define router_add_inline_route(router, route, func, user_data)   \
+    router_add_route_inner(router, route, #func, func, user_data, \
+                           ROUTE_PRIORITY_HIGH, ROUTE_RUN_INLINE)
 
 enum
 {
     ROUTE_MAX_LENGTH = 255
 };
 
+// The server maps these onto the thread pool's priorities
+enum route_priority
+{
+    ROUTE_PRIORITY_NORMAL,
+    // Latency sensitive routes, which get most of the workers' attention
+    ROUTE_PRIORITY_HIGH,
+    // Slow or bulk routes, which still get a share so they never starve
+    ROUTE_PRIORITY_LOW,
+};
+
+enum route_run_mode
+{
+    ROUTE_RUN_ON_POOL,
+    ROUTE_RUN_INLINE,
+};
+
 typedef struct router      router_t;
 typedef miniweb_response_t routerfunc(void* user_data, char const* const request);
 
+// Everything the server needs to know to run a route
+typedef struct route_info
+{
+    routerfunc*         func;
+    void*               user_data;
+    enum route_priority priority;
+    enum route_run_mode run_mode;
+} route_info_t;
+
 router_t* router_init(void);
 void      router_destroy(router_t* restrict router);
 
-int router_add_route_inner(router_t* restrict router,
-                           char const         route[static 1],
-                           char const         func_name[static 1],
-                           routerfunc*        func,
-                           void*              user_data);
+int router_add_route_inner(router_t* restrict  router,
+                           char const          route[static 1],
+                           char const          func_name[static 1],
+                           routerfunc*         func,
+                           void*               user_data,
+                           enum route_priority priority,
+                           enum route_run_mode run_mode);
 
 routerfunc*        router_get_route_func(router_t const* restrict router,
                                          char const               route[static 1],
                                          void**                   user_data);
+// Routes we don't know about come back with a NULL func, at normal priority and on
+// the pool. Returns false for them.
+bool router_get_route_info(router_t const* restrict router,
+                           char const               route[static 1],
+                           route_info_t*            info);
+// Counts a run of an inline route that went over its time budget. Once it has done
+// that max_overruns times it runs on the pool for good, and this returns true for
+// the overrun that moved it.
+bool router_report_inline_overrun(router_t const* restrict router,
+                                  char const               route[static 1],
+                                  unsigned                 max_overruns);
 miniweb_response_t router_invoke_route_func(router_t const* restrict router,
                                             char const               route[static 1],
                                             char const* const        request);
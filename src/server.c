@@ -1,17 +1,33 @@
+// Needed for accept4()
+#define _GNU_SOURCE
+
 #include "server.h"
 
+#include "arena.h"
+#include "completion_queue.h"
+#include "connection.h"
 #include "connection_manager.h"
 #include "http_helpers.h"
 #include "logging.h"
+#include "macro_helpers.h"
+#include "mpsc_queue.h"
 #include "pool.h"
+#include "response_queue.h"
+#include "slab.h"
 #include "thread_pool.h"
 
+#ifdef MINIWEB_USE_IO_URING
+    #include "uring_engine.h"
+#endif
+
 #include <assert.h>
 #include <errno.h>
 #include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <arpa/inet.h>
 #include <netdb.h>
@@ -24,25 +40,99 @@
 
 // CONSTANTS
 
-static const size_t REQUEST_BUFFER_SIZE     = 1024;
+// Most requests fit in the smallest class, and a connection's buffer only moves up
+// a class when a request doesn't. Every request's headers have to fit in the last.
+static const slab_class_t REQUEST_BUFFER_CLASSES[] = {
+    {1024, 100},
+    {4096, 16},
+    {16384, 4},
+    {65536, 1},
+};
 static const size_t INIT_NUM_REQUEST_BUFFERS = 100;
 static const size_t INITIAL_SERVER_CAPACITY = 10;
 static const int    MAX_QUEUED_CONNECTIONS  = 10;
 static const size_t DEFAULT_NUM_THREADS     = 8;
+static const size_t DEFAULT_MAX_THREADS     = 64;
+static const size_t DEFAULT_NUM_REACTORS    = 1;
+// Long enough to ride out a burst, short enough that a 503 beats waiting
+static const uint64_t DEFAULT_MAX_QUEUE_WAIT_MS = 100;
+// A static file or a health check is done well within this
+static const uint64_t DEFAULT_INLINE_BUDGET_US = 200;
+// One overrun could just be a cold cache, but a route that keeps doing it is
+// holding up every other connection on the reactor
+static const unsigned MAX_INLINE_OVERRUNS = 8;
+// Matches the Keep-Alive timeout we advertise in our responses
+static const uint64_t IDLE_CONNECTION_TIMEOUT_MS = 300 * 1000;
+// Often enough that memory follows the load down, rarely enough that a busy
+// period doesn't keep giving memory back only to fault it straight in again
+static const uint64_t POOL_TRIM_INTERVAL_MS = 10 * 1000;
+// Most routes won't touch their arena, and those that do rarely need more than a
+// chunk, so this covers a good few workers at once
+static const size_t INIT_NUM_ARENA_CHUNKS = 16;
+
+#ifdef MINIWEB_USE_IO_URING
+static const unsigned int URING_ENGINE_ENTRIES = 256;
+// The engine can't move a receive to a bigger buffer, so it sticks to one class.
+// Bigger requests are put back together in the connection's read buffer.
+static const size_t URING_RECV_BUFFER_SIZE = 4096;
+#endif
+
+enum
+{
+    // Requests from one round of events go to the thread pool together, this many
+    // at a time
+    MAX_PENDING_JOBS = 64,
+};
 
 // ==== STRUCTS ====
 
-struct miniweb_server
+struct miniweb_server;
+
+// Each reactor owns a listening socket and runs its own event loop. When there is
+// more than one, the sockets are bound with SO_REUSEPORT and the kernel spreads
+// incoming connections across them.
+struct miniweb_reactor
 {
-    int                   sock_fd;
-    atomic_bool           should_run;
-    connection_manager_t* connections;
-    router_t*             router;
-    thread_pool_t*        thread_pool;
+    size_t                  reactor_num;
+    // Where the reactor runs and keeps its memory, -1 if it isn't pinned
+    int                     cpu;
+    pthread_t               thread;
+    bool                    thread_started;
+    int                     sock_fd;
+    bool                    is_listening;
+    connection_manager_t*   connections;
+    struct miniweb_server*  server;
+#ifdef MINIWEB_USE_IO_URING
+    uring_engine_t* uring;
+#endif
 
     // Used to allocate dispatch_job_data structs
     pool_t* dispatch_pool;
-    pool_t* request_buf_pool;
+    slab_t* request_buf_slab;
+    // Backs the request arenas, on the workers as well as here
+    pool_t* arena_chunk_pool;
+    // When to next give back whatever the pools grew by in a spike
+    uint64_t next_trim_ms;
+
+    // Workers hand their finished jobs back through here, responses and all. Only
+    // the reactor touches its pools, connections and sockets.
+    completion_queue_t completions;
+
+    // Requests dispatched during the current round of events, which haven't gone
+    // to the thread pool yet
+    thread_pool_job_t pending_jobs[MAX_PENDING_JOBS];
+    size_t            num_pending_jobs;
+};
+
+struct miniweb_server
+{
+    atomic_bool             should_run;
+    router_t*               router;
+    thread_pool_t*          thread_pool;
+    struct miniweb_reactor* reactors;
+    size_t                  num_reactors;
+    uint64_t                inline_budget_us;
+    enum pool_backing       pool_backing;
 };
 
 struct dispatch_job_data
@@ -50,27 +140,92 @@ struct dispatch_job_data
     int              sock_fd;
     routerfunc*      process_func;
     void*            user_data;
-    pool_handle_t    request_buf;
+    slab_handle_t    request_buf;
     pool_handle_t    handle_to_me;
 
-    // We need references back to the pools to be able to free
-    pool_t* dispatch_pool;
-    pool_t* request_pool;
+    // Where the response goes to be put back in order, NULL if it can go straight
+    // out. The job holds a reference.
+    response_queue_t* responses;
+    uint64_t          seq;
+
+    // Filled in by the worker, for the reactor to send once it has the job back
+    http_file_response_t response;
+
+    // We need a reference back to the reactor to hand the job back
+    struct miniweb_reactor* reactor;
+    mpsc_node_t             finished_node;
 };
 
+// Set while a route's running, see miniweb_request_arena
+static _Thread_local arena_t* tls_request_arena = NULL;
+
 // ==== STATIC PROTOTYPES ====
 
 // Job to run on the thread pool when receiving a request
 static void dispatch_response_job(void* data);
+static void dispatch_prepare_response(struct dispatch_job_data* job);
+static enum thread_pool_priority dispatch_job_priority(enum route_priority priority);
+static uint64_t miniweb_now_us(void);
 
 static int miniweb_server_get_bound_socket(char const* const address,
-                                           char const* const port);
-static int miniweb_server_listen(struct miniweb_server* server);
-
-static int miniweb_server_handle_new_connection(struct miniweb_server* server);
-static int miniweb_server_process_client_event(struct miniweb_server* server,
-                                               int                    connection_fd);
-
+                                           char const* const port,
+                                           bool              reuse_port);
+
+static int miniweb_server_set_affinity(struct miniweb_server* server,
+                                       cpu_affinity_t const*  affinity);
+
+static int  miniweb_reactor_init(struct miniweb_reactor* reactor,
+                                 struct miniweb_server*  server,
+                                 char const* const       address,
+                                 char const* const       port);
+static void miniweb_reactor_clean(struct miniweb_reactor* reactor);
+static int  miniweb_reactor_start_listening(struct miniweb_reactor* reactor);
+static void* miniweb_reactor_thread(void* data);
+
+static int miniweb_server_listen(struct miniweb_reactor* reactor);
+
+#ifndef MINIWEB_USE_IO_URING
+static int miniweb_server_handle_new_connection(struct miniweb_reactor* reactor);
+static int miniweb_server_process_client_event(struct miniweb_reactor* reactor,
+                                               int connection_fd);
+static int miniweb_reactor_read_connection(struct miniweb_reactor* reactor,
+                                           struct connection*      connection);
+static int miniweb_reactor_flush_connection(struct connection* connection);
+#else
+static int miniweb_reactor_add_connection(struct miniweb_reactor* reactor,
+                                          int                     sockfd);
+static int miniweb_reactor_handle_recv(struct miniweb_reactor* reactor,
+                                       uring_event_t const*    event);
+#endif
+static void miniweb_reactor_close_connection(struct miniweb_reactor* reactor,
+                                             struct connection*      connection);
+static int  miniweb_reactor_resume_connection(struct miniweb_reactor* reactor,
+                                              struct connection*      connection);
+static int  miniweb_reactor_dispatch_buffered(struct miniweb_reactor* reactor,
+                                              struct connection*      connection,
+                                              size_t                  searched);
+static int miniweb_server_dispatch_request(struct miniweb_reactor* reactor,
+                                           int                     connection_fd,
+                                           struct connection*      connection,
+                                           slab_handle_t           buf_handle,
+                                           size_t                  num_bytes);
+static int  miniweb_reactor_run_inline(struct miniweb_reactor*   reactor,
+                                       char const*               route,
+                                       struct dispatch_job_data* job);
+static void miniweb_reactor_submit_pending_jobs(struct miniweb_reactor* reactor);
+static void miniweb_reactor_hand_back_job(struct dispatch_job_data* job);
+static void miniweb_reactor_process_finished_jobs(struct miniweb_reactor* reactor);
+static void miniweb_reactor_trim_pools(struct miniweb_reactor* reactor);
+static int miniweb_reactor_send_in_order(struct miniweb_reactor* reactor,
+                                         int                     sockfd,
+                                         response_queue_t*       responses,
+                                         uint64_t                seq,
+                                         http_file_response_t const* prepared);
+static int miniweb_reactor_send_prepared(struct miniweb_reactor*     reactor,
+                                         int                         sockfd,
+                                         http_file_response_t const* prepared);
+
+#ifndef MINIWEB_USE_IO_URING
 static void* get_sockaddr_in_from_sockaddr(struct sockaddr* sa)
 {
     if (sa->sa_family == AF_INET) { return &(((struct sockaddr_in*) sa)->sin_addr); }
@@ -79,21 +234,46 @@ static void* get_sockaddr_in_from_sockaddr(struct sockaddr* sa)
         return &(((struct sockaddr_in6*) sa)->sin6_addr);
     }
 }
+#endif
 
 // ==== PUBLIC FUNCTIONS IMPLEMENTATION ====
 
+miniweb_server_options_t miniweb_server_default_options(void)
+{
+    return (miniweb_server_options_t) {
+        .num_reactors      = DEFAULT_NUM_REACTORS,
+        .num_threads       = DEFAULT_NUM_THREADS,
+        .thread_pool_mode  = THREAD_POOL_MODE_WORK_STEALING,
+        .max_threads       = DEFAULT_MAX_THREADS,
+        .max_queue_wait_ms = DEFAULT_MAX_QUEUE_WAIT_MS,
+        .inline_budget_us  = DEFAULT_INLINE_BUDGET_US,
+        .pool_backing      = POOL_BACKING_MMAP,
+        .affinity          = {.policy = CPU_AFFINITY_NONE}};
+}
+
 struct miniweb_server* miniweb_server_create(char const* const address,
                                              char const* const port,
                                              router_t*         router)
+{
+    miniweb_server_options_t options = miniweb_server_default_options();
+    return miniweb_server_create_with_options(address, port, router, &options);
+}
+
+struct miniweb_server*
+miniweb_server_create_with_options(char const* const                     address,
+                                   char const* const                     port,
+                                   router_t*                             router,
+                                   miniweb_server_options_t const* const options)
 {
     struct miniweb_server* server = calloc(1, sizeof(struct miniweb_server));
     if (!server)
     {
         MINIWEB_LOG_ERROR("Failed to allocate memory for miniweb_server");
+        if (router) router_destroy(router);
         return NULL;
     }
 
-    int rc = miniweb_server_init(server, address, port, router);
+    int rc = miniweb_server_init_with_options(server, address, port, router, options);
     if (rc != 0)
     {
         MINIWEB_LOG_ERROR("Failed to initialise miniweb_server, rc: %d", rc);
@@ -108,18 +288,48 @@ int miniweb_server_init(miniweb_server_t* restrict server,
                         char const* const          address,
                         char const* const          port,
                         router_t*                  router)
+{
+    miniweb_server_options_t options = miniweb_server_default_options();
+    return miniweb_server_init_with_options(server, address, port, router, &options);
+}
+
+int miniweb_server_init_with_options(miniweb_server_t* restrict            server,
+                                     char const* const                     address,
+                                     char const* const                     port,
+                                     router_t*                             router,
+                                     miniweb_server_options_t const* const options)
 {
     assert(server);
+    assert(options);
 
-    connection_manager_t* conns = connection_manager_create(INITIAL_SERVER_CAPACITY);
-    if (!conns)
+    // We own the router from here on, even if we fail, so set it first for
+    // miniweb_server_clean to free
+    memset(server, 0, sizeof(struct miniweb_server));
+    server->router = router;
+
+    if (options->num_reactors == 0 || options->num_threads == 0)
     {
-        MINIWEB_LOG_ERROR("Failed to create connection_manager struct");
+        MINIWEB_LOG_ERROR("Server needs at least one reactor and one thread!");
+        miniweb_server_clean(server);
         return -1;
     }
-    server->connections = conns;
 
-    thread_pool_t* thread_pool = thread_pool_init(DEFAULT_NUM_THREADS);
+    thread_pool_t* thread_pool = NULL;
+    if (options->thread_pool_mode == THREAD_POOL_MODE_ELASTIC)
+    {
+        size_t max_threads = options->max_threads;
+        if (max_threads < options->num_threads)
+        { max_threads = options->num_threads; }
+
+        thread_pool_elastic_options_t elastic =
+            thread_pool_default_elastic_options(options->num_threads, max_threads);
+        thread_pool = thread_pool_init_elastic(&elastic);
+    }
+    else
+    {
+        thread_pool = thread_pool_init_with_mode(options->num_threads,
+                                                 options->thread_pool_mode);
+    }
     if (!thread_pool)
     {
         MINIWEB_LOG_ERROR("Failed to create thread pool!");
@@ -127,39 +337,51 @@ int miniweb_server_init(miniweb_server_t* restrict server,
         return -1;
     }
     server->thread_pool = thread_pool;
+    thread_pool_set_max_queue_wait(thread_pool, options->max_queue_wait_ms * 1000);
+    server->inline_budget_us = options->inline_budget_us;
+    server->pool_backing     = options->pool_backing;
 
-    pool_t* request_pool = pool_init(REQUEST_BUFFER_SIZE, INIT_NUM_REQUEST_BUFFERS);
-    if (!request_pool)
+    struct miniweb_reactor* reactors =
+        calloc(options->num_reactors, sizeof(struct miniweb_reactor));
+    if (!reactors)
     {
-        MINIWEB_LOG_ERROR("Failed to create pool for request buffers!");
+        MINIWEB_LOG_ERROR("Failed to allocate memory for %zu reactors",
+                          options->num_reactors);
         miniweb_server_clean(server);
         return -2;
     }
-    server->request_buf_pool = request_pool;
+    server->reactors     = reactors;
+    server->num_reactors = options->num_reactors;
 
-    pool_t* dispatch_pool =
-        pool_init(sizeof(struct dispatch_job_data), INIT_NUM_REQUEST_BUFFERS);
-    if (!dispatch_pool)
+    for (size_t i = 0; i < server->num_reactors; ++i) { reactors[i].cpu = -1; }
+    if (options->affinity.policy != CPU_AFFINITY_NONE)
     {
-        MINIWEB_LOG_ERROR("Failed to create pool for dispatch job structures!");
-        miniweb_server_clean(server);
-        return -3;
+        int rc = miniweb_server_set_affinity(server, &options->affinity);
+        if (rc != 0)
+        {
+            MINIWEB_LOG_ERROR("Failed to set CPU affinity for server, rc: %d", rc);
+            miniweb_server_clean(server);
+            return -4;
+        }
     }
-    server->dispatch_pool = dispatch_pool;
 
-    int socket = miniweb_server_get_bound_socket(address, port);
-    if (socket == -1)
+    for (size_t i = 0; i < server->num_reactors; ++i)
     {
-        MINIWEB_LOG_ERROR(
-            "Failed to connect to get a bound socket for address: %s and port: %s",
-            address, port);
-        miniweb_server_clean(server);
-        return -1;
+        server->reactors[i].reactor_num = i;
+
+        // Build the reactor from its own CPU, so its memory starts out on its node
+        cpu_affinity_saved_t* saved =
+            cpu_affinity_move_current_thread(server->reactors[i].cpu);
+        int rc = miniweb_reactor_init(&server->reactors[i], server, address, port);
+        cpu_affinity_restore_current_thread(saved);
+        if (rc != 0)
+        {
+            MINIWEB_LOG_ERROR("Failed to initialise reactor %zu, rc: %d", i, rc);
+            miniweb_server_clean(server);
+            return -3;
+        }
     }
 
-    server->sock_fd = socket;
-    server->router  = router;
-
     return 0;
 }
 
@@ -174,21 +396,60 @@ int miniweb_server_start(miniweb_server_t* server)
         return -1;
     }
 
-    rc = listen(server->sock_fd, MAX_QUEUED_CONNECTIONS);
-    if (rc == -1)
+    for (size_t i = 0; i < server->num_reactors; ++i)
     {
-        MINIWEB_LOG_ERROR("Server failed to start listening on main socket: %d (%s)",
-                          errno, strerror(errno));
-        errno = 0;
-        return -1;
+        cpu_affinity_saved_t* saved =
+            cpu_affinity_move_current_thread(server->reactors[i].cpu);
+        rc = miniweb_reactor_start_listening(&server->reactors[i]);
+        cpu_affinity_restore_current_thread(saved);
+        if (rc != 0) { return -1; }
     }
 
-    // Add the listening socket to our maintained connections for polling
-    connection_manager_add_listener_socket(server->connections, server->sock_fd);
+    server->should_run = true;
+
+    // Reactor 0 runs on the calling thread, the rest get a thread of their own
+    cpu_affinity_pin_current_thread(server->reactors[0].cpu);
+    for (size_t i = 1; i < server->num_reactors; ++i)
+    {
+        struct miniweb_reactor* reactor = &server->reactors[i];
+
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        rc = cpu_affinity_set_attr(&attr, reactor->cpu);
+        if (rc == 0)
+        {
+            rc = pthread_create(&reactor->thread, &attr, miniweb_reactor_thread,
+                                reactor);
+        }
+        pthread_attr_destroy(&attr);
+        if (rc != 0)
+        {
+            MINIWEB_LOG_ERROR("Failed to create thread for reactor %zu: %d", i, rc);
+            server->should_run = false;
+            break;
+        }
+        reactor->thread_started = true;
+    }
 
     // And enter our main loop!
-    server->should_run = true;
-    return miniweb_server_listen(server);
+    if (server->should_run) { rc = miniweb_server_listen(&server->reactors[0]); }
+    else
+    {
+        rc = -1;
+    }
+
+    for (size_t i = 1; i < server->num_reactors; ++i)
+    {
+        struct miniweb_reactor* reactor = &server->reactors[i];
+        if (!reactor->thread_started) continue;
+
+        int join_rc = pthread_join(reactor->thread, NULL);
+        if (join_rc != 0)
+        { MINIWEB_LOG_ERROR("Failed to join reactor %zu: %d", i, join_rc); }
+        reactor->thread_started = false;
+    }
+
+    return rc;
 }
 
 void miniweb_server_stop(miniweb_server_t* server)
@@ -196,15 +457,29 @@ void miniweb_server_stop(miniweb_server_t* server)
     server->should_run = false;
 }
 
+void miniweb_server_get_thread_pool_stats(miniweb_server_t* restrict server,
+                                          thread_pool_stats_t*       stats)
+{
+    assert(server);
+    thread_pool_get_stats(server->thread_pool, stats);
+}
+
+arena_t* miniweb_request_arena(void)
+{
+    return tls_request_arena;
+}
+
 void miniweb_server_clean(miniweb_server_t* restrict server)
 {
     assert(server);
 
     if (server->router) router_destroy(server->router);
-    if (server->connections) connection_manager_destroy(server->connections);
     if (server->thread_pool) thread_pool_destroy(server->thread_pool);
-    if (server->request_buf_pool) pool_destroy(server->request_buf_pool);
-    if (server->dispatch_pool) pool_destroy(server->dispatch_pool);
+    for (size_t i = 0; i < server->num_reactors; ++i)
+    {
+        miniweb_reactor_clean(&server->reactors[i]);
+    }
+    free(server->reactors);
     memset(server, 0, sizeof(struct miniweb_server));
 }
 
@@ -216,26 +491,414 @@ void miniweb_server_destroy(miniweb_server_t* restrict server)
 
 // ==== STATIC FUNCTIONS IMPLEMENTATION ====
 
-static int miniweb_server_listen(struct miniweb_server* server)
+// Picks a CPU for each reactor, then for each worker after them
+static int miniweb_server_set_affinity(struct miniweb_server* server,
+                                       cpu_affinity_t const*  affinity)
 {
-    server->should_run = true;
+    cpu_topology_t* topology = cpu_topology_create();
+    if (!topology)
+    {
+        MINIWEB_LOG_ERROR("Failed to read the CPU topology");
+        return -1;
+    }
+
+    // Pinning a thread to a CPU we can't run on fails when the thread's created,
+    // so catch it here instead
+    if (affinity->policy == CPU_AFFINITY_LIST)
+    {
+        for (size_t i = 0; i < affinity->num_cpus; ++i)
+        {
+            int cpu = affinity->cpus[i];
+            if (cpu_topology_get_node(topology, cpu) != -1) { continue; }
+
+            MINIWEB_LOG_ERROR("CPU %d isn't one we're allowed to run on", cpu);
+            cpu_topology_destroy(topology);
+            return -3;
+        }
+    }
+
+    for (size_t i = 0; i < server->num_reactors; ++i)
+    { server->reactors[i].cpu = cpu_topology_pick_cpu(topology, affinity, i); }
+
+    int rc = thread_pool_set_affinity(server->thread_pool, topology, affinity,
+                                      server->num_reactors);
+    cpu_topology_destroy(topology);
+    if (rc != 0)
+    {
+        MINIWEB_LOG_ERROR("Failed to set CPU affinity for the thread pool: %d", rc);
+        return -2;
+    }
+
+    return 0;
+}
+
+static int miniweb_reactor_init(struct miniweb_reactor* reactor,
+                                struct miniweb_server*  server,
+                                char const* const       address,
+                                char const* const       port)
+{
+    assert(reactor);
+    assert(server);
+
+    reactor->server               = server;
+    reactor->sock_fd              = -1;
+    reactor->completions.event_fd = -1;
+
+    connection_manager_t* conns = connection_manager_create(INITIAL_SERVER_CAPACITY);
+    if (!conns)
+    {
+        MINIWEB_LOG_ERROR("Failed to create connection_manager struct");
+        return -1;
+    }
+    reactor->connections = conns;
+    connection_manager_set_idle_timeout(conns, IDLE_CONNECTION_TIMEOUT_MS);
+
+    // We're on the reactor's CPU, if it has one, so these fault in on its node
+    pool_options_t pool_options = pool_default_options();
+    pool_options.backing        = server->pool_backing;
+
+    size_t const num_classes =
+        sizeof(REQUEST_BUFFER_CLASSES) / sizeof(REQUEST_BUFFER_CLASSES[0]);
+    slab_t* request_slab = slab_init(num_classes, REQUEST_BUFFER_CLASSES,
+                                     &pool_options);
+    if (!request_slab)
+    {
+        MINIWEB_LOG_ERROR("Failed to create slab for request buffers!");
+        return -2;
+    }
+    reactor->request_buf_slab = request_slab;
+    connection_manager_set_read_buffer_slab(conns, request_slab);
+
+    pool_t* dispatch_pool = pool_init_with_options(
+        sizeof(struct dispatch_job_data), INIT_NUM_REQUEST_BUFFERS, &pool_options);
+    if (!dispatch_pool)
+    {
+        MINIWEB_LOG_ERROR("Failed to create pool for dispatch job structures!");
+        return -3;
+    }
+    reactor->dispatch_pool = dispatch_pool;
+
+    pool_options_t arena_options = pool_options;
+    arena_options.concurrent     = true;
+    pool_t* arena_chunk_pool     = pool_init_with_options(
+        ARENA_CHUNK_SIZE, INIT_NUM_ARENA_CHUNKS, &arena_options);
+    if (!arena_chunk_pool)
+    {
+        MINIWEB_LOG_ERROR("Failed to create pool for request arena chunks!");
+        return -6;
+    }
+    reactor->arena_chunk_pool = arena_chunk_pool;
+
+    if (completion_queue_init(&reactor->completions) != 0)
+    {
+        MINIWEB_LOG_ERROR("Failed to create completion queue for reactor");
+        return -5;
+    }
+
+    // Only share the port if there's more than one reactor to share it with
+    bool reuse_port = server->num_reactors > 1;
+    int  socket     = miniweb_server_get_bound_socket(address, port, reuse_port);
+    if (socket == -1)
+    {
+        MINIWEB_LOG_ERROR(
+            "Failed to connect to get a bound socket for address: %s and port: %s",
+            address, port);
+        return -4;
+    }
+    reactor->sock_fd = socket;
+
+    return 0;
+}
+
+static void miniweb_reactor_clean(struct miniweb_reactor* reactor)
+{
+    assert(reactor);
+
+    // Once we're listening the connection manager owns this and closes it
+    if (!reactor->is_listening && reactor->sock_fd != -1) close(reactor->sock_fd);
+    if (reactor->connections) connection_manager_destroy(reactor->connections);
+#ifdef MINIWEB_USE_IO_URING
+    if (reactor->uring) uring_engine_destroy(reactor->uring);
+#endif
+    if (reactor->request_buf_slab) slab_destroy(reactor->request_buf_slab);
+    if (reactor->dispatch_pool) pool_destroy(reactor->dispatch_pool);
+    if (reactor->arena_chunk_pool) pool_destroy(reactor->arena_chunk_pool);
+    completion_queue_clean(&reactor->completions);
+    memset(reactor, 0, sizeof(struct miniweb_reactor));
+}
+
+static int miniweb_reactor_start_listening(struct miniweb_reactor* reactor)
+{
+    int rc = listen(reactor->sock_fd, MAX_QUEUED_CONNECTIONS);
+    if (rc == -1)
+    {
+        MINIWEB_LOG_ERROR(
+            "Reactor %zu failed to start listening on socket %d: %d (%s)",
+            reactor->reactor_num, reactor->sock_fd, errno, strerror(errno));
+        errno = 0;
+        return -1;
+    }
+
+#ifdef MINIWEB_USE_IO_URING
+    // The engine accepts on the socket for us, but we still close it ourselves
+    reactor->uring = uring_engine_create(URING_ENGINE_ENTRIES, reactor->sock_fd,
+                                         reactor->request_buf_slab,
+                                         URING_RECV_BUFFER_SIZE);
+    if (!reactor->uring)
+    {
+        MINIWEB_LOG_ERROR("Reactor %zu failed to create io_uring engine",
+                          reactor->reactor_num);
+        return -2;
+    }
+    uring_engine_set_idle_timeout(reactor->uring, IDLE_CONNECTION_TIMEOUT_MS);
+
+    rc = uring_engine_watch_completions(reactor->uring, &reactor->completions);
+#else
+    // Add the listening socket to our maintained connections for polling
+    connection_manager_add_listener_socket(reactor->connections, reactor->sock_fd);
+    reactor->is_listening = true;
+
+    rc = connection_manager_add_completion_queue(reactor->connections,
+                                                 &reactor->completions);
+#endif
+    if (rc != 0)
+    {
+        MINIWEB_LOG_ERROR("Reactor %zu failed to watch its completion queue: %d",
+                          reactor->reactor_num, rc);
+        return -3;
+    }
+    return 0;
+}
+
+static void* miniweb_reactor_thread(void* data)
+{
+    struct miniweb_reactor* reactor = data;
+
+    int rc = miniweb_server_listen(reactor);
+    if (rc != 0)
+    {
+        MINIWEB_LOG_ERROR("Reactor %zu did not exit cleanly, rc: %d",
+                          reactor->reactor_num, rc);
+    }
+
+    return NULL;
+}
+
+#ifdef MINIWEB_USE_IO_URING
+
+static int miniweb_server_listen(struct miniweb_reactor* reactor)
+{
+    struct miniweb_server* server = reactor->server;
+    for (;;)
+    {
+        uring_event_t event = {0};
+        while (uring_engine_get_next_event(reactor->uring, &event))
+        {
+            MINIWEB_LOG_INFO("Got event %d on socket %d", event.type, event.sockfd);
+            int rc = 0;
+            switch (event.type)
+            {
+                case URING_EVENT_ACCEPT:
+                {
+                    rc = miniweb_reactor_add_connection(reactor, event.sockfd);
+                    break;
+                }
+                case URING_EVENT_RECV:
+                {
+                    rc = miniweb_reactor_handle_recv(reactor, &event);
+                    break;
+                }
+                case URING_EVENT_CLOSED:
+                {
+                    struct connection* connection =
+                        connection_manager_get_connection(reactor->connections,
+                                                          event.sockfd);
+                    if (connection)
+                    { miniweb_reactor_close_connection(reactor, connection); }
+                    else
+                    {
+                        uring_engine_close_connection(reactor->uring, event.sockfd);
+                    }
+                    break;
+                }
+                case URING_EVENT_COMPLETIONS:
+                {
+                    miniweb_reactor_process_finished_jobs(reactor);
+                    break;
+                }
+            }
+
+            if (rc != 0)
+            { MINIWEB_LOG_ERROR("Failed to handle event on socket %d!", event.sockfd); }
+        }
+
+        miniweb_reactor_submit_pending_jobs(reactor);
+
+        // These come back round as URING_EVENT_CLOSED, so there's nothing else to do
+        uring_engine_close_idle_connections(reactor->uring);
+        miniweb_reactor_trim_pools(reactor);
+
+        if (!server->should_run)
+        {
+            MINIWEB_LOG_ERROR("Server for socket %d is stopping!", reactor->sock_fd);
+            break;
+        }
+    }
+
+    // We've successfully exited
+    return 0;
+}
+
+static int miniweb_reactor_add_connection(struct miniweb_reactor* reactor,
+                                          int                     sockfd)
+{
+    // The engine owns the socket, we just keep the same state for it as we would
+    // for any other connection
+    int rc =
+        connection_manager_add_borrowed_connection(reactor->connections, sockfd);
+    if (rc != 0)
+    {
+        MINIWEB_LOG_ERROR("Failed to track new connection on socket %d", sockfd);
+        close(sockfd);
+        return -1;
+    }
+
+    rc = uring_engine_add_connection(reactor->uring, sockfd);
+    if (rc != 0)
+    {
+        connection_manager_remove_connection(reactor->connections, sockfd);
+        close(sockfd);
+        return -2;
+    }
+
+    MINIWEB_LOG_INFO("Reactor %zu accepted new connection on socket %d!",
+                     reactor->reactor_num, sockfd);
+    return 0;
+}
+
+static int miniweb_reactor_handle_recv(struct miniweb_reactor* reactor,
+                                       uring_event_t const*    event)
+{
+    struct connection* connection =
+        connection_manager_get_connection(reactor->connections, event->sockfd);
+    if (!connection)
+    {
+        MINIWEB_LOG_ERROR("Got data for untracked socket %d", event->sockfd);
+        slab_free(reactor->request_buf_slab, event->buffer);
+        return -1;
+    }
+
+    // It's on its way out, so anything more the client sends is of no use
+    if (connection->flags & CONNECTION_FLAG_CLOSING)
+    {
+        slab_free(reactor->request_buf_slab, event->buffer);
+        return 0;
+    }
+
+    // A recv can hold any part of a request, or several of them, so they're put
+    // back together in the read buffer just as the epoll path does
+    size_t searched = connection->read_len;
+    if (!connection->read_buffer.data)
+    {
+        // Nothing left over from before, so the recv buffer can just be kept
+        connection->read_buffer = event->buffer;
+        connection->read_len    = event->num_bytes;
+    }
+    else
+    {
+        size_t        needed = connection->read_len + event->num_bytes + 1;
+        slab_handle_t bigger = slab_grow(reactor->request_buf_slab,
+                                         connection->read_buffer, needed,
+                                         connection->read_len);
+        if (!bigger.data)
+        {
+            MINIWEB_LOG_ERROR(
+                "Request on socket %d is bigger than %zu bytes, giving up",
+                event->sockfd, slab_get_max_size(reactor->request_buf_slab) - 1);
+            slab_free(reactor->request_buf_slab, event->buffer);
+            miniweb_reactor_close_connection(reactor, connection);
+            return -1;
+        }
+
+        memcpy((char*) bigger.data + connection->read_len, event->buffer.data,
+               event->num_bytes);
+        connection->read_buffer = bigger;
+        connection->read_len += event->num_bytes;
+        slab_free(reactor->request_buf_slab, event->buffer);
+    }
+
+    int failed = miniweb_reactor_dispatch_buffered(reactor, connection, searched);
+    if (failed < 0) { return failed; }
+
+    int rc = miniweb_reactor_resume_connection(reactor, connection);
+    if (rc != 0) { return rc; }
+
+    return failed > 0 ? -1 : 0;
+}
+
+// Called whenever the reactor gets a connection back. Every response that's ready
+// goes to the engine, which sends them in the order it gets them. It keeps
+// receiving regardless, so after that all there is to do is close it once it's
+// finished with. Returns negative if the connection had to be closed.
+static int miniweb_reactor_resume_connection(struct miniweb_reactor* reactor,
+                                             struct connection*      connection)
+{
+    http_file_response_t response = {0};
+    while (connection->responses
+           && response_queue_take_next(connection->responses, &response))
+    {
+        // Just a placeholder for a request that failed, so nothing to send
+        if (response.header_len == 0) { continue; }
+
+        int rc =
+            uring_engine_send_response(reactor->uring, connection->fd, &response);
+        if (rc != 0)
+        {
+            miniweb_reactor_close_connection(reactor, connection);
+            return rc;
+        }
+    }
+
+    if (connection->jobs_in_flight > 0)
+    {
+        connection->state = CONNECTION_STATE_WORKERS;
+        return 0;
+    }
+
+    connection->state = CONNECTION_STATE_REACTOR;
+    if (connection->flags & CONNECTION_FLAG_CLOSING)
+    { miniweb_reactor_close_connection(reactor, connection); }
+
+    return 0;
+}
+
+#else
+
+static int miniweb_server_listen(struct miniweb_reactor* reactor)
+{
+    struct miniweb_server* server = reactor->server;
     for (;;)
     {
         int recv_fd = -1;
-        while (connection_manager_get_next_event(server->connections, &recv_fd))
+        while (connection_manager_get_next_event(reactor->connections, &recv_fd))
         {
             MINIWEB_LOG_INFO("Got event: %d", recv_fd);
             int failed_handles = 0;
-            if (recv_fd == server->sock_fd)
+            if (recv_fd == reactor->sock_fd)
             {
                 // NEW CONNECTION
-                int rc = miniweb_server_handle_new_connection(server);
+                int rc = miniweb_server_handle_new_connection(reactor);
                 if (rc != 0) ++failed_handles;
             }
+            else if (recv_fd == reactor->completions.event_fd)
+            {
+                // WORKERS HAVE FINISHED WITH SOME CONNECTIONS
+                miniweb_reactor_process_finished_jobs(reactor);
+            }
             else
             {
                 // NEW MESSAGE FROM CONNECTED CLIENT
-                int rc = miniweb_server_process_client_event(server, recv_fd);
+                int rc = miniweb_server_process_client_event(reactor, recv_fd);
                 if (rc != 0) ++failed_handles;
             }
 
@@ -243,9 +906,17 @@ static int miniweb_server_listen(struct miniweb_server* server)
             { MINIWEB_LOG_ERROR("Failed to handle %d events!", failed_handles); }
         }
 
+        miniweb_reactor_submit_pending_jobs(reactor);
+
+        size_t num_idle =
+            connection_manager_close_idle_connections(reactor->connections);
+        if (num_idle > 0)
+        { MINIWEB_LOG_INFO("Closed %zu idle connections", num_idle); }
+        miniweb_reactor_trim_pools(reactor);
+
         if (!server->should_run)
         {
-            MINIWEB_LOG_ERROR("Server for socket %d is stopping!", server->sock_fd);
+            MINIWEB_LOG_ERROR("Server for socket %d is stopping!", reactor->sock_fd);
             break;
         }
     }
@@ -254,13 +925,14 @@ static int miniweb_server_listen(struct miniweb_server* server)
     return 0;
 }
 
-static int miniweb_server_handle_new_connection(struct miniweb_server* server)
+static int miniweb_server_handle_new_connection(struct miniweb_reactor* reactor)
 {
     struct sockaddr_storage their_addr = {0};
     socklen_t               addrlen    = sizeof(their_addr);
 
-    int new_sockfd =
-        accept(server->sock_fd, (struct sockaddr*) &their_addr, &addrlen);
+    // Reads happen on the reactor, so they must never block
+    int new_sockfd = accept4(reactor->sock_fd, (struct sockaddr*) &their_addr,
+                             &addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
 
     if (new_sockfd == -1)
     {
@@ -275,55 +947,330 @@ static int miniweb_server_handle_new_connection(struct miniweb_server* server)
               get_sockaddr_in_from_sockaddr((struct sockaddr*) &their_addr),
               their_addr_string, INET6_ADDRSTRLEN);
 
-    int rc = connection_manager_add_new_connection(server->connections, new_sockfd);
+    int rc = connection_manager_add_new_connection(reactor->connections, new_sockfd);
     if (rc != 0)
     {
         MINIWEB_LOG_ERROR("Failed to add new connection to the manager, rejecting"
                           "connection from %s",
                           their_addr_string);
+        close(new_sockfd);
         return -1;
     }
 
-    MINIWEB_LOG_INFO("Accepted new connection from: %s on socket %d!",
-                     their_addr_string, new_sockfd);
+    MINIWEB_LOG_INFO("Reactor %zu accepted new connection from: %s on socket %d!",
+                     reactor->reactor_num, their_addr_string, new_sockfd);
     return 0;
 }
 
-static int miniweb_server_process_client_event(struct miniweb_server* server,
-                                               int                    connection_fd)
+static int miniweb_server_process_client_event(struct miniweb_reactor* reactor,
+                                               int connection_fd)
 {
     MINIWEB_LOG_INFO("Received event on socket %d", connection_fd);
 
-    pool_handle_t buf_handle = pool_calloc(server->request_buf_pool);
-    if (!buf_handle.data)
+    struct connection* connection =
+        connection_manager_get_connection(reactor->connections, connection_fd);
+    if (!connection)
     {
-        MINIWEB_LOG_ERROR("Failed to get a free request buffer!");
+        MINIWEB_LOG_ERROR("Got an event for untracked socket %d", connection_fd);
         return -1;
     }
 
-    char* buffer       = buf_handle.data;
-    int   num_bytes    = recv(connection_fd, buffer, REQUEST_BUFFER_SIZE, 0);
-    if (num_bytes <= 0)
+    // We were only waiting for it to drain, so carry on writing
+    if (connection->state == CONNECTION_STATE_WRITING)
+    { return miniweb_reactor_resume_connection(reactor, connection); }
+
+    // Read whatever has arrived so far, which may well not be a whole request
+    size_t searched = connection->read_len;
+    int    rc       = miniweb_reactor_read_connection(reactor, connection);
+    if (rc != 0)
+    {
+        miniweb_reactor_close_connection(reactor, connection);
+        return rc > 0 ? 0 : rc;
+    }
+
+    int failed = miniweb_reactor_dispatch_buffered(reactor, connection, searched);
+    if (failed < 0) { return failed; }
+
+    rc = miniweb_reactor_resume_connection(reactor, connection);
+    if (rc != 0) { return rc; }
+
+    return failed > 0 ? -1 : 0;
+}
+
+// Returns 0 once the socket has nothing more for us, 1 if the client hung up, or
+// negative on error
+static int miniweb_reactor_read_connection(struct miniweb_reactor* reactor,
+                                           struct connection*      connection)
+{
+    if (!connection->read_buffer.data)
+    {
+        // Start small, process_client_event moves it up if a request doesn't fit
+        connection->read_buffer = slab_alloc(reactor->request_buf_slab, 0);
+        connection->read_len    = 0;
+        if (!connection->read_buffer.data)
+        {
+            MINIWEB_LOG_ERROR("Failed to get a free request buffer!");
+            return -1;
+        }
+    }
+
+    char*  buffer   = connection->read_buffer.data;
+    size_t capacity = connection->read_buffer.size;
+
+    // Leave room for a NUL terminator, the request is treated as a string later
+    while (connection->read_len < capacity - 1)
     {
-        int rc = 0;
+        ssize_t num_bytes = recv(connection->fd, buffer + connection->read_len,
+                                 capacity - 1 - connection->read_len, 0);
+        if (num_bytes > 0)
+        {
+            connection->read_len += num_bytes;
+            continue;
+        }
+
         if (num_bytes == 0)
         {
             MINIWEB_LOG_ERROR("Connection on socket %d closed by client",
-                              connection_fd);
-            rc = 0;
+                              connection->fd);
+            return 1;
         }
-        else
+
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
         {
-            MINIWEB_LOG_ERROR("Error recv()ing: %d (%s)", errno, strerror(errno));
-            rc = -1;
+            errno = 0;
+            break;
         }
-        close(connection_fd);
-        connection_manager_remove_connection(server->connections, connection_fd);
+        if (errno == EINTR)
+        {
+            errno = 0;
+            continue;
+        }
+
+        MINIWEB_LOG_ERROR("Error recv()ing: %d (%s)", errno, strerror(errno));
+        errno = 0;
+        return -1;
+    }
+
+    return 0;
+}
+
+// Writes out every response that's ready, in order. Returns 0 once there's nothing
+// more we can send, 1 if the socket filled up first, or negative on error.
+static int miniweb_reactor_flush_connection(struct connection* connection)
+{
+    for (;;)
+    {
+        if (!connection->has_output)
+        {
+            if (!connection->responses
+                || !response_queue_take_next(connection->responses,
+                                             &connection->output))
+            { return 0; }
+
+            // Just a placeholder for a request that failed, so nothing to write
+            if (connection->output.header_len == 0) { continue; }
+
+            connection->has_output      = true;
+            connection->output_progress = (http_send_progress_t) {0};
+        }
+
+        int rc = http_helpers_try_send_prepared_response(
+            connection->fd, &connection->output, &connection->output_progress);
+        if (rc > 0) { return rc; }
+
+        if (connection->output.file_fd != -1) { close(connection->output.file_fd); }
+        connection->has_output = false;
+        if (rc < 0)
+        {
+            MINIWEB_LOG_ERROR("Failed to send queued response to socket %d: %d",
+                              connection->fd, rc);
+            return rc;
+        }
+    }
+}
+
+// Called whenever the reactor gets a connection back, to write what it can and work
+// out what to wait for next. Returns negative if the connection had to be closed.
+static int miniweb_reactor_resume_connection(struct miniweb_reactor* reactor,
+                                             struct connection*      connection)
+{
+    int connection_fd = connection->fd;
+
+    int rc = miniweb_reactor_flush_connection(connection);
+    if (rc < 0)
+    {
+        miniweb_reactor_close_connection(reactor, connection);
         return rc;
     }
 
+    enum connection_interest interest = CONNECTION_INTEREST_READ;
+    if (rc > 0)
+    {
+        // We'll pick up anything the workers finish in the meantime when it drains
+        connection->state = CONNECTION_STATE_WRITING;
+        interest          = CONNECTION_INTEREST_WRITE;
+    }
+    else if (connection->jobs_in_flight > 0)
+    {
+        // The workers still have some, and will hand it back once they're done
+        connection->state = CONNECTION_STATE_WORKERS;
+        return 0;
+    }
+    else
+    {
+        connection->state = CONNECTION_STATE_REACTOR;
+        if (connection->flags & CONNECTION_FLAG_CLOSING)
+        {
+            miniweb_reactor_close_connection(reactor, connection);
+            return 0;
+        }
+    }
+
+    rc = connection_manager_rearm_connection(reactor->connections, connection_fd,
+                                             interest);
+    if (rc != 0)
+    {
+        miniweb_reactor_close_connection(reactor, connection);
+        return -1;
+    }
+
+    return 0;
+}
+
+#endif // MINIWEB_USE_IO_URING
+
+static void miniweb_reactor_close_connection(struct miniweb_reactor* reactor,
+                                             struct connection*      connection)
+{
+    // Workers may still be writing to it, so it has to wait for them
+    if (connection->jobs_in_flight > 0)
+    {
+        connection->flags |= CONNECTION_FLAG_CLOSING;
+        connection->state = CONNECTION_STATE_WORKERS;
+        return;
+    }
+
+    // Stop watching the socket before closing it, epoll won't accept a closed fd.
+    // This also frees any partial request or response we were holding for it.
+    int connection_fd = connection->fd;
+    connection_manager_remove_connection(reactor->connections, connection_fd);
+#ifdef MINIWEB_USE_IO_URING
+    // The engine holds on to it until any sends it has queued are done
+    uring_engine_close_connection(reactor->uring, connection_fd);
+#else
+    close(connection_fd);
+#endif
+}
+
+// Hands every whole request in the connection's read buffer to the pool, and keeps
+// whatever's left for the next read. Returns negative if the connection had to be
+// closed, otherwise how many of the requests couldn't be dispatched.
+static int miniweb_reactor_dispatch_buffered(struct miniweb_reactor* reactor,
+                                             struct connection*      connection,
+                                             size_t                  searched)
+{
+    int connection_fd = connection->fd;
+    if (!connection->responses)
+    {
+        connection->responses = response_queue_create();
+        if (!connection->responses)
+        {
+            miniweb_reactor_close_connection(reactor, connection);
+            return -1;
+        }
+    }
+
+    // Clients may pipeline, so there could be any number of whole requests here.
+    // They all go to the pool now, and the response queue puts them back in order.
+    char*  buffer = connection->read_buffer.data;
+    size_t offset = 0;
+    int    failed = 0;
+    for (;;)
+    {
+        size_t already_searched = searched > offset ? searched - offset : 0;
+        size_t request_len      = http_helpers_find_request_end(
+            connection->read_len - offset, buffer + offset, already_searched);
+        if (request_len == 0) { break; }
+
+        slab_handle_t request = {0};
+        if (offset == 0 && request_len == connection->read_len)
+        {
+            // The common case of exactly one request, so just hand the buffer over
+            request                 = connection->read_buffer;
+            connection->read_buffer = (slab_handle_t) {0};
+            connection->read_len    = 0;
+        }
+        else
+        {
+            request = slab_alloc(reactor->request_buf_slab, request_len + 1);
+            if (!request.data)
+            {
+                MINIWEB_LOG_ERROR("Failed to get a request buffer for socket %d",
+                                  connection_fd);
+                miniweb_reactor_close_connection(reactor, connection);
+                return -1;
+            }
+            memcpy(request.data, buffer + offset, request_len);
+        }
+        ((char*) request.data)[request_len] = '\0';
+        offset += request_len;
+
+        int rc = miniweb_server_dispatch_request(reactor, connection_fd, connection,
+                                                 request, request_len);
+        if (rc != 0) ++failed;
+
+        if (!connection->read_buffer.data) { break; }
+    }
+
+    // Whatever is left is the start of the next request
+    if (connection->read_buffer.data)
+    {
+        size_t remaining = connection->read_len - offset;
+        if (remaining == 0)
+        {
+            slab_free(reactor->request_buf_slab, connection->read_buffer);
+            connection->read_buffer = (slab_handle_t) {0};
+        }
+        else if (offset > 0)
+        {
+            memmove(buffer, buffer + offset, remaining);
+        }
+        connection->read_len = remaining;
+
+        // We keep one byte back for the NUL terminator. If that's filled the buffer,
+        // move up a class and pick up the rest on the next read.
+        size_t capacity = connection->read_buffer.size;
+        if (remaining >= capacity - 1)
+        {
+            slab_handle_t bigger = slab_grow(reactor->request_buf_slab,
+                                             connection->read_buffer, capacity + 1,
+                                             remaining);
+            if (!bigger.data)
+            {
+                MINIWEB_LOG_ERROR(
+                    "Request on socket %d is bigger than %zu bytes, giving up",
+                    connection_fd, capacity - 1);
+                miniweb_reactor_close_connection(reactor, connection);
+                return -1;
+            }
+            connection->read_buffer = bigger;
+        }
+    }
+
+    return failed;
+}
+
+static int miniweb_server_dispatch_request(struct miniweb_reactor* reactor,
+                                           int                     connection_fd,
+                                           struct connection*      connection,
+                                           slab_handle_t           buf_handle,
+                                           size_t                  num_bytes)
+{
+    struct miniweb_server* server = reactor->server;
+    char*                  buffer = buf_handle.data;
+
     // We got some data! Let's just log it for now :)
-    MINIWEB_LOG_ERROR("Got %d bytes of data from socket %d: '%s'", num_bytes,
+    MINIWEB_LOG_ERROR("Got %zu bytes of data from socket %d: '%s'", num_bytes,
                       connection_fd, buffer);
 
     char               routebuf[ROUTE_MAX_LENGTH] = {0};
@@ -331,62 +1278,272 @@ static int miniweb_server_process_client_event(struct miniweb_server* server,
     if (!route)
     {
         MINIWEB_LOG_ERROR("Failed to get route from request!");
+        slab_free(reactor->request_buf_slab, buf_handle);
         return -1;
     }
 
-    // If this is NULL, then our dispatch job will just send back a 404
-    void*       user_data    = NULL;
-    routerfunc* process_func =
-        router_get_route_func(server->router, route, &user_data);
+    // If there's no func, then our dispatch job will just send back a 404
+    route_info_t info = {0};
+    router_get_route_info(server->router, route, &info);
+
+    // From here on the request always gets a response, so it can take its place
+    response_queue_t* responses = connection ? connection->responses : NULL;
+    uint64_t          seq       = responses ? response_queue_next_seq(responses) : 0;
+
+    struct dispatch_job_data job = {.sock_fd      = connection_fd,
+                                    .process_func = info.func,
+                                    .request_buf  = buf_handle,
+                                    .user_data    = info.user_data,
+                                    .responses    = responses,
+                                    .seq          = seq,
+                                    .reactor      = reactor};
+
+    if (info.run_mode == ROUTE_RUN_INLINE && server->inline_budget_us > 0)
+    { return miniweb_reactor_run_inline(reactor, route, &job); }
+
+    if (responses) { response_queue_retain(responses); }
+
+    pool_handle_t dispatch_handle = pool_alloc(reactor->dispatch_pool);
+    job.handle_to_me              = dispatch_handle;
+    *((struct dispatch_job_data*) dispatch_handle.data) = job;
+
+    // It goes to the pool with everything else from this round of events
+    if (reactor->num_pending_jobs == MAX_PENDING_JOBS)
+    { miniweb_reactor_submit_pending_jobs(reactor); }
+    reactor->pending_jobs[reactor->num_pending_jobs++] = (thread_pool_job_t) {
+        .func     = &dispatch_response_job,
+        .data     = dispatch_handle.data,
+        .priority = dispatch_job_priority(info.priority)};
+
+    if (connection) { ++connection->jobs_in_flight; }
+    return 0;
+}
+
+// Runs the route there and then, saving the trip through the thread pool and back.
+// The request is done with by the time this returns.
+static int miniweb_reactor_run_inline(struct miniweb_reactor*   reactor,
+                                      char const*               route,
+                                      struct dispatch_job_data* job)
+{
+    struct miniweb_server* server = reactor->server;
+
+    uint64_t start_us = miniweb_now_us();
+    dispatch_prepare_response(job);
+    uint64_t took_us = miniweb_now_us() - start_us;
 
-    pool_handle_t dispatch_handle = pool_alloc(server->dispatch_pool);
-    *((struct dispatch_job_data*) dispatch_handle.data) =
-        (struct dispatch_job_data) {.sock_fd       = connection_fd,
-                                    .process_func  = process_func,
-                                    .request_buf   = buf_handle,
-                                    .handle_to_me  = dispatch_handle,
-                                    .dispatch_pool = server->dispatch_pool,
-                                    .request_pool  = server->request_buf_pool};
+    slab_free(reactor->request_buf_slab, job->request_buf);
+
+    if (took_us > server->inline_budget_us)
+    {
+        MINIWEB_LOG_ERROR("Inline route %s took %lluus, over its budget of %lluus",
+                          route, (unsigned long long) took_us,
+                          (unsigned long long) server->inline_budget_us);
+        if (router_report_inline_overrun(server->router, route, MAX_INLINE_OVERRUNS))
+        {
+            MINIWEB_LOG_ERROR("Route %s is too slow to run inline, it goes to the "
+                              "thread pool from now on",
+                              route);
+        }
+    }
 
-    int rc = thread_pool_run(server->thread_pool, &dispatch_response_job,
-                             dispatch_handle.data);
+    int rc = miniweb_reactor_send_in_order(reactor, job->sock_fd, job->responses,
+                                           job->seq, &job->response);
     if (rc != 0)
     {
-        MINIWEB_LOG_ERROR(
-            "Failed to add response job to the thread pool. Returning 500 error.");
-        miniweb_response_t response = miniweb_build_file_response("res/500.html");
-        return http_helpers_send_response(connection_fd, &response);
+        MINIWEB_LOG_ERROR("Failed to send response to socket %d: %d", job->sock_fd,
+                          rc);
     }
 
-    return 0;
+    return rc;
 }
 
-// Job to run on the threadpool when we get a request
+static void miniweb_reactor_submit_pending_jobs(struct miniweb_reactor* reactor)
+{
+    if (reactor->num_pending_jobs == 0) { return; }
+
+    size_t queued = thread_pool_run_batch(reactor->server->thread_pool,
+                                          reactor->num_pending_jobs,
+                                          reactor->pending_jobs);
+    if (queued < reactor->num_pending_jobs)
+    {
+        MINIWEB_LOG_ERROR("Thread pool is overloaded, turning away %zu requests",
+                          reactor->num_pending_jobs - queued);
+    }
+
+    // The pool leaves the ones it turned away at the end, whatever lane they were
+    // for. Answering straight away keeps the reactor free for everyone else. They
+    // come back round just like jobs the workers finished.
+    for (size_t i = queued; i < reactor->num_pending_jobs; ++i)
+    {
+        struct dispatch_job_data* job = reactor->pending_jobs[i].data;
+        http_helpers_prepare_overloaded_response(&job->response);
+        miniweb_reactor_hand_back_job(job);
+    }
+
+    reactor->num_pending_jobs = 0;
+}
+
+// Sends it now if the connection doesn't keep its responses in order, otherwise
+// puts it in its place in the queue. Takes ownership of prepared->file_fd.
+static int miniweb_reactor_send_in_order(struct miniweb_reactor*     reactor,
+                                         int                         sockfd,
+                                         response_queue_t*           responses,
+                                         uint64_t                    seq,
+                                         http_file_response_t const* prepared)
+{
+    if (!responses)
+    {
+        // Nothing came of the request, and nothing's waiting behind it
+        if (prepared->header_len == 0) { return 0; }
+        return miniweb_reactor_send_prepared(reactor, sockfd, prepared);
+    }
+
+    // It's written out once the connection's resumed
+    int rc = response_queue_add(responses, seq, prepared);
+    if (rc != 0 && prepared->file_fd != -1) { close(prepared->file_fd); }
+
+    return rc;
+}
+
+// Takes ownership of prepared->file_fd
+static int miniweb_reactor_send_prepared(struct miniweb_reactor*     reactor,
+                                         int                         sockfd,
+                                         http_file_response_t const* prepared)
+{
+#ifdef MINIWEB_USE_IO_URING
+    return uring_engine_send_response(reactor->uring, sockfd, prepared);
+#else
+    (void) reactor;
+
+    int rc = http_helpers_send_prepared_response(sockfd, prepared);
+    if (prepared->file_fd != -1) { close(prepared->file_fd); }
+    return rc;
+#endif
+}
+
+// Job to run on the threadpool when we get a request. It only builds the response,
+// the reactor sends it.
 static void dispatch_response_job(void* data)
 {
     struct dispatch_job_data* args = data;
-    miniweb_response_t        response = {0};
 
-    if (!args->process_func)
+    dispatch_prepare_response(args);
+    miniweb_reactor_hand_back_job(args);
+}
+
+// Runs the route and gets its response ready to send. This is the slow part,
+// opening the file and formatting the header.
+static void dispatch_prepare_response(struct dispatch_job_data* job)
+{
+    miniweb_response_t response = {0};
+
+    // Lives until the response is ready, the response itself is copied out by value
+    arena_t arena = {0};
+    arena_init(&arena, job->reactor->arena_chunk_pool);
+    tls_request_arena = &arena;
+
+    if (!job->process_func)
     { response = miniweb_build_file_response("res/404.html"); }
     else
     {
-        response = args->process_func(args->user_data, args->request_buf.data);
+        response = job->process_func(job->user_data, job->request_buf.data);
     }
 
-    int rc = http_helpers_send_response(args->sock_fd, &response);
+    int rc = http_helpers_prepare_response(&response, &job->response);
     if (rc != 0)
     {
-        MINIWEB_LOG_ERROR("Failed to send response to socket %d: %d", args->sock_fd,
-                          rc);
+        MINIWEB_LOG_ERROR("Failed to prepare response for socket %d: %d",
+                          job->sock_fd, rc);
+        // Even with nothing to send, later responses mustn't wait on this one
+        job->response = (http_file_response_t) {.file_fd = -1};
     }
 
-    pool_free(args->request_pool, args->request_buf);
-    pool_free(args->dispatch_pool, args->handle_to_me);
+    tls_request_arena = NULL;
+    arena_reset(&arena);
+}
+
+static void miniweb_reactor_trim_pools(struct miniweb_reactor* reactor)
+{
+    uint64_t now_ms = miniweb_now_us() / 1000;
+    if (now_ms < reactor->next_trim_ms) { return; }
+    reactor->next_trim_ms = now_ms + POOL_TRIM_INTERVAL_MS;
+
+    // Keep what we started with, that much is always worth having ready
+    size_t released =
+        slab_trim(reactor->request_buf_slab)
+        + pool_trim(reactor->dispatch_pool, INIT_NUM_REQUEST_BUFFERS)
+        + pool_trim(reactor->arena_chunk_pool, INIT_NUM_ARENA_CHUNKS);
+    if (released > 0)
+    {
+        MINIWEB_LOG_INFO("Reactor %zu gave %zu bytes of idle pool memory back",
+                         reactor->reactor_num, released);
+    }
+}
+
+static enum thread_pool_priority dispatch_job_priority(enum route_priority priority)
+{
+    switch (priority)
+    {
+        case ROUTE_PRIORITY_HIGH:
+            return THREAD_POOL_PRIORITY_HIGH;
+        case ROUTE_PRIORITY_LOW:
+            return THREAD_POOL_PRIORITY_LOW;
+        case ROUTE_PRIORITY_NORMAL:
+        default:
+            return THREAD_POOL_PRIORITY_NORMAL;
+    }
+}
+
+static uint64_t miniweb_now_us(void)
+{
+    struct timespec now = {0};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return ((uint64_t) now.tv_sec * 1000000) + ((uint64_t) now.tv_nsec / 1000);
+}
+
+static void miniweb_reactor_hand_back_job(struct dispatch_job_data* job)
+{
+    completion_queue_post(&job->reactor->completions, &job->finished_node);
+}
+
+static void miniweb_reactor_process_finished_jobs(struct miniweb_reactor* reactor)
+{
+    mpsc_node_t* node = completion_queue_take_all(&reactor->completions);
+    while (node)
+    {
+        mpsc_node_t*              next = node->next;
+        struct dispatch_job_data* job =
+            CONTAINER_OF(node, struct dispatch_job_data, finished_node);
+
+        int rc = miniweb_reactor_send_in_order(reactor, job->sock_fd, job->responses,
+                                               job->seq, &job->response);
+        if (rc != 0)
+        {
+            MINIWEB_LOG_ERROR("Failed to send response to socket %d: %d",
+                              job->sock_fd, rc);
+        }
+        if (job->responses) { response_queue_release(job->responses); }
+
+        struct connection* connection =
+            connection_manager_get_connection(reactor->connections, job->sock_fd);
+        assert(connection && connection->jobs_in_flight > 0);
+
+        // Its response is waiting for us, unless we're already waiting on the
+        // socket to write an earlier one
+        --connection->jobs_in_flight;
+        if (connection->state == CONNECTION_STATE_WORKERS)
+        { miniweb_reactor_resume_connection(reactor, connection); }
+
+        slab_free(reactor->request_buf_slab, job->request_buf);
+        pool_free(reactor->dispatch_pool, job->handle_to_me);
+        node = next;
+    }
 }
 
 static int miniweb_server_get_bound_socket(char const* const address,
-                                           char const* const port)
+                                           char const* const port,
+                                           bool              reuse_port)
 {
     assert(address);
     assert(port);
@@ -426,16 +1583,31 @@ static int miniweb_server_get_bound_socket(char const* const address,
             MINIWEB_LOG_ERROR("Failed to set socket to allow address reuse: %d (%s)",
                               errno, strerror(errno));
             errno = 0;
+            close(sockfd);
             continue;
         }
 
-        int bind_rc = bind(sockfd, info->ai_addr, info->ai_addrlen);
+        if (reuse_port)
+        {
+            rc = setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes));
+            if (rc == -1)
+            {
+                MINIWEB_LOG_ERROR("Failed to set socket to allow port reuse: %d (%s)",
+                                  errno, strerror(errno));
+                errno = 0;
+                close(sockfd);
+                continue;
+            }
+        }
+
+        int bind_rc = bind(sockfd, p->ai_addr, p->ai_addrlen);
         if (bind_rc == -1)
         {
             MINIWEB_LOG_ERROR(
                 "Failed to bind socket %d for address: %s and port: %s (%s)", sockfd,
                 address, port, strerror(errno));
             errno = 0;
+            close(sockfd);
             continue;
         }
 
@@ -1,24 +1,82 @@
 #ifndef INCLUDED_SERVER_H
 #define INCLUDED_SERVER_H
 
+#include "arena.h"
+#include "cpu_affinity.h"
+#include "pool.h"
 #include "router.h"
+#include "thread_pool.h"
+
+#include <stdint.h>
+#include <stdlib.h>
 
 typedef struct miniweb_server miniweb_server_t;
 
+typedef struct miniweb_server_options
+{
+    // Number of event loops to run. Each gets its own SO_REUSEPORT listening
+    // socket, the first runs on the thread that calls miniweb_server_start
+    size_t num_reactors;
+    // Number of worker threads in the shared thread pool
+    size_t num_threads;
+    // How the reactors' jobs get shared out between those threads
+    enum thread_pool_mode thread_pool_mode;
+    // THREAD_POOL_MODE_ELASTIC starts with num_threads workers and adds more, up
+    // to this many, while requests are kept waiting
+    size_t max_threads;
+    // Requests that find the thread pool's queue full, or that would be kept
+    // waiting longer than this for a worker, get a 503 straight away. 0 makes the
+    // reactors wait for room instead, holding up all their other connections.
+    uint64_t max_queue_wait_ms;
+    // How long a reactor gives an inline route before it counts as an overrun. After
+    // a few of those the route goes to the thread pool instead. 0 sends every
+    // route to the pool.
+    uint64_t inline_budget_us;
+    // Where the reactors' buffer pools get their memory. Anything but
+    // POOL_BACKING_HEAP faults their initial buffers in before we start accepting
+    // connections.
+    enum pool_backing pool_backing;
+    // Where to pin the reactors and the workers, numbered in that order. Reactor 0
+    // is the thread that calls miniweb_server_start, so that gets pinned too.
+    cpu_affinity_t affinity;
+} miniweb_server_options_t;
+
+miniweb_server_options_t miniweb_server_default_options(void);
+
 // this will take ownership of the router - the user is not responsible for
-// destroying it
+// destroying it, even if creating the server fails
 miniweb_server_t* miniweb_server_create(char const* const address,
                                         char const* const port,
                                         router_t*         router);
-int               miniweb_server_init(miniweb_server_t* restrict server,
-                                      char const* const          address,
-                                      char const* const          port,
-                                      router_t*                  router);
+miniweb_server_t*
+    miniweb_server_create_with_options(char const* const               address,
+                                       char const* const               port,
+                                       router_t*                       router,
+                                       miniweb_server_options_t const* options);
+int miniweb_server_init(miniweb_server_t* restrict server,
+                        char const* const          address,
+                        char const* const          port,
+                        router_t*                  router);
+int miniweb_server_init_with_options(miniweb_server_t* restrict      server,
+                                     char const* const               address,
+                                     char const* const               port,
+                                     router_t*                       router,
+                                     miniweb_server_options_t const* options);
 
 int miniweb_server_start(miniweb_server_t* restrict server);
 // Should set a variable on the server to get it to stop polling
 void miniweb_server_stop(miniweb_server_t* restrict server);
 
+// How many workers there are right now, how often an elastic pool has resized, and
+// how many requests have been turned away
+void miniweb_server_get_thread_pool_stats(miniweb_server_t* restrict server,
+                                          thread_pool_stats_t*       stats);
+
+// Scratch memory for the request the calling thread is running a route for, or NULL
+// outside of a route. It's all freed once the response has been prepared, so routes
+// can allocate from it as much as they like without ever freeing anything.
+arena_t* miniweb_request_arena(void);
+
 void miniweb_server_clean(miniweb_server_t* restrict server);
 void miniweb_server_destroy(miniweb_server_t* restrict server);
 
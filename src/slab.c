@@ -0,0 +1,163 @@
+#include "slab.h"
+
+#include "logging.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <string.h>
+
+#ifdef MINIWEB_TESTING
+extern void* _test_malloc(const size_t size, char const* file, int const line);
+extern void*
+             _test_calloc(size_t nmemb, size_t size, char const* file, int const line);
+extern void  _test_free(void* ptr, char const* file, int const line);
+extern void* _test_realloc(void* ptr, size_t size, char const* file, int const line);
+
+    #define malloc(size)       _test_malloc(size, __FILE__, __LINE__)
+    #define calloc(n, size)    _test_calloc(n, size, __FILE__, __LINE__)
+    #define free(ptr)          _test_free(ptr, __FILE__, __LINE__)
+    #define realloc(ptr, size) _test_realloc(ptr, size, __FILE__, __LINE__)
+#endif
+
+enum
+{
+    // There's a linear search over the classes on every alloc, so keep it short
+    SLAB_MAX_CLASSES = 8,
+};
+
+struct slab
+{
+    size_t       num_classes;
+    slab_class_t classes[SLAB_MAX_CLASSES];
+    pool_t*      pools[SLAB_MAX_CLASSES];
+};
+
+// ==== PUBLIC FUNCTIONS IMPLEMENTATION ====
+
+slab_t* slab_init(size_t                num_classes,
+                  slab_class_t const    classes[num_classes],
+                  pool_options_t const* options)
+{
+    assert(classes);
+    assert(options);
+
+    if (num_classes == 0 || num_classes > SLAB_MAX_CLASSES)
+    {
+        MINIWEB_LOG_ERROR("Slabs need between 1 and %d size classes, not %zu",
+                          SLAB_MAX_CLASSES, num_classes);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < num_classes; ++i)
+    {
+        bool ascending = i == 0 || classes[i].size > classes[i - 1].size;
+        if (classes[i].size == 0 || !ascending)
+        {
+            MINIWEB_LOG_ERROR("Slab size classes must be ascending, but class %zu "
+                              "is %zu bytes",
+                              i, classes[i].size);
+            return NULL;
+        }
+    }
+
+    slab_t* slab = calloc(1, sizeof(slab_t));
+    if (!slab)
+    {
+        MINIWEB_LOG_ERROR("Failed to allocate slab with %zu classes", num_classes);
+        return NULL;
+    }
+
+    slab->num_classes = num_classes;
+    for (size_t i = 0; i < num_classes; ++i)
+    {
+        slab->classes[i] = classes[i];
+        // The pools insist on at least one block to start with
+        size_t init_num_blocks = classes[i].init_num_blocks;
+        if (init_num_blocks == 0) { init_num_blocks = 1; }
+        slab->pools[i] = pool_init_with_options(classes[i].size, init_num_blocks,
+                                                options);
+        if (!slab->pools[i])
+        {
+            MINIWEB_LOG_ERROR("Failed to create pool for slab class of %zu bytes",
+                              classes[i].size);
+            slab_destroy(slab);
+            return NULL;
+        }
+    }
+
+    return slab;
+}
+
+void slab_destroy(slab_t* restrict slab)
+{
+    if (!slab) { return; }
+
+    for (size_t i = 0; i < slab->num_classes; ++i)
+    {
+        if (slab->pools[i]) { pool_destroy(slab->pools[i]); }
+    }
+
+    free(slab);
+}
+
+slab_handle_t slab_alloc(slab_t* slab, size_t size)
+{
+    assert(slab);
+
+    for (size_t i = 0; i < slab->num_classes; ++i)
+    {
+        if (slab->classes[i].size < size) { continue; }
+
+        pool_handle_t block = pool_alloc(slab->pools[i]);
+        if (!block.data) { break; }
+
+        return (slab_handle_t) {.id         = block.id,
+                                .data       = block.data,
+                                .size       = slab->classes[i].size,
+                                .size_class = i};
+    }
+
+    return (slab_handle_t) {0};
+}
+
+void slab_free(slab_t* slab, slab_handle_t handle)
+{
+    assert(slab);
+    assert(handle.size_class < slab->num_classes);
+
+    pool_free(slab->pools[handle.size_class],
+              (pool_handle_t) {.id = handle.id, .data = handle.data});
+}
+
+slab_handle_t slab_grow(slab_t* slab, slab_handle_t handle, size_t size, size_t used)
+{
+    assert(slab);
+    assert(used <= handle.size);
+
+    if (size <= handle.size) { return handle; }
+
+    slab_handle_t bigger = slab_alloc(slab, size);
+    if (!bigger.data) { return bigger; }
+
+    memcpy(bigger.data, handle.data, used);
+    slab_free(slab, handle);
+
+    return bigger;
+}
+
+size_t slab_get_max_size(slab_t const* slab)
+{
+    assert(slab);
+    return slab->classes[slab->num_classes - 1].size;
+}
+
+size_t slab_trim(slab_t* slab)
+{
+    assert(slab);
+
+    size_t released = 0;
+    for (size_t i = 0; i < slab->num_classes; ++i)
+    { released += pool_trim(slab->pools[i], slab->classes[i].init_num_blocks); }
+
+    return released;
+}
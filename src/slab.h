@@ -0,0 +1,54 @@
+#ifndef INCLUDED_SLAB_H
+#define INCLUDED_SLAB_H
+
+#include "pool.h"
+
+#include <stdlib.h>
+
+// Variable-sized buffers on top of a handful of pools, one per size class. Each
+// allocation comes out of the smallest class it fits in, and a buffer that turns
+// out to be too small can be moved up to a bigger class with slab_grow.
+
+typedef struct slab slab_t;
+
+typedef struct slab_class
+{
+    size_t size;
+    // Also how many blocks slab_trim leaves in the class
+    size_t init_num_blocks;
+} slab_class_t;
+
+typedef struct slab_handle
+{
+    pool_id_t id;
+    void*     data;
+    // How much the buffer can actually hold, which is at least what was asked for
+    size_t size;
+    size_t size_class;
+} slab_handle_t;
+
+// CREATORS AND DESTROYERS
+// The classes must be in ascending order of size. Every class gets a pool made with
+// options, so a concurrent slab can be used from any thread.
+slab_t* slab_init(size_t                num_classes,
+                  slab_class_t const    classes[num_classes],
+                  pool_options_t const* options);
+void    slab_destroy(slab_t* restrict slab);
+
+// data is NULL if size is bigger than the biggest class, or we're out of memory
+slab_handle_t slab_alloc(slab_t* slab, size_t size);
+void          slab_free(slab_t* slab, slab_handle_t handle);
+
+// Moves the first used bytes of handle into a buffer that can hold at least size,
+// and frees the old one. Hands back handle untouched if it's already big enough.
+// If there's no class big enough, data is NULL and handle is still valid.
+slab_handle_t
+slab_grow(slab_t* slab, slab_handle_t handle, size_t size, size_t used);
+
+size_t slab_get_max_size(slab_t const* slab);
+
+// pool_trim on every class, keeping its init_num_blocks. Returns how many bytes
+// were released.
+size_t slab_trim(slab_t* slab);
+
+#endif // INCLUDED_SLAB_H
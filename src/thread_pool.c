@@ -6,7 +6,9 @@
 #include <assert.h>
 #include <errno.h>
 #include <limits.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 #include <time.h>
 
@@ -18,13 +20,39 @@
 
 enum
 {
-    MESSAGE_BUF_SIZE_BYTES = 1024,
+    // Per priority, so a burst of one class can't fill the others' room
+    SHARED_QUEUE_SIZE = 200,
+    // Per worker and priority, so a few reactors can get well ahead before anyone
+    // blocks
+    WORKER_QUEUE_SIZE = 256,
+    // How many jobs a worker takes at once. Whatever it's holding can't go to anyone
+    // else, so this stays small, and thieves only take half as many.
+    JOB_BATCH_SIZE   = 8,
+    STEAL_BATCH_SIZE = JOB_BATCH_SIZE / 2,
+    // thread_pool_run_batch converts jobs to messages this many at a time
+    RUN_BATCH_CHUNK_SIZE = 64,
+    // For THREAD_POOL_MODE_ELASTIC, unless told otherwise
+    DEFAULT_TARGET_WAIT_US  = 1000,
+    DEFAULT_IDLE_TIMEOUT_MS = 5000,
 };
 
+// Which lane each batch a worker takes comes from: four in every seven from the
+// high lane, two from normal and one from low. A lane with nothing in it gives its
+// turn to the others, highest first, so the weights only matter under load.
+static enum thread_pool_priority const LANE_SCHEDULE[] = {
+    THREAD_POOL_PRIORITY_HIGH, THREAD_POOL_PRIORITY_NORMAL,
+    THREAD_POOL_PRIORITY_HIGH, THREAD_POOL_PRIORITY_LOW,
+    THREAD_POOL_PRIORITY_HIGH, THREAD_POOL_PRIORITY_NORMAL,
+    THREAD_POOL_PRIORITY_HIGH,
+};
+
+static enum thread_pool_priority const LANE_ORDER[THREAD_POOL_NUM_PRIORITIES] = {
+    THREAD_POOL_PRIORITY_HIGH, THREAD_POOL_PRIORITY_NORMAL,
+    THREAD_POOL_PRIORITY_LOW};
+
 enum mq_data_type
 {
     MQ_FUNC_EXEC,
-    MQ_EXIT
 };
 
 struct mq_func_exec
@@ -42,13 +70,34 @@ struct mq_data
 {
     enum mq_data_type   type;
     union mq_data_union data;
+    // When the job was queued, only filled in for THREAD_POOL_MODE_ELASTIC and for
+    // admission control
+    uint64_t queued_us;
 };
 
+// What itc_queue's batch functions want an array of messages to look like
+typedef unsigned char mq_buffer_t[sizeof(struct mq_data)];
+
 struct thread_pool_thread_state
 {
     size_t    thread_num;
     pthread_t id;
-    itc_queue_t* job_queue;
+    // Where the worker is pinned, or -1 if it isn't
+    int cpu;
+    // Whether this slot has a worker, and whether one that's retired from an
+    // elastic pool still needs joining. Both guarded by resize_lock.
+    bool is_running;
+    bool needs_join;
+    // One lane per priority. In THREAD_POOL_MODE_WORK_STEALING these are the
+    // worker's own, otherwise they're the pool's.
+    itc_queue_t*        job_queues[THREAD_POOL_NUM_PRIORITIES];
+    size_t              lane_turn;
+    struct thread_pool* pool;
+    // Whether each of the worker's own lanes is keeping jobs waiting too long, for
+    // admission control in THREAD_POOL_MODE_WORK_STEALING
+    atomic_bool lane_overloaded[THREAD_POOL_NUM_PRIORITIES];
+    // For picking victims to steal from
+    uint64_t steal_seed;
     // WARNING! THIS WILL BECOME INVALID AFTER ALL THREADS HAVE
     // STARTED RUNNING. It will be DELETED!
     pthread_mutex_t* started_lock;
@@ -60,83 +109,531 @@ struct thread_pool
 {
     struct thread_pool_thread_state* threads;
     size_t                           num_threads;
-    itc_queue_t*                     job_queue;
-    bool                             is_running;
+    enum thread_pool_mode            mode;
+    // Not used in THREAD_POOL_MODE_WORK_STEALING
+    itc_queue_t* job_queues[THREAD_POOL_NUM_PRIORITIES];
+    bool         is_running;
+
+    // In THREAD_POOL_MODE_ELASTIC threads has room for max_threads workers, and
+    // resize_lock is held while any of them come or go
+    thread_pool_elastic_options_t elastic;
+    pthread_mutex_t               resize_lock;
+    atomic_size_t                 num_running;
+    atomic_uint_fast64_t          last_grow_us;
+    atomic_uint_fast64_t          num_grown;
+    atomic_uint_fast64_t          num_shrunk;
+    // Jobs queued but not yet taken, when that last went from none to some, and
+    // when a worker last took any. Workers stuck in slow jobs don't take batches to
+    // notice the queue backing up, so submitters use these to check for them.
+    atomic_size_t        num_queued;
+    atomic_uint_fast64_t pending_since_us;
+    atomic_uint_fast64_t last_take_us;
+
+    // Workers sleep here once every lane they can take from has come up empty
+    pthread_mutex_t sleep_lock;
+    pthread_cond_t  work_available;
+    atomic_size_t   num_sleeping;
+    // Set by thread_pool_stop. Workers finish off whatever's queued, then exit, and
+    // elastic pools stop growing or shrinking.
+    atomic_bool stopping;
+
+    // Admission control, which is off while max_queue_wait_us is 0. A lane is
+    // overloaded from when a worker takes a job that's waited longer than that
+    // until one finds it keeping up again, or finds it empty.
+    uint64_t             max_queue_wait_us;
+    atomic_bool          lane_overloaded[THREAD_POOL_NUM_PRIORITIES];
+    atomic_uint_fast64_t num_rejected;
 };
 
+// The worker this thread is, if it's one, so that jobs it runs stay local
+static _Thread_local struct thread_pool_thread_state* tls_current_worker = NULL;
+// Where a thread outside the pool puts its next job
+static _Thread_local size_t tls_next_worker = SIZE_MAX;
+
 // ==== STATIC FUNCTIONS ====
 
-void* thread_pool_job(void* data)
+static void* thread_pool_worker(void* data);
+
+static uint64_t thread_pool_now_us(void)
+{
+    struct timespec now = {0};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return ((uint64_t) now.tv_sec * 1000000) + ((uint64_t) now.tv_nsec / 1000);
+}
+
+// Starts another worker in the first free slot, if we still need one by the time
+// we've got the lock
+static void thread_pool_grow(struct thread_pool* pool, uint64_t now_us)
+{
+    pthread_mutex_lock(&pool->resize_lock);
+
+    uint64_t last_grow = atomic_load(&pool->last_grow_us);
+    size_t   running   = atomic_load(&pool->num_running);
+    if (atomic_load(&pool->stopping) || running >= pool->elastic.max_threads
+        || now_us - last_grow < pool->elastic.target_wait_us)
+    {
+        pthread_mutex_unlock(&pool->resize_lock);
+        return;
+    }
+    atomic_store(&pool->last_grow_us, now_us);
+
+    struct thread_pool_thread_state* state = NULL;
+    for (size_t i = 0; i < pool->num_threads && !state; ++i)
+    {
+        if (!pool->threads[i].is_running) { state = &pool->threads[i]; }
+    }
+    assert(state);
+
+    // Whoever had the slot last retired on its own, so won't keep us waiting
+    if (state->needs_join)
+    {
+        pthread_join(state->id, NULL);
+        state->needs_join = false;
+    }
+
+    // Nobody's waiting for this one to start
+    state->started_lock = NULL;
+    state->started      = NULL;
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    int rc = cpu_affinity_set_attr(&attr, state->cpu);
+    if (rc == 0)
+    { rc = pthread_create(&state->id, &attr, thread_pool_worker, state); }
+    pthread_attr_destroy(&attr);
+    if (rc != 0)
+    {
+        MINIWEB_LOG_ERROR("Failed to create thread number %zu: %d",
+                          state->thread_num, rc);
+    }
+    else
+    {
+        state->is_running = true;
+        atomic_fetch_add(&pool->num_running, 1);
+        atomic_fetch_add(&pool->num_grown, 1);
+        MINIWEB_LOG_INFO("Thread pool grew to %zu workers", running + 1);
+    }
+
+    pthread_mutex_unlock(&pool->resize_lock);
+}
+
+// Called by an elastic worker that's had nothing to do for a while. Returns whether
+// it should exit.
+static bool thread_pool_retire(struct thread_pool_thread_state* state)
+{
+    struct thread_pool* pool = state->pool;
+
+    pthread_mutex_lock(&pool->resize_lock);
+    size_t running = atomic_load(&pool->num_running);
+    bool   retire =
+        !atomic_load(&pool->stopping) && running > pool->elastic.min_threads;
+    if (retire)
+    {
+        state->is_running = false;
+        state->needs_join = true;
+        atomic_fetch_sub(&pool->num_running, 1);
+        atomic_fetch_add(&pool->num_shrunk, 1);
+    }
+    pthread_mutex_unlock(&pool->resize_lock);
+
+    if (retire)
+    { MINIWEB_LOG_INFO("Thread pool shrank to %zu workers", running - 1); }
+    return retire;
+}
+
+// Takes a batch from one of owner's lanes. With admission control on, it also keeps
+// the lane's overloaded flag up to date from how long the oldest job had waited.
+static size_t thread_pool_receive_lane(struct thread_pool_thread_state* owner,
+                                       enum thread_pool_priority        priority,
+                                       size_t                           max_jobs,
+                                       struct mq_data batch[max_jobs])
+{
+    struct thread_pool* pool  = owner->pool;
+    size_t              found = receive_messages_noblock(
+        owner->job_queues[priority], sizeof(struct mq_data), max_jobs,
+        (mq_buffer_t*) batch);
+    if (pool->max_queue_wait_us == 0) { return found; }
+
+    atomic_bool* flag = &pool->lane_overloaded[priority];
+    if (pool->mode == THREAD_POOL_MODE_WORK_STEALING)
+    { flag = &owner->lane_overloaded[priority]; }
+
+    bool overloaded = found > 0
+                   && thread_pool_now_us() - batch[0].queued_us
+                          > pool->max_queue_wait_us;
+    // Only written when it changes, so it isn't bounced between every worker's cache
+    if (overloaded != atomic_load_explicit(flag, memory_order_relaxed))
+    { atomic_store_explicit(flag, overloaded, memory_order_relaxed); }
+
+    return found;
+}
+
+// Takes a batch from whichever of owner's lanes it's our turn for, or failing that
+// from the first lane that has anything. Every job in a batch has the same priority.
+static size_t thread_pool_receive_lanes(struct thread_pool_thread_state* owner,
+                                        size_t*                          turn,
+                                        size_t                           max_jobs,
+                                        struct mq_data batch[max_jobs])
+{
+    size_t const num_turns = sizeof(LANE_SCHEDULE) / sizeof(LANE_SCHEDULE[0]);
+    enum thread_pool_priority first = LANE_SCHEDULE[(*turn)++ % num_turns];
+
+    size_t found = thread_pool_receive_lane(owner, first, max_jobs, batch);
+    for (size_t i = 0; i < THREAD_POOL_NUM_PRIORITIES && found == 0; ++i)
+    {
+        if (LANE_ORDER[i] == first) { continue; }
+        found = thread_pool_receive_lane(owner, LANE_ORDER[i], max_jobs, batch);
+    }
+
+    return found;
+}
+
+static uint64_t thread_pool_next_random(uint64_t* state)
+{
+    // xorshift64, plenty for spreading thieves around
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+// Takes jobs from our own lanes if there are any. Work stealing workers then go
+// round everyone else's, starting from a random victim. Returns how many it found.
+static size_t thread_pool_find_jobs(struct thread_pool_thread_state* state,
+                                    struct mq_data batch[JOB_BATCH_SIZE])
+{
+    struct thread_pool* pool  = state->pool;
+    size_t              found =
+        thread_pool_receive_lanes(state, &state->lane_turn, JOB_BATCH_SIZE, batch);
+    if (found > 0 || pool->mode != THREAD_POOL_MODE_WORK_STEALING) { return found; }
+
+    size_t first = thread_pool_next_random(&state->steal_seed) % pool->num_threads;
+    for (size_t i = 0; i < pool->num_threads; ++i)
+    {
+        struct thread_pool_thread_state* victim =
+            &pool->threads[(first + i) % pool->num_threads];
+        if (victim == state) { continue; }
+
+        found = thread_pool_receive_lanes(victim, &state->lane_turn,
+                                          STEAL_BATCH_SIZE, batch);
+        if (found > 0) { return found; }
+    }
+
+    return 0;
+}
+
+// Sleeps until somebody queues a job or the pool stops. Elastic workers give up
+// after their idle timeout, and then return false.
+static bool thread_pool_sleep(struct thread_pool* pool)
+{
+    if (pool->mode != THREAD_POOL_MODE_ELASTIC)
+    {
+        pthread_cond_wait(&pool->work_available, &pool->sleep_lock);
+        return true;
+    }
+
+    uint64_t        timeout_ms = pool->elastic.idle_timeout_ms;
+    struct timespec deadline   = {0};
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += (time_t) (timeout_ms / 1000);
+    deadline.tv_nsec += (long) ((timeout_ms % 1000) * 1000000);
+    if (deadline.tv_nsec >= 1000000000)
+    {
+        deadline.tv_sec += 1;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    int rc = pthread_cond_timedwait(&pool->work_available, &pool->sleep_lock,
+                                    &deadline);
+    return rc != ETIMEDOUT;
+}
+
+// The last worker to start gets a chance to catch up before we add another
+static void thread_pool_maybe_grow(struct thread_pool* pool, uint64_t now)
+{
+    uint64_t last_grow =
+        atomic_load_explicit(&pool->last_grow_us, memory_order_relaxed);
+    size_t running = atomic_load_explicit(&pool->num_running, memory_order_relaxed);
+    if (now - last_grow >= pool->elastic.target_wait_us
+        && running < pool->elastic.max_threads)
+    { thread_pool_grow(pool, now); }
+}
+
+// Called by a worker that's just taken num_taken jobs. Starts another worker if the
+// oldest of them has been kept waiting.
+static void thread_pool_check_wait(struct thread_pool*   pool,
+                                   size_t                num_taken,
+                                   struct mq_data const* oldest)
+{
+    uint64_t now = thread_pool_now_us();
+    atomic_fetch_sub_explicit(&pool->num_queued, num_taken, memory_order_relaxed);
+    atomic_store_explicit(&pool->last_take_us, now, memory_order_relaxed);
+
+    if (now - oldest->queued_us <= pool->elastic.target_wait_us) { return; }
+    thread_pool_maybe_grow(pool, now);
+}
+
+// Called before queueing more jobs. If something's been queued all along and no
+// worker has taken anything for a while, the oldest job has waited at least that
+// long, and every worker must be busy with something slow.
+static void thread_pool_check_backlog(struct thread_pool* pool, uint64_t now)
+{
+    if (atomic_load_explicit(&pool->num_queued, memory_order_relaxed) == 0)
+    { return; }
+
+    uint64_t since =
+        atomic_load_explicit(&pool->pending_since_us, memory_order_relaxed);
+    uint64_t last_take =
+        atomic_load_explicit(&pool->last_take_us, memory_order_relaxed);
+    if (last_take > since) { since = last_take; }
+
+    // Another thread's clock reading can be a little ahead of ours
+    if (since >= now || now - since <= pool->elastic.target_wait_us) { return; }
+    thread_pool_maybe_grow(pool, now);
+}
+
+static void* thread_pool_worker(void* data)
 {
     struct thread_pool_thread_state* state = data;
+    struct thread_pool*              pool  = state->pool;
+    tls_current_worker                     = state;
 
     // Signal that we've started, and successfully!
-    pthread_mutex_lock(state->started_lock);
-    state->is_started = true;
-    pthread_cond_signal(state->started);
-    pthread_mutex_unlock(state->started_lock);
+    if (state->started_lock)
+    {
+        pthread_mutex_lock(state->started_lock);
+        state->is_started = true;
+        pthread_cond_signal(state->started);
+        pthread_mutex_unlock(state->started_lock);
+    }
+
+    struct mq_data batch[JOB_BATCH_SIZE] = {0};
+    for (;;)
+    {
+        size_t found = thread_pool_find_jobs(state, batch);
+        if (found == 0)
+        {
+            if (atomic_load(&pool->stopping))
+            {
+                MINIWEB_LOG_INFO("Thread %zu is exiting", state->thread_num);
+                return NULL;
+            }
+
+            // Announce ourselves before the last look round, so whoever queues a
+            // job after it is sure to see us and wake us up
+            bool woken = true;
+            pthread_mutex_lock(&pool->sleep_lock);
+            atomic_fetch_add(&pool->num_sleeping, 1);
+            found = thread_pool_find_jobs(state, batch);
+            if (found == 0 && !atomic_load(&pool->stopping))
+            { woken = thread_pool_sleep(pool); }
+            atomic_fetch_sub(&pool->num_sleeping, 1);
+            pthread_mutex_unlock(&pool->sleep_lock);
+
+            if (!woken && thread_pool_retire(state)) { return NULL; }
+        }
+
+        if (found > 0 && pool->mode == THREAD_POOL_MODE_ELASTIC)
+        { thread_pool_check_wait(pool, found, &batch[0]); }
+
+        for (size_t i = 0; i < found; ++i)
+        {
+            assert(batch[i].type == MQ_FUNC_EXEC);
+            batch[i].data.func_exec.func(batch[i].data.func_exec.user_data);
+        }
+    }
+}
+
+static void thread_pool_wake_workers(struct thread_pool* pool, size_t num_jobs)
+{
+    // Pairs with the sleeper's increment. Either we see it here, or its last look
+    // round finds the jobs.
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&pool->num_sleeping, memory_order_relaxed) == 0)
+    { return; }
 
-    unsigned char buffer[MESSAGE_BUF_SIZE_BYTES] = {0};
+    pthread_mutex_lock(&pool->sleep_lock);
+    if (num_jobs > 1) { pthread_cond_broadcast(&pool->work_available); }
+    else { pthread_cond_signal(&pool->work_available); }
+    pthread_mutex_unlock(&pool->sleep_lock);
+}
+
+// Posts to a lane, waiting for room if it has to unless there's admission control.
+// Only workers make room, so they're woken up before every wait, not just at the
+// end. Returns how many it posted.
+static size_t thread_pool_post_lane(struct thread_pool*  pool,
+                                    itc_queue_t*         lane,
+                                    size_t               num_messages,
+                                    struct mq_data const messages[num_messages])
+{
+    size_t posted = 0;
     for (;;)
     {
-        int rc = receive_message(state->job_queue, MESSAGE_BUF_SIZE_BYTES, buffer);
+        posted += post_messages_noblock(lane, sizeof(struct mq_data),
+                                        num_messages - posted,
+                                        (mq_buffer_t const*) &messages[posted]);
+        thread_pool_wake_workers(pool, num_messages);
+        if (posted == num_messages || pool->max_queue_wait_us > 0) { return posted; }
+
+        int rc = post_message(lane, sizeof(struct mq_data),
+                              (unsigned char const*) &messages[posted]);
         if (rc != 0)
         {
-            MINIWEB_LOG_ERROR("Failed to receive message.");
-            continue;
+            MINIWEB_LOG_ERROR("Failed to post to the job queue: %d", rc);
+            return posted;
         }
+        ++posted;
+    }
+}
+
+static size_t thread_pool_run_stealing(struct thread_pool* restrict pool,
+                                       enum thread_pool_priority    priority,
+                                       size_t                       num_messages,
+                                       struct mq_data const messages[num_messages])
+{
+    bool is_worker = tls_current_worker && tls_current_worker->pool == pool;
+
+    // Our own lane if we're a worker, otherwise share them out between everyone
+    size_t first = 0;
+    size_t share = num_messages;
+    if (is_worker) { first = tls_current_worker->thread_num; }
+    else
+    {
+        // Each thread's variable has its own address, so different threads start
+        // on different workers
+        if (tls_next_worker == SIZE_MAX)
+        { tls_next_worker = (size_t) (uintptr_t) &tls_next_worker / 64; }
+        first = tls_next_worker++ % pool->num_threads;
+        share = (num_messages + pool->num_threads - 1) / pool->num_threads;
+    }
+
+    // Anything that doesn't fit where it should goes wherever there's room, apart
+    // from lanes that admission control says are already too far behind
+    size_t posted = 0;
+    for (size_t i = 0; i < 2 * pool->num_threads && posted < num_messages; ++i)
+    {
+        if (i == pool->num_threads) { share = num_messages; }
+
+        struct thread_pool_thread_state* target =
+            &pool->threads[(first + i) % pool->num_threads];
+        if (pool->max_queue_wait_us > 0
+            && atomic_load_explicit(&target->lane_overloaded[priority],
+                                    memory_order_relaxed))
+        { continue; }
 
-        struct mq_data* message = (struct mq_data*) &buffer;
+        size_t count = num_messages - posted;
+        if (count > share) { count = share; }
+        posted += post_messages_noblock(target->job_queues[priority],
+                                        sizeof(struct mq_data), count,
+                                        (mq_buffer_t const*) &messages[posted]);
+    }
 
-        switch (message->type)
+    if (posted < num_messages)
+    {
+        // Only workers make room, so one of them waiting could wait forever
+        if (is_worker)
         {
-            case MQ_EXIT:
+            for (; posted < num_messages; ++posted)
             {
-                MINIWEB_LOG_INFO("Thread %zu is exiting", state->thread_num);
-                return NULL;
-            }
-            case MQ_FUNC_EXEC:
-            {
-                message->data.func_exec.func(message->data.func_exec.user_data);
-                break;
-            }
-            default:
-            {
-                MINIWEB_LOG_ERROR("Invalid message type received: %d",
-                                  message->type);
+                struct mq_func_exec const* exec = &messages[posted].data.func_exec;
+                exec->func(exec->user_data);
             }
         }
+        else if (pool->max_queue_wait_us == 0)
+        {
+            return posted + thread_pool_post_lane(
+                                pool, pool->threads[first].job_queues[priority],
+                                num_messages - posted, &messages[posted]);
+        }
     }
+
+    thread_pool_wake_workers(pool, num_messages);
+    return posted;
 }
 
-int thread_pool_stop(struct thread_pool* restrict pool)
+// Returns how many of the messages were queued, always the first ones
+static size_t thread_pool_run_messages(struct thread_pool* restrict pool,
+                                       enum thread_pool_priority    priority,
+                                       size_t                       num_messages,
+                                       struct mq_data messages[num_messages])
 {
-    assert(pool->is_running);
-
-    bool all_sent = true;
-    for (size_t i = 0; i < pool->num_threads; ++i)
+    if (pool->mode == THREAD_POOL_MODE_ELASTIC || pool->max_queue_wait_us > 0)
     {
-        struct mq_data message = {.type = MQ_EXIT};
-        int            rc      = post_message(pool->job_queue, sizeof(message),
-                              (unsigned char*) &message);
-        if (rc != 0)
+        uint64_t now = thread_pool_now_us();
+        for (size_t i = 0; i < num_messages; ++i) { messages[i].queued_us = now; }
+
+        if (pool->mode == THREAD_POOL_MODE_ELASTIC)
         {
-            MINIWEB_LOG_ERROR("Failed to send exit message: %d", rc);
-            all_sent = false;
+            thread_pool_check_backlog(pool, now);
+
+            // Counted before they're posted, so a worker can't take them first
+            if (atomic_fetch_add(&pool->num_queued, num_messages) == 0)
+            { atomic_store(&pool->pending_since_us, now); }
         }
     }
 
-    if (!all_sent)
+    size_t posted = 0;
+    if (pool->mode == THREAD_POOL_MODE_WORK_STEALING)
+    { posted = thread_pool_run_stealing(pool, priority, num_messages, messages); }
+    else if (pool->max_queue_wait_us == 0
+             || !atomic_load_explicit(&pool->lane_overloaded[priority],
+                                      memory_order_relaxed))
     {
-        MINIWEB_LOG_ERROR(
-            "Could not send all threads to exit - will not try to join!");
-        return -1;
+        posted = thread_pool_post_lane(pool, pool->job_queues[priority],
+                                       num_messages, messages);
     }
 
-    // Now that we've sent all the exit notifications, we can join on the threads
+    if (posted < num_messages && pool->mode == THREAD_POOL_MODE_ELASTIC)
+    { atomic_fetch_sub(&pool->num_queued, num_messages - posted); }
+    if (posted < num_messages && pool->max_queue_wait_us > 0)
+    { atomic_fetch_add(&pool->num_rejected, num_messages - posted); }
+
+    return posted;
+}
+
+// Moves jobs[middle, num_jobs) in front of jobs[0, middle), keeping both in order
+static void thread_pool_rotate_jobs(size_t            num_jobs,
+                                    thread_pool_job_t jobs[num_jobs],
+                                    size_t            middle)
+{
+    // Reversing each part and then the whole lot leaves them swapped round
+    size_t const bounds[][2] = {{0, middle}, {middle, num_jobs}, {0, num_jobs}};
+    for (size_t i = 0; i < sizeof(bounds) / sizeof(bounds[0]); ++i)
+    {
+        for (size_t lo = bounds[i][0], hi = bounds[i][1]; lo + 1 < hi; ++lo, --hi)
+        {
+            thread_pool_job_t tmp = jobs[lo];
+            jobs[lo]              = jobs[hi - 1];
+            jobs[hi - 1]          = tmp;
+        }
+    }
+}
+
+int thread_pool_stop(struct thread_pool* restrict pool)
+{
+    assert(pool->is_running);
+
+    // Taking resize_lock means no elastic worker comes or goes after this
+    pthread_mutex_lock(&pool->resize_lock);
+    atomic_store(&pool->stopping, true);
+    pthread_mutex_unlock(&pool->resize_lock);
+
+    pthread_mutex_lock(&pool->sleep_lock);
+    pthread_cond_broadcast(&pool->work_available);
+    pthread_mutex_unlock(&pool->sleep_lock);
+
+    // Everyone finishes off what's queued before they go
     for (size_t i = 0; i < pool->num_threads; ++i)
     {
-        int rc = pthread_join(pool->threads[i].id, NULL);
+        struct thread_pool_thread_state* state = &pool->threads[i];
+        if (!state->is_running && !state->needs_join) { continue; }
+        state->is_running = false;
+        state->needs_join = false;
+
+        int rc = pthread_join(state->id, NULL);
         if (rc != 0)
         {
             MINIWEB_LOG_ERROR(
@@ -145,6 +642,8 @@ int thread_pool_stop(struct thread_pool* restrict pool)
         }
     }
 
+    atomic_store(&pool->num_running, 0);
+    atomic_store(&pool->stopping, false);
     pool->is_running = false;
 
     return 0;
@@ -154,6 +653,17 @@ int thread_pool_start(struct thread_pool* restrict pool)
 {
     assert(!pool->is_running);
 
+    // Elastic pools start small and grow into the rest of their slots
+    size_t num_to_start = pool->num_threads;
+    if (pool->mode == THREAD_POOL_MODE_ELASTIC)
+    {
+        num_to_start = pool->elastic.min_threads;
+        atomic_store(&pool->num_running, num_to_start);
+        atomic_store(&pool->last_grow_us, 0);
+        atomic_store(&pool->num_queued, 0);
+        atomic_store(&pool->last_take_us, 0);
+    }
+
     pthread_mutex_t* mutexes = calloc(pool->num_threads, sizeof(pthread_mutex_t));
     if (!mutexes)
     {
@@ -169,16 +679,22 @@ int thread_pool_start(struct thread_pool* restrict pool)
         return -1;
     }
 
-    for (size_t i = 0; i < pool->num_threads; ++i)
+    // Stops at the first thread we can't start, and only waits for the ones before
+    size_t num_started = 0;
+    int    rc          = 0;
+    for (; num_started < num_to_start; ++num_started)
     {
+        size_t i = num_started;
+
         // Initialise the condition variable for this thread
-        int rc = pthread_cond_init(&conds[i], NULL);
+        rc = pthread_cond_init(&conds[i], NULL);
         if (rc != 0)
         {
             MINIWEB_LOG_ERROR(
                 "Failed to initialise the condition variable for thread %zu: %d", i,
                 rc);
-            return -2;
+            rc = -2;
+            break;
         }
 
         rc = pthread_mutex_init(&mutexes[i], NULL);
@@ -186,20 +702,37 @@ int thread_pool_start(struct thread_pool* restrict pool)
         {
             MINIWEB_LOG_ERROR("Failed to initialise the mutex for thread %zu: %d", i,
                               rc);
-            return -2;
+            pthread_cond_destroy(&conds[i]);
+            rc = -2;
+            break;
         }
 
         struct thread_pool_thread_state* state = &pool->threads[i];
-        state->thread_num                      = i;
         state->started                         = &conds[i];
         state->started_lock                    = &mutexes[i];
-        state->job_queue                       = pool->job_queue;
-        rc = pthread_create(&state->id, NULL, thread_pool_job, state);
-        if (rc != 0) { MINIWEB_LOG_ERROR("Failed to create thread number %zu!", i); }
+        state->is_running                      = true;
+
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        rc = cpu_affinity_set_attr(&attr, state->cpu);
+        if (rc == 0)
+        { rc = pthread_create(&state->id, &attr, thread_pool_worker, state); }
+        pthread_attr_destroy(&attr);
+        if (rc != 0)
+        {
+            MINIWEB_LOG_ERROR("Failed to create thread number %zu: %d", i, rc);
+            pthread_cond_destroy(&conds[i]);
+            pthread_mutex_destroy(&mutexes[i]);
+            state->started      = NULL;
+            state->started_lock = NULL;
+            state->is_running   = false;
+            rc                  = -3;
+            break;
+        }
     }
 
     // Now we need to wait on the condition variables
-    for (size_t i = 0; i < pool->num_threads; ++i)
+    for (size_t i = 0; i < num_started; ++i)
     {
         pthread_mutex_lock(&mutexes[i]);
         while (!pool->threads[i].is_started)
@@ -210,19 +743,43 @@ int thread_pool_start(struct thread_pool* restrict pool)
 
         pthread_cond_destroy(&conds[i]);
         pthread_mutex_destroy(&mutexes[i]);
+        pool->threads[i].started      = NULL;
+        pool->threads[i].started_lock = NULL;
     }
 
     free(conds);
     free(mutexes);
 
     pool->is_running = true;
+    if (rc != 0)
+    {
+        // Don't leave the ones that did start running with nothing to do
+        thread_pool_stop(pool);
+        return rc;
+    }
 
     return 0;
 }
 
 // ==== PUBLIC FUNCTIONS IMPLEMENTATION
 
+thread_pool_elastic_options_t
+thread_pool_default_elastic_options(size_t min_threads, size_t max_threads)
+{
+    return (thread_pool_elastic_options_t) {
+        .min_threads     = min_threads,
+        .max_threads     = max_threads,
+        .target_wait_us  = DEFAULT_TARGET_WAIT_US,
+        .idle_timeout_ms = DEFAULT_IDLE_TIMEOUT_MS};
+}
+
 struct thread_pool* thread_pool_init(size_t num_threads)
+{
+    return thread_pool_init_with_mode(num_threads, THREAD_POOL_MODE_SHARED_QUEUE);
+}
+
+struct thread_pool* thread_pool_init_with_mode(size_t                num_threads,
+                                               enum thread_pool_mode mode)
 {
     struct thread_pool_thread_state* thread_storage =
         calloc(num_threads, sizeof(struct thread_pool_thread_state));
@@ -243,42 +800,285 @@ struct thread_pool* thread_pool_init(size_t num_threads)
     }
     pool->threads = thread_storage;
     pool->num_threads = num_threads;
+    pool->mode        = mode;
+    pool->elastic     = thread_pool_default_elastic_options(1, num_threads);
+    atomic_init(&pool->num_sleeping, 0);
+    atomic_init(&pool->stopping, false);
+    atomic_init(&pool->num_running, 0);
+    atomic_init(&pool->last_grow_us, 0);
+    atomic_init(&pool->num_grown, 0);
+    atomic_init(&pool->num_shrunk, 0);
+    atomic_init(&pool->num_rejected, 0);
+    for (size_t p = 0; p < THREAD_POOL_NUM_PRIORITIES; ++p)
+    { atomic_init(&pool->lane_overloaded[p], false); }
+
+    int rc = pthread_mutex_init(&pool->sleep_lock, NULL);
+    if (rc != 0)
+    {
+        MINIWEB_LOG_ERROR("Failed to init sleep_lock: %d (%s)", rc, strerror(rc));
+        free(thread_storage);
+        free(pool);
+        return NULL;
+    }
+
+    // Elastic workers time out while waiting, against CLOCK_MONOTONIC
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    rc = pthread_cond_init(&pool->work_available, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+    if (rc != 0)
+    {
+        MINIWEB_LOG_ERROR("Failed to init work_available: %d (%s)", rc,
+                          strerror(rc));
+        pthread_mutex_destroy(&pool->sleep_lock);
+        free(thread_storage);
+        free(pool);
+        return NULL;
+    }
 
-    itc_queue_t* queue = itc_queue_init(200, sizeof(struct mq_data));
-    if (!queue)
+    rc = pthread_mutex_init(&pool->resize_lock, NULL);
+    if (rc != 0)
     {
-        MINIWEB_LOG_ERROR("Failed to initialise message queue");
+        MINIWEB_LOG_ERROR("Failed to init resize_lock: %d (%s)", rc, strerror(rc));
+        pthread_cond_destroy(&pool->work_available);
+        pthread_mutex_destroy(&pool->sleep_lock);
         free(thread_storage);
         free(pool);
         return NULL;
     }
-    pool->job_queue = queue;
+
+    for (size_t p = 0; p < THREAD_POOL_NUM_PRIORITIES
+                       && mode != THREAD_POOL_MODE_WORK_STEALING;
+         ++p)
+    {
+        itc_queue_t* queue =
+            itc_queue_init(SHARED_QUEUE_SIZE, sizeof(struct mq_data));
+        if (!queue)
+        {
+            MINIWEB_LOG_ERROR("Failed to initialise message queue");
+            thread_pool_destroy(pool);
+            return NULL;
+        }
+        pool->job_queues[p] = queue;
+    }
+
+    for (size_t i = 0; i < num_threads; ++i)
+    {
+        struct thread_pool_thread_state* state = &thread_storage[i];
+        state->thread_num                      = i;
+        state->pool                            = pool;
+        state->cpu                             = -1;
+        // Any odd non-zero seed will do, as long as they differ
+        state->steal_seed = ((uint64_t) i << 1) | 1;
+
+        for (size_t p = 0; p < THREAD_POOL_NUM_PRIORITIES; ++p)
+        {
+            atomic_init(&state->lane_overloaded[p], false);
+            if (mode != THREAD_POOL_MODE_WORK_STEALING)
+            {
+                state->job_queues[p] = pool->job_queues[p];
+                continue;
+            }
+
+            itc_queue_t* queue =
+                itc_queue_init(WORKER_QUEUE_SIZE, sizeof(struct mq_data));
+            if (!queue)
+            {
+                MINIWEB_LOG_ERROR(
+                    "Failed to initialise message queue for thread %zu", i);
+                thread_pool_destroy(pool);
+                return NULL;
+            }
+            state->job_queues[p] = queue;
+        }
+    }
+
+    return pool;
+}
+
+struct thread_pool*
+thread_pool_init_elastic(thread_pool_elastic_options_t const* options)
+{
+    assert(options);
+
+    if (options->min_threads == 0 || options->max_threads < options->min_threads)
+    {
+        MINIWEB_LOG_ERROR("Elastic thread pool can't have %zu to %zu threads",
+                          options->min_threads, options->max_threads);
+        return NULL;
+    }
+
+    struct thread_pool* pool =
+        thread_pool_init_with_mode(options->max_threads, THREAD_POOL_MODE_ELASTIC);
+    if (pool) { pool->elastic = *options; }
 
     return pool;
 }
 
+void thread_pool_set_max_queue_wait(struct thread_pool* restrict pool,
+                                    uint64_t                     max_wait_us)
+{
+    assert(!pool->is_running);
+
+    pool->max_queue_wait_us = max_wait_us;
+}
+
+int thread_pool_set_affinity(struct thread_pool* restrict pool,
+                             cpu_topology_t const*        topology,
+                             cpu_affinity_t const*        affinity,
+                             size_t                       first_thread_index)
+{
+    assert(!pool->is_running);
+
+    for (size_t i = 0; i < pool->num_threads; ++i)
+    {
+        struct thread_pool_thread_state* state = &pool->threads[i];
+        state->cpu =
+            cpu_topology_pick_cpu(topology, affinity, first_thread_index + i);
+        if (pool->mode != THREAD_POOL_MODE_WORK_STEALING || state->cpu == -1)
+        { continue; }
+
+        // The kernel puts pages on the node of whoever first touches them, so the
+        // lanes have to be made again from the worker's CPU
+        cpu_affinity_saved_t* saved = cpu_affinity_move_current_thread(state->cpu);
+        if (!saved) { continue; }
+
+        for (size_t p = 0; p < THREAD_POOL_NUM_PRIORITIES; ++p)
+        {
+            itc_queue_t* queue =
+                itc_queue_init(WORKER_QUEUE_SIZE, sizeof(struct mq_data));
+            if (!queue)
+            {
+                MINIWEB_LOG_ERROR("Failed to move thread %zu's queues to CPU %d", i,
+                                  state->cpu);
+                cpu_affinity_restore_current_thread(saved);
+                return -1;
+            }
+
+            itc_queue_destroy(state->job_queues[p]);
+            state->job_queues[p] = queue;
+        }
+        cpu_affinity_restore_current_thread(saved);
+    }
+
+    return 0;
+}
+
 void thread_pool_destroy(struct thread_pool* restrict pool)
 {
     if (pool->is_running) thread_pool_stop(pool);
-    itc_queue_destroy(pool->job_queue);
+
+    for (size_t p = 0; p < THREAD_POOL_NUM_PRIORITIES; ++p)
+    {
+        if (pool->job_queues[p]) { itc_queue_destroy(pool->job_queues[p]); }
+        for (size_t i = 0; i < pool->num_threads
+                           && pool->mode == THREAD_POOL_MODE_WORK_STEALING;
+             ++i)
+        {
+            if (pool->threads[i].job_queues[p])
+            { itc_queue_destroy(pool->threads[i].job_queues[p]); }
+        }
+    }
+
+    pthread_mutex_destroy(&pool->resize_lock);
+    pthread_cond_destroy(&pool->work_available);
+    pthread_mutex_destroy(&pool->sleep_lock);
 
     free(pool->threads);
     free(pool);
 }
 
+void thread_pool_get_stats(struct thread_pool* restrict pool,
+                           thread_pool_stats_t*         stats)
+{
+    assert(pool);
+    assert(stats);
+
+    stats->num_threads = pool->num_threads;
+    if (pool->mode == THREAD_POOL_MODE_ELASTIC)
+    { stats->num_threads = atomic_load(&pool->num_running); }
+    stats->num_grown    = atomic_load(&pool->num_grown);
+    stats->num_shrunk   = atomic_load(&pool->num_shrunk);
+    stats->num_rejected = atomic_load(&pool->num_rejected);
+}
+
 int thread_pool_run(struct thread_pool* restrict pool,
                     thread_pool_func*            func,
                     void*                        data)
+{
+    return thread_pool_run_with_priority(pool, THREAD_POOL_PRIORITY_NORMAL, func,
+                                         data);
+}
+
+int thread_pool_run_with_priority(struct thread_pool* restrict pool,
+                                  enum thread_pool_priority    priority,
+                                  thread_pool_func*            func,
+                                  void*                        data)
 {
     assert(pool->is_running);
+    assert(priority < THREAD_POOL_NUM_PRIORITIES);
 
     struct mq_data message = {
         .type = MQ_FUNC_EXEC,
         .data = (union mq_data_union) {
             .func_exec = (struct mq_func_exec) {.func = func, .user_data = data}}};
 
-    int rc =
-        post_message(pool->job_queue, sizeof(message), (unsigned char*) &message);
+    if (thread_pool_run_messages(pool, priority, 1, &message) == 1) { return 0; }
+
+    return pool->max_queue_wait_us > 0 ? THREAD_POOL_OVERLOADED : -1;
+}
+
+size_t thread_pool_run_batch(struct thread_pool* restrict pool,
+                             size_t                       num_jobs,
+                             thread_pool_job_t            jobs[num_jobs])
+{
+    assert(pool->is_running);
+
+    struct mq_data messages[RUN_BATCH_CHUNK_SIZE];
+
+    // jobs[0, queued) went to the pool and jobs[queued, next) were turned away
+    size_t queued = 0;
+    size_t next   = 0;
+    while (next < num_jobs)
+    {
+        // Each chunk goes to one lane, so it ends where the priority changes
+        enum thread_pool_priority priority = jobs[next].priority;
+        assert(priority < THREAD_POOL_NUM_PRIORITIES);
+
+        size_t chunk = 0;
+        while (chunk < RUN_BATCH_CHUNK_SIZE && next + chunk < num_jobs
+               && jobs[next + chunk].priority == priority)
+        {
+            messages[chunk] = (struct mq_data) {
+                .type = MQ_FUNC_EXEC,
+                .data = (union mq_data_union) {
+                    .func_exec = (struct mq_func_exec) {
+                        .func      = jobs[next + chunk].func,
+                        .user_data = jobs[next + chunk].data}}};
+            ++chunk;
+        }
+
+        // A full lane mustn't hold up the rest of the batch, which may well be
+        // going to lanes that still have room
+        size_t posted = thread_pool_run_messages(pool, priority, chunk, messages);
+        if (posted < chunk && pool->max_queue_wait_us == 0)
+        {
+            // Under admission control being turned away is routine, and the caller
+            // deals with it. Otherwise something's gone wrong.
+            MINIWEB_LOG_ERROR("Failed to queue %zu of %zu jobs", chunk - posted,
+                              chunk);
+        }
+
+        // The ones that went in move up ahead of everything turned away so far
+        if (posted > 0 && next > queued)
+        {
+            thread_pool_rotate_jobs(next + posted - queued, jobs + queued,
+                                    next - queued);
+        }
+        queued += posted;
+        next += chunk;
+    }
 
-    return rc;
+    return queued;
 }
@@ -1,18 +1,120 @@
 #ifndef INCLUDED_THREAD_POOL_H
 #define INCLUDED_THREAD_POOL_H
 
+#include "cpu_affinity.h"
+
+#include <stdint.h>
 #include <stdlib.h>
 
 typedef struct thread_pool thread_pool_t;
 typedef void thread_pool_func(void*);
 
+enum thread_pool_priority
+{
+    // First, so that jobs which don't say get it
+    THREAD_POOL_PRIORITY_NORMAL,
+    // Latency sensitive jobs, which get most of the workers' attention
+    THREAD_POOL_PRIORITY_HIGH,
+    // Slow or bulk jobs, which still get a share so they never starve
+    THREAD_POOL_PRIORITY_LOW,
+    THREAD_POOL_NUM_PRIORITIES,
+};
+
+enum
+{
+    // What the run functions give back for jobs turned away because the pool is
+    // overloaded. See thread_pool_set_max_queue_wait.
+    THREAD_POOL_OVERLOADED = -2,
+};
+
+typedef struct thread_pool_job
+{
+    thread_pool_func*         func;
+    void*                     data;
+    enum thread_pool_priority priority;
+} thread_pool_job_t;
+
+// Whatever the mode, each priority has a lane of its own. Workers take jobs from
+// the lanes with weighted round robin, so high priority jobs don't queue up behind
+// the rest, but low priority ones still get their turn.
+enum thread_pool_mode
+{
+    // Every worker takes jobs from one set of lanes, and each lane's jobs start in
+    // the order they were run
+    THREAD_POOL_MODE_SHARED_QUEUE,
+    // Each worker has a queue of its own, and steals from the others once it runs
+    // dry. Jobs run from a worker go on its own queue, anyone else's are shared
+    // out between the workers. There's no ordering between jobs.
+    THREAD_POOL_MODE_WORK_STEALING,
+    // One queue as in THREAD_POOL_MODE_SHARED_QUEUE, but workers are added while
+    // jobs wait too long to be picked up, and let go again once they're idle
+    THREAD_POOL_MODE_ELASTIC,
+};
+
+typedef struct thread_pool_elastic_options
+{
+    size_t min_threads;
+    size_t max_threads;
+    // Another worker starts whenever a job has waited longer than this for one
+    uint64_t target_wait_us;
+    // Workers beyond min_threads exit after this long without a job
+    uint64_t idle_timeout_ms;
+} thread_pool_elastic_options_t;
+
+typedef struct thread_pool_stats
+{
+    size_t num_threads;
+    // Workers started and stopped by THREAD_POOL_MODE_ELASTIC since it was created
+    uint64_t num_grown;
+    uint64_t num_shrunk;
+    // Jobs turned away with THREAD_POOL_OVERLOADED
+    uint64_t num_rejected;
+} thread_pool_stats_t;
+
+thread_pool_elastic_options_t
+thread_pool_default_elastic_options(size_t min_threads, size_t max_threads);
+
+// Uses THREAD_POOL_MODE_SHARED_QUEUE
 thread_pool_t* thread_pool_init(size_t num_threads);
+// THREAD_POOL_MODE_ELASTIC gets the default options, with 1 to num_threads workers
+thread_pool_t* thread_pool_init_with_mode(size_t                num_threads,
+                                          enum thread_pool_mode mode);
+thread_pool_t*
+thread_pool_init_elastic(thread_pool_elastic_options_t const* options);
+// Pins the workers, before the pool is started, to the CPUs picked for thread
+// indices first_thread_index onwards. In THREAD_POOL_MODE_WORK_STEALING each
+// worker's queue is also moved onto its CPU's node.
+int            thread_pool_set_affinity(thread_pool_t* restrict pool,
+                                        cpu_topology_t const*   topology,
+                                        cpu_affinity_t const*   affinity,
+                                        size_t                  first_thread_index);
+// Admission control, set before the pool is started. Rather than wait for room when
+// a lane is full, running a job fails straight away with THREAD_POOL_OVERLOADED. So
+// does running one in a lane whose jobs have lately waited longer than max_wait_us
+// to be picked up, until it catches up again. 0, the default, always waits.
+void           thread_pool_set_max_queue_wait(thread_pool_t* restrict pool,
+                                              uint64_t                max_wait_us);
 int            thread_pool_start(thread_pool_t* restrict pool);
 int            thread_pool_stop(thread_pool_t* restrict pool);
 void           thread_pool_destroy(thread_pool_t* restrict pool);
 
+void thread_pool_get_stats(thread_pool_t* restrict pool, thread_pool_stats_t* stats);
+
+// Runs the job at THREAD_POOL_PRIORITY_NORMAL. Both return 0 once it's queued.
 int thread_pool_run(thread_pool_t* restrict pool,
                     thread_pool_func*       func,
                     void*                   data);
+int thread_pool_run_with_priority(thread_pool_t* restrict   pool,
+                                  enum thread_pool_priority priority,
+                                  thread_pool_func*         func,
+                                  void*                     data);
+// Queues the jobs with as few trips to the queues as possible. A lane turning its
+// jobs away doesn't stop the others being queued. Returns how many were queued,
+// which is only fewer than num_jobs if the pool turned some away or something went
+// wrong. Those are moved to the end of jobs, after the queued ones, and both keep
+// their order.
+size_t thread_pool_run_batch(thread_pool_t* restrict pool,
+                             size_t                  num_jobs,
+                             thread_pool_job_t       jobs[num_jobs]);
 
 #endif // INCLUDED_THREAD_POOL_H
@@ -0,0 +1,188 @@
+#include "timer_wheel.h"
+
+#include "logging.h"
+
+#include <assert.h>
+#include <time.h>
+
+#ifdef MINIWEB_TESTING
+extern void* _test_malloc(const size_t size, char const* file, int const line);
+extern void*
+             _test_calloc(size_t nmemb, size_t size, char const* file, int const line);
+extern void  _test_free(void* ptr, char const* file, int const line);
+extern void* _test_realloc(void* ptr, size_t size, char const* file, int const line);
+
+    #define malloc(size)       _test_malloc(size, __FILE__, __LINE__)
+    #define calloc(n, size)    _test_calloc(n, size, __FILE__, __LINE__)
+    #define free(ptr)          _test_free(ptr, __FILE__, __LINE__)
+    #define realloc(ptr, size) _test_realloc(ptr, size, __FILE__, __LINE__)
+#endif
+
+// ==== TYPES ====
+
+struct timer_wheel
+{
+    // Each slot is the head of a doubly linked list of entries. An entry lives in
+    // slot (deadline_tick % num_slots), which may be some revolutions away.
+    timer_wheel_entry_t** slots;
+    size_t                num_slots;
+    size_t                num_entries;
+    uint64_t              tick_ms;
+    // Every tick up to and including this one has been processed
+    uint64_t current_tick;
+};
+
+// ==== STATIC PROTOTYPES ====
+
+static void timer_wheel_link(struct timer_wheel* wheel, timer_wheel_entry_t* entry);
+static void timer_wheel_unlink(struct timer_wheel*  wheel,
+                               timer_wheel_entry_t* entry);
+
+// ==== PUBLIC FUNCTIONS IMPLEMENTATION ====
+
+struct timer_wheel* timer_wheel_init(size_t   num_slots,
+                                     uint64_t tick_ms,
+                                     uint64_t now_ms)
+{
+    assert(num_slots > 0);
+    assert(tick_ms > 0);
+
+    timer_wheel_entry_t** slots = calloc(num_slots, sizeof(timer_wheel_entry_t*));
+    if (!slots)
+    {
+        MINIWEB_LOG_ERROR("Failed to allocate %zu timer wheel slots", num_slots);
+        return NULL;
+    }
+
+    struct timer_wheel* wheel = calloc(1, sizeof(struct timer_wheel));
+    if (!wheel)
+    {
+        MINIWEB_LOG_ERROR("Failed to allocate timer wheel control structure");
+        free(slots);
+        return NULL;
+    }
+
+    wheel->slots        = slots;
+    wheel->num_slots    = num_slots;
+    wheel->num_entries  = 0;
+    wheel->tick_ms      = tick_ms;
+    wheel->current_tick = now_ms / tick_ms;
+
+    return wheel;
+}
+
+void timer_wheel_destroy(struct timer_wheel* restrict wheel)
+{
+    assert(wheel);
+
+    // The entries belong to the caller, so there's nothing to do for them
+    free(wheel->slots);
+    free(wheel);
+}
+
+void timer_wheel_schedule(struct timer_wheel*  wheel,
+                          timer_wheel_entry_t* entry,
+                          uint64_t             deadline_ms)
+{
+    assert(wheel);
+    assert(entry);
+
+    if (entry->is_scheduled) { timer_wheel_unlink(wheel, entry); }
+
+    // Round up, and never schedule into a tick we've already processed
+    uint64_t deadline_tick = (deadline_ms + wheel->tick_ms - 1) / wheel->tick_ms;
+    if (deadline_tick <= wheel->current_tick)
+    { deadline_tick = wheel->current_tick + 1; }
+
+    entry->deadline_tick = deadline_tick;
+    timer_wheel_link(wheel, entry);
+}
+
+void timer_wheel_cancel(struct timer_wheel* wheel, timer_wheel_entry_t* entry)
+{
+    assert(wheel);
+    assert(entry);
+
+    if (entry->is_scheduled) { timer_wheel_unlink(wheel, entry); }
+}
+
+timer_wheel_entry_t* timer_wheel_advance(struct timer_wheel* wheel, uint64_t now_ms)
+{
+    assert(wheel);
+
+    uint64_t now_tick = now_ms / wheel->tick_ms;
+    if (now_tick <= wheel->current_tick) { return NULL; }
+
+    // Past one full revolution every slot has been visited, so stop there
+    uint64_t ticks_to_process = now_tick - wheel->current_tick;
+    if (ticks_to_process > wheel->num_slots) { ticks_to_process = wheel->num_slots; }
+
+    timer_wheel_entry_t* expired = NULL;
+    for (uint64_t i = 1; i <= ticks_to_process; ++i)
+    {
+        size_t               slot = (wheel->current_tick + i) % wheel->num_slots;
+        timer_wheel_entry_t* curr = wheel->slots[slot];
+        while (curr)
+        {
+            timer_wheel_entry_t* next = curr->next;
+
+            // Anything a revolution or more away stays put
+            if (curr->deadline_tick <= now_tick)
+            {
+                timer_wheel_unlink(wheel, curr);
+                curr->next = expired;
+                expired    = curr;
+            }
+
+            curr = next;
+        }
+    }
+
+    wheel->current_tick = now_tick;
+    return expired;
+}
+
+size_t timer_wheel_get_size(struct timer_wheel const* wheel)
+{
+    assert(wheel);
+    return wheel->num_entries;
+}
+
+uint64_t timer_wheel_now_ms(void)
+{
+    struct timespec now = {0};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return ((uint64_t) now.tv_sec * 1000) + ((uint64_t) now.tv_nsec / 1000000);
+}
+
+// ==== STATIC FUNCTIONS IMPLEMENTATION ====
+
+static void timer_wheel_link(struct timer_wheel* wheel, timer_wheel_entry_t* entry)
+{
+    size_t slot = entry->deadline_tick % wheel->num_slots;
+
+    entry->prev = NULL;
+    entry->next = wheel->slots[slot];
+    if (entry->next) { entry->next->prev = entry; }
+    wheel->slots[slot] = entry;
+
+    entry->is_scheduled = true;
+    ++wheel->num_entries;
+}
+
+static void timer_wheel_unlink(struct timer_wheel*  wheel,
+                               timer_wheel_entry_t* entry)
+{
+    if (entry->prev) { entry->prev->next = entry->next; }
+    else
+    {
+        wheel->slots[entry->deadline_tick % wheel->num_slots] = entry->next;
+    }
+    if (entry->next) { entry->next->prev = entry->prev; }
+
+    entry->prev         = NULL;
+    entry->next         = NULL;
+    entry->is_scheduled = false;
+    --wheel->num_entries;
+}
@@ -0,0 +1,42 @@
+#ifndef INCLUDED_TIMER_WHEEL_H
+#define INCLUDED_TIMER_WHEEL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// A hashed timing wheel. Entries are embedded in the caller's own structs, so
+// scheduling, rescheduling and cancelling never allocate and are all O(1).
+// Deadlines are rounded up to the wheel's tick, and times are in milliseconds from
+// whatever clock the caller likes, so long as it's monotonic.
+
+typedef struct timer_wheel timer_wheel_t;
+
+typedef struct timer_wheel_entry
+{
+    struct timer_wheel_entry* prev;
+    struct timer_wheel_entry* next;
+    uint64_t                  deadline_tick;
+    bool                      is_scheduled;
+} timer_wheel_entry_t;
+
+timer_wheel_t* timer_wheel_init(size_t num_slots, uint64_t tick_ms, uint64_t now_ms);
+void           timer_wheel_destroy(timer_wheel_t* restrict wheel);
+
+// Works whether or not the entry is already scheduled, so this is also how you push
+// a deadline back
+void timer_wheel_schedule(timer_wheel_t*       wheel,
+                          timer_wheel_entry_t* entry,
+                          uint64_t             deadline_ms);
+void timer_wheel_cancel(timer_wheel_t* wheel, timer_wheel_entry_t* entry);
+
+// Moves the wheel on to now_ms and returns everything that expired on the way as a
+// list linked through next. Expired entries are no longer scheduled.
+timer_wheel_entry_t* timer_wheel_advance(timer_wheel_t* wheel, uint64_t now_ms);
+
+size_t timer_wheel_get_size(timer_wheel_t const* wheel);
+
+// Milliseconds on CLOCK_MONOTONIC, for callers that don't have a clock of their own
+uint64_t timer_wheel_now_ms(void);
+
+#endif // INCLUDED_TIMER_WHEEL_H
@@ -0,0 +1,1226 @@
+// Needed for pipe2() and F_GETPIPE_SZ
+#define _GNU_SOURCE
+
+#include "uring_engine.h"
+
+#include "logging.h"
+#include "macro_helpers.h"
+#include "timer_wheel.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static const int      URING_ENGINE_DEFAULT_TIMEOUT_MS      = 2000;
+static const uint64_t URING_ENGINE_DEFAULT_IDLE_TIMEOUT_MS = 300 * 1000;
+static const uint64_t URING_ENGINE_IDLE_TICK_MS            = 1000;
+static const size_t   URING_ENGINE_IDLE_WHEEL_SLOTS        = 512;
+
+enum
+{
+    // The header send plus up to 16 file->pipe->socket splice pairs. Anything
+    // bigger than that goes out over more than one chain.
+    URING_ENGINE_MAX_CHAIN_LENGTH     = 33,
+    URING_ENGINE_DEFAULT_PIPE_SIZE    = 64 * 1024,
+    URING_ENGINE_INIT_NUM_CONNECTIONS = 64,
+};
+
+// ==== DATA TYPES ====
+
+// The user_data of every SQE points at one of these, so when the completion comes
+// back we know what it was for
+enum uring_op_type
+{
+    URING_OP_ACCEPT,
+    URING_OP_RECV,
+    URING_OP_SEND,
+    URING_OP_POLL_COMPLETIONS
+};
+
+struct uring_op
+{
+    enum uring_op_type type;
+};
+
+// One of these lives for as long as a connection does. The socket stays open until
+// the caller's done with it and the kernel has finished every recv and send on it,
+// so its fd can't be handed out again while something might still use it.
+struct uring_recv_op
+{
+    struct uring_op       op; // Must be first
+    int                   sockfd;
+    slab_handle_t         buffer;
+    pool_handle_t         handle_to_me;
+    timer_wheel_entry_t   idle_timer;
+    bool                  receiving;
+    bool                  closing;
+    // Sends go out one at a time in the order they were queued, so that one
+    // response's chain can't be interleaved with the next
+    struct uring_send_op* sends_head;
+    struct uring_send_op* sends_tail;
+    unsigned int          num_sends;
+    struct uring_recv_op* prev;
+    struct uring_recv_op* next;
+};
+
+// Lives until the whole response has gone out, which may take more than one chain
+// if the file's big or the ring's busy
+struct uring_send_op
+{
+    struct uring_op       op; // Must be first
+    int                   sockfd;
+    struct uring_recv_op* connection;
+    int                   file_fd;
+    size_t                file_size;
+    int                   pipe_fds[2];
+    size_t                chunk_size;
+    // How far through the response the chains we've queued so far go
+    bool                  header_queued;
+    size_t                file_queued;
+    // SQEs in the current chain that haven't completed
+    unsigned int          pending;
+    bool                  failed;
+    struct uring_send_op* next;
+    // Set while it's waiting for room in the ring
+    struct uring_send_op* next_stalled;
+    size_t                header_len;
+    char                  header[];
+};
+
+// The bits of the kernel's shared rings that we need
+struct uring_ring
+{
+    int ring_fd;
+
+    unsigned int*        sq_head;
+    unsigned int*        sq_tail;
+    unsigned int*        sq_mask;
+    unsigned int*        sq_array;
+    unsigned int         sq_entries;
+    struct io_uring_sqe* sqes;
+    // Our local tail - SQEs up to here have been filled but maybe not submitted
+    unsigned int sqe_tail;
+
+    unsigned int*        cq_head;
+    unsigned int*        cq_tail;
+    unsigned int*        cq_mask;
+    struct io_uring_cqe* cqes;
+
+    void*  sq_ptr;
+    size_t sq_size;
+    void*  cq_ptr;
+    size_t cq_size;
+    size_t sqes_size;
+};
+
+struct uring_engine
+{
+    struct uring_ring ring;
+    int               listen_fd;
+    struct uring_op   accept_op;
+    // The completion queue's eventfd, or -1 if we aren't watching one
+    int               completions_fd;
+    struct uring_op   completions_op;
+    bool              iterating;
+
+    slab_t* request_slab;
+    size_t  buffer_size;
+
+    pool_t*               recv_op_pool;
+    struct uring_recv_op* connections;
+    // Indexed by fd, NULL for any fd we aren't tracking
+    struct uring_recv_op** fd_table;
+    size_t                 fd_table_cap;
+
+    timer_wheel_t* idle_timers;
+    uint64_t       idle_timeout_ms;
+
+    // Sends that couldn't get any room in the ring, tried again before we next wait
+    struct uring_send_op* stalled_sends;
+    // Set while we're being destroyed, so nothing new gets queued
+    bool stopping;
+};
+
+// ==== STATIC PROTOTYPES ====
+
+static int  uring_ring_init(struct uring_ring* ring, unsigned int entries);
+static void uring_ring_clean(struct uring_ring* ring);
+static struct io_uring_sqe* uring_ring_get_sqe(struct uring_ring* ring);
+static unsigned int         uring_ring_sq_space(struct uring_ring* ring);
+static int                  uring_ring_submit(struct uring_ring* ring);
+static int uring_ring_wait(struct uring_ring* ring, int timeout_ms);
+static struct io_uring_cqe* uring_ring_peek_cqe(struct uring_ring* ring);
+static void                 uring_ring_cqe_seen(struct uring_ring* ring);
+
+static int  uring_engine_arm_accept(struct uring_engine* engine);
+static int  uring_engine_arm_completions(struct uring_engine* engine);
+static int  uring_engine_arm_recv(struct uring_engine*  engine,
+                                  struct uring_recv_op* recv_op);
+static void uring_engine_remove_recv_op(struct uring_engine*  engine,
+                                        struct uring_recv_op* recv_op);
+static void uring_engine_release_recv_op(struct uring_engine*  engine,
+                                         struct uring_recv_op* recv_op);
+static struct uring_recv_op* uring_engine_lookup(struct uring_engine* engine,
+                                                 int                  sockfd);
+static int uring_engine_grow_fd_table(struct uring_engine* engine, int sockfd);
+static bool uring_engine_handle_accept(struct uring_engine* engine,
+                                       struct io_uring_cqe* cqe,
+                                       uring_event_t*       event_out);
+static bool uring_engine_handle_completions(struct uring_engine* engine,
+                                            struct io_uring_cqe* cqe,
+                                            uring_event_t*       event_out);
+static bool uring_engine_handle_recv(struct uring_engine*  engine,
+                                     struct uring_recv_op* recv_op,
+                                     int                   res,
+                                     uring_event_t*        event_out);
+static bool uring_engine_handle_cqe(struct uring_engine* engine,
+                                    struct io_uring_cqe* cqe,
+                                    uring_event_t*       event_out);
+static void uring_engine_handle_send(struct uring_engine*  engine,
+                                     struct uring_send_op* send_op,
+                                     int                   res);
+static void uring_engine_queue_send_chain(struct uring_engine*  engine,
+                                          struct uring_send_op* send_op);
+static void uring_engine_retry_stalled_sends(struct uring_engine* engine);
+static void uring_engine_finish_send(struct uring_engine*  engine,
+                                     struct uring_send_op* send_op);
+static void uring_engine_drop_sends(struct uring_recv_op* connection,
+                                    bool                  keep_head);
+static void uring_send_op_destroy(struct uring_send_op* send_op);
+
+// ==== PUBLIC FUNCTIONS IMPLEMENTATION ====
+
+struct uring_engine* uring_engine_create(unsigned int entries,
+                                         int          listen_fd,
+                                         slab_t*      request_slab,
+                                         size_t       buffer_size)
+{
+    assert(request_slab);
+    assert(buffer_size <= slab_get_max_size(request_slab));
+
+    struct uring_engine* engine = calloc(1, sizeof(struct uring_engine));
+    if (!engine)
+    {
+        MINIWEB_LOG_ERROR("Failed to allocate memory for uring_engine");
+        return NULL;
+    }
+
+    int rc = uring_ring_init(&engine->ring, entries);
+    if (rc != 0)
+    {
+        MINIWEB_LOG_ERROR("Failed to set up io_uring, rc: %d", rc);
+        free(engine);
+        return NULL;
+    }
+
+    engine->recv_op_pool =
+        pool_init(sizeof(struct uring_recv_op), URING_ENGINE_INIT_NUM_CONNECTIONS);
+    if (!engine->recv_op_pool)
+    {
+        MINIWEB_LOG_ERROR("Failed to create pool for recv operations");
+        uring_ring_clean(&engine->ring);
+        free(engine);
+        return NULL;
+    }
+
+    engine->idle_timers = timer_wheel_init(URING_ENGINE_IDLE_WHEEL_SLOTS,
+                                           URING_ENGINE_IDLE_TICK_MS,
+                                           timer_wheel_now_ms());
+    if (!engine->idle_timers)
+    {
+        MINIWEB_LOG_ERROR("Failed to create idle connection timers");
+        pool_destroy(engine->recv_op_pool);
+        uring_ring_clean(&engine->ring);
+        free(engine);
+        return NULL;
+    }
+
+    engine->listen_fd           = listen_fd;
+    engine->accept_op.type      = URING_OP_ACCEPT;
+    engine->completions_fd      = -1;
+    engine->completions_op.type = URING_OP_POLL_COMPLETIONS;
+    engine->request_slab        = request_slab;
+    engine->buffer_size         = buffer_size;
+    engine->idle_timeout_ms     = URING_ENGINE_DEFAULT_IDLE_TIMEOUT_MS;
+
+    rc = uring_engine_arm_accept(engine);
+    if (rc != 0)
+    {
+        MINIWEB_LOG_ERROR("Failed to queue accept on socket %d", listen_fd);
+        uring_engine_destroy(engine);
+        return NULL;
+    }
+
+    return engine;
+}
+
+void uring_engine_destroy(struct uring_engine* restrict engine)
+{
+    assert(engine);
+
+    // Shutting every socket down completes its recv and fails whatever it's
+    // sending. The kernel could be using our buffers until all of that's come
+    // back, so nothing can be freed before then.
+    engine->stopping      = true;
+    engine->stalled_sends = NULL;
+    for (struct uring_recv_op* curr = engine->connections; curr;)
+    {
+        struct uring_recv_op* next = curr->next;
+        shutdown(curr->sockfd, SHUT_RDWR);
+        uring_engine_drop_sends(curr, curr->sends_head && curr->sends_head->pending);
+        curr->closing = true;
+        uring_engine_release_recv_op(engine, curr);
+        curr = next;
+    }
+
+    while (engine->connections)
+    {
+        int rc = uring_ring_submit(&engine->ring);
+        if (rc >= 0)
+        { rc = uring_ring_wait(&engine->ring, URING_ENGINE_DEFAULT_TIMEOUT_MS); }
+        if (rc <= 0)
+        {
+            MINIWEB_LOG_ERROR("Gave up waiting for the kernel to finish with our "
+                              "sockets");
+            break;
+        }
+
+        struct io_uring_cqe* cqe   = NULL;
+        uring_event_t        event = {0};
+        while ((cqe = uring_ring_peek_cqe(&engine->ring)))
+        {
+            // Nobody's going to take any new connections now
+            bool have_event = uring_engine_handle_cqe(engine, cqe, &event);
+            if (have_event && event.type == URING_EVENT_ACCEPT)
+            { close(event.sockfd); }
+            uring_ring_cqe_seen(&engine->ring);
+        }
+    }
+
+    uring_ring_clean(&engine->ring);
+
+    // Only left if we gave up on the kernel, and it's torn down the ring since
+    for (struct uring_recv_op* curr = engine->connections; curr;)
+    {
+        struct uring_recv_op* next = curr->next;
+        MINIWEB_LOG_INFO("Closing socket %d", curr->sockfd);
+        close(curr->sockfd);
+        if (curr->buffer.data) { slab_free(engine->request_slab, curr->buffer); }
+        uring_engine_drop_sends(curr, false);
+        curr = next;
+    }
+
+    timer_wheel_destroy(engine->idle_timers);
+    pool_destroy(engine->recv_op_pool);
+    free(engine->fd_table);
+    free(engine);
+}
+
+int uring_engine_watch_completions(struct uring_engine*      engine,
+                                   completion_queue_t const* completions)
+{
+    assert(engine);
+    assert(completions);
+
+    engine->completions_fd = completions->event_fd;
+    int rc                 = uring_engine_arm_completions(engine);
+    if (rc != 0)
+    {
+        MINIWEB_LOG_ERROR("Failed to queue poll on completions eventfd %d",
+                          engine->completions_fd);
+        engine->completions_fd = -1;
+        return -1;
+    }
+
+    return 0;
+}
+
+int uring_engine_add_connection(struct uring_engine* engine, int sockfd)
+{
+    assert(engine);
+
+    if (sockfd < 0 || uring_engine_lookup(engine, sockfd))
+    {
+        MINIWEB_LOG_ERROR("Socket %d is invalid or already being received on",
+                          sockfd);
+        return -1;
+    }
+    if ((size_t) sockfd >= engine->fd_table_cap)
+    {
+        int rc = uring_engine_grow_fd_table(engine, sockfd);
+        if (rc != 0) { return -1; }
+    }
+
+    pool_handle_t op_handle = pool_calloc(engine->recv_op_pool);
+    if (!op_handle.data)
+    {
+        MINIWEB_LOG_ERROR("Failed to allocate recv operation for socket %d", sockfd);
+        return -1;
+    }
+
+    slab_handle_t buffer = slab_alloc(engine->request_slab, engine->buffer_size);
+    if (!buffer.data)
+    {
+        MINIWEB_LOG_ERROR("Failed to allocate request buffer for socket %d", sockfd);
+        pool_free(engine->recv_op_pool, op_handle);
+        return -2;
+    }
+
+    struct uring_recv_op* recv_op = op_handle.data;
+    recv_op->op.type              = URING_OP_RECV;
+    recv_op->sockfd               = sockfd;
+    recv_op->buffer               = buffer;
+    recv_op->handle_to_me         = op_handle;
+    recv_op->receiving            = true;
+
+    int rc = uring_engine_arm_recv(engine, recv_op);
+    if (rc != 0)
+    {
+        MINIWEB_LOG_ERROR("Failed to queue recv for socket %d", sockfd);
+        slab_free(engine->request_slab, buffer);
+        pool_free(engine->recv_op_pool, op_handle);
+        return -3;
+    }
+
+    recv_op->next = engine->connections;
+    if (engine->connections) { engine->connections->prev = recv_op; }
+    engine->connections      = recv_op;
+    engine->fd_table[sockfd] = recv_op;
+
+    timer_wheel_schedule(engine->idle_timers, &recv_op->idle_timer,
+                         timer_wheel_now_ms() + engine->idle_timeout_ms);
+
+    return 0;
+}
+
+void uring_engine_close_connection(struct uring_engine* engine, int sockfd)
+{
+    assert(engine);
+
+    struct uring_recv_op* recv_op = uring_engine_lookup(engine, sockfd);
+    if (!recv_op || recv_op->closing)
+    {
+        MINIWEB_LOG_ERROR("Attempted to close socket %d but it isn't open", sockfd);
+        return;
+    }
+
+    // Only stop it receiving, so anything we've queued to send still goes out. The
+    // recv then completes, and the socket's closed once the sends have too.
+    recv_op->closing = true;
+    if (recv_op->receiving) { shutdown(sockfd, SHUT_RD); }
+    uring_engine_release_recv_op(engine, recv_op);
+}
+
+void uring_engine_set_idle_timeout(struct uring_engine* engine, uint64_t timeout_ms)
+{
+    assert(engine);
+    assert(timeout_ms > 0);
+
+    // Connections already being tracked pick this up the next time they're active
+    engine->idle_timeout_ms = timeout_ms;
+}
+
+size_t uring_engine_close_idle_connections(struct uring_engine* engine)
+{
+    assert(engine);
+
+    timer_wheel_entry_t* expired =
+        timer_wheel_advance(engine->idle_timers, timer_wheel_now_ms());
+
+    // We can't close the socket while the kernel still has a recv outstanding on
+    // it, so shut it down instead. The recv then completes with 0 and the caller
+    // gets a URING_EVENT_CLOSED like it would for any other hang up.
+    size_t num_closed = 0;
+    while (expired)
+    {
+        timer_wheel_entry_t*  next = expired->next;
+        struct uring_recv_op* recv_op =
+            CONTAINER_OF(expired, struct uring_recv_op, idle_timer);
+
+        // It's still busy sending, so give it another timeout once that's done
+        if (recv_op->num_sends > 0)
+        {
+            timer_wheel_schedule(engine->idle_timers, &recv_op->idle_timer,
+                                 timer_wheel_now_ms() + engine->idle_timeout_ms);
+            expired = next;
+            continue;
+        }
+
+        MINIWEB_LOG_INFO("Shutting down idle connection on socket %d",
+                         recv_op->sockfd);
+        shutdown(recv_op->sockfd, SHUT_RDWR);
+        ++num_closed;
+
+        expired = next;
+    }
+
+    return num_closed;
+}
+
+bool uring_engine_get_next_event(struct uring_engine* engine,
+                                 uring_event_t*       event_out)
+{
+    assert(engine);
+    assert(event_out);
+
+    // We're not currently iterating, so push out anything we've queued and wait
+    if (!engine->iterating)
+    {
+        uring_engine_retry_stalled_sends(engine);
+        int rc = uring_ring_submit(&engine->ring);
+        if (rc < 0) { return false; }
+
+        rc = uring_ring_wait(&engine->ring, URING_ENGINE_DEFAULT_TIMEOUT_MS);
+        if (rc <= 0)
+        {
+            // We timed out, got interrupted or failed
+            return false;
+        }
+
+        engine->iterating = true;
+    }
+
+    struct io_uring_cqe* cqe = NULL;
+    while ((cqe = uring_ring_peek_cqe(&engine->ring)))
+    {
+        bool have_event = uring_engine_handle_cqe(engine, cqe, event_out);
+        uring_ring_cqe_seen(&engine->ring);
+        if (have_event) { return true; }
+    }
+
+    // If we get here we've drained the completion queue
+    engine->iterating = false;
+    return false;
+}
+
+int uring_engine_send_response(struct uring_engine*              engine,
+                               int                               sockfd,
+                               http_file_response_t const* const prepared)
+{
+    assert(engine);
+    assert(prepared);
+
+    struct uring_recv_op* connection = uring_engine_lookup(engine, sockfd);
+    if (!connection || connection->closing)
+    {
+        MINIWEB_LOG_ERROR("Attempted to send to socket %d but it isn't open",
+                          sockfd);
+        if (prepared->file_fd != -1) { close(prepared->file_fd); }
+        return -1;
+    }
+
+    struct uring_send_op* send_op =
+        calloc(1, sizeof(struct uring_send_op) + prepared->header_len);
+    if (!send_op)
+    {
+        MINIWEB_LOG_ERROR("Failed to allocate send operation for socket %d", sockfd);
+        if (prepared->file_fd != -1) { close(prepared->file_fd); }
+        return -1;
+    }
+
+    send_op->op.type     = URING_OP_SEND;
+    send_op->sockfd      = sockfd;
+    send_op->connection  = connection;
+    send_op->file_fd     = prepared->file_fd;
+    send_op->file_size   = prepared->file_size > 0 ? prepared->file_size : 0;
+    send_op->pipe_fds[0] = -1;
+    send_op->pipe_fds[1] = -1;
+    send_op->chunk_size  = URING_ENGINE_DEFAULT_PIPE_SIZE;
+    send_op->header_len  = prepared->header_len;
+    memcpy(send_op->header, prepared->header, prepared->header_len);
+
+    // There's no sendfile for io_uring, so the file goes file -> pipe -> socket
+    if (send_op->file_size > 0)
+    {
+        int rc = pipe2(send_op->pipe_fds, O_CLOEXEC);
+        if (rc == -1)
+        {
+            MINIWEB_LOG_ERROR("Failed to create pipe for splicing: %d (%s)", errno,
+                              strerror(errno));
+            errno = 0;
+            uring_send_op_destroy(send_op);
+            return -2;
+        }
+
+        int pipe_size = fcntl(send_op->pipe_fds[1], F_GETPIPE_SZ);
+        if (pipe_size > 0) { send_op->chunk_size = pipe_size; }
+    }
+
+    // It waits its turn behind anything else going out on the socket
+    if (connection->sends_tail) { connection->sends_tail->next = send_op; }
+    else
+    {
+        connection->sends_head = send_op;
+    }
+    connection->sends_tail = send_op;
+    ++connection->num_sends;
+
+    if (connection->sends_head == send_op)
+    { uring_engine_queue_send_chain(engine, send_op); }
+
+    return 0;
+}
+
+// ==== STATIC FUNCTIONS IMPLEMENTATION ====
+
+static int uring_engine_arm_accept(struct uring_engine* engine)
+{
+    struct io_uring_sqe* sqe = uring_ring_get_sqe(&engine->ring);
+    if (!sqe)
+    {
+        uring_ring_submit(&engine->ring);
+        sqe = uring_ring_get_sqe(&engine->ring);
+    }
+    if (!sqe) { return -1; }
+
+    // One multishot accept keeps posting completions until it's cancelled or fails
+    sqe->opcode       = IORING_OP_ACCEPT;
+    sqe->fd           = engine->listen_fd;
+    sqe->ioprio       = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data    = (uintptr_t) &engine->accept_op;
+
+    return 0;
+}
+
+static int uring_engine_arm_completions(struct uring_engine* engine)
+{
+    struct io_uring_sqe* sqe = uring_ring_get_sqe(&engine->ring);
+    if (!sqe)
+    {
+        uring_ring_submit(&engine->ring);
+        sqe = uring_ring_get_sqe(&engine->ring);
+    }
+    if (!sqe) { return -1; }
+
+    // Like the accept, one multishot poll keeps firing every time it's readable
+    sqe->opcode        = IORING_OP_POLL_ADD;
+    sqe->fd            = engine->completions_fd;
+    sqe->poll32_events = POLLIN;
+    sqe->len           = IORING_POLL_ADD_MULTI;
+    sqe->user_data     = (uintptr_t) &engine->completions_op;
+
+    return 0;
+}
+
+static int uring_engine_arm_recv(struct uring_engine*  engine,
+                                 struct uring_recv_op* recv_op)
+{
+    struct io_uring_sqe* sqe = uring_ring_get_sqe(&engine->ring);
+    if (!sqe)
+    {
+        uring_ring_submit(&engine->ring);
+        sqe = uring_ring_get_sqe(&engine->ring);
+    }
+    if (!sqe) { return -1; }
+
+    // Leave room for a NUL terminator, the request is treated as a string later
+    sqe->opcode    = IORING_OP_RECV;
+    sqe->fd        = recv_op->sockfd;
+    sqe->addr      = (uintptr_t) recv_op->buffer.data;
+    sqe->len       = engine->buffer_size - 1;
+    sqe->user_data = (uintptr_t) recv_op;
+
+    return 0;
+}
+
+static void uring_engine_remove_recv_op(struct uring_engine*  engine,
+                                        struct uring_recv_op* recv_op)
+{
+    timer_wheel_cancel(engine->idle_timers, &recv_op->idle_timer);
+
+    if (recv_op->prev) { recv_op->prev->next = recv_op->next; }
+    else
+    {
+        engine->connections = recv_op->next;
+    }
+    if (recv_op->next) { recv_op->next->prev = recv_op->prev; }
+
+    engine->fd_table[recv_op->sockfd] = NULL;
+    pool_free(engine->recv_op_pool, recv_op->handle_to_me);
+}
+
+static void uring_engine_release_recv_op(struct uring_engine*  engine,
+                                         struct uring_recv_op* recv_op)
+{
+    bool in_use = recv_op->receiving || recv_op->num_sends > 0;
+    if (!recv_op->closing || in_use) { return; }
+
+    MINIWEB_LOG_INFO("Closing socket %d", recv_op->sockfd);
+    close(recv_op->sockfd);
+    uring_engine_remove_recv_op(engine, recv_op);
+}
+
+static struct uring_recv_op* uring_engine_lookup(struct uring_engine* engine,
+                                                 int                  sockfd)
+{
+    if (sockfd < 0 || (size_t) sockfd >= engine->fd_table_cap) { return NULL; }
+    return engine->fd_table[sockfd];
+}
+
+static int uring_engine_grow_fd_table(struct uring_engine* engine, int sockfd)
+{
+    size_t new_cap = engine->fd_table_cap ? engine->fd_table_cap : 16;
+    while (new_cap <= (size_t) sockfd) new_cap *= 2;
+
+    struct uring_recv_op** new_table =
+        realloc(engine->fd_table, new_cap * sizeof(struct uring_recv_op*));
+    if (!new_table)
+    {
+        MINIWEB_LOG_ERROR("Was unable to allocate memory for the fd table!");
+        return -1;
+    }
+
+    memset(new_table + engine->fd_table_cap, 0,
+           (new_cap - engine->fd_table_cap) * sizeof(struct uring_recv_op*));
+    engine->fd_table     = new_table;
+    engine->fd_table_cap = new_cap;
+
+    return 0;
+}
+
+static bool uring_engine_handle_accept(struct uring_engine* engine,
+                                       struct io_uring_cqe* cqe,
+                                       uring_event_t*       event_out)
+{
+    // The multishot accept has stopped, so we need to start another one
+    if (!(cqe->flags & IORING_CQE_F_MORE))
+    {
+        int rc = uring_engine_arm_accept(engine);
+        if (rc != 0)
+        { MINIWEB_LOG_ERROR("Failed to re-queue accept on %d", engine->listen_fd); }
+    }
+
+    if (cqe->res < 0)
+    {
+        MINIWEB_LOG_ERROR("Failed to accept new connection: %d (%s)", -cqe->res,
+                          strerror(-cqe->res));
+        return false;
+    }
+
+    *event_out = (uring_event_t) {.type = URING_EVENT_ACCEPT, .sockfd = cqe->res};
+    return true;
+}
+
+static bool uring_engine_handle_completions(struct uring_engine* engine,
+                                            struct io_uring_cqe* cqe,
+                                            uring_event_t*       event_out)
+{
+    if (!(cqe->flags & IORING_CQE_F_MORE))
+    {
+        int rc = uring_engine_arm_completions(engine);
+        if (rc != 0)
+        {
+            MINIWEB_LOG_ERROR("Failed to re-queue poll on completions eventfd %d",
+                              engine->completions_fd);
+        }
+    }
+
+    if (cqe->res < 0)
+    {
+        MINIWEB_LOG_ERROR("Poll on completions eventfd failed: %d (%s)", -cqe->res,
+                          strerror(-cqe->res));
+        return false;
+    }
+
+    *event_out = (uring_event_t) {.type   = URING_EVENT_COMPLETIONS,
+                                  .sockfd = engine->completions_fd};
+    return true;
+}
+
+static bool uring_engine_handle_recv(struct uring_engine*  engine,
+                                     struct uring_recv_op* recv_op,
+                                     int                   res,
+                                     uring_event_t*        event_out)
+{
+    int sockfd = recv_op->sockfd;
+
+    // We shut it down ourselves, so nobody wants whatever it got
+    if (recv_op->closing)
+    {
+        slab_free(engine->request_slab, recv_op->buffer);
+        recv_op->buffer    = (slab_handle_t) {0};
+        recv_op->receiving = false;
+        uring_engine_release_recv_op(engine, recv_op);
+        return false;
+    }
+
+    slab_handle_t next_buffer = {0};
+    if (res > 0)
+    {
+        next_buffer = slab_alloc(engine->request_slab, engine->buffer_size);
+        if (!next_buffer.data)
+        {
+            MINIWEB_LOG_ERROR("No request buffer to keep receiving on socket %d",
+                              sockfd);
+            res = -ENOMEM;
+        }
+    }
+
+    if (res <= 0)
+    {
+        if (res == 0)
+        { MINIWEB_LOG_ERROR("Connection on socket %d closed by client", sockfd); }
+        else
+        {
+            MINIWEB_LOG_ERROR("Error recv()ing on socket %d: %d (%s)", sockfd, -res,
+                              strerror(-res));
+        }
+
+        // The socket stays open until the caller closes it
+        slab_free(engine->request_slab, recv_op->buffer);
+        recv_op->buffer    = (slab_handle_t) {0};
+        recv_op->receiving = false;
+        timer_wheel_cancel(engine->idle_timers, &recv_op->idle_timer);
+        *event_out = (uring_event_t) {.type = URING_EVENT_CLOSED, .sockfd = sockfd};
+        return true;
+    }
+
+    timer_wheel_schedule(engine->idle_timers, &recv_op->idle_timer,
+                         timer_wheel_now_ms() + engine->idle_timeout_ms);
+
+    // Hand the filled buffer to the caller and keep receiving into a fresh one
+    slab_handle_t filled = recv_op->buffer;
+    ((char*) filled.data)[res] = '\0';
+    recv_op->buffer            = next_buffer;
+
+    int rc = uring_engine_arm_recv(engine, recv_op);
+    if (rc != 0)
+    {
+        // Without a recv outstanding we'd never hear about it again
+        MINIWEB_LOG_ERROR("Failed to re-queue recv for socket %d, dropping it",
+                          sockfd);
+        slab_free(engine->request_slab, filled);
+        slab_free(engine->request_slab, recv_op->buffer);
+        recv_op->buffer    = (slab_handle_t) {0};
+        recv_op->receiving = false;
+        timer_wheel_cancel(engine->idle_timers, &recv_op->idle_timer);
+        *event_out = (uring_event_t) {.type = URING_EVENT_CLOSED, .sockfd = sockfd};
+        return true;
+    }
+
+    *event_out = (uring_event_t) {.type      = URING_EVENT_RECV,
+                                  .sockfd    = sockfd,
+                                  .buffer    = filled,
+                                  .num_bytes = res};
+    return true;
+}
+
+static void uring_engine_handle_send(struct uring_engine*  engine,
+                                     struct uring_send_op* send_op,
+                                     int                   res)
+{
+    // Everything after a failure in the chain comes back as -ECANCELED, so only
+    // log the first one
+    if (res < 0 && !send_op->failed)
+    {
+        MINIWEB_LOG_ERROR("Failed to send response to socket %d: %d (%s)",
+                          send_op->sockfd, -res, strerror(-res));
+        send_op->failed = true;
+    }
+
+    --send_op->pending;
+    if (send_op->pending > 0) { return; }
+
+    bool done = send_op->header_queued && send_op->file_queued == send_op->file_size;
+    if (!done && !send_op->failed && !engine->stopping)
+    {
+        uring_engine_queue_send_chain(engine, send_op);
+        return;
+    }
+
+    uring_engine_finish_send(engine, send_op);
+}
+
+// Queues as much of what's left of the response as the ring has room for, as one
+// linked chain. The rest goes once that's completed.
+static void uring_engine_queue_send_chain(struct uring_engine*  engine,
+                                          struct uring_send_op* send_op)
+{
+    // If the ring is backed up, handing what we have to the kernel frees up space
+    unsigned int max_sqes = URING_ENGINE_MAX_CHAIN_LENGTH;
+    if (uring_ring_sq_space(&engine->ring) < max_sqes)
+    { uring_ring_submit(&engine->ring); }
+    if (uring_ring_sq_space(&engine->ring) < max_sqes)
+    { max_sqes = uring_ring_sq_space(&engine->ring); }
+
+    // Chunks need a splice in and a splice out, so there has to be room for both
+    unsigned int needed = send_op->header_queued ? 2 : 1;
+    if (max_sqes < needed)
+    {
+        MINIWEB_LOG_INFO("No room in the ring to send to socket %d yet",
+                         send_op->sockfd);
+        send_op->next_stalled = engine->stalled_sends;
+        engine->stalled_sends = send_op;
+        return;
+    }
+
+    struct io_uring_sqe* last = NULL;
+    unsigned int         num_sqes = 0;
+    if (!send_op->header_queued)
+    {
+        struct io_uring_sqe* sqe = uring_ring_get_sqe(&engine->ring);
+        sqe->opcode              = IORING_OP_SEND;
+        sqe->fd                  = send_op->sockfd;
+        sqe->addr                = (uintptr_t) send_op->header;
+        sqe->len                 = send_op->header_len;
+        sqe->msg_flags           = MSG_NOSIGNAL | MSG_WAITALL;
+        sqe->user_data           = (uintptr_t) send_op;
+        if (send_op->file_size > 0) { sqe->msg_flags |= MSG_MORE; }
+
+        send_op->header_queued = true;
+        last                   = sqe;
+        ++num_sqes;
+    }
+
+    while (send_op->file_queued < send_op->file_size && num_sqes + 2 <= max_sqes)
+    {
+        size_t offset = send_op->file_queued;
+        size_t len    = send_op->file_size - offset;
+        if (len > send_op->chunk_size) { len = send_op->chunk_size; }
+
+        if (last) { last->flags |= IOSQE_IO_LINK; }
+
+        struct io_uring_sqe* sqe = uring_ring_get_sqe(&engine->ring);
+        sqe->opcode              = IORING_OP_SPLICE;
+        sqe->fd                  = send_op->pipe_fds[1];
+        sqe->off                 = (uint64_t) -1;
+        sqe->splice_fd_in        = send_op->file_fd;
+        sqe->splice_off_in       = offset;
+        sqe->len                 = len;
+        sqe->flags               = IOSQE_IO_LINK;
+        sqe->user_data           = (uintptr_t) send_op;
+
+        sqe                = uring_ring_get_sqe(&engine->ring);
+        sqe->opcode        = IORING_OP_SPLICE;
+        sqe->fd            = send_op->sockfd;
+        sqe->off           = (uint64_t) -1;
+        sqe->splice_fd_in  = send_op->pipe_fds[0];
+        sqe->splice_off_in = (uint64_t) -1;
+        sqe->len           = len;
+        sqe->user_data     = (uintptr_t) send_op;
+
+        send_op->file_queued += len;
+        last = sqe;
+        num_sqes += 2;
+    }
+
+    send_op->pending = num_sqes;
+
+    // The reactor submits everything else it's queued before it next waits
+    int rc = uring_ring_submit(&engine->ring);
+    if (rc < 0)
+    {
+        MINIWEB_LOG_ERROR("Failed to submit response for socket %d: %d",
+                          send_op->sockfd, rc);
+    }
+}
+
+static void uring_engine_retry_stalled_sends(struct uring_engine* engine)
+{
+    struct uring_send_op* stalled = engine->stalled_sends;
+    engine->stalled_sends         = NULL;
+
+    while (stalled)
+    {
+        struct uring_send_op* next = stalled->next_stalled;
+        stalled->next_stalled      = NULL;
+        uring_engine_queue_send_chain(engine, stalled);
+        stalled = next;
+    }
+}
+
+// The response is as done as it's going to get, so start on the next one
+static void uring_engine_finish_send(struct uring_engine*  engine,
+                                     struct uring_send_op* send_op)
+{
+    struct uring_recv_op* connection = send_op->connection;
+    assert(connection->sends_head == send_op);
+
+    connection->sends_head = send_op->next;
+    if (!connection->sends_head) { connection->sends_tail = NULL; }
+    --connection->num_sends;
+    uring_send_op_destroy(send_op);
+
+    if (engine->stopping) { uring_engine_drop_sends(connection, false); }
+    else if (connection->sends_head)
+    {
+        uring_engine_queue_send_chain(engine, connection->sends_head);
+    }
+
+    uring_engine_release_recv_op(engine, connection);
+}
+
+// Throws away sends that haven't gone to the kernel, and with keep_head false, the
+// one that's going out now as well
+static void uring_engine_drop_sends(struct uring_recv_op* connection,
+                                    bool                  keep_head)
+{
+    struct uring_send_op* curr = connection->sends_head;
+    if (keep_head && curr)
+    {
+        struct uring_send_op* rest = curr->next;
+        curr->next                 = NULL;
+        connection->sends_tail     = curr;
+        connection->num_sends      = 1;
+        curr                       = rest;
+    }
+    else
+    {
+        connection->sends_head = NULL;
+        connection->sends_tail = NULL;
+        connection->num_sends  = 0;
+    }
+
+    while (curr)
+    {
+        struct uring_send_op* next = curr->next;
+        uring_send_op_destroy(curr);
+        curr = next;
+    }
+}
+
+static bool uring_engine_handle_cqe(struct uring_engine* engine,
+                                    struct io_uring_cqe* cqe,
+                                    uring_event_t*       event_out)
+{
+    struct uring_op* op  = (struct uring_op*) (uintptr_t) cqe->user_data;
+    int              res = cqe->res;
+
+    switch (op->type)
+    {
+        case URING_OP_ACCEPT:
+            return uring_engine_handle_accept(engine, cqe, event_out);
+        case URING_OP_RECV:
+            return uring_engine_handle_recv(engine, (struct uring_recv_op*) op, res,
+                                            event_out);
+        case URING_OP_SEND:
+            uring_engine_handle_send(engine, (struct uring_send_op*) op, res);
+            return false;
+        case URING_OP_POLL_COMPLETIONS:
+            return uring_engine_handle_completions(engine, cqe, event_out);
+        default:
+            MINIWEB_LOG_ERROR("Invalid operation type completed: %d", op->type);
+            return false;
+    }
+}
+
+static void uring_send_op_destroy(struct uring_send_op* send_op)
+{
+    if (send_op->pipe_fds[0] != -1) close(send_op->pipe_fds[0]);
+    if (send_op->pipe_fds[1] != -1) close(send_op->pipe_fds[1]);
+    if (send_op->file_fd != -1) close(send_op->file_fd);
+    free(send_op);
+}
+
+// ==== RING HELPERS ====
+
+static int uring_ring_init(struct uring_ring* ring, unsigned int entries)
+{
+    struct io_uring_params params = {0};
+
+    int ring_fd = (int) syscall(__NR_io_uring_setup, entries, &params);
+    if (ring_fd == -1)
+    {
+        MINIWEB_LOG_ERROR("Call to io_uring_setup() failed: %d (%s)", errno,
+                          strerror(errno));
+        errno = 0;
+        return -1;
+    }
+
+    // We rely on waiting with a timeout, and on the kernel never dropping CQEs
+    if (!(params.features & IORING_FEAT_EXT_ARG) ||
+        !(params.features & IORING_FEAT_NODROP))
+    {
+        MINIWEB_LOG_ERROR("Kernel io_uring is missing features we need: 0x%x",
+                          params.features);
+        close(ring_fd);
+        return -2;
+    }
+
+    ring->ring_fd   = ring_fd;
+    ring->sq_size   = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    ring->cq_size   = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap)
+    {
+        if (ring->cq_size > ring->sq_size) { ring->sq_size = ring->cq_size; }
+        ring->cq_size = ring->sq_size;
+    }
+
+    ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED)
+    {
+        MINIWEB_LOG_ERROR("Failed to map SQ ring: %d (%s)", errno, strerror(errno));
+        errno = 0;
+        close(ring_fd);
+        return -3;
+    }
+
+    ring->cq_ptr = ring->sq_ptr;
+    if (!single_mmap)
+    {
+        ring->cq_ptr = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED)
+        {
+            MINIWEB_LOG_ERROR("Failed to map CQ ring: %d (%s)", errno,
+                              strerror(errno));
+            errno = 0;
+            munmap(ring->sq_ptr, ring->sq_size);
+            close(ring_fd);
+            return -4;
+        }
+    }
+
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+    {
+        MINIWEB_LOG_ERROR("Failed to map SQEs: %d (%s)", errno, strerror(errno));
+        errno = 0;
+        if (!single_mmap) munmap(ring->cq_ptr, ring->cq_size);
+        munmap(ring->sq_ptr, ring->sq_size);
+        close(ring_fd);
+        return -5;
+    }
+
+    unsigned char* sq = ring->sq_ptr;
+    ring->sq_head     = (unsigned int*) (sq + params.sq_off.head);
+    ring->sq_tail     = (unsigned int*) (sq + params.sq_off.tail);
+    ring->sq_mask     = (unsigned int*) (sq + params.sq_off.ring_mask);
+    ring->sq_array    = (unsigned int*) (sq + params.sq_off.array);
+    ring->sq_entries  = params.sq_entries;
+    ring->sqe_tail    = *ring->sq_tail;
+
+    unsigned char* cq = ring->cq_ptr;
+    ring->cq_head     = (unsigned int*) (cq + params.cq_off.head);
+    ring->cq_tail     = (unsigned int*) (cq + params.cq_off.tail);
+    ring->cq_mask     = (unsigned int*) (cq + params.cq_off.ring_mask);
+    ring->cqes        = (struct io_uring_cqe*) (cq + params.cq_off.cqes);
+
+    // SQE slots are always used in order, so the indirection array never changes
+    for (unsigned int i = 0; i < ring->sq_entries; ++i)
+    {
+        ring->sq_array[i] = i;
+    }
+
+    return 0;
+}
+
+static void uring_ring_clean(struct uring_ring* ring)
+{
+    munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ptr != ring->sq_ptr) munmap(ring->cq_ptr, ring->cq_size);
+    munmap(ring->sq_ptr, ring->sq_size);
+    close(ring->ring_fd);
+}
+
+static unsigned int uring_ring_sq_space(struct uring_ring* ring)
+{
+    unsigned int head =
+        atomic_load_explicit((_Atomic unsigned int*) ring->sq_head, memory_order_acquire);
+    return ring->sq_entries - (ring->sqe_tail - head);
+}
+
+static struct io_uring_sqe* uring_ring_get_sqe(struct uring_ring* ring)
+{
+    if (uring_ring_sq_space(ring) == 0) { return NULL; }
+
+    struct io_uring_sqe* sqe = &ring->sqes[ring->sqe_tail & *ring->sq_mask];
+    ++ring->sqe_tail;
+
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    return sqe;
+}
+
+static int uring_ring_submit(struct uring_ring* ring)
+{
+    // We're the only ones that write the tail, so no need for an atomic read
+    unsigned int to_submit = ring->sqe_tail - *ring->sq_tail;
+    if (to_submit == 0) { return 0; }
+
+    atomic_store_explicit((_Atomic unsigned int*) ring->sq_tail, ring->sqe_tail,
+                          memory_order_release);
+
+    for (;;)
+    {
+        int rc = (int) syscall(__NR_io_uring_enter, ring->ring_fd, to_submit, 0, 0,
+                               NULL, 0);
+        if (rc == -1 && errno == EINTR) { continue; }
+        if (rc == -1)
+        {
+            MINIWEB_LOG_ERROR("Call to io_uring_enter() failed: %d (%s)", errno,
+                              strerror(errno));
+            errno = 0;
+            return -1;
+        }
+
+        return rc;
+    }
+}
+
+static int uring_ring_wait(struct uring_ring* ring, int timeout_ms)
+{
+    if (uring_ring_peek_cqe(ring)) { return 1; }
+
+    struct __kernel_timespec timeout = {
+        .tv_sec  = timeout_ms / 1000,
+        .tv_nsec = (timeout_ms % 1000) * 1000 * 1000,
+    };
+    struct io_uring_getevents_arg arg = {
+        .sigmask    = 0,
+        .sigmask_sz = _NSIG / 8,
+        .ts         = (uintptr_t) &timeout,
+    };
+
+    int rc = (int) syscall(__NR_io_uring_enter, ring->ring_fd, 0, 1,
+                           IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg,
+                           sizeof(arg));
+    if (rc == -1)
+    {
+        if (errno == ETIME || errno == EINTR)
+        {
+            errno = 0;
+            return 0;
+        }
+
+        MINIWEB_LOG_ERROR("Failed waiting on io_uring: %d (%s)", errno,
+                          strerror(errno));
+        errno = 0;
+        return -1;
+    }
+
+    return uring_ring_peek_cqe(ring) ? 1 : 0;
+}
+
+static struct io_uring_cqe* uring_ring_peek_cqe(struct uring_ring* ring)
+{
+    // Only the reactor consumes, so the head is ours, but the kernel moves the tail
+    unsigned int head = *ring->cq_head;
+    unsigned int tail =
+        atomic_load_explicit((_Atomic unsigned int*) ring->cq_tail, memory_order_acquire);
+    if (head == tail) { return NULL; }
+
+    return &ring->cqes[head & *ring->cq_mask];
+}
+
+static void uring_ring_cqe_seen(struct uring_ring* ring)
+{
+    atomic_store_explicit((_Atomic unsigned int*) ring->cq_head, *ring->cq_head + 1,
+                          memory_order_release);
+}
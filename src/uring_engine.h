@@ -0,0 +1,73 @@
+#ifndef INCLUDED_URING_ENGINE_H
+#define INCLUDED_URING_ENGINE_H
+
+#include "completion_queue.h"
+#include "http_helpers.h"
+#include "slab.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// An io_uring based replacement for connection_manager. Rather than telling the
+// caller which sockets are ready, it accepts and recv()s on their behalf, so each
+// event arrives with its data already read.
+
+typedef struct uring_engine uring_engine_t;
+
+enum uring_event_type
+{
+    URING_EVENT_ACCEPT,
+    URING_EVENT_RECV,
+    // The client's gone or the recv failed. The socket stays open, so that its fd
+    // can't be reused, until the caller calls uring_engine_close_connection.
+    URING_EVENT_CLOSED,
+    // Something's been posted to the completion queue we're watching
+    URING_EVENT_COMPLETIONS
+};
+
+typedef struct uring_event
+{
+    enum uring_event_type type;
+    int                   sockfd;
+    // Only set for URING_EVENT_RECV - the caller owns the buffer and must return it
+    // to the request slab
+    slab_handle_t buffer;
+    size_t        num_bytes;
+} uring_event_t;
+
+// Receives are done into buffer_size buffers from request_slab, which is only ever
+// touched from the reactor thread
+uring_engine_t* uring_engine_create(unsigned int entries,
+                                    int          listen_fd,
+                                    slab_t*      request_slab,
+                                    size_t       buffer_size);
+void            uring_engine_destroy(uring_engine_t* restrict engine);
+
+// Keeps a poll on the queue's eventfd, so the engine wakes up with a
+// URING_EVENT_COMPLETIONS as soon as something's posted. The queue still owns it.
+int uring_engine_watch_completions(uring_engine_t*           engine,
+                                   completion_queue_t const* completions);
+
+// Starts receiving on a socket we got from a URING_EVENT_ACCEPT. The engine owns it
+// from then on.
+int uring_engine_add_connection(uring_engine_t* engine, int sockfd);
+// Stops receiving, and closes the socket once every send queued on it has finished.
+// Nothing more is reported for it.
+void uring_engine_close_connection(uring_engine_t* engine, int sockfd);
+
+// A connection that hasn't received anything for timeout_ms gets shut down by
+// uring_engine_close_idle_connections, and then shows up as URING_EVENT_CLOSED
+void   uring_engine_set_idle_timeout(uring_engine_t* engine, uint64_t timeout_ms);
+size_t uring_engine_close_idle_connections(uring_engine_t* engine);
+
+bool uring_engine_get_next_event(uring_engine_t* engine, uring_event_t* event_out);
+
+// Responses on a socket go out one after another in the order they're queued, each
+// as however many linked chains it takes. Only the reactor sends, since the
+// connection has to be looked up. The engine takes ownership of prepared->file_fd.
+int uring_engine_send_response(uring_engine_t*                   engine,
+                               int                               sockfd,
+                               http_file_response_t const* const prepared);
+
+#endif // INCLUDED_URING_ENGINE_H
@@ -0,0 +1,116 @@
+#include "arena.t.h"
+
+#include <arena.h>
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cmocka.h>
+
+static void test_allocations_are_aligned(void** state)
+{
+    pool_t* chunk_pool = pool_init(ARENA_CHUNK_SIZE, 4);
+    arena_t arena      = {0};
+    arena_init(&arena, chunk_pool);
+
+    char* first  = arena_alloc(&arena, 1);
+    char* second = arena_alloc(&arena, 3);
+    char* third  = arena_alloc(&arena, 0);
+    assert_non_null(first);
+    assert_non_null(second);
+    assert_non_null(third);
+    assert_ptr_not_equal(first, second);
+    assert_ptr_not_equal(second, third);
+
+    assert_int_equal(0, (uintptr_t) first % _Alignof(max_align_t));
+    assert_int_equal(0, (uintptr_t) second % _Alignof(max_align_t));
+    assert_int_equal(0, (uintptr_t) third % _Alignof(max_align_t));
+
+    arena_reset(&arena);
+    pool_destroy(chunk_pool);
+}
+
+static void test_spans_chunks(void** state)
+{
+    pool_t* chunk_pool = pool_init(ARENA_CHUNK_SIZE, 2);
+    arena_t arena      = {0};
+    arena_init(&arena, chunk_pool);
+
+    // Enough to need a few chunks, and for the pool to grow
+    char* ptrs[64];
+    for (size_t i = 0; i < 64; ++i)
+    {
+        ptrs[i] = arena_alloc(&arena, 300);
+        assert_non_null(ptrs[i]);
+        memset(ptrs[i], (int) i, 300);
+    }
+    for (size_t i = 0; i < 64; ++i)
+    {
+        assert_int_equal((char) i, ptrs[i][0]);
+        assert_int_equal((char) i, ptrs[i][299]);
+    }
+
+    arena_reset(&arena);
+    pool_destroy(chunk_pool);
+}
+
+static void test_oversized_allocations(void** state)
+{
+    pool_t* chunk_pool = pool_init(ARENA_CHUNK_SIZE, 1);
+    arena_t arena      = {0};
+    arena_init(&arena, chunk_pool);
+
+    char* small = arena_alloc(&arena, 16);
+    char* big   = arena_alloc(&arena, 3 * ARENA_CHUNK_SIZE);
+    assert_non_null(small);
+    assert_non_null(big);
+    memset(big, 'x', 3 * ARENA_CHUNK_SIZE);
+
+    // The big one didn't take over the chunk we were using
+    char* after = arena_alloc(&arena, 16);
+    assert_ptr_equal(small + 16, after);
+
+    arena_reset(&arena);
+    pool_destroy(chunk_pool);
+}
+
+static void test_reset_recycles_chunks(void** state)
+{
+    pool_t* chunk_pool = pool_init(ARENA_CHUNK_SIZE, 4);
+    arena_t arena      = {0};
+    arena_init(&arena, chunk_pool);
+
+    char* first = arena_calloc(&arena, 100);
+    assert_non_null(first);
+    for (size_t i = 0; i < 100; ++i) { assert_int_equal(0, first[i]); }
+    memset(first, 'x', 100);
+
+    arena_reset(&arena);
+
+    // Back to the start of the same chunk, and calloc still zeroes it
+    char* again = arena_calloc(&arena, 100);
+    assert_ptr_equal(first, again);
+    for (size_t i = 0; i < 100; ++i) { assert_int_equal(0, again[i]); }
+
+    char* copy = arena_strdup(&arena, "Hello from Miniweb!");
+    assert_string_equal("Hello from Miniweb!", copy);
+
+    arena_reset(&arena);
+    pool_destroy(chunk_pool);
+}
+
+int run_arena_tests()
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_allocations_are_aligned),
+        cmocka_unit_test(test_spans_chunks),
+        cmocka_unit_test(test_oversized_allocations),
+        cmocka_unit_test(test_reset_recycles_chunks),
+    };
+
+    return cmocka_run_group_tests_name("ArenaTests", tests, NULL, NULL);
+}
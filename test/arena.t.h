@@ -0,0 +1,6 @@
+#ifndef INCLUDED_ARENA_T_H
+#define INCLUDED_ARENA_T_H
+
+int run_arena_tests();
+
+#endif
@@ -0,0 +1,139 @@
+#include "completion_queue.t.h"
+
+#include <completion_queue.h>
+#include <macro_helpers.h>
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <poll.h>
+#include <pthread.h>
+
+#include <cmocka.h>
+
+enum
+{
+    NUM_POSTERS      = 4,
+    ITEMS_PER_POSTER = 10000
+};
+
+struct test_item
+{
+    mpsc_node_t node;
+    size_t      poster;
+    size_t      value;
+};
+
+struct poster_args
+{
+    completion_queue_t* completions;
+    struct test_item*   items;
+};
+
+static bool is_readable(int fd, int timeout_ms)
+{
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    return poll(&pfd, 1, timeout_ms) == 1 && (pfd.revents & POLLIN);
+}
+
+static void* post_items(void* arg)
+{
+    struct poster_args* args = arg;
+    for (size_t i = 0; i < ITEMS_PER_POSTER; ++i)
+    { completion_queue_post(args->completions, &args->items[i].node); }
+    return NULL;
+}
+
+static void test_post_wakes_reactor(void** state)
+{
+    completion_queue_t completions;
+    assert_int_equal(0, completion_queue_init(&completions));
+    assert_int_not_equal(-1, completions.event_fd);
+
+    // Nothing to take, and nothing to wake up for
+    assert_false(is_readable(completions.event_fd, 0));
+    assert_null(completion_queue_take_all(&completions));
+
+    struct test_item items[3] = {{.value = 0}, {.value = 1}, {.value = 2}};
+    for (size_t i = 0; i < 3; ++i)
+    {
+        completion_queue_post(&completions, &items[i].node);
+        assert_true(is_readable(completions.event_fd, 0));
+    }
+
+    mpsc_node_t* node = completion_queue_take_all(&completions);
+    for (size_t i = 0; i < 3; ++i)
+    {
+        assert_ptr_equal(&items[i].node, node);
+        node = node->next;
+    }
+    assert_null(node);
+
+    // Taking everything quietens it down until the next post
+    assert_false(is_readable(completions.event_fd, 0));
+    completion_queue_post(&completions, &items[0].node);
+    assert_true(is_readable(completions.event_fd, 0));
+
+    completion_queue_clean(&completions);
+    assert_int_equal(-1, completions.event_fd);
+}
+
+static void test_many_posters(void** state)
+{
+    completion_queue_t completions;
+    assert_int_equal(0, completion_queue_init(&completions));
+
+    static struct test_item items[NUM_POSTERS][ITEMS_PER_POSTER];
+    struct poster_args      args[NUM_POSTERS];
+    pthread_t               threads[NUM_POSTERS];
+    for (size_t p = 0; p < NUM_POSTERS; ++p)
+    {
+        for (size_t i = 0; i < ITEMS_PER_POSTER; ++i)
+        { items[p][i] = (struct test_item) {.poster = p, .value = i}; }
+        args[p] = (struct poster_args) {.completions = &completions,
+                                        .items       = items[p]};
+        assert_int_equal(0, pthread_create(&threads[p], NULL, post_items, &args[p]));
+    }
+
+    // Only take when the eventfd says there's something there, like the reactor
+    // does. If a wakeup went missing we'd block here forever.
+    size_t next[NUM_POSTERS] = {0};
+    size_t num_taken         = 0;
+    while (num_taken < NUM_POSTERS * ITEMS_PER_POSTER)
+    {
+        assert_true(is_readable(completions.event_fd, 5000));
+
+        mpsc_node_t* node = completion_queue_take_all(&completions);
+        while (node)
+        {
+            struct test_item* item = CONTAINER_OF(node, struct test_item, node);
+            assert_int_equal(next[item->poster], item->value);
+            ++next[item->poster];
+            ++num_taken;
+            node = node->next;
+        }
+    }
+
+    for (size_t p = 0; p < NUM_POSTERS; ++p)
+    {
+        assert_int_equal(0, pthread_join(threads[p], NULL));
+        assert_int_equal(ITEMS_PER_POSTER, next[p]);
+    }
+    assert_null(completion_queue_take_all(&completions));
+
+    completion_queue_clean(&completions);
+}
+
+int run_completion_queue_tests()
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_post_wakes_reactor),
+        cmocka_unit_test(test_many_posters),
+    };
+
+    return cmocka_run_group_tests_name("CompletionQueueTests", tests, NULL, NULL);
+}
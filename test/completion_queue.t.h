@@ -0,0 +1,6 @@
+#ifndef INCLUDED_COMPLETION_QUEUE_T_H
+#define INCLUDED_COMPLETION_QUEUE_T_H
+
+int run_completion_queue_tests();
+
+#endif // INCLUDED_COMPLETION_QUEUE_T_H
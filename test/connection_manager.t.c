@@ -0,0 +1,231 @@
+#include "connection_manager.t.h"
+
+#include <connection.h>
+#include <connection_manager.h>
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cmocka.h>
+
+enum
+{
+    NUM_TEST_SOCKETS = 8
+};
+
+// Our end of each pair goes into the manager, and we write to the other end to
+// make it readable
+struct socket_pairs
+{
+    int ours[NUM_TEST_SOCKETS];
+    int theirs[NUM_TEST_SOCKETS];
+};
+
+static connection_manager_t* setup_manager(struct socket_pairs* pairs)
+{
+    // Start small so that the table has to grow
+    connection_manager_t* manager = connection_manager_create(2);
+    assert_non_null(manager);
+
+    for (size_t i = 0; i < NUM_TEST_SOCKETS; ++i)
+    {
+        int fds[2] = {-1, -1};
+        assert_int_equal(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+        pairs->ours[i]   = fds[0];
+        pairs->theirs[i] = fds[1];
+
+        assert_int_equal(0, connection_manager_add_new_connection(manager, fds[0]));
+    }
+
+    return manager;
+}
+
+static void teardown_manager(connection_manager_t* manager,
+                             struct socket_pairs*  pairs)
+{
+    // The manager closes whatever it's still tracking
+    connection_manager_destroy(manager);
+    for (size_t i = 0; i < NUM_TEST_SOCKETS; ++i) close(pairs->theirs[i]);
+}
+
+static void test_lookup_after_swap_remove(void** state)
+{
+    struct socket_pairs   pairs   = {0};
+    connection_manager_t* manager = setup_manager(&pairs);
+    assert_int_equal(NUM_TEST_SOCKETS, connection_manager_get_size(manager));
+
+    // Take out the first one, so the last one gets moved into its slot
+    connection_manager_remove_connection(manager, pairs.ours[0]);
+    close(pairs.ours[0]);
+    assert_null(connection_manager_get_connection(manager, pairs.ours[0]));
+    assert_int_equal(NUM_TEST_SOCKETS - 1, connection_manager_get_size(manager));
+
+    // Everything else should still be found, and the table should have no holes
+    size_t seen = 0;
+    for (size_t i = 1; i < NUM_TEST_SOCKETS; ++i)
+    {
+        struct connection* connection =
+            connection_manager_get_connection(manager, pairs.ours[i]);
+        assert_non_null(connection);
+        assert_int_equal(pairs.ours[i], connection->fd);
+        assert_true(connection->index < NUM_TEST_SOCKETS - 1);
+        assert_false(seen & (1u << connection->index));
+        seen |= 1u << connection->index;
+    }
+
+    teardown_manager(manager, &pairs);
+}
+
+static void test_event_after_swap_remove(void** state)
+{
+    struct socket_pairs   pairs   = {0};
+    connection_manager_t* manager = setup_manager(&pairs);
+
+    connection_manager_remove_connection(manager, pairs.ours[1]);
+    close(pairs.ours[1]);
+
+    // The socket that got moved should still be polled
+    int last = NUM_TEST_SOCKETS - 1;
+    assert_int_equal(1, write(pairs.theirs[last], "x", 1));
+
+    int sockfd = -1;
+    assert_true(connection_manager_get_next_event(manager, &sockfd));
+    assert_int_equal(pairs.ours[last], sockfd);
+    assert_false(connection_manager_get_next_event(manager, &sockfd));
+
+    teardown_manager(manager, &pairs);
+}
+
+static void test_remove_while_iterating(void** state)
+{
+    struct socket_pairs   pairs   = {0};
+    connection_manager_t* manager = setup_manager(&pairs);
+
+    for (size_t i = 0; i < NUM_TEST_SOCKETS; ++i)
+    { assert_int_equal(1, write(pairs.theirs[i], "x", 1)); }
+
+    // Removing each socket as we're handed it mustn't make us skip any of the
+    // others
+    size_t num_events = 0;
+    int    sockfd     = -1;
+    while (connection_manager_get_next_event(manager, &sockfd))
+    {
+        connection_manager_remove_connection(manager, sockfd);
+        close(sockfd);
+        ++num_events;
+    }
+
+    assert_int_equal(NUM_TEST_SOCKETS, num_events);
+    assert_int_equal(0, connection_manager_get_size(manager));
+
+    teardown_manager(manager, &pairs);
+}
+
+static void test_disarmed_until_rearmed(void** state)
+{
+    struct socket_pairs   pairs   = {0};
+    connection_manager_t* manager = setup_manager(&pairs);
+
+    assert_int_equal(1, write(pairs.theirs[0], "x", 1));
+    int sockfd = -1;
+    assert_true(connection_manager_get_next_event(manager, &sockfd));
+    assert_int_equal(pairs.ours[0], sockfd);
+    assert_false(connection_manager_get_next_event(manager, &sockfd));
+
+    // We never read the byte, but we shouldn't hear about it again for now
+    assert_int_equal(1, write(pairs.theirs[1], "x", 1));
+    assert_true(connection_manager_get_next_event(manager, &sockfd));
+    assert_int_equal(pairs.ours[1], sockfd);
+    assert_false(connection_manager_get_next_event(manager, &sockfd));
+
+    // Until we ask for it
+    assert_int_equal(0, connection_manager_rearm_connection(
+                            manager, pairs.ours[0], CONNECTION_INTEREST_READ));
+    assert_true(connection_manager_get_next_event(manager, &sockfd));
+    assert_int_equal(pairs.ours[0], sockfd);
+    assert_false(connection_manager_get_next_event(manager, &sockfd));
+
+    teardown_manager(manager, &pairs);
+}
+
+static void test_rearm_for_writing(void** state)
+{
+    struct socket_pairs   pairs   = {0};
+    connection_manager_t* manager = setup_manager(&pairs);
+
+    // Nothing to read, but there's plenty of room to write
+    assert_int_equal(0, connection_manager_rearm_connection(
+                            manager, pairs.ours[2], CONNECTION_INTEREST_WRITE));
+    int sockfd = -1;
+    assert_true(connection_manager_get_next_event(manager, &sockfd));
+    assert_int_equal(pairs.ours[2], sockfd);
+    assert_false(connection_manager_get_next_event(manager, &sockfd));
+
+    // And that's a one-off too
+    assert_false(connection_manager_get_next_event(manager, &sockfd));
+
+    teardown_manager(manager, &pairs);
+}
+
+static void test_unknown_socket(void** state)
+{
+    struct socket_pairs   pairs   = {0};
+    connection_manager_t* manager = setup_manager(&pairs);
+
+    assert_null(connection_manager_get_connection(manager, -1));
+    assert_null(connection_manager_get_connection(manager, 100000));
+
+    // Should just be logged and ignored
+    connection_manager_remove_connection(manager, 100000);
+    assert_int_equal(NUM_TEST_SOCKETS, connection_manager_get_size(manager));
+
+    // Adding the same socket twice is an error
+    int rc = connection_manager_add_new_connection(manager, pairs.ours[0]);
+    assert_int_not_equal(0, rc);
+
+    teardown_manager(manager, &pairs);
+}
+
+static void test_borrowed_connection(void** state)
+{
+    connection_manager_t* manager = connection_manager_create(2);
+    assert_non_null(manager);
+
+    int fds[2] = {-1, -1};
+    assert_int_equal(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    assert_int_equal(0, connection_manager_add_borrowed_connection(manager, fds[0]));
+
+    struct connection* connection =
+        connection_manager_get_connection(manager, fds[0]);
+    assert_non_null(connection);
+    assert_true(connection->flags & CONNECTION_FLAG_BORROWED);
+
+    // Whoever lent it to the manager still has to close it
+    connection_manager_destroy(manager);
+    assert_int_not_equal(-1, fcntl(fds[0], F_GETFD));
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+int run_connection_manager_tests()
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_lookup_after_swap_remove),
+        cmocka_unit_test(test_event_after_swap_remove),
+        cmocka_unit_test(test_remove_while_iterating),
+        cmocka_unit_test(test_disarmed_until_rearmed),
+        cmocka_unit_test(test_rearm_for_writing),
+        cmocka_unit_test(test_unknown_socket),
+        cmocka_unit_test(test_borrowed_connection),
+    };
+
+    return cmocka_run_group_tests_name("ConnectionManagerTests", tests, NULL, NULL);
+}
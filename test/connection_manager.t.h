@@ -0,0 +1,6 @@
+#ifndef INCLUDED_CONNECTION_MANAGER_T_H
+#define INCLUDED_CONNECTION_MANAGER_T_H
+
+int run_connection_manager_tests();
+
+#endif // INCLUDED_CONNECTION_MANAGER_T_H
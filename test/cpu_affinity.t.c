@@ -0,0 +1,118 @@
+#include "cpu_affinity.t.h"
+
+#include <cpu_affinity.h>
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <cmocka.h>
+
+enum
+{
+    NUM_TEST_NODES = 2,
+    CPUS_PER_NODE  = 4,
+};
+
+static char const* TEST_NODE_LISTS[NUM_TEST_NODES] = {"0-3", "4-7"};
+
+static void test_parse_list(void** state)
+{
+    int cpus[8]    = {0};
+    int expected[] = {0, 1, 2, 5, 7, 8};
+
+    assert_int_equal(6, cpu_affinity_parse_list("0-2,5,7-8\n", 8, cpus));
+    assert_memory_equal(expected, cpus, sizeof(expected));
+
+    // Anything that doesn't fit still gets counted
+    assert_int_equal(6, cpu_affinity_parse_list("0-2,5,7-8", 2, cpus));
+    assert_int_equal(0, cpu_affinity_parse_list("", 8, cpus));
+
+    assert_int_equal(-1, cpu_affinity_parse_list("3-1", 8, cpus));
+    assert_int_equal(-1, cpu_affinity_parse_list("1,,2", 8, cpus));
+    assert_int_equal(-1, cpu_affinity_parse_list("one", 8, cpus));
+}
+
+static void test_get_node(void** state)
+{
+    cpu_topology_t* topology =
+        cpu_topology_create_from_lists(NUM_TEST_NODES, TEST_NODE_LISTS);
+    assert_non_null(topology);
+
+    assert_int_equal(NUM_TEST_NODES, cpu_topology_get_num_nodes(topology));
+    assert_int_equal(0, cpu_topology_get_node(topology, 0));
+    assert_int_equal(0, cpu_topology_get_node(topology, 3));
+    assert_int_equal(1, cpu_topology_get_node(topology, 4));
+    assert_int_equal(1, cpu_topology_get_node(topology, 7));
+    assert_int_equal(-1, cpu_topology_get_node(topology, 8));
+
+    cpu_topology_destroy(topology);
+}
+
+static void test_pick_cpu(void** state)
+{
+    cpu_topology_t* topology =
+        cpu_topology_create_from_lists(NUM_TEST_NODES, TEST_NODE_LISTS);
+    assert_non_null(topology);
+
+    cpu_affinity_t none = {.policy = CPU_AFFINITY_NONE};
+    assert_int_equal(-1, cpu_topology_pick_cpu(topology, &none, 0));
+
+    // Compact fills node 0 before touching node 1, then wraps
+    cpu_affinity_t compact = {.policy = CPU_AFFINITY_COMPACT};
+    for (size_t i = 0; i < 2 * NUM_TEST_NODES * CPUS_PER_NODE; ++i)
+    {
+        assert_int_equal(i % (NUM_TEST_NODES * CPUS_PER_NODE),
+                         cpu_topology_pick_cpu(topology, &compact, i));
+    }
+
+    // Scatter alternates between the nodes
+    cpu_affinity_t scatter     = {.policy = CPU_AFFINITY_SCATTER};
+    int            expected[]  = {0, 4, 1, 5, 2, 6, 3, 7, 0, 4};
+    size_t const   num_scatter = sizeof(expected) / sizeof(int);
+    for (size_t i = 0; i < num_scatter; ++i)
+    { assert_int_equal(expected[i], cpu_topology_pick_cpu(topology, &scatter, i)); }
+
+    int const      cpus[] = {6, 2, 5};
+    cpu_affinity_t list   = {
+        .policy = CPU_AFFINITY_LIST, .cpus = cpus, .num_cpus = 3};
+    for (size_t i = 0; i < 6; ++i)
+    { assert_int_equal(cpus[i % 3], cpu_topology_pick_cpu(topology, &list, i)); }
+
+    cpu_topology_destroy(topology);
+}
+
+static void test_move_current_thread(void** state)
+{
+    // Whatever the machine looks like, we're allowed on everything in here
+    cpu_topology_t* topology = cpu_topology_create();
+    assert_non_null(topology);
+    assert_true(cpu_topology_get_num_nodes(topology) >= 1);
+
+    cpu_affinity_t compact = {.policy = CPU_AFFINITY_COMPACT};
+    int            cpu     = cpu_topology_pick_cpu(topology, &compact, 0);
+    assert_true(cpu >= 0);
+    assert_true(cpu_topology_get_node(topology, cpu) >= 0);
+
+    assert_null(cpu_affinity_move_current_thread(-1));
+
+    cpu_affinity_saved_t* saved = cpu_affinity_move_current_thread(cpu);
+    assert_non_null(saved);
+    cpu_affinity_restore_current_thread(saved);
+
+    cpu_topology_destroy(topology);
+}
+
+int run_cpu_affinity_tests()
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_parse_list),
+        cmocka_unit_test(test_get_node),
+        cmocka_unit_test(test_pick_cpu),
+        cmocka_unit_test(test_move_current_thread),
+    };
+
+    return cmocka_run_group_tests_name("CpuAffinityTests", tests, NULL, NULL);
+}
@@ -0,0 +1,6 @@
+#ifndef INCLUDED_CPU_AFFINITY_T_H
+#define INCLUDED_CPU_AFFINITY_T_H
+
+int run_cpu_affinity_tests();
+
+#endif // INCLUDED_CPU_AFFINITY_T_H
@@ -0,0 +1,147 @@
+#include "http_helpers.t.h"
+
+#include <http_helpers.h>
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cmocka.h>
+
+static void test_find_request_end(void** state)
+{
+    char const request[] = "GET /hello HTTP/1.1\r\nHost: x\r\n\r\n";
+    size_t     len       = strlen(request);
+
+    assert_int_equal(len, http_helpers_find_request_end(len, request, 0));
+}
+
+static void test_find_request_end_incomplete(void** state)
+{
+    char const request[] = "GET /hello HTTP/1.1\r\nHost: x\r\n\r";
+
+    assert_int_equal(0, http_helpers_find_request_end(strlen(request), request, 0));
+    assert_int_equal(0, http_helpers_find_request_end(0, request, 0));
+}
+
+static void test_find_request_end_split_terminator(void** state)
+{
+    char const request[] = "GET / HTTP/1.1\r\n\r\n";
+    size_t     len       = strlen(request);
+
+    // Each of these pretends the request turned up in two reads, with the second
+    // starting part way through the terminator
+    for (size_t first_read = len - 4; first_read < len; ++first_read)
+    {
+        assert_int_equal(0, http_helpers_find_request_end(first_read, request, 0));
+        size_t end = http_helpers_find_request_end(len, request, first_read);
+        assert_int_equal(len, end);
+    }
+}
+
+static void test_find_request_end_stops_at_first(void** state)
+{
+    char const requests[] = "GET /a HTTP/1.1\r\n\r\nGET /b HTTP/1.1\r\n\r\n";
+    size_t     first_len  = strlen("GET /a HTTP/1.1\r\n\r\n");
+
+    assert_int_equal(first_len,
+                     http_helpers_find_request_end(strlen(requests), requests, 0));
+}
+
+static void test_try_send_resumes(void** state)
+{
+    int fds[2] = {-1, -1};
+    assert_int_equal(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    assert_int_equal(0, fcntl(fds[0], F_SETFL, O_NONBLOCK));
+    assert_int_equal(0, fcntl(fds[1], F_SETFL, O_NONBLOCK));
+    int sndbuf = 4096;
+    assert_int_equal(
+        0, setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf)));
+
+    // Far more than the socket will hold, so it has to go in several goes
+    FILE* file = tmpfile();
+    assert_non_null(file);
+    char chunk[4096];
+    memset(chunk, 'x', sizeof(chunk));
+    size_t const file_size = 64 * sizeof(chunk);
+    for (size_t i = 0; i < file_size / sizeof(chunk); ++i)
+    { assert_int_equal(sizeof(chunk), fwrite(chunk, 1, sizeof(chunk), file)); }
+    fflush(file);
+
+    http_file_response_t prepared = {.file_fd    = fileno(file),
+                                     .file_size  = file_size,
+                                     .header_len = 5};
+    memcpy(prepared.header, "head\n", 5);
+
+    http_send_progress_t progress    = {0};
+    size_t               received    = 0;
+    size_t               num_partial = 0;
+    int                  rc          = 1;
+    while (rc == 1)
+    {
+        rc = http_helpers_try_send_prepared_response(fds[0], &prepared, &progress);
+        assert_true(rc >= 0);
+        if (rc == 1) { ++num_partial; }
+
+        ssize_t n = 0;
+        while ((n = read(fds[1], chunk, sizeof(chunk))) > 0) received += n;
+    }
+
+    assert_true(num_partial > 0);
+    assert_int_equal(prepared.header_len + file_size, received);
+    assert_int_equal(prepared.header_len, progress.header_sent);
+    assert_int_equal(file_size, progress.file_sent);
+
+    fclose(file);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+static void test_overloaded_response(void** state)
+{
+    int fds[2] = {-1, -1};
+    assert_int_equal(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+
+    http_file_response_t prepared = {0};
+    http_helpers_prepare_overloaded_response(&prepared);
+    assert_int_equal(-1, prepared.file_fd);
+    assert_int_equal(0, http_helpers_send_prepared_response(fds[0], &prepared));
+
+    char    response[HTTP_HELPERS_MAX_HEADER_SIZE + 1] = {0};
+    ssize_t received = read(fds[1], response, sizeof(response) - 1);
+    assert_int_equal(prepared.header_len, received);
+    assert_memory_equal("HTTP/1.1 503 ", response, 13);
+
+    // The body's all there, and Content-Length agrees with it
+    char const* body = strstr(response, "\r\n\r\n");
+    assert_non_null(body);
+    body += 4;
+    char const* length = strstr(response, "Content-Length: ");
+    assert_non_null(length);
+    assert_int_equal(strlen(body), strtoul(length + 16, NULL, 10));
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+int run_http_helpers_tests()
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_find_request_end),
+        cmocka_unit_test(test_find_request_end_incomplete),
+        cmocka_unit_test(test_find_request_end_split_terminator),
+        cmocka_unit_test(test_find_request_end_stops_at_first),
+        cmocka_unit_test(test_try_send_resumes),
+        cmocka_unit_test(test_overloaded_response),
+    };
+
+    return cmocka_run_group_tests_name("HttpHelpersTests", tests, NULL, NULL);
+}
@@ -0,0 +1,6 @@
+#ifndef INCLUDED_HTTP_HELPERS_T_H
+#define INCLUDED_HTTP_HELPERS_T_H
+
+int run_http_helpers_tests();
+
+#endif // INCLUDED_HTTP_HELPERS_T_H
@@ -0,0 +1,295 @@
+#include "itc_queue.t.h"
+
+#include <itc_queue.h>
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <pthread.h>
+
+#include <cmocka.h>
+
+struct queue_thread_args
+{
+    itc_queue_t* queue;
+    int          value;
+    atomic_bool  done;
+};
+
+static void* receive_one(void* data)
+{
+    struct queue_thread_args* args = data;
+
+    int value = 0;
+    receive_message(args->queue, sizeof(value), (unsigned char*) &value);
+    args->value = value;
+    atomic_store(&args->done, true);
+    return NULL;
+}
+
+static void* post_one(void* data)
+{
+    struct queue_thread_args* args = data;
+
+    post_message(args->queue, sizeof(args->value), (unsigned char*) &args->value);
+    atomic_store(&args->done, true);
+    return NULL;
+}
+
+enum
+{
+    NUM_STRESS_THREADS  = 4,
+    MESSAGES_PER_THREAD = 20000,
+    STRESS_QUEUE_SIZE   = 8,
+};
+
+struct stress_args
+{
+    itc_queue_t* queue;
+    long long    sum;
+};
+
+static void* post_many(void* data)
+{
+    struct stress_args* args = data;
+    for (int i = 1; i <= MESSAGES_PER_THREAD; ++i)
+    {
+        int value = i;
+        post_message(args->queue, sizeof(value), (unsigned char*) &value);
+    }
+    return NULL;
+}
+
+static void* receive_many(void* data)
+{
+    struct stress_args* args = data;
+    for (int i = 0; i < MESSAGES_PER_THREAD; ++i)
+    {
+        int value = 0;
+        receive_message(args->queue, sizeof(value), (unsigned char*) &value);
+        args->sum += value;
+    }
+    return NULL;
+}
+
+enum
+{
+    NUM_BATCHED_MESSAGES = 10,
+};
+
+// How the batch functions see an array of ints
+typedef unsigned char int_buffer_t[sizeof(int)];
+
+static void* post_batch(void* data)
+{
+    itc_queue_t* queue = data;
+
+    int values[NUM_BATCHED_MESSAGES];
+    for (int i = 0; i < NUM_BATCHED_MESSAGES; ++i) values[i] = i + 1;
+    post_messages(queue, sizeof(int), NUM_BATCHED_MESSAGES,
+                  (int_buffer_t const*) values);
+    return NULL;
+}
+
+static void sleep_ms(long ms)
+{
+    struct timespec sleep = {.tv_nsec = ms * 1000 * 1000};
+    nanosleep(&sleep, NULL);
+}
+
+static void test_receive_waits_for_post(void** state)
+{
+    itc_queue_t* queue = itc_queue_init(4, sizeof(int));
+    assert_non_null(queue);
+
+    struct queue_thread_args args = {.queue = queue};
+    pthread_t                thread;
+    assert_int_equal(0, pthread_create(&thread, NULL, receive_one, &args));
+
+    // Give it long enough to stop spinning and go to sleep
+    sleep_ms(50);
+    assert_false(atomic_load(&args.done));
+
+    int value = 42;
+    assert_int_equal(0, post_message(queue, sizeof(value), (unsigned char*) &value));
+    assert_int_equal(0, pthread_join(thread, NULL));
+    assert_true(atomic_load(&args.done));
+    assert_int_equal(42, args.value);
+
+    itc_queue_destroy(queue);
+}
+
+static void test_post_waits_for_space(void** state)
+{
+    itc_queue_t* queue = itc_queue_init(2, sizeof(int));
+    assert_non_null(queue);
+
+    for (int value = 1; value <= 2; ++value)
+    {
+        assert_int_equal(
+            0, post_message(queue, sizeof(value), (unsigned char*) &value));
+    }
+    int value = 0;
+    assert_int_not_equal(
+        0, post_message_noblock(queue, sizeof(value), (unsigned char*) &value));
+
+    struct queue_thread_args args = {.queue = queue, .value = 3};
+    pthread_t                thread;
+    assert_int_equal(0, pthread_create(&thread, NULL, post_one, &args));
+
+    sleep_ms(50);
+    assert_false(atomic_load(&args.done));
+
+    // Taking the first makes room for the last, which should still come in order
+    assert_int_equal(
+        0, receive_message(queue, sizeof(value), (unsigned char*) &value));
+    assert_int_equal(1, value);
+    assert_int_equal(0, pthread_join(thread, NULL));
+    for (int expected = 2; expected <= 3; ++expected)
+    {
+        assert_int_equal(
+            0, receive_message(queue, sizeof(value), (unsigned char*) &value));
+        assert_int_equal(expected, value);
+    }
+
+    assert_int_not_equal(
+        0, receive_message_noblock(queue, sizeof(value), (unsigned char*) &value));
+
+    itc_queue_destroy(queue);
+}
+
+static void test_many_posters_and_receivers(void** state)
+{
+    // A small queue, so everyone spends plenty of time both full and empty
+    itc_queue_t* queue = itc_queue_init(STRESS_QUEUE_SIZE, sizeof(int));
+    assert_non_null(queue);
+
+    struct stress_args posters[NUM_STRESS_THREADS];
+    struct stress_args receivers[NUM_STRESS_THREADS];
+    pthread_t          threads[2 * NUM_STRESS_THREADS];
+    for (int i = 0; i < NUM_STRESS_THREADS; ++i)
+    {
+        posters[i]   = (struct stress_args) {.queue = queue};
+        receivers[i] = (struct stress_args) {.queue = queue};
+        assert_int_equal(0,
+                         pthread_create(&threads[i], NULL, post_many, &posters[i]));
+        assert_int_equal(0, pthread_create(&threads[NUM_STRESS_THREADS + i], NULL,
+                                           receive_many, &receivers[i]));
+    }
+
+    long long total = 0;
+    for (int i = 0; i < 2 * NUM_STRESS_THREADS; ++i)
+    { assert_int_equal(0, pthread_join(threads[i], NULL)); }
+    for (int i = 0; i < NUM_STRESS_THREADS; ++i) total += receivers[i].sum;
+
+    // Every message arrived exactly once
+    long long per_thread =
+        (long long) MESSAGES_PER_THREAD * (MESSAGES_PER_THREAD + 1) / 2;
+    assert_int_equal(NUM_STRESS_THREADS * per_thread, total);
+
+    int value = 0;
+    assert_int_not_equal(
+        0, receive_message_noblock(queue, sizeof(value), (unsigned char*) &value));
+
+    itc_queue_destroy(queue);
+}
+
+static void test_batches_keep_order(void** state)
+{
+    itc_queue_t* queue = itc_queue_init(4, sizeof(int));
+    assert_non_null(queue);
+
+    // Only as many as there's room for go in
+    int                 values[] = {1, 2, 3, 4, 5, 6};
+    int_buffer_t const* in       = (int_buffer_t const*) values;
+    assert_int_equal(4, post_messages_noblock(queue, sizeof(int), 6, in));
+
+    int           received[8] = {0};
+    int_buffer_t* out         = (int_buffer_t*) received;
+    assert_int_equal(3, receive_messages_noblock(queue, sizeof(int), 3, out));
+    assert_int_equal(1, received[0]);
+    assert_int_equal(2, received[1]);
+    assert_int_equal(3, received[2]);
+
+    assert_int_equal(2, post_messages_noblock(queue, sizeof(int), 2, &in[4]));
+
+    // Asking for more than there is just gets what's there
+    assert_int_equal(3, receive_messages_noblock(queue, sizeof(int), 8, out));
+    assert_int_equal(4, received[0]);
+    assert_int_equal(5, received[1]);
+    assert_int_equal(6, received[2]);
+
+    assert_int_equal(0, receive_messages_noblock(queue, sizeof(int), 8, out));
+
+    itc_queue_destroy(queue);
+}
+
+static void test_post_messages_waits_for_space(void** state)
+{
+    itc_queue_t* queue = itc_queue_init(4, sizeof(int));
+    assert_non_null(queue);
+
+    pthread_t thread;
+    assert_int_equal(0, pthread_create(&thread, NULL, post_batch, queue));
+
+    // The poster has to wait for us to make room a few times over
+    int expected = 1;
+    while (expected <= NUM_BATCHED_MESSAGES)
+    {
+        int    received[3] = {0};
+        size_t num =
+            receive_messages(queue, sizeof(int), 3, (int_buffer_t*) received);
+        assert_true(num >= 1 && num <= 3);
+        for (size_t i = 0; i < num; ++i) assert_int_equal(expected++, received[i]);
+    }
+
+    assert_int_equal(0, pthread_join(thread, NULL));
+    itc_queue_destroy(queue);
+}
+
+static void test_receive_messages_timed(void** state)
+{
+    itc_queue_t* queue = itc_queue_init(4, sizeof(int));
+    assert_non_null(queue);
+
+    int           received[2] = {0};
+    int_buffer_t* out         = (int_buffer_t*) received;
+
+    struct timespec start = {0};
+    struct timespec end   = {0};
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    assert_int_equal(0, receive_messages_timed(queue, sizeof(int), 2, out, 50));
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    long long waited_ms = ((end.tv_sec - start.tv_sec) * 1000LL)
+                          + ((end.tv_nsec - start.tv_nsec) / 1000000);
+    assert_true(waited_ms >= 50);
+
+    // Anything already there comes straight back
+    int value = 7;
+    assert_int_equal(0, post_message(queue, sizeof(value), (unsigned char*) &value));
+    assert_int_equal(1, receive_messages_timed(queue, sizeof(int), 2, out, 1000));
+    assert_int_equal(7, received[0]);
+
+    itc_queue_destroy(queue);
+}
+
+int run_itc_queue_tests()
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_receive_waits_for_post),
+        cmocka_unit_test(test_post_waits_for_space),
+        cmocka_unit_test(test_many_posters_and_receivers),
+        cmocka_unit_test(test_batches_keep_order),
+        cmocka_unit_test(test_post_messages_waits_for_space),
+        cmocka_unit_test(test_receive_messages_timed),
+    };
+
+    return cmocka_run_group_tests_name("ItcQueueTests", tests, NULL, NULL);
+}
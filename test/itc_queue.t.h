@@ -0,0 +1,6 @@
+#ifndef INCLUDED_ITC_QUEUE_T_H
+#define INCLUDED_ITC_QUEUE_T_H
+
+int run_itc_queue_tests();
+
+#endif // INCLUDED_ITC_QUEUE_T_H
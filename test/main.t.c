@@ -1,7 +1,21 @@
+#include "arena.t.h"
+#include "completion_queue.t.h"
+#include "connection_manager.t.h"
+#include "cpu_affinity.t.h"
 #include "hash.t.h"
+#include "http_helpers.t.h"
+#include "itc_queue.t.h"
+#include "mpsc_queue.t.h"
 #include "pool.t.h"
+#include "response_queue.t.h"
 #include "router.t.h"
+#include "slab.t.h"
 #include "thread_pool.t.h"
+#include "timer_wheel.t.h"
+
+#ifdef MINIWEB_USE_IO_URING
+    #include "uring_engine.t.h"
+#endif
 
 int main(void)
 {
@@ -9,7 +23,20 @@ int main(void)
     rc |= run_pool_tests();
     rc |= run_hash_tests();
     rc |= run_router_tests();
+    rc |= run_itc_queue_tests();
     rc |= run_thread_pool_tests();
+    rc |= run_timer_wheel_tests();
+    rc |= run_connection_manager_tests();
+    rc |= run_http_helpers_tests();
+    rc |= run_response_queue_tests();
+    rc |= run_mpsc_queue_tests();
+    rc |= run_completion_queue_tests();
+    rc |= run_cpu_affinity_tests();
+    rc |= run_slab_tests();
+    rc |= run_arena_tests();
+#ifdef MINIWEB_USE_IO_URING
+    rc |= run_uring_engine_tests();
+#endif
 
     return rc;
 }
@@ -0,0 +1,8 @@
+#include "connection_manager.t.h"
+
+// Only the connection manager has a separate epoll backend, so the rest of the
+// suite isn't run again
+int main(void)
+{
+    return run_connection_manager_tests();
+}
@@ -0,0 +1,117 @@
+#include "mpsc_queue.t.h"
+
+#include <macro_helpers.h>
+#include <mpsc_queue.h>
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <pthread.h>
+
+#include <cmocka.h>
+
+enum
+{
+    NUM_PRODUCERS      = 4,
+    ITEMS_PER_PRODUCER = 10000
+};
+
+struct test_item
+{
+    mpsc_node_t node;
+    size_t      producer;
+    size_t      value;
+};
+
+struct producer_args
+{
+    mpsc_queue_t*     queue;
+    struct test_item* items;
+};
+
+static void* produce(void* arg)
+{
+    struct producer_args* args = arg;
+    for (size_t i = 0; i < ITEMS_PER_PRODUCER; ++i)
+    { mpsc_queue_push(args->queue, &args->items[i].node); }
+    return NULL;
+}
+
+static void test_take_in_push_order(void** state)
+{
+    mpsc_queue_t queue;
+    mpsc_queue_init(&queue);
+    assert_null(mpsc_queue_take_all(&queue));
+
+    // Only the first push should say the consumer needs waking up
+    struct test_item items[3] = {{.value = 0}, {.value = 1}, {.value = 2}};
+    assert_true(mpsc_queue_push(&queue, &items[0].node));
+    assert_false(mpsc_queue_push(&queue, &items[1].node));
+    assert_false(mpsc_queue_push(&queue, &items[2].node));
+
+    mpsc_node_t* node = mpsc_queue_take_all(&queue);
+    for (size_t i = 0; i < 3; ++i)
+    {
+        assert_ptr_equal(&items[i].node, node);
+        node = node->next;
+    }
+    assert_null(node);
+
+    // And it's empty again afterwards
+    assert_null(mpsc_queue_take_all(&queue));
+    assert_true(mpsc_queue_push(&queue, &items[0].node));
+}
+
+static void test_many_producers(void** state)
+{
+    mpsc_queue_t queue;
+    mpsc_queue_init(&queue);
+
+    static struct test_item items[NUM_PRODUCERS][ITEMS_PER_PRODUCER];
+    struct producer_args    args[NUM_PRODUCERS];
+    pthread_t               threads[NUM_PRODUCERS];
+    for (size_t p = 0; p < NUM_PRODUCERS; ++p)
+    {
+        for (size_t i = 0; i < ITEMS_PER_PRODUCER; ++i)
+        { items[p][i] = (struct test_item) {.producer = p, .value = i}; }
+        args[p] = (struct producer_args) {.queue = &queue, .items = items[p]};
+        assert_int_equal(0, pthread_create(&threads[p], NULL, produce, &args[p]));
+    }
+
+    // Take while they're still pushing. Nothing should go missing, and each
+    // producer's items should come out in the order it pushed them.
+    size_t next[NUM_PRODUCERS] = {0};
+    size_t num_taken           = 0;
+    while (num_taken < NUM_PRODUCERS * ITEMS_PER_PRODUCER)
+    {
+        mpsc_node_t* node = mpsc_queue_take_all(&queue);
+        while (node)
+        {
+            struct test_item* item = CONTAINER_OF(node, struct test_item, node);
+            assert_int_equal(next[item->producer], item->value);
+            ++next[item->producer];
+            ++num_taken;
+            node = node->next;
+        }
+    }
+
+    for (size_t p = 0; p < NUM_PRODUCERS; ++p)
+    {
+        assert_int_equal(0, pthread_join(threads[p], NULL));
+        assert_int_equal(ITEMS_PER_PRODUCER, next[p]);
+    }
+    assert_null(mpsc_queue_take_all(&queue));
+}
+
+int run_mpsc_queue_tests()
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_take_in_push_order),
+        cmocka_unit_test(test_many_producers),
+    };
+
+    return cmocka_run_group_tests_name("MpscQueueTests", tests, NULL, NULL);
+}
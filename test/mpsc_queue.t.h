@@ -0,0 +1,6 @@
+#ifndef INCLUDED_MPSC_QUEUE_T_H
+#define INCLUDED_MPSC_QUEUE_T_H
+
+int run_mpsc_queue_tests();
+
+#endif // INCLUDED_MPSC_QUEUE_T_H
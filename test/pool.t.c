@@ -7,9 +7,20 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+
+#include <pthread.h>
 
 #include <cmocka.h>
 
+enum
+{
+    NUM_POOL_THREADS      = 4,
+    BLOCKS_PER_THREAD     = 1000,
+    CONCURRENT_ITERATIONS = 20000,
+    BLOCKS_PER_ITERATION  = 8,
+};
+
 struct pool_test_state
 {
     pool_t* pool;
@@ -102,6 +113,223 @@ static void test_reallocating_over_and_over(void** state)
     pool_destroy(pool);
 }
 
+static void test_reuses_most_recently_freed(void** state)
+{
+    pool_t* pool = pool_init(sizeof(uint64_t), 64);
+
+    pool_handle_t handles[64];
+    for (size_t i = 0; i < 64; ++i)
+    {
+        handles[i] = pool_alloc(pool);
+        assert_int_equal(i, handles[i].id);
+    }
+
+    // Freeing blocks from all over the pool, early ones included, shouldn't make
+    // it grow, and the last one freed should be the first one back
+    size_t const freed[]   = {0, 40, 7, 63, 21};
+    size_t const num_freed = sizeof(freed) / sizeof(freed[0]);
+    for (size_t i = 0; i < num_freed; ++i) { pool_free(pool, handles[freed[i]]); }
+
+    for (size_t i = num_freed; i > 0; --i)
+    {
+        pool_handle_t handle = pool_alloc(pool);
+        assert_int_equal(freed[i - 1], handle.id);
+        assert_ptr_equal(handles[freed[i - 1]].data, handle.data);
+    }
+
+    // Now it's full, so the next one comes from a new meta block
+    pool_handle_t handle = pool_alloc(pool);
+    assert_int_equal(64, handle.id);
+
+    pool_destroy(pool);
+}
+
+static void test_trim_releases_empty_meta_blocks(void** state)
+{
+    // Meta blocks of 4, 8 and 16 pages
+    size_t const page_size = 4096;
+    pool_t*      pool      = pool_init(page_size, 4);
+
+    pool_handle_t handles[28];
+    for (size_t i = 0; i < 28; ++i)
+    {
+        handles[i] = pool_alloc(pool);
+        assert_int_equal(i, handles[i].id);
+    }
+
+    // Nothing's empty, so there's nothing to give back
+    assert_int_equal(0, pool_trim(pool, 0));
+
+    for (size_t i = 0; i < 28; ++i) { pool_free(pool, handles[i]); }
+
+    // Keeping 4 free means the two spike meta blocks can go, but not the first
+    size_t released = pool_trim(pool, 4);
+    assert_true(released >= 22 * page_size);
+    assert_true(released <= 24 * page_size);
+    assert_int_equal(0, pool_trim(pool, 4));
+
+    // The blocks we kept come out first, then the released ones, handles unchanged
+    for (size_t i = 0; i < 28; ++i)
+    {
+        pool_handle_t handle = pool_alloc(pool);
+        assert_int_equal(i, handle.id);
+        assert_ptr_equal(handles[i].data, handle.data);
+        *(uint64_t*) handle.data = i;
+    }
+
+    pool_destroy(pool);
+}
+
+static void test_mapped_backings(void** state)
+{
+    enum pool_backing const backings[] = {POOL_BACKING_MMAP,
+                                          POOL_BACKING_HUGE_PAGES};
+    for (size_t b = 0; b < sizeof(backings) / sizeof(backings[0]); ++b)
+    {
+        pool_options_t options = pool_default_options();
+        options.backing        = backings[b];
+
+        pool_t* pool = pool_init_with_options(sizeof(uint64_t), 8, &options);
+        assert_non_null(pool);
+
+        // Plenty to make it grow a few times
+        static pool_handle_t handles[10000];
+        for (size_t i = 0; i < 10000; ++i)
+        {
+            handles[i] = pool_calloc(pool);
+            assert_int_equal(i, handles[i].id);
+            assert_int_equal(0, *(uint64_t*) handles[i].data);
+            *(uint64_t*) handles[i].data = i;
+        }
+        for (size_t i = 0; i < 10000; ++i)
+        {
+            assert_int_equal(i, *(uint64_t*) handles[i].data);
+            pool_free(pool, handles[i]);
+        }
+
+        // The mappings can be trimmed like anything else
+        pool_trim(pool, 0);
+        pool_handle_t handle = pool_alloc(pool);
+        assert_non_null(handle.data);
+        *(uint64_t*) handle.data = 42;
+
+        pool_destroy(pool);
+    }
+}
+
+struct concurrent_args
+{
+    pool_t*        pool;
+    uint64_t       thread_num;
+    pool_handle_t* handles;
+    size_t         num_mismatches;
+};
+
+static void* alloc_and_free(void* arg)
+{
+    struct concurrent_args* args = arg;
+
+    for (uint64_t i = 0; i < CONCURRENT_ITERATIONS; ++i)
+    {
+        pool_handle_t handles[BLOCKS_PER_ITERATION];
+        uint64_t      stamp = (args->thread_num << 32) | i;
+        for (size_t b = 0; b < BLOCKS_PER_ITERATION; ++b)
+        {
+            handles[b]                   = pool_alloc(args->pool);
+            *(uint64_t*) handles[b].data = stamp + b;
+        }
+
+        // If anyone else had been handed the same block they'd have stamped it
+        for (size_t b = 0; b < BLOCKS_PER_ITERATION; ++b)
+        {
+            if (*(uint64_t*) handles[b].data != stamp + b) ++args->num_mismatches;
+            pool_free(args->pool, handles[b]);
+        }
+    }
+
+    return NULL;
+}
+
+static void* free_handles(void* arg)
+{
+    struct concurrent_args* args = arg;
+    for (size_t i = 0; i < BLOCKS_PER_THREAD; ++i)
+    { pool_free(args->pool, args->handles[i]); }
+
+    return NULL;
+}
+
+static int compare_ptrs(void const* lhs, void const* rhs)
+{
+    uintptr_t a = (uintptr_t) (*(void* const*) lhs);
+    uintptr_t b = (uintptr_t) (*(void* const*) rhs);
+    return (a > b) - (a < b);
+}
+
+static void test_concurrent_alloc_free(void** state)
+{
+    pool_t* pool = pool_init_concurrent(sizeof(uint64_t), 16);
+    assert_non_null(pool);
+
+    pthread_t              threads[NUM_POOL_THREADS];
+    struct concurrent_args args[NUM_POOL_THREADS];
+    for (size_t t = 0; t < NUM_POOL_THREADS; ++t)
+    {
+        args[t] = (struct concurrent_args) {.pool = pool, .thread_num = t};
+        assert_int_equal(
+            0, pthread_create(&threads[t], NULL, alloc_and_free, &args[t]));
+    }
+
+    for (size_t t = 0; t < NUM_POOL_THREADS; ++t)
+    {
+        assert_int_equal(0, pthread_join(threads[t], NULL));
+        assert_int_equal(0, args[t].num_mismatches);
+    }
+
+    pool_destroy(pool);
+}
+
+static void test_frees_from_other_threads(void** state)
+{
+    pool_t* pool = pool_init_concurrent(sizeof(uint64_t), 64);
+    assert_non_null(pool);
+
+    static pool_handle_t handles[NUM_POOL_THREADS][BLOCKS_PER_THREAD];
+    for (size_t t = 0; t < NUM_POOL_THREADS; ++t)
+    {
+        for (size_t i = 0; i < BLOCKS_PER_THREAD; ++i)
+        {
+            handles[t][i] = pool_alloc(pool);
+            assert_non_null(handles[t][i].data);
+        }
+    }
+
+    // Every block goes back from a thread other than the one that allocated it
+    pthread_t              threads[NUM_POOL_THREADS];
+    struct concurrent_args args[NUM_POOL_THREADS];
+    for (size_t t = 0; t < NUM_POOL_THREADS; ++t)
+    {
+        args[t] = (struct concurrent_args) {.pool = pool, .handles = handles[t]};
+        assert_int_equal(0,
+                         pthread_create(&threads[t], NULL, free_handles, &args[t]));
+    }
+    for (size_t t = 0; t < NUM_POOL_THREADS; ++t)
+    { assert_int_equal(0, pthread_join(threads[t], NULL)); }
+
+    // They're free to hand out again, and nobody gets the same block twice
+    static void* ptrs[NUM_POOL_THREADS * BLOCKS_PER_THREAD];
+    for (size_t i = 0; i < NUM_POOL_THREADS * BLOCKS_PER_THREAD; ++i)
+    {
+        ptrs[i] = pool_alloc(pool).data;
+        assert_non_null(ptrs[i]);
+    }
+    qsort(ptrs, NUM_POOL_THREADS * BLOCKS_PER_THREAD, sizeof(void*), compare_ptrs);
+    for (size_t i = 1; i < NUM_POOL_THREADS * BLOCKS_PER_THREAD; ++i)
+    { assert_ptr_not_equal(ptrs[i - 1], ptrs[i]); }
+
+    pool_destroy(pool);
+}
+
 int run_pool_tests()
 {
     const struct CMUnitTest tests[] = {
@@ -109,7 +337,12 @@ int run_pool_tests()
         cmocka_unit_test(test_resize),
         cmocka_unit_test(test_pool_calloc),
         cmocka_unit_test(test_reallocating_over_and_over),
+        cmocka_unit_test(test_reuses_most_recently_freed),
+        cmocka_unit_test(test_trim_releases_empty_meta_blocks),
+        cmocka_unit_test(test_mapped_backings),
         cmocka_unit_test(test_big_pool),
+        cmocka_unit_test(test_concurrent_alloc_free),
+        cmocka_unit_test(test_frees_from_other_threads),
     };
 
     return cmocka_run_group_tests_name("PoolTests", tests, NULL, NULL);
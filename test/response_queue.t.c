@@ -0,0 +1,102 @@
+#include "response_queue.t.h"
+
+#include <response_queue.h>
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cmocka.h>
+
+// We never send these, so the header length is just used to tell them apart
+static http_file_response_t make_response(size_t id)
+{
+    return (http_file_response_t) {.file_fd = -1, .header_len = id};
+}
+
+static void test_in_order(void** state)
+{
+    response_queue_t* queue = response_queue_create();
+    assert_non_null(queue);
+
+    for (size_t i = 0; i < 3; ++i)
+    {
+        uint64_t             seq      = response_queue_next_seq(queue);
+        http_file_response_t response = make_response(i + 1);
+        assert_int_equal(0, response_queue_add(queue, seq, &response));
+    }
+
+    http_file_response_t taken = {0};
+    for (size_t i = 0; i < 3; ++i)
+    {
+        assert_true(response_queue_take_next(queue, &taken));
+        assert_int_equal(i + 1, taken.header_len);
+    }
+    assert_false(response_queue_take_next(queue, &taken));
+
+    response_queue_release(queue);
+}
+
+static void test_out_of_order(void** state)
+{
+    response_queue_t* queue = response_queue_create();
+    for (size_t i = 0; i < 3; ++i) response_queue_next_seq(queue);
+
+    // The last two finish first, so nothing can go out yet
+    http_file_response_t response = make_response(3);
+    response_queue_add(queue, 2, &response);
+    response = make_response(2);
+    response_queue_add(queue, 1, &response);
+
+    http_file_response_t taken = {0};
+    assert_false(response_queue_take_next(queue, &taken));
+
+    // Now the first is done, everything should come out in order
+    response = make_response(1);
+    response_queue_add(queue, 0, &response);
+    for (size_t i = 0; i < 3; ++i)
+    {
+        assert_true(response_queue_take_next(queue, &taken));
+        assert_int_equal(i + 1, taken.header_len);
+    }
+    assert_false(response_queue_take_next(queue, &taken));
+
+    response_queue_release(queue);
+}
+
+static void test_release_closes_files(void** state)
+{
+    response_queue_t* queue = response_queue_create();
+    response_queue_retain(queue);
+
+    int pipe_fds[2] = {-1, -1};
+    assert_int_equal(0, pipe(pipe_fds));
+    close(pipe_fds[1]);
+
+    // Never taken, because the request before it never finished
+    http_file_response_t response = {.file_fd = pipe_fds[0], .header_len = 1};
+    response_queue_add(queue, 1, &response);
+
+    // The other reference keeps it open
+    response_queue_release(queue);
+    assert_int_not_equal(-1, fcntl(pipe_fds[0], F_GETFD));
+
+    response_queue_release(queue);
+    assert_int_equal(-1, fcntl(pipe_fds[0], F_GETFD));
+}
+
+int run_response_queue_tests()
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_in_order),
+        cmocka_unit_test(test_out_of_order),
+        cmocka_unit_test(test_release_closes_files),
+    };
+
+    return cmocka_run_group_tests_name("ResponseQueueTests", tests, NULL, NULL);
+}
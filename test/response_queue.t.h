@@ -0,0 +1,6 @@
+#ifndef INCLUDED_RESPONSE_QUEUE_T_H
+#define INCLUDED_RESPONSE_QUEUE_T_H
+
+int run_response_queue_tests();
+
+#endif // INCLUDED_RESPONSE_QUEUE_T_H
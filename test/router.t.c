@@ -67,11 +67,85 @@ static void test_returns_null_on_route_not_find(void** state)
     router_destroy(router);
 }
 
+static void test_routes_keep_their_priority(void** state)
+{
+    struct user_data test_data = {0};
+
+    router_t* router = router_init();
+    assert_non_null(router);
+
+    int rc = router_add_route_with_priority(router, "fast", test_callback,
+                                            &test_data, ROUTE_PRIORITY_HIGH);
+    assert_int_equal(0, rc);
+    rc = router_add_route(router, "normal", test_callback, &test_data);
+    assert_int_equal(0, rc);
+
+    route_info_t info = {0};
+    assert_true(router_get_route_info(router, "fast", &info));
+    assert_non_null(info.func);
+    assert_ptr_equal(&test_data, info.user_data);
+    assert_int_equal(ROUTE_PRIORITY_HIGH, info.priority);
+
+    assert_true(router_get_route_info(router, "normal", &info));
+    assert_non_null(info.func);
+    assert_int_equal(ROUTE_PRIORITY_NORMAL, info.priority);
+
+    info.priority = ROUTE_PRIORITY_LOW;
+    assert_false(router_get_route_info(router, "notfoundroute", &info));
+    assert_null(info.func);
+    assert_int_equal(ROUTE_PRIORITY_NORMAL, info.priority);
+
+    router_destroy(router);
+}
+
+static void test_inline_routes_move_to_pool(void** state)
+{
+    struct user_data test_data = {0};
+
+    router_t* router = router_init();
+    assert_non_null(router);
+
+    int rc = router_add_inline_route(router, "cheap", test_callback, &test_data);
+    assert_int_equal(0, rc);
+    rc = router_add_route(router, "normal", test_callback, &test_data);
+    assert_int_equal(0, rc);
+
+    route_info_t info = {0};
+    assert_true(router_get_route_info(router, "cheap", &info));
+    assert_true(info.func == test_callback);
+    assert_ptr_equal(&test_data, info.user_data);
+    assert_int_equal(ROUTE_RUN_INLINE, info.run_mode);
+    assert_int_equal(ROUTE_PRIORITY_HIGH, info.priority);
+
+    assert_true(router_get_route_info(router, "normal", &info));
+    assert_int_equal(ROUTE_RUN_ON_POOL, info.run_mode);
+
+    // It stays inline until the last overrun we'll put up with
+    assert_false(router_report_inline_overrun(router, "cheap", 3));
+    assert_false(router_report_inline_overrun(router, "cheap", 3));
+    assert_true(router_get_route_info(router, "cheap", &info));
+    assert_int_equal(ROUTE_RUN_INLINE, info.run_mode);
+
+    assert_true(router_report_inline_overrun(router, "cheap", 3));
+    assert_true(router_get_route_info(router, "cheap", &info));
+    assert_int_equal(ROUTE_RUN_ON_POOL, info.run_mode);
+    assert_false(router_report_inline_overrun(router, "cheap", 3));
+
+    assert_false(router_get_route_info(router, "notfoundroute", &info));
+    assert_null(info.func);
+    assert_int_equal(ROUTE_RUN_ON_POOL, info.run_mode);
+    assert_false(router_report_inline_overrun(router, "notfoundroute", 1));
+
+    router_destroy(router);
+}
+
 int run_router_tests()
 {
     struct CMUnitTest tests[] = {
         cmocka_unit_test(test_router_basic_test),
         cmocka_unit_test(test_returns_null_on_route_not_find),
+        cmocka_unit_test(test_routes_keep_their_priority),
+        cmocka_unit_test(test_inline_routes_move_to_pool),
     };
 
     return cmocka_run_group_tests_name("RouterTests", tests, NULL, NULL);
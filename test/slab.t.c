@@ -0,0 +1,138 @@
+#include "slab.t.h"
+
+#include <slab.h>
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cmocka.h>
+
+static const slab_class_t TEST_CLASSES[] = {
+    {64, 4},
+    {256, 2},
+    {1024, 1},
+};
+static const size_t NUM_TEST_CLASSES =
+    sizeof(TEST_CLASSES) / sizeof(TEST_CLASSES[0]);
+
+static slab_t* make_test_slab(void)
+{
+    pool_options_t options = pool_default_options();
+    return slab_init(NUM_TEST_CLASSES, TEST_CLASSES, &options);
+}
+
+static void test_picks_smallest_class(void** state)
+{
+    slab_t* slab = make_test_slab();
+    assert_non_null(slab);
+    assert_int_equal(1024, slab_get_max_size(slab));
+
+    slab_handle_t small = slab_alloc(slab, 10);
+    assert_non_null(small.data);
+    assert_int_equal(64, small.size);
+    assert_int_equal(0, small.size_class);
+
+    // Exactly a class's size still fits in it
+    slab_handle_t exact = slab_alloc(slab, 256);
+    assert_non_null(exact.data);
+    assert_int_equal(256, exact.size);
+
+    slab_handle_t big = slab_alloc(slab, 1000);
+    assert_non_null(big.data);
+    assert_int_equal(1024, big.size);
+    memset(big.data, 'x', big.size);
+
+    slab_handle_t too_big = slab_alloc(slab, 1025);
+    assert_null(too_big.data);
+
+    slab_free(slab, small);
+    slab_free(slab, exact);
+    slab_free(slab, big);
+    slab_destroy(slab);
+}
+
+static void test_classes_grow_independently(void** state)
+{
+    slab_t* slab = make_test_slab();
+    assert_non_null(slab);
+
+    // Well past what any class started with
+    slab_handle_t handles[20];
+    for (size_t i = 0; i < 20; ++i)
+    {
+        handles[i] = slab_alloc(slab, 1024);
+        assert_non_null(handles[i].data);
+        memset(handles[i].data, (int) i, 1024);
+    }
+    for (size_t i = 0; i < 20; ++i)
+    {
+        assert_int_equal((char) i, ((char*) handles[i].data)[1023]);
+        slab_free(slab, handles[i]);
+    }
+
+    // Only the one block the class started with is kept
+    assert_true(slab_trim(slab) > 0);
+
+    slab_destroy(slab);
+}
+
+static void test_grow_promotes_and_copies(void** state)
+{
+    slab_t* slab = make_test_slab();
+    assert_non_null(slab);
+
+    slab_handle_t handle = slab_alloc(slab, 0);
+    assert_non_null(handle.data);
+    assert_int_equal(64, handle.size);
+    memcpy(handle.data, "GET / HTTP/1.1\r\n", 16);
+
+    // Already big enough, so nothing moves
+    slab_handle_t same = slab_grow(slab, handle, 50, 16);
+    assert_ptr_equal(handle.data, same.data);
+
+    handle = slab_grow(slab, handle, handle.size + 1, 16);
+    assert_non_null(handle.data);
+    assert_int_equal(256, handle.size);
+    assert_memory_equal("GET / HTTP/1.1\r\n", handle.data, 16);
+
+    handle = slab_grow(slab, handle, 1024, 16);
+    assert_int_equal(1024, handle.size);
+    assert_memory_equal("GET / HTTP/1.1\r\n", handle.data, 16);
+
+    // There's nowhere left to go, but the old buffer is still ours
+    slab_handle_t failed = slab_grow(slab, handle, handle.size + 1, 16);
+    assert_null(failed.data);
+    assert_memory_equal("GET / HTTP/1.1\r\n", handle.data, 16);
+
+    slab_free(slab, handle);
+    slab_destroy(slab);
+}
+
+static void test_rejects_bad_classes(void** state)
+{
+    pool_options_t options = pool_default_options();
+
+    slab_class_t const descending[] = {{256, 1}, {64, 1}};
+    assert_null(slab_init(2, descending, &options));
+
+    slab_class_t const empty_class[] = {{0, 1}};
+    assert_null(slab_init(1, empty_class, &options));
+
+    assert_null(slab_init(0, TEST_CLASSES, &options));
+}
+
+int run_slab_tests()
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_picks_smallest_class),
+        cmocka_unit_test(test_classes_grow_independently),
+        cmocka_unit_test(test_grow_promotes_and_copies),
+        cmocka_unit_test(test_rejects_bad_classes),
+    };
+
+    return cmocka_run_group_tests_name("SlabTests", tests, NULL, NULL);
+}
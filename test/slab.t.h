@@ -0,0 +1,6 @@
+#ifndef INCLUDED_SLAB_T_H
+#define INCLUDED_SLAB_T_H
+
+int run_slab_tests();
+
+#endif
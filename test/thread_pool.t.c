@@ -5,9 +5,11 @@
 #include <setjmp.h>
 #include <stdarg.h>
 #include <stdatomic.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <time.h>
 
 #include <cmocka.h>
 
@@ -21,6 +23,7 @@ static void basic_test(void** state)
 {
     thread_pool_t* pool = thread_pool_init(2);
     assert_non_null(pool);
+    assert_int_equal(0, thread_pool_start(pool));
 
     atomic_int my_data = 0;
     thread_pool_run(pool, &basic_test_func, &my_data);
@@ -32,10 +35,435 @@ static void basic_test(void** state)
     assert_int_equal(1234, result);
 }
 
+enum
+{
+    NUM_STEALING_THREADS = 4,
+    NUM_JOBS             = 10000,
+    NUM_PARENT_JOBS      = 20,
+    // More than a worker's queue holds, so some have to go elsewhere
+    NUM_CHILDREN_PER_JOB = 500,
+    NUM_BATCHED_JOBS     = 300,
+    NUM_BATCHES          = 10,
+    NUM_SLOW_JOBS        = 100,
+    SLOW_JOB_MS          = 2,
+    MAX_ELASTIC_THREADS  = 4,
+    JOBS_PER_PRIORITY    = 40,
+    MAX_QUEUE_WAIT_US    = 1000,
+    // Far more than any lane holds
+    MAX_ADMITTED_JOBS = 10000,
+    // How many jobs in a row share a priority in the mixed batch
+    MIXED_BATCH_RUN = 8,
+};
+
+struct count_args
+{
+    thread_pool_t* pool;
+    atomic_int     count;
+};
+
+static void count_job(void* data)
+{
+    struct count_args* args = data;
+    atomic_fetch_add(&args->count, 1);
+}
+
+static void sleep_ms(long ms)
+{
+    struct timespec sleep = {.tv_nsec = ms * 1000 * 1000};
+    nanosleep(&sleep, NULL);
+}
+
+static void slow_job(void* data)
+{
+    sleep_ms(SLOW_JOB_MS);
+    count_job(data);
+}
+
+static void parent_job(void* data)
+{
+    struct count_args* args = data;
+    for (int i = 0; i < NUM_CHILDREN_PER_JOB; ++i)
+    { assert_int_equal(0, thread_pool_run(args->pool, &count_job, args)); }
+}
+
+static void test_work_stealing_runs_everything(void** state)
+{
+    thread_pool_t* pool = thread_pool_init_with_mode(NUM_STEALING_THREADS,
+                                                     THREAD_POOL_MODE_WORK_STEALING);
+    assert_non_null(pool);
+    assert_int_equal(0, thread_pool_start(pool));
+
+    struct count_args args = {.pool = pool, .count = 0};
+    for (int i = 0; i < NUM_JOBS; ++i)
+    { assert_int_equal(0, thread_pool_run(pool, &count_job, &args)); }
+
+    // Stopping waits for everything that's been queued
+    thread_pool_destroy(pool);
+    assert_int_equal(NUM_JOBS, atomic_load(&args.count));
+}
+
+static void test_jobs_can_run_jobs(void** state)
+{
+    thread_pool_t* pool = thread_pool_init_with_mode(NUM_STEALING_THREADS,
+                                                     THREAD_POOL_MODE_WORK_STEALING);
+    assert_non_null(pool);
+    assert_int_equal(0, thread_pool_start(pool));
+
+    struct count_args args = {.pool = pool, .count = 0};
+    for (int i = 0; i < NUM_PARENT_JOBS; ++i)
+    { assert_int_equal(0, thread_pool_run(pool, &parent_job, &args)); }
+
+    thread_pool_destroy(pool);
+    assert_int_equal(NUM_PARENT_JOBS * NUM_CHILDREN_PER_JOB,
+                     atomic_load(&args.count));
+}
+
+static void test_run_batch(void** state)
+{
+    enum thread_pool_mode modes[] = {THREAD_POOL_MODE_SHARED_QUEUE,
+                                     THREAD_POOL_MODE_WORK_STEALING,
+                                     THREAD_POOL_MODE_ELASTIC};
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m)
+    {
+        thread_pool_t* pool =
+            thread_pool_init_with_mode(NUM_STEALING_THREADS, modes[m]);
+        assert_non_null(pool);
+        assert_int_equal(0, thread_pool_start(pool));
+
+        struct count_args args = {.pool = pool, .count = 0};
+        thread_pool_job_t jobs[NUM_BATCHED_JOBS];
+        for (int i = 0; i < NUM_BATCHED_JOBS; ++i)
+        { jobs[i] = (thread_pool_job_t) {.func = &count_job, .data = &args}; }
+
+        // A few times over, so the batches are bigger than the queues
+        for (int i = 0; i < NUM_BATCHES; ++i)
+        {
+            assert_int_equal(NUM_BATCHED_JOBS,
+                             thread_pool_run_batch(pool, NUM_BATCHED_JOBS, jobs));
+        }
+
+        thread_pool_destroy(pool);
+        assert_int_equal(NUM_BATCHES * NUM_BATCHED_JOBS, atomic_load(&args.count));
+    }
+}
+
+struct order_args
+{
+    atomic_bool               gate_started;
+    atomic_bool               gate_open;
+    atomic_int                next;
+    enum thread_pool_priority order[THREAD_POOL_NUM_PRIORITIES * JOBS_PER_PRIORITY];
+};
+
+struct order_job
+{
+    struct order_args*        args;
+    enum thread_pool_priority priority;
+};
+
+static void gate_job(void* data)
+{
+    struct order_args* args = data;
+    atomic_store(&args->gate_started, true);
+    while (!atomic_load(&args->gate_open)) { sleep_ms(1); }
+}
+
+static void order_job(void* data)
+{
+    struct order_job* job  = data;
+    int               next = atomic_fetch_add(&job->args->next, 1);
+    job->args->order[next] = job->priority;
+}
+
+static void test_priorities_share_the_workers(void** state)
+{
+    enum thread_pool_mode modes[] = {THREAD_POOL_MODE_SHARED_QUEUE,
+                                     THREAD_POOL_MODE_WORK_STEALING};
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m)
+    {
+        // One worker, so the order it picks jobs in is the order they run in
+        thread_pool_t* pool = thread_pool_init_with_mode(1, modes[m]);
+        assert_non_null(pool);
+        assert_int_equal(0, thread_pool_start(pool));
+
+        struct order_args args = {0};
+        assert_int_equal(0, thread_pool_run(pool, &gate_job, &args));
+        while (!atomic_load(&args.gate_started)) { sleep_ms(1); }
+
+        // Queued lowest first, which is the opposite of how they should come out
+        enum thread_pool_priority const priorities[] = {
+            THREAD_POOL_PRIORITY_LOW, THREAD_POOL_PRIORITY_NORMAL,
+            THREAD_POOL_PRIORITY_HIGH};
+        struct order_job jobs[THREAD_POOL_NUM_PRIORITIES][JOBS_PER_PRIORITY];
+        for (size_t p = 0; p < THREAD_POOL_NUM_PRIORITIES; ++p)
+        {
+            for (size_t i = 0; i < JOBS_PER_PRIORITY; ++i)
+            {
+                jobs[p][i] = (struct order_job) {.args     = &args,
+                                                 .priority = priorities[p]};
+                int rc = thread_pool_run_with_priority(pool, priorities[p],
+                                                       &order_job, &jobs[p][i]);
+                assert_int_equal(0, rc);
+            }
+        }
+        atomic_store(&args.gate_open, true);
+        thread_pool_destroy(pool);
+
+        int const total = THREAD_POOL_NUM_PRIORITIES * JOBS_PER_PRIORITY;
+        assert_int_equal(total, atomic_load(&args.next));
+
+        int last_high = -1;
+        int first_low = total;
+        for (int i = 0; i < total; ++i)
+        {
+            if (args.order[i] == THREAD_POOL_PRIORITY_HIGH) { last_high = i; }
+            if (args.order[i] == THREAD_POOL_PRIORITY_LOW && first_low == total)
+            { first_low = i; }
+        }
+
+        // High jobs get most of the turns, so they're done well before the rest...
+        assert_true(last_high < 2 * JOBS_PER_PRIORITY);
+        // ...but low ones still get a look in long before the high ones run out
+        assert_true(first_low < JOBS_PER_PRIORITY + JOBS_PER_PRIORITY / 2);
+    }
+}
+
+static void test_admission_control(void** state)
+{
+    enum thread_pool_mode modes[] = {THREAD_POOL_MODE_SHARED_QUEUE,
+                                     THREAD_POOL_MODE_WORK_STEALING};
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m)
+    {
+        thread_pool_t* pool = thread_pool_init_with_mode(1, modes[m]);
+        assert_non_null(pool);
+        thread_pool_set_max_queue_wait(pool, MAX_QUEUE_WAIT_US);
+        assert_int_equal(0, thread_pool_start(pool));
+
+        struct order_args first_gate = {0};
+        assert_int_equal(0, thread_pool_run(pool, &gate_job, &first_gate));
+        while (!atomic_load(&first_gate.gate_started)) { sleep_ms(1); }
+
+        // The second gate is at the front of the lane, so the worker gets stuck on it
+        // again as soon as it takes anything from there
+        struct order_args second_gate = {0};
+        assert_int_equal(0, thread_pool_run(pool, &gate_job, &second_gate));
+
+        // With the worker stuck, the lane fills up and then turns jobs away rather
+        // than blocking us
+        struct count_args args   = {.pool = pool, .count = 0};
+        int               queued = 0;
+        int               rc     = 0;
+        while (queued < MAX_ADMITTED_JOBS
+               && (rc = thread_pool_run(pool, &count_job, &args)) == 0)
+        { ++queued; }
+        assert_int_equal(THREAD_POOL_OVERLOADED, rc);
+
+        // Other lanes have their own room
+        rc = thread_pool_run_with_priority(pool, THREAD_POOL_PRIORITY_HIGH,
+                                           &count_job, &args);
+        assert_int_equal(0, rc);
+        ++queued;
+
+        // The worker takes a batch of long stale jobs, the second gate first, so
+        // the lane stays closed even though there's room in it now
+        sleep_ms(5);
+        atomic_store(&first_gate.gate_open, true);
+        while (!atomic_load(&second_gate.gate_started)) { sleep_ms(1); }
+        assert_int_equal(THREAD_POOL_OVERLOADED,
+                         thread_pool_run(pool, &count_job, &args));
+
+        // Once it's caught up, jobs are let in again
+        atomic_store(&second_gate.gate_open, true);
+        rc = THREAD_POOL_OVERLOADED;
+        for (int i = 0; i < 1000 && rc != 0; ++i)
+        {
+            sleep_ms(1);
+            rc = thread_pool_run(pool, &count_job, &args);
+        }
+        assert_int_equal(0, rc);
+
+        thread_pool_stats_t stats = {0};
+        thread_pool_get_stats(pool, &stats);
+        assert_true(stats.num_rejected >= 2);
+
+        thread_pool_destroy(pool);
+        assert_int_equal(queued + 1, atomic_load(&args.count));
+    }
+}
+
+static void test_run_batch_skips_full_lanes(void** state)
+{
+    enum thread_pool_mode modes[] = {THREAD_POOL_MODE_SHARED_QUEUE,
+                                     THREAD_POOL_MODE_WORK_STEALING};
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m)
+    {
+        thread_pool_t* pool = thread_pool_init_with_mode(1, modes[m]);
+        assert_non_null(pool);
+        thread_pool_set_max_queue_wait(pool, MAX_QUEUE_WAIT_US);
+        assert_int_equal(0, thread_pool_start(pool));
+
+        struct order_args gate = {0};
+        assert_int_equal(0, thread_pool_run(pool, &gate_job, &gate));
+        while (!atomic_load(&gate.gate_started)) { sleep_ms(1); }
+
+        // Fill the normal lane up while the worker's stuck
+        struct count_args normal_args = {.pool = pool, .count = 0};
+        int               queued      = 0;
+        while (queued < MAX_ADMITTED_JOBS
+               && thread_pool_run(pool, &count_job, &normal_args) == 0)
+        { ++queued; }
+
+        // The normal jobs come first, so turning them away mustn't stop the high
+        // ones behind them getting in
+        struct count_args high_args = {.pool = pool, .count = 0};
+        thread_pool_job_t jobs[4 * MIXED_BATCH_RUN];
+        for (size_t i = 0; i < 4 * MIXED_BATCH_RUN; ++i)
+        {
+            jobs[i] = (thread_pool_job_t) {.func = &count_job, .data = &normal_args};
+            if ((i / MIXED_BATCH_RUN) % 2 == 1)
+            {
+                jobs[i].data     = &high_args;
+                jobs[i].priority = THREAD_POOL_PRIORITY_HIGH;
+            }
+        }
+        assert_int_equal(2 * MIXED_BATCH_RUN,
+                         thread_pool_run_batch(pool, 4 * MIXED_BATCH_RUN, jobs));
+
+        // The ones turned away are at the back, for the caller to deal with
+        for (size_t i = 0; i < 4 * MIXED_BATCH_RUN; ++i)
+        {
+            enum thread_pool_priority expected = THREAD_POOL_PRIORITY_NORMAL;
+            if (i < 2 * MIXED_BATCH_RUN) { expected = THREAD_POOL_PRIORITY_HIGH; }
+            assert_int_equal(expected, jobs[i].priority);
+        }
+
+        atomic_store(&gate.gate_open, true);
+        thread_pool_destroy(pool);
+        assert_int_equal(2 * MIXED_BATCH_RUN, atomic_load(&high_args.count));
+        assert_int_equal(queued, atomic_load(&normal_args.count));
+    }
+}
+
+static void test_elastic_grows_and_shrinks(void** state)
+{
+    thread_pool_elastic_options_t options =
+        thread_pool_default_elastic_options(1, MAX_ELASTIC_THREADS);
+    options.target_wait_us  = 500;
+    options.idle_timeout_ms = 50;
+
+    thread_pool_t* pool = thread_pool_init_elastic(&options);
+    assert_non_null(pool);
+    assert_int_equal(0, thread_pool_start(pool));
+
+    thread_pool_stats_t stats = {0};
+    thread_pool_get_stats(pool, &stats);
+    assert_int_equal(1, stats.num_threads);
+
+    // One worker can't keep up with these, so jobs wait and more get started
+    struct count_args args = {.pool = pool, .count = 0};
+    for (int i = 0; i < NUM_SLOW_JOBS; ++i)
+    { assert_int_equal(0, thread_pool_run(pool, &slow_job, &args)); }
+
+    for (int i = 0; i < 1000 && atomic_load(&args.count) < NUM_SLOW_JOBS; ++i)
+    { sleep_ms(5); }
+    assert_int_equal(NUM_SLOW_JOBS, atomic_load(&args.count));
+
+    thread_pool_get_stats(pool, &stats);
+    assert_true(stats.num_grown > 0);
+    assert_true(stats.num_threads <= MAX_ELASTIC_THREADS);
+
+    // With nothing left to do, everyone but the minimum drifts away
+    for (int i = 0; i < 200 && stats.num_threads > 1; ++i)
+    {
+        sleep_ms(10);
+        thread_pool_get_stats(pool, &stats);
+    }
+    assert_int_equal(1, stats.num_threads);
+    assert_int_equal(stats.num_grown, stats.num_shrunk);
+
+    // And it can still grow again afterwards
+    for (int i = 0; i < NUM_SLOW_JOBS; ++i)
+    { assert_int_equal(0, thread_pool_run(pool, &slow_job, &args)); }
+
+    thread_pool_destroy(pool);
+    assert_int_equal(2 * NUM_SLOW_JOBS, atomic_load(&args.count));
+}
+
+static void blocking_job(void* data)
+{
+    atomic_bool* release = data;
+    while (!atomic_load(release)) { sleep_ms(1); }
+}
+
+static void test_elastic_grows_while_workers_are_stuck(void** state)
+{
+    thread_pool_elastic_options_t options =
+        thread_pool_default_elastic_options(1, MAX_ELASTIC_THREADS);
+    options.target_wait_us = 500;
+
+    thread_pool_t* pool = thread_pool_init_elastic(&options);
+    assert_non_null(pool);
+    assert_int_equal(0, thread_pool_start(pool));
+
+    // The only worker won't take anything else until it's let go
+    atomic_bool release = false;
+    assert_int_equal(0, thread_pool_run(pool, &blocking_job, &release));
+
+    // Nobody's taking jobs to see them waiting, so the new jobs themselves have
+    // to get another worker started
+    struct count_args args = {.pool = pool, .count = 0};
+    for (int i = 0; i < 1000 && atomic_load(&args.count) == 0; ++i)
+    {
+        assert_int_equal(0, thread_pool_run(pool, &count_job, &args));
+        sleep_ms(2);
+    }
+    int ran_while_stuck = atomic_load(&args.count);
+
+    thread_pool_stats_t stats = {0};
+    thread_pool_get_stats(pool, &stats);
+
+    // Let it go before checking, so a failure doesn't leave it stuck for good
+    atomic_store(&release, true);
+    thread_pool_destroy(pool);
+
+    assert_true(ran_while_stuck > 0);
+    assert_true(stats.num_grown > 0);
+}
+
+static void test_start_fails_on_bad_cpu(void** state)
+{
+    char const*     node_cpus[] = {"0"};
+    cpu_topology_t* topology    = cpu_topology_create_from_lists(1, node_cpus);
+    assert_non_null(topology);
+
+    // The second worker can't be pinned to a CPU that isn't there, so the pool
+    // has to give up on starting, rather than wait for it forever
+    int const      cpus[]   = {0, 1000};
+    cpu_affinity_t affinity = {
+        .policy = CPU_AFFINITY_LIST, .cpus = cpus, .num_cpus = 2};
+
+    thread_pool_t* pool = thread_pool_init(2);
+    assert_non_null(pool);
+    assert_int_equal(0, thread_pool_set_affinity(pool, topology, &affinity, 0));
+    assert_int_not_equal(0, thread_pool_start(pool));
+
+    thread_pool_destroy(pool);
+    cpu_topology_destroy(topology);
+}
+
 int run_thread_pool_tests()
 {
     const struct CMUnitTest tests[] = {
         cmocka_unit_test(basic_test),
+        cmocka_unit_test(test_work_stealing_runs_everything),
+        cmocka_unit_test(test_jobs_can_run_jobs),
+        cmocka_unit_test(test_run_batch),
+        cmocka_unit_test(test_elastic_grows_and_shrinks),
+        cmocka_unit_test(test_elastic_grows_while_workers_are_stuck),
+        cmocka_unit_test(test_priorities_share_the_workers),
+        cmocka_unit_test(test_admission_control),
+        cmocka_unit_test(test_run_batch_skips_full_lanes),
+        cmocka_unit_test(test_start_fails_on_bad_cpu),
     };
 
     return cmocka_run_group_tests_name("ThreadPoolTests", tests, NULL, NULL);
@@ -0,0 +1,135 @@
+#include "timer_wheel.t.h"
+
+#include <timer_wheel.h>
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <cmocka.h>
+
+static size_t count_expired(timer_wheel_entry_t* expired)
+{
+    size_t count = 0;
+    for (; expired; expired = expired->next) ++count;
+
+    return count;
+}
+
+static void test_expires_on_deadline(void** state)
+{
+    timer_wheel_t*      wheel = timer_wheel_init(8, 100, 0);
+    timer_wheel_entry_t entry = {0};
+
+    timer_wheel_schedule(wheel, &entry, 300);
+    assert_int_equal(1, timer_wheel_get_size(wheel));
+
+    // Nothing should go off early
+    assert_null(timer_wheel_advance(wheel, 299));
+
+    timer_wheel_entry_t* expired = timer_wheel_advance(wheel, 300);
+    assert_ptr_equal(&entry, expired);
+    assert_null(expired->next);
+    assert_false(entry.is_scheduled);
+    assert_int_equal(0, timer_wheel_get_size(wheel));
+
+    timer_wheel_destroy(wheel);
+}
+
+static void test_reschedule_pushes_deadline_back(void** state)
+{
+    timer_wheel_t*      wheel = timer_wheel_init(8, 100, 0);
+    timer_wheel_entry_t entry = {0};
+
+    timer_wheel_schedule(wheel, &entry, 300);
+    assert_null(timer_wheel_advance(wheel, 200));
+
+    // Being rescheduled shouldn't leave the entry in the wheel twice
+    timer_wheel_schedule(wheel, &entry, 500);
+    assert_int_equal(1, timer_wheel_get_size(wheel));
+
+    assert_null(timer_wheel_advance(wheel, 400));
+    assert_ptr_equal(&entry, timer_wheel_advance(wheel, 500));
+
+    timer_wheel_destroy(wheel);
+}
+
+static void test_cancel(void** state)
+{
+    timer_wheel_t*      wheel      = timer_wheel_init(8, 100, 0);
+    timer_wheel_entry_t entries[3] = {0};
+
+    for (size_t i = 0; i < 3; ++i) timer_wheel_schedule(wheel, &entries[i], 100);
+
+    // Take the one from the middle of the slot's list
+    timer_wheel_cancel(wheel, &entries[1]);
+    assert_false(entries[1].is_scheduled);
+    assert_int_equal(2, timer_wheel_get_size(wheel));
+
+    // Cancelling twice is fine
+    timer_wheel_cancel(wheel, &entries[1]);
+
+    assert_int_equal(2, count_expired(timer_wheel_advance(wheel, 100)));
+
+    timer_wheel_destroy(wheel);
+}
+
+static void test_deadline_beyond_one_revolution(void** state)
+{
+    timer_wheel_t*      wheel = timer_wheel_init(4, 100, 0);
+    timer_wheel_entry_t near  = {0};
+    timer_wheel_entry_t far   = {0};
+
+    // Both of these hash to the same slot, but far is a whole revolution later
+    timer_wheel_schedule(wheel, &near, 100);
+    timer_wheel_schedule(wheel, &far, 500);
+
+    assert_ptr_equal(&near, timer_wheel_advance(wheel, 100));
+    assert_null(timer_wheel_advance(wheel, 400));
+    assert_ptr_equal(&far, timer_wheel_advance(wheel, 500));
+
+    timer_wheel_destroy(wheel);
+}
+
+static void test_large_jump_expires_everything(void** state)
+{
+    timer_wheel_t*      wheel      = timer_wheel_init(4, 100, 0);
+    timer_wheel_entry_t entries[8] = {0};
+
+    for (size_t i = 0; i < 8; ++i)
+    { timer_wheel_schedule(wheel, &entries[i], (i + 1) * 100); }
+
+    // Way more than one revolution in one go, which is what happens if the
+    // reactor has been stuck for a while
+    assert_int_equal(8, count_expired(timer_wheel_advance(wheel, 10000)));
+    assert_int_equal(0, timer_wheel_get_size(wheel));
+
+    timer_wheel_destroy(wheel);
+}
+
+static void test_past_deadline_goes_off_next_tick(void** state)
+{
+    timer_wheel_t*      wheel = timer_wheel_init(8, 100, 1000);
+    timer_wheel_entry_t entry = {0};
+
+    timer_wheel_schedule(wheel, &entry, 0);
+    assert_ptr_equal(&entry, timer_wheel_advance(wheel, 1100));
+
+    timer_wheel_destroy(wheel);
+}
+
+int run_timer_wheel_tests()
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_expires_on_deadline),
+        cmocka_unit_test(test_reschedule_pushes_deadline_back),
+        cmocka_unit_test(test_cancel),
+        cmocka_unit_test(test_deadline_beyond_one_revolution),
+        cmocka_unit_test(test_large_jump_expires_everything),
+        cmocka_unit_test(test_past_deadline_goes_off_next_tick),
+    };
+
+    return cmocka_run_group_tests_name("TimerWheelTests", tests, NULL, NULL);
+}
@@ -0,0 +1,6 @@
+#ifndef INCLUDED_TIMER_WHEEL_T_H
+#define INCLUDED_TIMER_WHEEL_T_H
+
+int run_timer_wheel_tests();
+
+#endif // INCLUDED_TIMER_WHEEL_T_H
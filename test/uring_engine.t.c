@@ -0,0 +1,263 @@
+#include "uring_engine.t.h"
+
+#include <completion_queue.h>
+#include <http_helpers.h>
+#include <slab.h>
+#include <uring_engine.h>
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cmocka.h>
+
+enum
+{
+    TEST_RING_ENTRIES = 64,
+    TEST_BUFFER_SIZE  = 1024,
+    // Each wait gives up after a couple of seconds, so this is only hit if the
+    // engine's lost something
+    MAX_EMPTY_WAITS = 5,
+    TEST_TIMEOUT_S  = 20
+};
+
+static const slab_class_t TEST_CLASSES[] = {
+    {TEST_BUFFER_SIZE, 4},
+};
+
+// One engine listening on loopback, with one client connected to it
+struct test_server
+{
+    int                listen_fd;
+    int                client_fd;
+    int                sockfd;
+    slab_t*            slab;
+    completion_queue_t completions;
+    uring_engine_t*    engine;
+};
+
+// The client reads on its own thread, since a big response can fill the socket
+// up and only carry on once the other end's read some of it
+struct client_reader
+{
+    struct test_server* server;
+    size_t              len;
+    char*               buffer;
+    size_t              received;
+    mpsc_node_t         done;
+};
+
+static void next_event(uring_engine_t* engine, uring_event_t* event)
+{
+    for (size_t i = 0; i < MAX_EMPTY_WAITS; ++i)
+    {
+        if (uring_engine_get_next_event(engine, event)) { return; }
+    }
+
+    fail_msg("No event from the engine");
+}
+
+static void setup_server(struct test_server* server)
+{
+    server->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    assert_true(server->listen_fd >= 0);
+
+    // Let the kernel pick the port, then find out which one it was
+    struct sockaddr_in addr = {.sin_family      = AF_INET,
+                               .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+                               .sin_port        = 0};
+    socklen_t          addrlen = sizeof(addr);
+    assert_int_equal(0, bind(server->listen_fd, (struct sockaddr*) &addr, addrlen));
+    assert_int_equal(0, listen(server->listen_fd, 4));
+    assert_int_equal(
+        0, getsockname(server->listen_fd, (struct sockaddr*) &addr, &addrlen));
+
+    pool_options_t options = pool_default_options();
+    server->slab = slab_init(1, TEST_CLASSES, &options);
+    assert_non_null(server->slab);
+
+    server->engine = uring_engine_create(TEST_RING_ENTRIES, server->listen_fd,
+                                         server->slab, TEST_BUFFER_SIZE);
+    if (!server->engine)
+    {
+        // Some kernels and sandboxes don't allow io_uring at all
+        slab_destroy(server->slab);
+        close(server->listen_fd);
+        skip();
+    }
+
+    assert_int_equal(0, completion_queue_init(&server->completions));
+    assert_int_equal(
+        0, uring_engine_watch_completions(server->engine, &server->completions));
+
+    server->client_fd = socket(AF_INET, SOCK_STREAM, 0);
+    assert_true(server->client_fd >= 0);
+    assert_int_equal(
+        0, connect(server->client_fd, (struct sockaddr*) &addr, sizeof(addr)));
+
+    uring_event_t event = {0};
+    next_event(server->engine, &event);
+    assert_int_equal(URING_EVENT_ACCEPT, event.type);
+    server->sockfd = event.sockfd;
+    assert_int_equal(0, uring_engine_add_connection(server->engine, server->sockfd));
+}
+
+static void teardown_server(struct test_server* server)
+{
+    // The engine closes the sockets it's been given, but not the listener
+    uring_engine_destroy(server->engine);
+    completion_queue_clean(&server->completions);
+    slab_destroy(server->slab);
+    if (server->client_fd != -1) { close(server->client_fd); }
+    close(server->listen_fd);
+}
+
+static void* read_response(void* arg)
+{
+    struct client_reader* reader = arg;
+    while (reader->received < reader->len)
+    {
+        char*   next = reader->buffer + reader->received;
+        ssize_t n    = recv(reader->server->client_fd, next,
+                            reader->len - reader->received, 0);
+        if (n <= 0) { break; }
+        reader->received += n;
+    }
+
+    completion_queue_post(&reader->server->completions, &reader->done);
+    return NULL;
+}
+
+// Nothing's reported when a send finishes, so keep the engine going until the
+// client's said it's read everything we expect
+static void receive_response(struct test_server* server,
+                             size_t              len,
+                             char                buffer[len])
+{
+    struct client_reader reader = {.server = server, .len = len, .buffer = buffer};
+    pthread_t            thread;
+    assert_int_equal(0, pthread_create(&thread, NULL, read_response, &reader));
+
+    // Nothing but the reader's post should turn up
+    uring_event_t event     = {0};
+    bool          got_event = false;
+    time_t const  deadline  = time(NULL) + TEST_TIMEOUT_S;
+    while (!got_event && time(NULL) < deadline)
+    { got_event = uring_engine_get_next_event(server->engine, &event); }
+
+    // If we've given up on the engine, the reader has to be stopped before we fail
+    if (!got_event || event.type != URING_EVENT_COMPLETIONS)
+    { shutdown(server->client_fd, SHUT_RDWR); }
+    assert_int_equal(0, pthread_join(thread, NULL));
+
+    assert_true(got_event);
+    assert_int_equal(URING_EVENT_COMPLETIONS, event.type);
+    assert_ptr_equal(&reader.done, completion_queue_take_all(&server->completions));
+    assert_int_equal(len, reader.received);
+}
+
+static void test_accept_recv_send(void** state)
+{
+    struct test_server server = {0};
+    setup_server(&server);
+
+    char const request[] = "GET / HTTP/1.1\r\n\r\n";
+    size_t     len       = strlen(request);
+    assert_int_equal(len, send(server.client_fd, request, len, 0));
+
+    uring_event_t event = {0};
+    next_event(server.engine, &event);
+    assert_int_equal(URING_EVENT_RECV, event.type);
+    assert_int_equal(server.sockfd, event.sockfd);
+    assert_int_equal(len, event.num_bytes);
+    assert_memory_equal(request, event.buffer.data, len);
+    slab_free(server.slab, event.buffer);
+
+    http_file_response_t prepared = {0};
+    http_helpers_prepare_overloaded_response(&prepared);
+    assert_int_equal(
+        0, uring_engine_send_response(server.engine, server.sockfd, &prepared));
+
+    char response[HTTP_HELPERS_MAX_HEADER_SIZE] = {0};
+    receive_response(&server, prepared.header_len, response);
+    assert_memory_equal(prepared.header, response, prepared.header_len);
+
+    // Hanging up shows up as a close, and the socket's ours to close after that
+    close(server.client_fd);
+    server.client_fd = -1;
+    next_event(server.engine, &event);
+    assert_int_equal(URING_EVENT_CLOSED, event.type);
+    assert_int_equal(server.sockfd, event.sockfd);
+    uring_engine_close_connection(server.engine, server.sockfd);
+
+    teardown_server(&server);
+}
+
+static void test_pipelined_file_responses(void** state)
+{
+    struct test_server server = {0};
+    setup_server(&server);
+
+    // Big enough to need more than one chain of splices
+    size_t const file_size = 2 * 1024 * 1024;
+    char*        contents  = malloc(file_size);
+    assert_non_null(contents);
+    for (size_t i = 0; i < file_size; ++i) contents[i] = (char) (i % 251);
+
+    FILE* file = tmpfile();
+    assert_non_null(file);
+    assert_int_equal(file_size, fwrite(contents, 1, file_size, file));
+    fflush(file);
+
+    http_file_response_t file_response = {.file_fd    = dup(fileno(file)),
+                                          .file_size  = file_size,
+                                          .header_len = 5};
+    memcpy(file_response.header, "head\n", 5);
+    fclose(file);
+
+    // The second response is queued before the first has gone anywhere, and still
+    // has to come out after it
+    http_file_response_t overloaded = {0};
+    http_helpers_prepare_overloaded_response(&overloaded);
+    assert_int_equal(
+        0, uring_engine_send_response(server.engine, server.sockfd, &file_response));
+    assert_int_equal(
+        0, uring_engine_send_response(server.engine, server.sockfd, &overloaded));
+
+    size_t const total =
+        file_response.header_len + file_size + overloaded.header_len;
+    char* response = malloc(total);
+    assert_non_null(response);
+    receive_response(&server, total, response);
+
+    assert_memory_equal("head\n", response, 5);
+    char const* body = response + file_response.header_len;
+    assert_memory_equal(contents, body, file_size);
+    assert_memory_equal(overloaded.header, body + file_size, overloaded.header_len);
+
+    free(response);
+    free(contents);
+    teardown_server(&server);
+}
+
+int run_uring_engine_tests()
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_accept_recv_send),
+        cmocka_unit_test(test_pipelined_file_responses),
+    };
+
+    return cmocka_run_group_tests_name("UringEngineTests", tests, NULL, NULL);
+}
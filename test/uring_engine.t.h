@@ -0,0 +1,6 @@
+#ifndef INCLUDED_URING_ENGINE_T_H
+#define INCLUDED_URING_ENGINE_T_H
+
+int run_uring_engine_tests();
+
+#endif // INCLUDED_URING_ENGINE_T_H